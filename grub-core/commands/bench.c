@@ -0,0 +1,670 @@
+/* bench.c - Command to benchmark disks, filesystems, decoders and video.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/mm.h>
+#include <grub/file.h>
+#include <grub/disk.h>
+#include <grub/device.h>
+#include <grub/fs.h>
+#include <grub/env.h>
+#include <grub/time.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+#include <grub/crypto.h>
+#include <grub/video.h>
+#include <grub/bitmap.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Loops of CPU bound tests run for at least this many milliseconds.  */
+#define BENCH_MIN_TIME		250
+
+#define BENCH_DISK_SIZE		(32 << 20)
+#define BENCH_DISK_CHUNK	(1 << 20)
+#define BENCH_CACHED_SIZE	(1 << 20)
+#define BENCH_RANDOM_SIZE	4096
+#define BENCH_RANDOM_COUNT	256
+#define BENCH_HASH_SIZE		(1 << 20)
+#define BENCH_FILE_CHUNK	65536
+
+/* The digests of "abc", checked before each hash is timed.  The default
+   list is every hash named here.  */
+static const struct
+{
+  const char *name;
+  const char *abc;
+} known_hashes[] =
+  {
+    { "crc32", "352441c2" },
+    { "md5", "900150983cd24fb0d6963f7d28e17f72" },
+    { "ripemd160", "8eb208f7e05d987a9b044a8e98c6b087f15a0bfc" },
+    { "sha1", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+    { "sha224", "23097d223405d8228642a477bda255b32aadbce4bda0b3f7e36c9da7" },
+    { "sha256", "ba7816bf8f01cfea414140de5dae2223"
+		"b00361a396177a9cb410ff61f20015ad" },
+    { "sha384", "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded163"
+		"1a8b605a43ff5bed8086072ba1e7cc2358baeca134c825a7" },
+    { "sha512", "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+		"2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f" }
+  };
+
+/* The decompression filters and the formats they decode.  */
+static const struct
+{
+  const char *fs;
+  const char *name;
+} decompressors[] =
+  {
+    { "gzio", "gzip" },
+    { "lzmaio", "lzma" },
+    { "xzio", "xz" },
+    { "lzopio", "lzop" },
+    { "zstdio", "zstd" },
+    { "lz4io", "lz4" }
+  };
+
+static const struct grub_arg_option options[] =
+  {
+    {"size", 's', 0, N_("Bytes to read or hash."), N_("BYTES"), ARG_TYPE_INT},
+    {"count", 'c', 0, N_("Number of random reads or files to open."),
+     N_("NUMBER"), ARG_TYPE_INT},
+    {"quiet", 'q', 0, N_("Only set the result variables."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum options
+  {
+    BENCH_SIZE,
+    BENCH_COUNT,
+    BENCH_QUIET
+  };
+
+struct bench_ctx
+{
+  grub_uint64_t size;
+  unsigned count;
+  int quiet;
+};
+
+/* Print KEY=VAL and set the variable bench_KEY, KEY being made of
+   PREFIX and NAME with anything but letters and digits turned into
+   underscores.  */
+static void
+report_string (struct bench_ctx *ctx, const char *prefix, const char *name,
+	       const char *val)
+{
+  char key[64], var[72];
+  char *p;
+
+  grub_snprintf (key, sizeof (key), "%s_%s", prefix, name);
+  for (p = key; *p; p++)
+    if (! grub_isalnum (*p))
+      *p = '_';
+
+  grub_snprintf (var, sizeof (var), "bench_%s", key);
+  grub_env_set (var, val);
+  grub_env_export (var);
+
+  if (! ctx->quiet)
+    grub_printf ("%s=%s\n", key, val);
+}
+
+static void
+report (struct bench_ctx *ctx, const char *prefix, const char *name,
+	grub_uint64_t value)
+{
+  char val[24];
+
+  grub_snprintf (val, sizeof (val), "%llu", (unsigned long long) value);
+  report_string (ctx, prefix, name, val);
+}
+
+/* KiB per second for BYTES in MS milliseconds.  */
+static grub_uint64_t
+kibps (grub_uint64_t bytes, grub_uint64_t ms)
+{
+  return grub_divmod64 (bytes * 1000 / 1024, ms ? : 1, 0);
+}
+
+/* A fixed sequence, so that runs on different machines are comparable.  */
+static grub_uint32_t
+next_random (grub_uint32_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static grub_err_t
+bench_disk (struct bench_ctx *ctx, int argc, char **args)
+{
+  grub_disk_t disk;
+  grub_uint64_t size, done, start, ms, sectors;
+  grub_uint32_t seed = 1;
+  char *name, *buf;
+  unsigned i, n;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("device name required"));
+
+  name = args[0];
+  if (name[0] == '(')
+    {
+      name = grub_strdup (name + 1);
+      if (! name)
+	return grub_errno;
+      if (grub_strlen (name) && name[grub_strlen (name) - 1] == ')')
+	name[grub_strlen (name) - 1] = 0;
+    }
+  disk = grub_disk_open (name);
+  if (name != args[0])
+    grub_free (name);
+  if (! disk)
+    return grub_errno;
+
+  buf = grub_malloc (BENCH_DISK_CHUNK);
+  if (! buf)
+    {
+      grub_disk_close (disk);
+      return grub_errno;
+    }
+
+  sectors = grub_disk_get_size (disk);
+  if (sectors == GRUB_DISK_SIZE_UNKNOWN)
+    sectors = (ctx->size ? : BENCH_DISK_SIZE) >> GRUB_DISK_SECTOR_BITS;
+
+  /* Sequential reads from the start of the disk, with a cold cache.  */
+  size = ctx->size ? : BENCH_DISK_SIZE;
+  if (size > sectors << GRUB_DISK_SECTOR_BITS)
+    size = sectors << GRUB_DISK_SECTOR_BITS;
+  grub_disk_cache_invalidate_all ();
+  start = grub_get_time_ms ();
+  for (done = 0; done < size; done += n)
+    {
+      n = size - done < BENCH_DISK_CHUNK ? size - done : BENCH_DISK_CHUNK;
+      if (grub_disk_read (disk, done >> GRUB_DISK_SECTOR_BITS, 0, n, buf))
+	goto fail;
+    }
+  ms = grub_get_time_ms () - start;
+  report (ctx, "disk_seq", "bytes", size);
+  report (ctx, "disk_seq", "ms", ms);
+  report (ctx, "disk_seq", "kibps", kibps (size, ms));
+
+  /* Random reads of BENCH_RANDOM_SIZE, aligned to it.  */
+  n = ctx->count ? : BENCH_RANDOM_COUNT;
+  if (sectors >= (BENCH_RANDOM_SIZE >> GRUB_DISK_SECTOR_BITS))
+    {
+      grub_uint64_t slots = sectors / (BENCH_RANDOM_SIZE
+				       >> GRUB_DISK_SECTOR_BITS);
+
+      grub_disk_cache_invalidate_all ();
+      start = grub_get_time_ms ();
+      for (i = 0; i < n; i++)
+	{
+	  grub_uint64_t slot;
+
+	  grub_divmod64 (((grub_uint64_t) next_random (&seed) << 32)
+			 | next_random (&seed), slots, &slot);
+	  if (grub_disk_read (disk, slot * (BENCH_RANDOM_SIZE
+					    >> GRUB_DISK_SECTOR_BITS),
+			      0, BENCH_RANDOM_SIZE, buf))
+	    goto fail;
+	}
+      ms = grub_get_time_ms () - start;
+      report (ctx, "disk_rand", "count", n);
+      report (ctx, "disk_rand", "ms", ms);
+      report (ctx, "disk_rand", "iops", grub_divmod64 (n * 1000ULL,
+						      ms ? : 1, 0));
+    }
+
+  /* Reads of an area that fits in the disk cache, once it is filled.  */
+  size = BENCH_CACHED_SIZE;
+  if (size > sectors << GRUB_DISK_SECTOR_BITS)
+    size = sectors << GRUB_DISK_SECTOR_BITS;
+  if (grub_disk_read (disk, 0, 0, size, buf))
+    goto fail;
+  done = 0;
+  start = grub_get_time_ms ();
+  do
+    {
+      if (grub_disk_read (disk, 0, 0, size, buf))
+	goto fail;
+      done += size;
+      ms = grub_get_time_ms () - start;
+    }
+  while (ms < BENCH_MIN_TIME);
+  report (ctx, "disk_cached", "bytes", done);
+  report (ctx, "disk_cached", "ms", ms);
+  report (ctx, "disk_cached", "kibps", kibps (done, ms));
+
+ fail:
+  grub_free (buf);
+  grub_disk_close (disk);
+  return grub_errno;
+}
+
+struct bench_dir_ctx
+{
+  unsigned entries;
+  unsigned nfiles, max_files;
+  char **files;
+};
+
+static int
+bench_dir_hook (const char *filename, const struct grub_dirhook_info *info,
+		void *data)
+{
+  struct bench_dir_ctx *ctx = data;
+
+  ctx->entries++;
+  if (info->dir || ctx->nfiles == ctx->max_files)
+    return 0;
+
+  ctx->files[ctx->nfiles] = grub_strdup (filename);
+  if (ctx->files[ctx->nfiles])
+    ctx->nfiles++;
+  else
+    grub_errno = GRUB_ERR_NONE;
+
+  return 0;
+}
+
+static grub_err_t
+bench_fs (struct bench_ctx *ctx, int argc, char **args)
+{
+  struct bench_dir_ctx dctx;
+  grub_device_t dev;
+  grub_fs_t fs;
+  grub_uint64_t start, ms, open_ms, total;
+  const char *path;
+  char *device_name, *buf;
+  unsigned i, opened;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("directory expected"));
+
+  device_name = grub_file_get_device_name (args[0]);
+  if (grub_errno)
+    return grub_errno;
+  dev = grub_device_open (device_name);
+  grub_free (device_name);
+  if (! dev)
+    return grub_errno;
+
+  path = grub_strchr (args[0], ')');
+  path = path ? path + 1 : args[0];
+  if (! *path)
+    path = "/";
+
+  dctx.entries = 0;
+  dctx.nfiles = 0;
+  dctx.max_files = ctx->count ? : BENCH_RANDOM_COUNT;
+  dctx.files = grub_calloc (dctx.max_files, sizeof (dctx.files[0]));
+  buf = grub_malloc (BENCH_FILE_CHUNK);
+  if (! dctx.files || ! buf)
+    goto fail;
+
+  /* Probe and list the directory with a cold cache.  */
+  grub_disk_cache_invalidate_all ();
+  start = grub_get_time_ms ();
+  fs = grub_fs_probe (dev);
+  if (! fs)
+    goto fail;
+  ms = grub_get_time_ms () - start;
+  report_string (ctx, "fs", "name", fs->name);
+  report (ctx, "fs_probe", "ms", ms);
+
+  start = grub_get_time_ms ();
+  if (fs->fs_dir (dev, path, bench_dir_hook, &dctx))
+    goto fail;
+  ms = grub_get_time_ms () - start;
+  report (ctx, "fs_dir", "entries", dctx.entries);
+  report (ctx, "fs_dir", "ms", ms);
+
+  /* Open and read the regular files found.  */
+  open_ms = 0;
+  total = 0;
+  opened = 0;
+  start = grub_get_time_ms ();
+  for (i = 0; i < dctx.nfiles; i++)
+    {
+      grub_uint64_t t;
+      grub_file_t file;
+      grub_ssize_t n;
+      char *name;
+
+      name = grub_xasprintf ("%s%s%s", args[0],
+			     path[grub_strlen (path) - 1] == '/' ? "" : "/",
+			     dctx.files[i]);
+      if (! name)
+	goto fail;
+
+      t = grub_get_time_ms ();
+      file = grub_file_open (name, GRUB_FILE_TYPE_TESTLOAD
+			     | GRUB_FILE_TYPE_NO_DECOMPRESS);
+      open_ms += grub_get_time_ms () - t;
+      grub_free (name);
+      if (! file)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+      opened++;
+
+      while ((n = grub_file_read (file, buf, BENCH_FILE_CHUNK)) > 0)
+	total += n;
+      grub_file_close (file);
+      grub_errno = GRUB_ERR_NONE;
+    }
+  ms = grub_get_time_ms () - start;
+  report (ctx, "fs_open", "count", opened);
+  report (ctx, "fs_open", "us", grub_divmod64 (open_ms * 1000,
+					       opened ? : 1, 0));
+  report (ctx, "fs_read", "bytes", total);
+  report (ctx, "fs_read", "ms", ms);
+  report (ctx, "fs_read", "kibps", kibps (total, ms));
+
+ fail:
+  if (dctx.files)
+    for (i = 0; i < dctx.nfiles; i++)
+      grub_free (dctx.files[i]);
+  grub_free (dctx.files);
+  grub_free (buf);
+  grub_device_close (dev);
+  return grub_errno;
+}
+
+/* Return the format decoded by the filter FILE is read through, or "none"
+   if it is read as it is stored.  */
+static const char *
+decompressor_name (grub_file_t file)
+{
+  unsigned i;
+
+  for (i = 0; file->fs && i < ARRAY_SIZE (decompressors); i++)
+    if (grub_strcmp (file->fs->name, decompressors[i].fs) == 0)
+      return decompressors[i].name;
+  return "none";
+}
+
+/* Read compressed files through their decompression filters, the results
+   being named after the format decoded.  */
+static grub_err_t
+bench_decompress (struct bench_ctx *ctx, int argc, char **args)
+{
+  char *buf;
+  int i;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+
+  buf = grub_malloc (BENCH_FILE_CHUNK);
+  if (! buf)
+    return grub_errno;
+
+  for (i = 0; i < argc; i++)
+    {
+      grub_uint64_t start, ms, total = 0;
+      char prefix[32];
+      grub_file_t file;
+      grub_ssize_t n;
+
+      start = grub_get_time_ms ();
+      file = grub_file_open (args[i], GRUB_FILE_TYPE_TESTLOAD);
+      if (! file)
+	break;
+
+      while ((n = grub_file_read (file, buf, BENCH_FILE_CHUNK)) > 0)
+	total += n;
+      ms = grub_get_time_ms () - start;
+
+      grub_snprintf (prefix, sizeof (prefix), "decompress_%s",
+		     decompressor_name (file));
+      grub_file_close (file);
+      if (grub_errno)
+	break;
+
+      report (ctx, prefix, "bytes", total);
+      report (ctx, prefix, "ms", ms);
+      report (ctx, prefix, "kibps", kibps (total, ms));
+    }
+
+  grub_free (buf);
+  return grub_errno;
+}
+
+/* Check that HASH computes the known digest of "abc", or for hashes not
+   in KNOWN_HASHES, that hashing BUF at once and in two pieces agree.  OUT
+   has room for the digest.  */
+static grub_err_t
+check_hash (const gcry_md_spec_t *hash, grub_uint8_t *out,
+	    const grub_uint8_t *buf, grub_size_t size)
+{
+  grub_uint8_t ctx[GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE];
+  unsigned i, j;
+
+  if (hash->contextsize > sizeof (ctx) || hash->mdlen > GRUB_CRYPTO_MAX_MDLEN)
+    return grub_error (GRUB_ERR_BUG, "hash `%s' is too large", hash->name);
+
+  for (i = 0; i < ARRAY_SIZE (known_hashes); i++)
+    if (grub_strcasecmp (hash->name, known_hashes[i].name) == 0)
+      {
+	const char *abc = known_hashes[i].abc;
+
+	grub_crypto_hash (hash, out, "abc", 3);
+	for (j = 0; j < hash->mdlen; j++)
+	  {
+	    char byte[3] = { abc[2 * j], abc[2 * j + 1], 0 };
+
+	    if (out[j] != grub_strtoul (byte, 0, 16))
+	      return grub_error (GRUB_ERR_TEST_FAILURE,
+				 "hash `%s' of \"abc\" is wrong", hash->name);
+	  }
+	return GRUB_ERR_NONE;
+      }
+
+  hash->init (ctx);
+  hash->write (ctx, buf, size / 3);
+  hash->write (ctx, buf + size / 3, size - size / 3);
+  hash->final (ctx);
+  grub_crypto_hash (hash, out, buf, size);
+  if (grub_memcmp (out, hash->read (ctx), hash->mdlen) != 0)
+    return grub_error (GRUB_ERR_TEST_FAILURE,
+		       "hash `%s' depends on how the data is split", hash->name);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+bench_hash (struct bench_ctx *ctx, int argc, char **args)
+{
+  grub_uint64_t size = ctx->size ? : BENCH_HASH_SIZE;
+  grub_uint8_t *buf, *out = NULL;
+  int i, n = argc ? argc : (int) ARRAY_SIZE (known_hashes);
+
+  buf = grub_malloc (size);
+  if (! buf)
+    return grub_errno;
+  grub_memset (buf, 0x5a, size);
+
+  out = grub_malloc (GRUB_CRYPTO_MAX_MDLEN);
+  if (! out)
+    goto fail;
+
+  for (i = 0; i < n; i++)
+    {
+      const char *name = argc ? args[i] : known_hashes[i].name;
+      const gcry_md_spec_t *hash;
+      grub_uint64_t start, ms, done = 0;
+      char prefix[32];
+
+      hash = grub_crypto_lookup_md_by_name (name);
+      if (! hash)
+	{
+	  if (argc)
+	    {
+	      grub_error (GRUB_ERR_BAD_ARGUMENT,
+			  N_("unknown hash `%s'"), name);
+	      break;
+	    }
+	  continue;
+	}
+
+      grub_snprintf (prefix, sizeof (prefix), "hash_%s", hash->name);
+      if (check_hash (hash, out, buf, size))
+	break;
+      report_string (ctx, prefix, "check", "ok");
+
+      start = grub_get_time_ms ();
+      do
+	{
+	  grub_crypto_hash (hash, out, buf, size);
+	  done += size;
+	  ms = grub_get_time_ms () - start;
+	}
+      while (ms < BENCH_MIN_TIME);
+
+      report (ctx, prefix, "kibps", kibps (done, ms));
+    }
+
+ fail:
+  grub_free (out);
+  grub_free (buf);
+  return grub_errno;
+}
+
+/* Fill and blit the whole screen, which is left overwritten.  */
+static grub_err_t
+bench_video (struct bench_ctx *ctx,
+	     int argc __attribute__ ((unused)),
+	     char **args __attribute__ ((unused)))
+{
+  struct grub_video_mode_info info;
+  struct grub_video_bitmap *bitmap;
+  grub_uint64_t start, ms, frames, bytes;
+  grub_uint32_t *p;
+  unsigned i;
+
+  if (grub_video_get_info (&info))
+    return grub_errno;
+
+  bytes = (grub_uint64_t) info.width * info.height * info.bytes_per_pixel;
+
+  frames = 0;
+  start = grub_get_time_ms ();
+  do
+    {
+      grub_video_fill_rect (grub_video_map_rgb (frames, frames >> 2,
+						frames >> 4),
+			    0, 0, info.width, info.height);
+      grub_video_swap_buffers ();
+      frames++;
+      ms = grub_get_time_ms () - start;
+    }
+  while (ms < BENCH_MIN_TIME && ! grub_errno);
+  if (grub_errno)
+    return grub_errno;
+  report (ctx, "video_fill", "fps", grub_divmod64 (frames * 1000,
+						    ms ? : 1, 0));
+  report (ctx, "video_fill", "kibps", kibps (frames * bytes, ms));
+
+  if (grub_video_bitmap_create (&bitmap, info.width, info.height,
+				GRUB_VIDEO_BLIT_FORMAT_RGBA_8888))
+    return grub_errno;
+  for (i = 0, p = bitmap->data; i < info.width * info.height; i++)
+    p[i] = 0xff000000 | (i * 0x010305);
+
+  frames = 0;
+  start = grub_get_time_ms ();
+  do
+    {
+      grub_video_blit_bitmap (bitmap, GRUB_VIDEO_BLIT_REPLACE, 0, 0, 0, 0,
+			      info.width, info.height);
+      grub_video_swap_buffers ();
+      frames++;
+      ms = grub_get_time_ms () - start;
+    }
+  while (ms < BENCH_MIN_TIME && ! grub_errno);
+  grub_video_bitmap_destroy (bitmap);
+  if (grub_errno)
+    return grub_errno;
+  report (ctx, "video_blit", "fps", grub_divmod64 (frames * 1000,
+						    ms ? : 1, 0));
+  report (ctx, "video_blit", "kibps", kibps (frames * bytes, ms));
+
+  return GRUB_ERR_NONE;
+}
+
+static struct
+{
+  const char *name;
+  grub_err_t (*run) (struct bench_ctx *ctx, int argc, char **args);
+} tests[] =
+  {
+    { "disk", bench_disk },
+    { "fs", bench_fs },
+    { "decompress", bench_decompress },
+    { "hash", bench_hash },
+    { "video", bench_video }
+  };
+
+static grub_err_t
+grub_cmd_bench (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  struct bench_ctx ctx;
+  unsigned i;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
+
+  ctx.size = state[BENCH_SIZE].set
+    ? grub_strtoull (state[BENCH_SIZE].arg, 0, 0) : 0;
+  ctx.count = state[BENCH_COUNT].set
+    ? grub_strtoul (state[BENCH_COUNT].arg, 0, 0) : 0;
+  ctx.quiet = state[BENCH_QUIET].set;
+  if (grub_errno)
+    return grub_errno;
+
+  for (i = 0; i < ARRAY_SIZE (tests); i++)
+    if (grub_strcmp (args[0], tests[i].name) == 0)
+      return tests[i].run (&ctx, argc - 1, args + 1);
+
+  return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("unknown test `%s'"), args[0]);
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(bench)
+{
+  cmd = grub_register_extcmd ("bench", grub_cmd_bench, 0,
+			      N_("[-s BYTES] [-c NUMBER] [-q] "
+				 "disk DEVICE|fs DIR|decompress FILE...|"
+				 "hash [HASH...]|video"),
+			      N_("Measure the speed of disks, filesystems, "
+				 "decompression, hashes and video."),
+			      options);
+}
+
+GRUB_MOD_FINI(bench)
+{
+  grub_unregister_extcmd (cmd);
+}
@@ -0,0 +1,114 @@
+/* diskstat.c - show disk I/O statistics.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/disk.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static const struct grub_arg_option options[] =
+  {
+    {"histogram", 'l', 0, N_("Show the read latency histogram."), 0, 0},
+    {"reset", 'r', 0, N_("Reset all counters."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum options
+  {
+    DISKSTAT_HISTOGRAM,
+    DISKSTAT_RESET
+  };
+
+static void
+print_histogram (struct grub_disk_stat *stat)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_DISK_STAT_BUCKETS; i++)
+    {
+      if (! stat->latency[i])
+	continue;
+      if (i == 0)
+	grub_printf ("  < 1 us: %llu\n",
+		     (unsigned long long) stat->latency[i]);
+      else if (i == GRUB_DISK_STAT_BUCKETS - 1)
+	grub_printf ("  >= %lu us: %llu\n", 1UL << (i - 1),
+		     (unsigned long long) stat->latency[i]);
+      else
+	grub_printf ("  %lu - %lu us: %llu\n", 1UL << (i - 1),
+		     (1UL << i) - 1, (unsigned long long) stat->latency[i]);
+    }
+}
+
+static grub_err_t
+grub_cmd_diskstat (grub_extcmd_context_t ctxt,
+		   int argc __attribute__ ((unused)),
+		   char **args __attribute__ ((unused)))
+{
+  struct grub_arg_list *state = ctxt->state;
+  struct grub_disk_stat *stat;
+
+  if (state[DISKSTAT_RESET].set)
+    {
+      grub_disk_stat_reset ();
+      return GRUB_ERR_NONE;
+    }
+
+  for (stat = grub_disk_stat_list; stat; stat = stat->next)
+    {
+      if (! stat->reads && ! stat->device_reads)
+	continue;
+
+      grub_printf ("%s: reads=%llu device_reads=%llu sectors=%llu"
+		   " cache_hits=%llu cache_misses=%llu cache_bytes=%llu"
+		   " readahead_hits=%llu readahead_misses=%llu"
+		   " read_time_us=%llu\n", stat->name,
+		   (unsigned long long) stat->reads,
+		   (unsigned long long) stat->device_reads,
+		   (unsigned long long) stat->sectors,
+		   (unsigned long long) stat->cache_hits,
+		   (unsigned long long) stat->cache_misses,
+		   (unsigned long long) stat->cache_bytes,
+		   (unsigned long long) stat->ra_hits,
+		   (unsigned long long) stat->ra_misses,
+		   (unsigned long long) stat->read_time);
+
+      if (state[DISKSTAT_HISTOGRAM].set)
+	print_histogram (stat);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(diskstat)
+{
+  cmd = grub_register_extcmd ("diskstat", grub_cmd_diskstat, 0,
+			      N_("[-l|-r]"),
+			      N_("Show disk I/O statistics."), options);
+}
+
+GRUB_MOD_FINI(diskstat)
+{
+  grub_unregister_extcmd (cmd);
+}
@@ -138,10 +138,20 @@ grub_cmd_stat (grub_extcmd_context_t ctxt, int argc, char **args)
 
   if (file->device && file->device->disk)
   {
-    file->read_hook = read_block_start;
-    file->read_hook_data = &start;
-    grub_file_read (file, str, GRUB_DISK_SECTOR_SIZE);
-    grub_memset (str, 0, GRUB_DISK_SECTOR_SIZE);
+    struct grub_fs_block block;
+
+    if (file->fs->fs_map && file->size
+        && file->fs->fs_map (file, 0, &block) == GRUB_ERR_NONE)
+      start = grub_partition_get_start (file->device->disk->partition)
+              + (block.offset >> GRUB_DISK_SECTOR_BITS);
+    else
+    {
+      grub_errno = GRUB_ERR_NONE;
+      file->read_hook = read_block_start;
+      file->read_hook_data = &start;
+      grub_file_read (file, str, GRUB_DISK_SECTOR_SIZE);
+      grub_memset (str, 0, GRUB_DISK_SECTOR_SIZE);
+    }
   }
 
   if (state[STAT_SIZE].set)
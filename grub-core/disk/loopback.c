@@ -24,6 +24,7 @@
 #include <grub/mm.h>
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
+#include <grub/memload.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -45,11 +46,13 @@ static const struct grub_arg_option options[] =
     {"delete", 'd', 0, N_("Delete the specified loopback drive."), 0, 0},
     {"mem", 'm', 0, N_("Copy to RAM."), 0, 0},
     {"blocklist", 'l', 0, N_("Convert to blocklist."), 0, 0},
+    {"sha256", 's', 0, N_("Verify the SHA-256 of the copy in RAM."),
+     N_("HEX"), ARG_TYPE_STRING},
     {0, 0, 0, 0, 0, 0}
   };
 
 static grub_file_t
-loop_file_open (const char *name, int mem, int bl)
+loop_file_open (const char *name, int mem, int bl, const char *sha256)
 {
   grub_file_t file = 0;
   grub_size_t size = 0;
@@ -65,19 +68,15 @@ loop_file_open (const char *name, int mem, int bl)
   {
     void *addr = NULL;
     char newname[100];
-    addr = grub_malloc (size + GRUB_DISK_SECTOR_SIZE - 1);
-    if (!addr)
-    {
-      grub_printf ("out of memory\n");
-      grub_file_close (file);
-      return NULL;
-    }
     grub_printf ("Loading %s ...\n", name);
-    grub_file_read (file, addr, size);
+    addr = grub_memload_file (file, GRUB_DISK_SECTOR_SIZE - 1, 0, sha256);
     grub_file_close (file);
-    grub_memset ((grub_uint8_t *)addr + size, 0, GRUB_DISK_SECTOR_SIZE - 1);
+    if (!addr)
+      return NULL;
     grub_snprintf (newname, 100, "mem:%p:size:%lld", addr, (unsigned long long)size);
     file = grub_file_open (newname, type);
+    if (!file)
+      grub_memload_free (addr, size + GRUB_DISK_SECTOR_SIZE - 1);
   }
   return file;
 }
@@ -88,7 +87,7 @@ loop_file_close (grub_file_t file)
   if (!file)
     return;
   if (grub_ismemfile (file->name))
-    grub_free (file->data);
+    grub_memload_free (file->data, file->size + GRUB_DISK_SECTOR_SIZE - 1);
   grub_file_close (file);
 }
 
@@ -158,7 +157,8 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
   if (argc < 2)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
 
-  file = loop_file_open (args[1], state[1].set, state[2].set);
+  file = loop_file_open (args[1], state[1].set, state[2].set,
+                         state[3].set ? state[3].arg : NULL);
   if (! file)
     return grub_errno;
 
@@ -294,7 +294,7 @@ static grub_extcmd_t cmd;
 GRUB_MOD_INIT(loopback)
 {
   cmd = grub_register_extcmd ("loopback", grub_cmd_loopback, 0,
-                              N_("[-m] [-d] DEVICENAME FILE."),
+                              N_("[-m [-s HEX]] [-d] DEVICENAME FILE."),
   /* TRANSLATORS: The file itself is not destroyed or transformed into drive.  */
                               N_("Make a virtual drive from a file."), options);
   grub_disk_dev_register (&grub_loopback_dev);
@@ -45,6 +45,7 @@
 #include <grub/crypto.h>
 #include <grub/diskfilter.h>
 #include <grub/safemath.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -87,7 +88,9 @@ struct grub_btrfs_superblock
   grub_uint64_t bytes_used;
   grub_uint64_t root_dir_objectid;
   grub_uint64_t num_devices;
-  grub_uint8_t dummy3[0x39];
+  grub_uint32_t sectorsize;
+  grub_uint32_t nodesize;
+  grub_uint8_t dummy3[0x31];
   struct grub_btrfs_device this_device;
   char label[0x100];
   grub_uint8_t dummy4[0x100];
@@ -99,7 +102,9 @@ struct btrfs_header
   grub_btrfs_checksum_t checksum;
   grub_btrfs_uuid_t uuid;
   grub_uint64_t bytenr;
-  grub_uint8_t dummy[0x28];
+  grub_uint8_t dummy[0x18];
+  grub_uint64_t generation;
+  grub_uint64_t owner;
   grub_uint32_t nitems;
   grub_uint8_t level;
 } GRUB_PACKED;
@@ -110,6 +115,30 @@ struct grub_btrfs_device_desc
   grub_uint64_t id;
 };
 
+/* Decompressed extents kept per mount, keyed by the logical address of
+   the compressed data.  */
+#define GRUB_BTRFS_EXTENT_CACHE_ENTRIES 32
+#define GRUB_BTRFS_EXTENT_CACHE_BYTES (4 << 20)
+/* Btrfs never compresses more than this into one extent.  */
+#define GRUB_BTRFS_MAX_UNCOMPRESSED (128 * 1024)
+
+struct grub_btrfs_extent_cache_entry
+{
+  grub_uint64_t laddr;
+  grub_uint64_t last_use;
+  grub_size_t size;
+  grub_size_t alloc;
+  char *buf;
+};
+
+struct grub_btrfs_chunk_map_entry
+{
+  grub_uint64_t start;
+  grub_uint64_t size;
+  struct grub_btrfs_key key;
+  struct grub_btrfs_chunk_item *chunk;
+};
+
 struct grub_btrfs_data
 {
   struct grub_btrfs_superblock sblock;
@@ -128,6 +157,21 @@ struct grub_btrfs_data
   grub_size_t extsize;
   struct grub_btrfs_extent_data *extent;
   grub_uint64_t fs_tree;
+
+  struct grub_btrfs_extent_cache_entry
+  extent_cache[GRUB_BTRFS_EXTENT_CACHE_ENTRIES];
+  grub_uint64_t extent_cache_clock;
+  grub_size_t extent_cache_bytes;
+
+  grub_uint32_t nodesize;
+
+  /* Chunk tree loaded at mount, sorted by logical address.  */
+  struct grub_btrfs_chunk_map_entry *chunks;
+  unsigned n_chunks;
+  unsigned n_chunks_allocated;
+
+  /* Leaf last returned by lower_bound or next.  */
+  grub_disk_addr_t leaf_addr;
 };
 
 struct grub_btrfs_chunk_item
@@ -169,7 +213,7 @@ struct grub_btrfs_internal_node
 {
   struct grub_btrfs_key key;
   grub_uint64_t addr;
-  grub_uint64_t dummy;
+  grub_uint64_t generation;
 } GRUB_PACKED;
 
 struct grub_btrfs_dir_item
@@ -353,6 +397,167 @@ check_btrfs_header (struct grub_btrfs_data *data, struct btrfs_header *header,
   return GRUB_ERR_NONE;
 }
 
+/* Tree nodes shared by all mounts, keyed by the device the filesystem
+   was mounted from, the logical address of the node and its generation.
+   Dropped when grub_fs_cache_generation changes.  */
+#define GRUB_BTRFS_NODE_CACHE_ENTRIES 32
+
+struct grub_btrfs_node_cache_entry
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_disk_addr_t addr;
+  grub_uint64_t generation;
+  grub_uint64_t last_use;
+  grub_uint32_t size;
+  /* Nodes failing check_btrfs_header are kept only as a buffer for the
+     caller and never returned from the cache.  */
+  int verified;
+  grub_uint8_t *buf;
+};
+
+static struct grub_btrfs_node_cache_entry
+node_cache[GRUB_BTRFS_NODE_CACHE_ENTRIES];
+static grub_uint64_t node_cache_clock;
+static grub_uint32_t node_cache_generation;
+static unsigned long node_cache_hits, node_cache_misses;
+
+static void
+node_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (node_cache); i++)
+    {
+      grub_free (node_cache[i].buf);
+      node_cache[i].buf = NULL;
+    }
+}
+
+static struct grub_btrfs_node_cache_entry *
+node_cache_find (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+		 grub_uint64_t generation)
+{
+  grub_disk_t disk = data->devices_attached[0].dev->disk;
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  unsigned i;
+
+  if (node_cache_generation != grub_fs_cache_generation)
+    {
+      node_cache_flush ();
+      node_cache_generation = grub_fs_cache_generation;
+    }
+
+  for (i = 0; i < ARRAY_SIZE (node_cache); i++)
+    {
+      struct grub_btrfs_node_cache_entry *e = &node_cache[i];
+
+      if (e->buf && e->verified && e->addr == addr
+	  && e->size == data->nodesize
+	  && (!generation || e->generation == generation)
+	  && e->dev_id == disk->dev->id && e->disk_id == disk->id
+	  && e->part_start == part_start)
+	{
+	  e->last_use = ++node_cache_clock;
+	  return e;
+	}
+    }
+  return NULL;
+}
+
+/* Read the tree node at ADDR and return its header in *HEAD; the items
+   follow the header.  GENERATION is the one recorded in the parent's
+   block pointer, or 0 for a root.  The node stays valid until the next
+   call.  */
+static grub_err_t
+read_node (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+	   grub_uint64_t generation, int recursion_depth,
+	   const struct btrfs_header **head)
+{
+  struct grub_btrfs_node_cache_entry *e;
+  struct btrfs_header *h;
+  grub_uint8_t *buf;
+  grub_size_t item_size;
+  grub_err_t err;
+  unsigned i;
+
+  e = node_cache_find (data, addr, generation);
+  if (e)
+    {
+      node_cache_hits++;
+      *head = (const struct btrfs_header *) e->buf;
+      return GRUB_ERR_NONE;
+    }
+  node_cache_misses++;
+
+  /* Reading may recurse into the chunk tree, so don't pick the slot
+     until the node is in memory.  */
+  buf = grub_malloc (data->nodesize);
+  if (!buf)
+    return grub_errno;
+  err = grub_btrfs_read_logical (data, addr, buf, data->nodesize,
+				 recursion_depth);
+  if (err)
+    {
+      grub_free (buf);
+      return err;
+    }
+
+  h = (struct btrfs_header *) buf;
+  item_size = h->level ? sizeof (struct grub_btrfs_internal_node)
+    : sizeof (struct grub_btrfs_leaf_node);
+  if (grub_le_to_cpu32 (h->nitems)
+      > (data->nodesize - sizeof (*h)) / item_size)
+    {
+      grub_free (buf);
+      return grub_error (GRUB_ERR_BAD_FS, "too many items in tree node");
+    }
+
+  e = &node_cache[0];
+  for (i = 1; i < ARRAY_SIZE (node_cache) && e->buf; i++)
+    if (!node_cache[i].buf || node_cache[i].last_use < e->last_use)
+      e = &node_cache[i];
+
+  grub_free (e->buf);
+  e->dev_id = data->devices_attached[0].dev->disk->dev->id;
+  e->disk_id = data->devices_attached[0].dev->disk->id;
+  e->part_start
+    = grub_partition_get_start (data->devices_attached[0].dev->disk->partition);
+  e->addr = addr;
+  e->generation = grub_le_to_cpu64 (h->generation);
+  e->last_use = ++node_cache_clock;
+  e->size = data->nodesize;
+  e->buf = buf;
+  /* A bad header has always been reported but not fatal.  */
+  e->verified = (check_btrfs_header (data, h, addr) == GRUB_ERR_NONE
+		 && (!generation || e->generation == generation));
+
+  *head = h;
+  return GRUB_ERR_NONE;
+}
+
+/* Return the number of items in a node whose key is not above KEY.  */
+static unsigned
+node_upper_bound (const struct btrfs_header *head, grub_size_t item_size,
+		  const struct grub_btrfs_key *key)
+{
+  const grub_uint8_t *items = (const grub_uint8_t *) (head + 1);
+  unsigned lo = 0, hi = grub_le_to_cpu32 (head->nitems);
+
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (key_cmp ((const struct grub_btrfs_key *) (items + mid * item_size),
+		   key) <= 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
 static grub_err_t
 save_ref (struct grub_btrfs_leaf_descriptor *desc,
 	  grub_disk_addr_t addr, unsigned i, unsigned m, int l)
@@ -386,7 +591,8 @@ next (struct grub_btrfs_data *data,
       struct grub_btrfs_key *key_out)
 {
   grub_err_t err;
-  struct grub_btrfs_leaf_node leaf;
+  const struct btrfs_header *head;
+  const struct grub_btrfs_leaf_node *leaf;
 
   for (; desc->depth > 0; desc->depth--)
     {
@@ -399,37 +605,43 @@ next (struct grub_btrfs_data *data,
     return 0;
   while (!desc->data[desc->depth - 1].leaf)
     {
-      struct grub_btrfs_internal_node node;
-      struct btrfs_header head;
+      const struct grub_btrfs_internal_node *node;
+      grub_disk_addr_t addr;
+      grub_uint64_t generation;
 
-      err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
-				     * sizeof (node)
-				     + sizeof (struct btrfs_header)
-				     + desc->data[desc->depth - 1].addr,
-				     &node, sizeof (node), 0);
+      err = read_node (data, desc->data[desc->depth - 1].addr, 0, 0, &head);
       if (err)
 	return -err;
+      if (desc->data[desc->depth - 1].iter >= grub_le_to_cpu32 (head->nitems))
+	return -grub_error (GRUB_ERR_BAD_FS, "tree node changed under iterator");
+
+      node = (const struct grub_btrfs_internal_node *) (head + 1)
+	+ desc->data[desc->depth - 1].iter;
+      addr = grub_le_to_cpu64 (node->addr);
+      generation = grub_le_to_cpu64 (node->generation);
 
-      err = grub_btrfs_read_logical (data, grub_le_to_cpu64 (node.addr),
-				     &head, sizeof (head), 0);
-      check_btrfs_header (data, &head, grub_le_to_cpu64 (node.addr));
+      err = read_node (data, addr, generation, 0, &head);
       if (err)
 	return -err;
 
-      save_ref (desc, grub_le_to_cpu64 (node.addr), 0,
-		grub_le_to_cpu32 (head.nitems), !head.level);
+      err = save_ref (desc, addr, 0, grub_le_to_cpu32 (head->nitems),
+		      !head->level);
+      if (err)
+	return -err;
     }
-  err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
-				 * sizeof (leaf)
-				 + sizeof (struct btrfs_header)
-				 + desc->data[desc->depth - 1].addr, &leaf,
-				 sizeof (leaf), 0);
+  err = read_node (data, desc->data[desc->depth - 1].addr, 0, 0, &head);
   if (err)
     return -err;
-  *outsize = grub_le_to_cpu32 (leaf.size);
+  if (desc->data[desc->depth - 1].iter >= grub_le_to_cpu32 (head->nitems))
+    return -grub_error (GRUB_ERR_BAD_FS, "tree node changed under iterator");
+
+  leaf = (const struct grub_btrfs_leaf_node *) (head + 1)
+    + desc->data[desc->depth - 1].iter;
+  data->leaf_addr = desc->data[desc->depth - 1].addr;
+  *outsize = grub_le_to_cpu32 (leaf->size);
   *outaddr = desc->data[desc->depth - 1].addr + sizeof (struct btrfs_header)
-    + grub_le_to_cpu32 (leaf.offset);
-  *key_out = leaf.key;
+    + grub_le_to_cpu32 (leaf->offset);
+  *key_out = leaf->key;
   return 1;
 }
 
@@ -443,6 +655,7 @@ lower_bound (struct grub_btrfs_data *data,
 	     int recursion_depth)
 {
   grub_disk_addr_t addr = grub_le_to_cpu64 (root);
+  grub_uint64_t generation = 0;
   int depth = -1;
 
   if (desc)
@@ -467,123 +680,73 @@ lower_bound (struct grub_btrfs_data *data,
   while (1)
     {
       grub_err_t err;
-      struct btrfs_header head;
+      const struct btrfs_header *head;
+      grub_uint32_t nitems;
+      unsigned i;
 
-    reiter:
       depth++;
-      /* FIXME: preread few nodes into buffer. */
-      err = grub_btrfs_read_logical (data, addr, &head, sizeof (head),
-				     recursion_depth + 1);
-      check_btrfs_header (data, &head, addr);
+      err = read_node (data, addr, generation, recursion_depth + 1, &head);
       if (err)
 	return err;
-      addr += sizeof (head);
-      if (head.level)
+      nitems = grub_le_to_cpu32 (head->nitems);
+      if (head->level)
 	{
-	  unsigned i;
-	  struct grub_btrfs_internal_node node, node_last;
-	  int have_last = 0;
-	  grub_memset (&node_last, 0, sizeof (node_last));
-	  for (i = 0; i < grub_le_to_cpu32 (head.nitems); i++)
+	  const struct grub_btrfs_internal_node *node;
+
+	  i = node_upper_bound (head, sizeof (*node), key_in);
+	  if (i)
 	    {
-	      err = grub_btrfs_read_logical (data, addr + i * sizeof (node),
-					     &node, sizeof (node),
-					     recursion_depth + 1);
-	      if (err)
-		return err;
+	      node = (const struct grub_btrfs_internal_node *) (head + 1) + i - 1;
 
 	      grub_dprintf ("btrfs",
 			    "internal node (depth %d) %" PRIxGRUB_UINT64_T
 			    " %x %" PRIxGRUB_UINT64_T "\n", depth,
-			    node.key.object_id, node.key.type,
-			    node.key.offset);
+			    node->key.object_id, node->key.type,
+			    node->key.offset);
 
-	      if (key_cmp (&node.key, key_in) == 0)
-		{
-		  err = GRUB_ERR_NONE;
-		  if (desc)
-		    err = save_ref (desc, addr - sizeof (head), i,
-				    grub_le_to_cpu32 (head.nitems), 0);
-		  if (err)
-		    return err;
-		  addr = grub_le_to_cpu64 (node.addr);
-		  goto reiter;
-		}
-	      if (key_cmp (&node.key, key_in) > 0)
-		break;
-	      node_last = node;
-	      have_last = 1;
-	    }
-	  if (have_last)
-	    {
 	      err = GRUB_ERR_NONE;
 	      if (desc)
-		err = save_ref (desc, addr - sizeof (head), i - 1,
-				grub_le_to_cpu32 (head.nitems), 0);
+		err = save_ref (desc, addr, i - 1, nitems, 0);
 	      if (err)
 		return err;
-	      addr = grub_le_to_cpu64 (node_last.addr);
-	      goto reiter;
+	      addr = grub_le_to_cpu64 (node->addr);
+	      generation = grub_le_to_cpu64 (node->generation);
+	      continue;
 	    }
 	  *outsize = 0;
 	  *outaddr = 0;
 	  grub_memset (key_out, 0, sizeof (*key_out));
 	  if (desc)
-	    return save_ref (desc, addr - sizeof (head), -1,
-			     grub_le_to_cpu32 (head.nitems), 0);
+	    return save_ref (desc, addr, -1, nitems, 0);
 	  return GRUB_ERR_NONE;
 	}
       {
-	unsigned i;
-	struct grub_btrfs_leaf_node leaf, leaf_last;
-	int have_last = 0;
-	for (i = 0; i < grub_le_to_cpu32 (head.nitems); i++)
+	const struct grub_btrfs_leaf_node *leaf;
+
+	data->leaf_addr = addr;
+	i = node_upper_bound (head, sizeof (*leaf), key_in);
+	if (i)
 	  {
-	    err = grub_btrfs_read_logical (data, addr + i * sizeof (leaf),
-					   &leaf, sizeof (leaf),
-					   recursion_depth + 1);
-	    if (err)
-	      return err;
+	    leaf = (const struct grub_btrfs_leaf_node *) (head + 1) + i - 1;
 
 	    grub_dprintf ("btrfs",
 			  "leaf (depth %d) %" PRIxGRUB_UINT64_T
 			  " %x %" PRIxGRUB_UINT64_T "\n", depth,
-			  leaf.key.object_id, leaf.key.type, leaf.key.offset);
-
-	    if (key_cmp (&leaf.key, key_in) == 0)
-	      {
-		grub_memcpy (key_out, &leaf.key, sizeof (*key_out));
-		*outsize = grub_le_to_cpu32 (leaf.size);
-		*outaddr = addr + grub_le_to_cpu32 (leaf.offset);
-		if (desc)
-		  return save_ref (desc, addr - sizeof (head), i,
-				   grub_le_to_cpu32 (head.nitems), 1);
-		return GRUB_ERR_NONE;
-	      }
-
-	    if (key_cmp (&leaf.key, key_in) > 0)
-	      break;
+			  leaf->key.object_id, leaf->key.type, leaf->key.offset);
 
-	    have_last = 1;
-	    leaf_last = leaf;
-	  }
-
-	if (have_last)
-	  {
-	    grub_memcpy (key_out, &leaf_last.key, sizeof (*key_out));
-	    *outsize = grub_le_to_cpu32 (leaf_last.size);
-	    *outaddr = addr + grub_le_to_cpu32 (leaf_last.offset);
+	    grub_memcpy (key_out, &leaf->key, sizeof (*key_out));
+	    *outsize = grub_le_to_cpu32 (leaf->size);
+	    *outaddr = addr + sizeof (struct btrfs_header)
+	      + grub_le_to_cpu32 (leaf->offset);
 	    if (desc)
-	      return save_ref (desc, addr - sizeof (head), i - 1,
-			       grub_le_to_cpu32 (head.nitems), 1);
+	      return save_ref (desc, addr, i - 1, nitems, 1);
 	    return GRUB_ERR_NONE;
 	  }
 	*outsize = 0;
 	*outaddr = 0;
 	grub_memset (key_out, 0, sizeof (*key_out));
 	if (desc)
-	  return save_ref (desc, addr - sizeof (head), -1,
-			   grub_le_to_cpu32 (head.nitems), 1);
+	  return save_ref (desc, addr, -1, nitems, 1);
 	return GRUB_ERR_NONE;
       }
     }
@@ -886,15 +1049,53 @@ raid56_read_retry (struct grub_btrfs_data *data,
   return ret;
 }
 
+static struct grub_btrfs_chunk_map_entry *
+chunk_map_find (struct grub_btrfs_data *data, grub_uint64_t addr)
+{
+  unsigned lo = 0, hi = data->n_chunks;
+  struct grub_btrfs_chunk_map_entry *e;
+
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (data->chunks[mid].start <= addr)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo == 0)
+    return NULL;
+  e = &data->chunks[lo - 1];
+  if (addr - e->start >= e->size)
+    return NULL;
+  return e;
+}
+
 static grub_err_t
 grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			 void *buf, grub_size_t size, int recursion_depth)
 {
+  /* Items of the leaf just looked up are usually read right away.  */
+  if (data->leaf_addr && addr >= data->leaf_addr && size <= data->nodesize
+      && addr - data->leaf_addr <= data->nodesize - size)
+    {
+      struct grub_btrfs_node_cache_entry *e;
+
+      e = node_cache_find (data, data->leaf_addr, 0);
+      if (e)
+	{
+	  grub_memcpy (buf, e->buf + (addr - data->leaf_addr), size);
+	  return GRUB_ERR_NONE;
+	}
+    }
+
   while (size > 0)
     {
       grub_uint8_t *ptr;
       struct grub_btrfs_key *key;
       struct grub_btrfs_chunk_item *chunk;
+      struct grub_btrfs_chunk_map_entry *centry;
       grub_uint64_t csize;
       grub_err_t err = 0;
       struct grub_btrfs_key key_out;
@@ -903,6 +1104,14 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
       grub_size_t chsize;
       grub_disk_addr_t chaddr;
 
+      centry = chunk_map_find (data, addr);
+      if (centry)
+	{
+	  key = &centry->key;
+	  chunk = centry->chunk;
+	  goto chunk_found;
+	}
+
       grub_dprintf ("btrfs", "searching for laddr %" PRIxGRUB_UINT64_T "\n",
 		    addr);
       for (ptr = data->sblock.bootstrap_mapping;
@@ -1302,6 +1511,142 @@ btrfs_handle_subvol(struct grub_btrfs_data *data __attribute__ ((unused)))
 }
 
 
+static void
+free_chunk_map (struct grub_btrfs_data *data)
+{
+  unsigned i;
+
+  for (i = 0; i < data->n_chunks; i++)
+    grub_free (data->chunks[i].chunk);
+  grub_free (data->chunks);
+  data->chunks = NULL;
+  data->n_chunks = data->n_chunks_allocated = 0;
+}
+
+static grub_err_t
+chunk_map_add (struct grub_btrfs_data *data, const struct grub_btrfs_key *key,
+	       struct grub_btrfs_chunk_item *chunk)
+{
+  struct grub_btrfs_chunk_map_entry *e;
+  grub_uint64_t start = grub_le_to_cpu64 (key->offset);
+
+  /* The chunk tree is sorted, so entries simply get appended.  */
+  if (data->n_chunks
+      && start < data->chunks[data->n_chunks - 1].start
+      + data->chunks[data->n_chunks - 1].size)
+    return grub_error (GRUB_ERR_BAD_FS, "overlapping chunks");
+
+  if (data->n_chunks == data->n_chunks_allocated)
+    {
+      void *tmp;
+      grub_size_t sz;
+
+      if (grub_mul (data->n_chunks_allocated, 2, &data->n_chunks_allocated) ||
+	  grub_add (data->n_chunks_allocated, 16, &data->n_chunks_allocated) ||
+	  grub_mul (data->n_chunks_allocated, sizeof (data->chunks[0]), &sz))
+	return grub_error (GRUB_ERR_OUT_OF_RANGE, "overflow is detected");
+
+      tmp = grub_realloc (data->chunks, sz);
+      if (!tmp)
+	return grub_errno;
+      data->chunks = tmp;
+    }
+
+  e = &data->chunks[data->n_chunks++];
+  e->start = start;
+  e->size = grub_le_to_cpu64 (chunk->size);
+  e->key = *key;
+  e->chunk = chunk;
+  return GRUB_ERR_NONE;
+}
+
+/* Walk the whole chunk tree once so that grub_btrfs_read_logical can map
+   addresses with a binary search instead of a tree lookup.  */
+static grub_err_t
+load_chunk_map (struct grub_btrfs_data *data)
+{
+  struct grub_btrfs_key key_in, key_out;
+  struct grub_btrfs_leaf_descriptor desc;
+  grub_disk_addr_t elemaddr;
+  grub_size_t elemsize;
+  grub_err_t err;
+  int r;
+
+  key_in.object_id = grub_cpu_to_le64_compile_time (GRUB_BTRFS_OBJECT_ID_CHUNK);
+  key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
+  key_in.offset = 0;
+
+  err = lower_bound (data, &key_in, &key_out, data->sblock.chunk_tree,
+		     &elemaddr, &elemsize, &desc, 0);
+  if (err)
+    {
+      free_iterator (&desc);
+      return err;
+    }
+  r = 1;
+  if (key_out.object_id != key_in.object_id
+      || key_out.type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
+    r = next (data, &desc, &elemaddr, &elemsize, &key_out);
+
+  for (; r > 0; r = next (data, &desc, &elemaddr, &elemsize, &key_out))
+    {
+      struct grub_btrfs_chunk_item *chunk;
+
+      if (key_out.object_id != key_in.object_id
+	  || key_out.type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
+	break;
+
+      if (elemsize < sizeof (*chunk))
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "invalid chunk item");
+	  break;
+	}
+      chunk = grub_malloc (elemsize);
+      if (!chunk)
+	{
+	  err = grub_errno;
+	  break;
+	}
+      err = grub_btrfs_read_logical (data, elemaddr, chunk, elemsize, 0);
+      if (!err && elemsize < sizeof (*chunk)
+	  + sizeof (struct grub_btrfs_chunk_stripe)
+	  * grub_le_to_cpu16 (chunk->nstripes))
+	err = grub_error (GRUB_ERR_BAD_FS, "invalid chunk item");
+      if (!err)
+	err = chunk_map_add (data, &key_out, chunk);
+      if (err)
+	{
+	  grub_free (chunk);
+	  break;
+	}
+    }
+  if (r < 0)
+    err = -r;
+
+  free_iterator (&desc);
+  return err;
+}
+
+static void
+grub_btrfs_unmount (struct grub_btrfs_data *data)
+{
+  unsigned i;
+
+  grub_dprintf ("btrfs", "node cache: %lu hits, %lu misses\n",
+		node_cache_hits, node_cache_misses);
+
+  /* The device 0 is closed one layer upper.  */
+  for (i = 1; i < data->n_devices_attached; i++)
+    if (data->devices_attached[i].dev)
+        grub_device_close (data->devices_attached[i].dev);
+  grub_free (data->devices_attached);
+  grub_free (data->extent);
+  for (i = 0; i < ARRAY_SIZE (data->extent_cache); i++)
+    grub_free (data->extent_cache[i].buf);
+  free_chunk_map (data);
+  grub_free (data);
+}
+
 static struct grub_btrfs_data *
 grub_btrfs_mount (grub_device_t dev)
 {
@@ -1338,12 +1683,31 @@ grub_btrfs_mount (grub_device_t dev)
   data->devices_attached[0].dev = dev;
   data->devices_attached[0].id = data->sblock.this_device.device_id;
 
+  data->nodesize = grub_le_to_cpu32 (data->sblock.nodesize);
+  if (data->nodesize < 4096 || data->nodesize > 65536
+      || (data->nodesize & (data->nodesize - 1)))
+    {
+      grub_error (GRUB_ERR_BAD_FS, "invalid node size");
+      grub_btrfs_unmount (data);
+      return NULL;
+    }
+
+  /* Not fatal: chunks missing from the map are still looked up in the
+     tree.  */
+  err = load_chunk_map (data);
+  if (err)
+    {
+      grub_dprintf ("btrfs", "couldn't load the chunk tree: %s\n", grub_errmsg);
+      free_chunk_map (data);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
   if (relpath && (relpath[0] == '1' || relpath[0] == 'y'))
     {
       err = btrfs_handle_subvol (data);
       if (err)
       {
-        grub_free (data);
+        grub_btrfs_unmount (data);
         return NULL;
       }
     }
@@ -1351,19 +1715,6 @@ grub_btrfs_mount (grub_device_t dev)
   return data;
 }
 
-static void
-grub_btrfs_unmount (struct grub_btrfs_data *data)
-{
-  unsigned i;
-  /* The device 0 is closed one layer upper.  */
-  for (i = 1; i < data->n_devices_attached; i++)
-    if (data->devices_attached[i].dev)
-        grub_device_close (data->devices_attached[i].dev);
-  grub_free (data->devices_attached);
-  grub_free (data->extent);
-  grub_free (data);
-}
-
 static grub_err_t
 grub_btrfs_read_inode (struct grub_btrfs_data *data,
 		       struct grub_btrfs_inode *inode, grub_uint64_t num,
@@ -1572,6 +1923,113 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
   return ret;
 }
 
+/* Read the compressed data of the current extent and decompress OSIZE
+   bytes from offset OFF of it into OBUF.  */
+static grub_ssize_t
+grub_btrfs_decompress_extent (struct grub_btrfs_data *data, grub_off_t off,
+			      char *obuf, grub_size_t osize)
+{
+  char *tmp;
+  grub_uint64_t zsize;
+  grub_ssize_t ret;
+  grub_err_t err;
+
+  zsize = grub_le_to_cpu64 (data->extent->compressed_size);
+  tmp = grub_malloc (zsize);
+  if (!tmp)
+    return -1;
+  err = grub_btrfs_read_logical (data,
+				 grub_le_to_cpu64 (data->extent->laddr),
+				 tmp, zsize, 0);
+  if (err)
+    {
+      grub_free (tmp);
+      return -1;
+    }
+
+  if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZLIB)
+    ret = grub_zlib_decompress (tmp, zsize, off, obuf, osize);
+  else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_LZO)
+    ret = grub_btrfs_lzo_decompress (tmp, zsize, off, obuf, osize);
+  else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
+    ret = grub_btrfs_zstd_decompress (tmp, zsize, off, obuf, osize);
+  else
+    ret = -1;
+
+  grub_free (tmp);
+  return ret;
+}
+
+/* Return the whole decompressed current extent and its length in SIZE,
+   decompressing it into the extent cache if needed.  */
+static const char *
+grub_btrfs_extent_cache_get (struct grub_btrfs_data *data, grub_size_t *size)
+{
+  grub_uint64_t laddr = grub_le_to_cpu64 (data->extent->laddr);
+  grub_size_t usize = grub_le_to_cpu64 (data->extent->size);
+  struct grub_btrfs_extent_cache_entry *e;
+  grub_ssize_t ret;
+  char *ubuf;
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (data->extent_cache); i++)
+    {
+      e = &data->extent_cache[i];
+      if (e->buf && e->laddr == laddr)
+	{
+	  e->last_use = ++data->extent_cache_clock;
+	  *size = e->size;
+	  return e->buf;
+	}
+    }
+
+  ubuf = grub_malloc (usize);
+  if (!ubuf)
+    return NULL;
+  ret = grub_btrfs_decompress_extent (data, 0, ubuf, usize);
+  if (ret < 0)
+    {
+      grub_free (ubuf);
+      return NULL;
+    }
+
+  /* Evict the least recently used extents until there is both a free
+     slot and room in the budget.  */
+  while (1)
+    {
+      struct grub_btrfs_extent_cache_entry *victim = NULL;
+
+      e = NULL;
+      for (i = 0; i < ARRAY_SIZE (data->extent_cache); i++)
+	{
+	  if (!data->extent_cache[i].buf)
+	    {
+	      if (!e)
+		e = &data->extent_cache[i];
+	    }
+	  else if (!victim
+		   || data->extent_cache[i].last_use < victim->last_use)
+	    victim = &data->extent_cache[i];
+	}
+      if ((e && data->extent_cache_bytes + usize
+	   <= GRUB_BTRFS_EXTENT_CACHE_BYTES) || !victim)
+	break;
+      data->extent_cache_bytes -= victim->alloc;
+      grub_free (victim->buf);
+      victim->buf = NULL;
+    }
+
+  e->laddr = laddr;
+  e->last_use = ++data->extent_cache_clock;
+  e->size = ret;
+  e->alloc = usize;
+  e->buf = ubuf;
+  data->extent_cache_bytes += usize;
+
+  *size = ret;
+  return ubuf;
+}
+
 static grub_ssize_t
 grub_btrfs_extent_read (struct grub_btrfs_data *data,
 			grub_uint64_t ino, grub_uint64_t tree,
@@ -1716,39 +2174,31 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 
 	  if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE)
 	    {
-	      char *tmp;
-	      grub_uint64_t zsize;
+	      grub_off_t zoff = extoff + grub_le_to_cpu64 (data->extent->offset);
+	      grub_uint64_t usize = grub_le_to_cpu64 (data->extent->size);
 	      grub_ssize_t ret;
 
-	      zsize = grub_le_to_cpu64 (data->extent->compressed_size);
-	      tmp = grub_malloc (zsize);
-	      if (!tmp)
-		return -1;
-	      err = grub_btrfs_read_logical (data,
-					     grub_le_to_cpu64 (data->extent->laddr),
-					     tmp, zsize, 0);
-	      if (err)
+	      if (zoff == 0 && csize == usize)
+		/* The whole extent is wanted: decompress straight into
+		   the caller's buffer.  */
+		ret = grub_btrfs_decompress_extent (data, 0, buf, csize);
+	      else if (usize && usize <= GRUB_BTRFS_MAX_UNCOMPRESSED)
 		{
-		  grub_free (tmp);
-		  return -1;
-		}
+		  const char *ubuf;
+		  grub_size_t ulen;
 
-	      if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZLIB)
-		ret = grub_zlib_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
-	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_LZO)
-		ret = grub_btrfs_lzo_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
-	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
-		ret = grub_btrfs_zstd_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
+		  ubuf = grub_btrfs_extent_cache_get (data, &ulen);
+		  ret = -1;
+		  if (ubuf && zoff < ulen)
+		    {
+		      ret = ulen - zoff;
+		      if (ret > (grub_ssize_t) csize)
+			ret = csize;
+		      grub_memcpy (buf, ubuf + zoff, ret);
+		    }
+		}
 	      else
-		ret = -1;
-
-	      grub_free (tmp);
+		ret = grub_btrfs_decompress_extent (data, zoff, buf, csize);
 
 	      if (ret != (grub_ssize_t) csize)
 		{
@@ -3116,6 +3566,14 @@ grub_cmd_btrfs_get_default_subvol (struct grub_extcmd_context *ctxt,
   return GRUB_ERR_NONE;
 }
 
+static const struct grub_fs_signature grub_btrfs_signatures[] =
+  {
+    /* The primary superblock at 64 KiB must be valid.  */
+    { 0x10000 + 0x40, sizeof (GRUB_BTRFS_SIGNATURE) - 1,
+      GRUB_BTRFS_SIGNATURE },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_btrfs_fs = {
   .name = "btrfs",
   .fs_dir = grub_btrfs_dir,
@@ -3129,6 +3587,7 @@ static struct grub_fs grub_btrfs_fs = {
   .reserved_first_sector = 1,
   .blocklist_install = 0,
 #endif
+  .signatures = grub_btrfs_signatures,
 };
 
 static grub_command_t cmd_info;
@@ -3226,6 +3685,7 @@ GRUB_MOD_FINI (btrfs)
   grub_unregister_command (cmd_info);
   grub_unregister_extcmd (cmd_list_subvols);
   grub_fs_unregister (&grub_btrfs_fs);
+  node_cache_flush ();
 }
 
 // vim: si et sw=2:
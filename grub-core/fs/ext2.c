@@ -61,6 +61,27 @@ struct grub_fshelp_node
   int inode_read;
 };
 
+/* A run of LEN file blocks from BLOCK on, stored from START on disk, or
+   reading as zeros if START is 0.  */
+struct grub_ext2_extent
+{
+  grub_uint32_t block;
+  grub_uint32_t len;
+  grub_disk_addr_t start;
+};
+
+/* The extent tree of inode INO, flattened and sorted by file block.
+   VALID is negative if the tree could not be decoded.  */
+struct grub_ext2_extent_map
+{
+  int ino;
+  int valid;
+  grub_size_t count;
+  grub_size_t alloc;
+  grub_size_t hint;
+  struct grub_ext2_extent *ext;
+};
+
 /* Information about a "mounted" ext2 filesystem.  */
 struct grub_ext2_data
 {
@@ -69,6 +90,7 @@ struct grub_ext2_data
   grub_disk_t disk;
   struct grub_ext2_inode *inode;
   struct grub_fshelp_node diropen;
+  struct grub_ext2_extent_map extents;
 };
 
 static grub_dl_t my_mod;
@@ -185,6 +207,201 @@ grub_ext4_find_leaf (struct grub_ext2_data *data,
   return 0;
 }
 
+/* Append the extents below HDR, which holds at most MAX entries, to
+   MAP.  */
+static grub_err_t
+grub_ext4_map_extents (struct grub_ext2_data *data,
+		       struct grub_ext2_extent_map *map,
+		       struct grub_ext4_extent_header *hdr,
+		       unsigned max, int level)
+{
+  unsigned entries, i;
+
+  if (hdr->magic != grub_cpu_to_le16_compile_time (EXT4_EXT_MAGIC)
+      || (entries = grub_le_to_cpu16 (hdr->entries)) > max
+      || level > 8)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid extent");
+
+  if (hdr->depth == 0)
+    {
+      struct grub_ext4_extent *ext = (struct grub_ext4_extent *) (hdr + 1);
+
+      for (i = 0; i < entries; i++)
+	{
+	  struct grub_ext2_extent *e;
+
+	  if (map->count
+	      && (grub_le_to_cpu32 (ext[i].block)
+		  < map->ext[map->count - 1].block))
+	    return grub_error (GRUB_ERR_BAD_FS, "unsorted extents");
+
+	  if (map->count == map->alloc)
+	    {
+	      struct grub_ext2_extent *n;
+	      grub_size_t sz;
+
+	      map->alloc = map->alloc ? map->alloc * 2 : 16;
+	      if (grub_mul (map->alloc, sizeof (map->ext[0]), &sz))
+		return grub_error (GRUB_ERR_OUT_OF_RANGE, "overflow is detected");
+	      n = grub_realloc (map->ext, sz);
+	      if (! n)
+		return grub_errno;
+	      map->ext = n;
+	    }
+
+	  e = &map->ext[map->count++];
+	  e->block = grub_le_to_cpu32 (ext[i].block);
+	  e->len = grub_le_to_cpu16 (ext[i].len);
+	  e->start = grub_le_to_cpu16 (ext[i].start_hi);
+	  e->start = (e->start << 32) | grub_le_to_cpu32 (ext[i].start);
+	  /* Unwritten extents read as zeros, like holes.  */
+	  if (e->len > EXT4_EXT_INIT_MAX_LEN)
+	    {
+	      e->len -= EXT4_EXT_INIT_MAX_LEN;
+	      e->start = 0;
+	    }
+	}
+
+      return GRUB_ERR_NONE;
+    }
+  else
+    {
+      struct grub_ext4_extent_idx *index;
+      unsigned blksz = EXT2_BLOCK_SIZE (data);
+      void *buf;
+      grub_err_t err = GRUB_ERR_NONE;
+
+      buf = grub_malloc (blksz);
+      if (! buf)
+	return grub_errno;
+
+      for (i = 0; i < entries && ! err; i++)
+	{
+	  grub_disk_addr_t block;
+
+	  /* HDR may be the block BUF is about to be reused for.  */
+	  index = (struct grub_ext4_extent_idx *) (hdr + 1) + i;
+	  block = grub_le_to_cpu16 (index->leaf_hi);
+	  block = (block << 32) | grub_le_to_cpu32 (index->leaf);
+
+	  err = grub_disk_read (data->disk,
+				block << LOG2_EXT2_BLOCK_SIZE (data),
+				0, blksz, buf);
+	  if (! err)
+	    err = grub_ext4_map_extents (data, map, buf,
+					 (blksz - sizeof (*hdr))
+					 / sizeof (*index), level + 1);
+	}
+
+      grub_free (buf);
+      return err;
+    }
+}
+
+/* Return the flattened extent tree of NODE, decoding it if it is not
+   the one cached in the mount.  */
+static struct grub_ext2_extent_map *
+grub_ext2_get_extent_map (grub_fshelp_node_t node)
+{
+  struct grub_ext2_extent_map *map = &node->data->extents;
+
+  if (map->valid && map->ino == node->ino)
+    return map->valid > 0 ? map : 0;
+
+  map->ino = node->ino;
+  map->count = 0;
+  map->hint = 0;
+  map->valid = 1;
+  if (grub_ext4_map_extents (node->data, map,
+			     (struct grub_ext4_extent_header *)
+			     node->inode.blocks.dir_blocks,
+			     (sizeof (node->inode.blocks)
+			      - sizeof (struct grub_ext4_extent_header))
+			     / sizeof (struct grub_ext4_extent), 0))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      map->valid = -1;
+      return 0;
+    }
+
+  return map;
+}
+
+static grub_disk_addr_t
+grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock);
+
+/* Map FILEBLOCK of an extent-mapped NODE, and the blocks following it
+   in the same extent or hole.  */
+static grub_disk_addr_t
+grub_ext2_read_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		       grub_disk_addr_t *count)
+{
+  struct grub_ext2_extent_map *map;
+  struct grub_ext2_extent *e;
+  grub_size_t lo, hi;
+
+  map = grub_ext2_get_extent_map (node);
+  if (! map)
+    {
+      /* Fall back to walking the tree for every block.  */
+      *count = 1;
+      return grub_ext2_read_block (node, fileblock);
+    }
+
+  /* Find the last extent starting at or before FILEBLOCK.  Sequential
+     reads almost always hit the previous extent or the next one.  */
+  lo = 0;
+  hi = map->count;
+  if (map->hint < map->count && map->ext[map->hint].block <= fileblock)
+    {
+      lo = map->hint;
+      if (lo + 1 < map->count && map->ext[lo + 1].block <= fileblock)
+	lo++;
+      if (lo + 1 < map->count && map->ext[lo + 1].block <= fileblock)
+	lo++;
+      else
+	hi = lo + 1;
+    }
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (map->ext[mid].block <= fileblock)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  if (! map->count || map->ext[lo].block > fileblock)
+    {
+      /* Hole before the first extent.  */
+      *count = map->count ? map->ext[0].block - fileblock : 1;
+      return 0;
+    }
+
+  map->hint = lo;
+  e = &map->ext[lo];
+  if (fileblock - e->block < e->len)
+    {
+      /* Overlapping extents are corrupt, but must not make the run
+	 cover blocks mapped elsewhere.  */
+      *count = e->len - (fileblock - e->block);
+      if (lo + 1 < map->count
+	  && map->ext[lo + 1].block - fileblock < *count)
+	*count = map->ext[lo + 1].block - fileblock;
+      if (! e->start)
+	return 0;
+      return e->start + (fileblock - e->block);
+    }
+
+  /* Hole after the extent.  */
+  if (lo + 1 < map->count)
+    *count = map->ext[lo + 1].block - fileblock;
+  else
+    *count = 1;
+  return 0;
+}
+
 static grub_disk_addr_t
 grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 {
@@ -220,8 +437,11 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
       if (--i >= 0)
         {
+	  grub_uint16_t len = grub_le_to_cpu16 (ext[i].len);
+
           fileblock -= grub_le_to_cpu32 (ext[i].block);
-          if (fileblock >= grub_le_to_cpu16 (ext[i].len))
+	  /* Unwritten extents read as zeros.  */
+          if (len > EXT4_EXT_INIT_MAX_LEN || fileblock >= len)
 	    ret = 0;
           else
             {
@@ -302,12 +522,16 @@ grub_ext2_read_file (grub_fshelp_node_t node,
 		     grub_disk_read_hook_t read_hook, void *read_hook_data, int blocklist,
 		     grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data, blocklist,
-				pos, len, buf, grub_ext2_read_block,
-				grub_cpu_to_le32 (node->inode.size)
-				| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
-				LOG2_EXT2_BLOCK_SIZE (node->data), 0);
+  int extents = !! (node->inode.flags
+		    & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG));
+
+  return grub_fshelp_read_file_ex (node->data->disk, node,
+				   read_hook, read_hook_data, blocklist,
+				   pos, len, buf, grub_ext2_read_block,
+				   extents ? grub_ext2_read_extent : NULL,
+				   grub_cpu_to_le32 (node->inode.size)
+				   | (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+				   LOG2_EXT2_BLOCK_SIZE (node->data), 0);
 
 }
 
@@ -413,6 +637,10 @@ grub_ext2_mount (grub_disk_t disk)
   data->diropen.ino = 2;
   data->diropen.inode_read = 1;
 
+  data->extents.valid = 0;
+  data->extents.alloc = 0;
+  data->extents.ext = 0;
+
   data->inode = &data->diropen.inode;
 
   grub_ext2_read_inode (data, 2, data->inode);
@@ -582,6 +810,32 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+static grub_uint64_t
+grub_ext2_dir_key (grub_fshelp_node_t dir)
+{
+  return dir->ino;
+}
+
+static grub_fshelp_node_t
+grub_ext2_dup_node (grub_fshelp_node_t node, grub_fshelp_node_t dir)
+{
+  struct grub_fshelp_node *copy;
+
+  copy = grub_malloc (sizeof (*copy));
+  if (! copy)
+    return 0;
+
+  grub_memcpy (copy, node, sizeof (*copy));
+  copy->data = dir->data;
+  return copy;
+}
+
+static const struct grub_fshelp_cache_ops grub_ext2_cache_ops =
+  {
+    .dir_key = grub_ext2_dir_key,
+    .dup_node = grub_ext2_dup_node
+  };
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_ext2_open (struct grub_file *file, const char *name)
@@ -599,9 +853,10 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				      grub_ext2_iterate_dir,
+				      grub_ext2_read_symlink, GRUB_FSHELP_REG,
+				      data->disk, &grub_ext2_cache_ops);
   if (err)
     goto fail;
 
@@ -619,6 +874,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
     }
 
   grub_memcpy (data->inode, &fdiro->inode, sizeof (struct grub_ext2_inode));
+  data->diropen.ino = fdiro->ino;
   grub_free (fdiro);
 
   file->size = grub_le_to_cpu32 (data->inode->size);
@@ -631,6 +887,8 @@ grub_ext2_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
+  if (data)
+    grub_free (data->extents.ext);
   grub_free (data);
 
   grub_dl_unref (my_mod);
@@ -641,7 +899,10 @@ grub_ext2_open (struct grub_file *file, const char *name)
 static grub_err_t
 grub_ext2_close (grub_file_t file)
 {
-  grub_free (file->data);
+  struct grub_ext2_data *data = file->data;
+
+  grub_free (data->extents.ext);
+  grub_free (data);
 
   grub_dl_unref (my_mod);
 
@@ -660,6 +921,24 @@ grub_ext2_read (grub_file_t file, char *buf, grub_size_t len)
 }
 
 
+static grub_err_t
+grub_ext2_map (grub_file_t file, grub_off_t offset,
+	       struct grub_fs_block *block)
+{
+  struct grub_ext2_data *data = (struct grub_ext2_data *) file->data;
+  struct grub_fshelp_node *node = &data->diropen;
+  int extents = !! (node->inode.flags
+		    & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG));
+
+  return grub_fshelp_map_file (data->disk, node, offset, block,
+			       grub_ext2_read_block,
+			       extents ? grub_ext2_read_extent : NULL,
+			       grub_cpu_to_le32 (node->inode.size)
+			       | (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+			       LOG2_EXT2_BLOCK_SIZE (data), 0);
+}
+
+
 /* Context for grub_ext2_dir.  */
 struct grub_ext2_dir_ctx
 {
@@ -711,9 +990,10 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &ctx.data->diropen, &fdiro,
+				grub_ext2_iterate_dir, grub_ext2_read_symlink,
+				GRUB_FSHELP_DIR, ctx.data->disk,
+				&grub_ext2_cache_ops);
   if (grub_errno)
     goto fail;
 
@@ -722,6 +1002,8 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
  fail:
   if (fdiro != &ctx.data->diropen)
     grub_free (fdiro);
+  if (ctx.data)
+    grub_free (ctx.data->extents.ext);
   grub_free (ctx.data);
 
   grub_dl_unref (my_mod);
@@ -807,6 +1089,13 @@ grub_ext2_mtime (grub_device_t device, grub_int32_t *tm)
 
 
 
+static const struct grub_fs_signature grub_ext2_signatures[] =
+  {
+    /* s_magic in the superblock at byte 1024.  */
+    { 1024 + 56, 2, "\x53\xef" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_ext2_fs =
   {
     .name = "ext2",
@@ -817,11 +1106,13 @@ static struct grub_fs grub_ext2_fs =
     .fs_label = grub_ext2_label,
     .fs_uuid = grub_ext2_uuid,
     .fs_mtime = grub_ext2_mtime,
+    .fs_map = grub_ext2_map,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
 #endif
     .fast_blocklist = 1,
+    .signatures = grub_ext2_signatures,
     .next = 0
   };
 
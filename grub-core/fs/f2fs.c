@@ -1304,6 +1304,14 @@ grub_f2fs_uuid (grub_device_t device, char **uuid)
   return grub_errno;
 }
 
+static const struct grub_fs_signature grub_f2fs_signatures[] =
+  {
+    { F2FS_SUPER_OFFSET, 4, "\x10\x20\xf5\xf2" },
+    /* Backup superblock.  */
+    { F2FS_SUPER_OFFSET + F2FS_BLKSIZE, 4, "\x10\x20\xf5\xf2" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_f2fs_fs = {
   .name                  = "f2fs",
   .fs_dir                   = grub_f2fs_dir,
@@ -1317,6 +1325,7 @@ static struct grub_fs grub_f2fs_fs = {
   .blocklist_install     = 0,
 #endif
   .fast_blocklist        = 1,
+  .signatures            = grub_f2fs_signatures,
   .next                  = 0
 };
 
@@ -34,6 +34,7 @@
 #endif
 #include <grub/fshelp.h>
 #include <grub/i18n.h>
+#include <grub/safemath.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -185,6 +186,15 @@ struct grub_fat_data
   grub_uint32_t uuid;
 };
 
+/* COUNT clusters of a file from logical cluster LOGICAL on, stored
+   contiguously from CLUSTER on.  */
+struct grub_fat_run
+{
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+  grub_uint32_t count;
+};
+
 struct grub_fshelp_node {
   grub_disk_t disk;
   struct grub_fat_data *data;
@@ -202,8 +212,20 @@ struct grub_fshelp_node {
 #ifdef MODE_EXFAT
   int is_contiguous;
 #endif
+
+  /* Cluster chain of an open file, decoded into runs as far as it has
+     been read.  Only used if USE_RUNS is set.  */
+  int use_runs;
+  int chain_end;
+  struct grub_fat_run *runs;
+  grub_uint32_t num_runs;
+  grub_uint32_t alloc_runs;
+  grub_uint32_t cur_run;
 };
 
+/* How much of the FAT is read at once while decoding a chain.  */
+#define GRUB_FAT_MAP_BUFSIZE	4096
+
 static grub_dl_t my_mod;
 
 #ifndef MODE_EXFAT
@@ -449,6 +471,281 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+static grub_err_t
+grub_fat_add_run (grub_fshelp_node_t node, grub_uint32_t logical,
+		  grub_uint32_t cluster)
+{
+  struct grub_fat_run *run;
+
+  if (node->num_runs == node->alloc_runs)
+    {
+      grub_uint32_t alloc = node->alloc_runs ? node->alloc_runs * 2 : 8;
+      grub_size_t sz;
+
+      if (grub_mul (alloc, sizeof (*run), &sz))
+	return grub_error (GRUB_ERR_OUT_OF_RANGE, "overflow is detected");
+      run = grub_realloc (node->runs, sz);
+      if (! run)
+	return grub_errno;
+      node->runs = run;
+      node->alloc_runs = alloc;
+    }
+
+  run = &node->runs[node->num_runs++];
+  run->logical = logical;
+  run->cluster = cluster;
+  run->count = 1;
+  return GRUB_ERR_NONE;
+}
+
+/* Follow the cluster chain of NODE until it covers logical cluster
+   LOGICAL, then as far as the part of the FAT already read allows, but
+   no further than the file size.  */
+static grub_err_t
+grub_fat_extend_runs (grub_disk_t disk, grub_fshelp_node_t node,
+		      grub_uint32_t logical)
+{
+  struct grub_fat_data *data = node->data;
+  grub_uint64_t fat_bytes, fat_start = 0;
+  grub_size_t fat_len = 0;
+  grub_uint8_t *fat = 0;
+  grub_err_t err = GRUB_ERR_NONE;
+  grub_uint64_t max_clusters = data->num_clusters;
+  unsigned logical_cluster_bits = data->cluster_bits + GRUB_DISK_SECTOR_BITS;
+
+  /* Directories have no size, only the number of clusters bounds them.  */
+  if (! (node->attr & GRUB_FAT_ATTR_DIRECTORY))
+    max_clusters = (((grub_uint64_t) node->file_size
+		     + (1ULL << logical_cluster_bits) - 1)
+		    >> logical_cluster_bits);
+
+  if (! node->num_runs)
+    {
+      if (node->file_cluster < 2 || node->file_cluster >= data->num_clusters)
+	{
+	  node->chain_end = 1;
+	  return GRUB_ERR_NONE;
+	}
+      err = grub_fat_add_run (node, 0, node->file_cluster);
+      if (err)
+	return err;
+    }
+
+  fat_bytes = (grub_uint64_t) data->sectors_per_fat << GRUB_DISK_SECTOR_BITS;
+
+  while (! node->chain_end)
+    {
+      struct grub_fat_run *last = &node->runs[node->num_runs - 1];
+      grub_uint32_t cluster = last->cluster + last->count - 1;
+      grub_uint32_t next_cluster;
+      grub_uint64_t fat_offset;
+      grub_uint64_t total = (grub_uint64_t) last->logical + last->count;
+      int covered = (total > logical);
+
+      /* Nothing past the end of the file is read.  */
+      if (covered && total >= max_clusters)
+	break;
+
+      switch (data->fat_size)
+	{
+	case 32:
+	  fat_offset = (grub_uint64_t) cluster << 2;
+	  break;
+	case 16:
+	  fat_offset = (grub_uint64_t) cluster << 1;
+	  break;
+	default:
+	  /* case 12: */
+	  fat_offset = cluster + (cluster >> 1);
+	  break;
+	}
+
+      if (! fat || fat_offset < fat_start
+	  || fat_offset + ((data->fat_size + 7) >> 3) > fat_start + fat_len)
+	{
+	  /* Stop at the end of what has been read once LOGICAL is
+	     covered, to keep the decoding proportional to the reads.  */
+	  if (covered)
+	    break;
+
+	  if (! fat)
+	    {
+	      fat = grub_malloc (GRUB_FAT_MAP_BUFSIZE);
+	      if (! fat)
+		return grub_errno;
+	    }
+
+	  fat_start = fat_offset & ~(grub_uint64_t) (GRUB_DISK_SECTOR_SIZE - 1);
+	  if (fat_start >= fat_bytes)
+	    {
+	      err = grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+				cluster);
+	      break;
+	    }
+	  fat_len = GRUB_FAT_MAP_BUFSIZE;
+	  if (fat_len > fat_bytes - fat_start)
+	    fat_len = fat_bytes - fat_start;
+
+	  err = grub_disk_read (disk, data->fat_sector, fat_start, fat_len, fat);
+	  if (err)
+	    break;
+
+	  if (fat_offset + ((data->fat_size + 7) >> 3) > fat_start + fat_len)
+	    {
+	      err = grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+				cluster);
+	      break;
+	    }
+	}
+
+      if (data->fat_size == 32)
+	next_cluster = grub_le_to_cpu32 (grub_get_unaligned32
+					 (fat + fat_offset - fat_start));
+      else
+	{
+	  next_cluster = grub_le_to_cpu16 (grub_get_unaligned16
+					   (fat + fat_offset - fat_start));
+	  if (data->fat_size == 12)
+	    {
+	      if (cluster & 1)
+		next_cluster >>= 4;
+	      next_cluster &= 0x0FFF;
+	    }
+	}
+
+      if (next_cluster >= data->cluster_eof_mark)
+	{
+	  node->chain_end = 1;
+	  break;
+	}
+
+      if (next_cluster < 2 || next_cluster >= data->num_clusters)
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+			    next_cluster);
+	  break;
+	}
+
+      /* A chain holding more clusters than the filesystem loops.  */
+      if (total >= data->num_clusters - 2)
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "cluster chain loops");
+	  break;
+	}
+
+      if (next_cluster == cluster + 1)
+	last->count++;
+      else
+	{
+	  err = grub_fat_add_run (node, last->logical + last->count,
+				  next_cluster);
+	  if (err)
+	    break;
+	}
+    }
+
+  grub_free (fat);
+  return err;
+}
+
+/* Return the run holding logical cluster LOGICAL of NODE, or NULL if
+   the chain is shorter or an error occurred.  */
+static struct grub_fat_run *
+grub_fat_find_run (grub_disk_t disk, grub_fshelp_node_t node,
+		   grub_uint32_t logical)
+{
+  struct grub_fat_run *run;
+  grub_uint32_t lo, hi;
+
+  if (! node->num_runs
+      || (node->runs[node->num_runs - 1].logical
+	  + node->runs[node->num_runs - 1].count <= logical))
+    {
+      if (node->chain_end)
+	return 0;
+      if (grub_fat_extend_runs (disk, node, logical) || ! node->num_runs)
+	return 0;
+    }
+
+  /* Sequential reads stay in the same run or move to the next one.  */
+  lo = 0;
+  hi = node->num_runs;
+  if (node->cur_run < node->num_runs
+      && node->runs[node->cur_run].logical <= logical)
+    {
+      lo = node->cur_run;
+      if (lo + 1 < hi && node->runs[lo + 1].logical <= logical)
+	lo++;
+    }
+  while (hi - lo > 1)
+    {
+      grub_uint32_t mid = lo + (hi - lo) / 2;
+
+      if (node->runs[mid].logical <= logical)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  run = &node->runs[lo];
+  if (logical < run->logical || logical - run->logical >= run->count)
+    return 0;
+
+  node->cur_run = lo;
+  return run;
+}
+
+/* Read from a file whose cluster chain is mapped into runs.  Every run
+   is read with a single request.  */
+static grub_ssize_t
+grub_fat_read_runs (grub_disk_t disk, grub_fshelp_node_t node,
+		    grub_disk_read_hook_t read_hook, void *read_hook_data,
+		    int blocklist, grub_off_t offset, grub_size_t len,
+		    char *buf)
+{
+  unsigned logical_cluster_bits = (node->data->cluster_bits
+				   + GRUB_DISK_SECTOR_BITS);
+  grub_ssize_t ret = 0;
+
+  while (len)
+    {
+      struct grub_fat_run *run;
+      grub_disk_addr_t sector;
+      grub_uint64_t run_offset, size;
+
+      run = grub_fat_find_run (disk, node, offset >> logical_cluster_bits);
+      if (! run)
+	return grub_errno ? -1 : ret;
+
+      run_offset = offset - ((grub_uint64_t) run->logical
+			     << logical_cluster_bits);
+      size = ((grub_uint64_t) run->count << logical_cluster_bits) - run_offset;
+      if (size > len)
+	size = len;
+
+      sector = (node->data->cluster_sector
+		+ ((grub_disk_addr_t) (run->cluster - 2)
+		   << node->data->cluster_bits));
+
+      disk->read_hook = read_hook;
+      disk->read_hook_data = read_hook_data;
+      grub_disk_read_ex (disk, sector + (run_offset >> GRUB_DISK_SECTOR_BITS),
+			 run_offset & (GRUB_DISK_SECTOR_SIZE - 1), size, buf,
+			 blocklist);
+      disk->read_hook = 0;
+      if (grub_errno)
+	return -1;
+
+      len -= size;
+      if (buf)
+	buf += size;
+      ret += size;
+      offset += size;
+    }
+
+  return ret;
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data, int blocklist,
@@ -497,6 +794,10 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
     }
 #endif
 
+  if (node->use_runs)
+    return grub_fat_read_runs (disk, node, read_hook, read_hook_data,
+			       blocklist, offset, len, buf);
+
   /* Calculate the logical cluster number and offset.  */
   logical_cluster_bits = (node->data->cluster_bits
 			  + GRUB_DISK_SECTOR_BITS);
@@ -912,21 +1213,58 @@ grub_fat_timestamp (grub_uint16_t time, grub_uint16_t date, grub_int32_t *nix) {
 
 #endif
 
-static grub_err_t lookup_file (grub_fshelp_node_t node,
-			       const char *name,
-			       grub_fshelp_node_t *foundnode,
-			       enum grub_fshelp_filetype *foundtype)
+static grub_uint64_t
+grub_fat_dir_key (grub_fshelp_node_t dir)
+{
+  return dir->file_cluster;
+}
+
+static grub_fshelp_node_t
+grub_fat_dup_node (grub_fshelp_node_t node, grub_fshelp_node_t dir)
+{
+  grub_fshelp_node_t copy;
+
+  copy = grub_malloc (sizeof (*copy));
+  if (!copy)
+    return 0;
+  grub_memcpy (copy, node, sizeof (*copy));
+  copy->data = dir->data;
+  copy->disk = dir->disk;
+  copy->cur_cluster_num = ~0U;
+  copy->cur_cluster = 0;
+  copy->use_runs = 0;
+  copy->chain_end = 0;
+  copy->runs = 0;
+  copy->num_runs = 0;
+  copy->alloc_runs = 0;
+  copy->cur_run = 0;
+  return copy;
+}
+
+/* FAT directories are unsorted and long names are stored as UTF-16
+   pieces, so have large ones indexed.  */
+static const struct grub_fshelp_cache_ops grub_fat_cache_ops =
+  {
+    .dir_key = grub_fat_dir_key,
+    .dup_node = grub_fat_dup_node,
+    .index_dirs = 1
+  };
+
+static int
+grub_fat_iterate_dir (grub_fshelp_node_t dir,
+		      grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
 {
   grub_err_t err;
   struct grub_fat_iterate_context ctxt;
+  grub_fshelp_node_t node;
+  enum grub_fshelp_filetype type;
+  int ret = 0;
 
-  err = grub_fat_iterate_init (&ctxt);
-  if (err)
-    return err;
+  if (grub_fat_iterate_init (&ctxt))
+    return 0;
 
-  while (!(err = grub_fat_iterate_dir_next (node, &ctxt)))
+  while (!(err = grub_fat_iterate_dir_next (dir, &ctxt)))
     {
-
 #ifdef MODE_EXFAT
       if (!ctxt.dir.have_stream)
 	continue;
@@ -935,41 +1273,40 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 	continue;
 #endif
 
-      if (grub_strcasecmp (name, ctxt.filename) == 0)
-	{
-	  *foundnode = grub_malloc (sizeof (struct grub_fshelp_node));
-	  if (!*foundnode)
-	    return grub_errno;
-	  (*foundnode)->attr = ctxt.dir.attr;
+      node = grub_zalloc (sizeof (struct grub_fshelp_node));
+      if (!node)
+	break;
+      node->attr = ctxt.dir.attr;
 #ifdef MODE_EXFAT
-	  (*foundnode)->file_size = ctxt.dir.file_size;
-	  (*foundnode)->file_cluster = ctxt.dir.first_cluster;
-	  (*foundnode)->is_contiguous = ctxt.dir.is_contiguous;
+      node->file_size = ctxt.dir.file_size;
+      node->file_cluster = ctxt.dir.first_cluster;
+      node->is_contiguous = ctxt.dir.is_contiguous;
 #else
-	  (*foundnode)->file_size = grub_le_to_cpu32 (ctxt.dir.file_size);
-	  (*foundnode)->file_cluster = ((grub_le_to_cpu16 (ctxt.dir.first_cluster_high) << 16)
-				| grub_le_to_cpu16 (ctxt.dir.first_cluster_low));
-	  /* If directory points to root, starting cluster is 0 */
-	  if (!(*foundnode)->file_cluster)
-	    (*foundnode)->file_cluster = node->data->root_cluster;
+      node->file_size = grub_le_to_cpu32 (ctxt.dir.file_size);
+      node->file_cluster = ((grub_le_to_cpu16 (ctxt.dir.first_cluster_high) << 16)
+			    | grub_le_to_cpu16 (ctxt.dir.first_cluster_low));
+      /* If directory points to root, starting cluster is 0 */
+      if (!node->file_cluster)
+	node->file_cluster = dir->data->root_cluster;
 #endif
-	  (*foundnode)->cur_cluster_num = ~0U;
-	  (*foundnode)->data = node->data;
-	  (*foundnode)->disk = node->disk;
+      node->cur_cluster_num = ~0U;
+      node->data = dir->data;
+      node->disk = dir->disk;
 
-	  *foundtype = ((*foundnode)->attr & GRUB_FAT_ATTR_DIRECTORY) ? GRUB_FSHELP_DIR : GRUB_FSHELP_REG;
-
-	  grub_fat_iterate_fini (&ctxt);
-	  return GRUB_ERR_NONE;
+      type = (node->attr & GRUB_FAT_ATTR_DIRECTORY) ? GRUB_FSHELP_DIR : GRUB_FSHELP_REG;
+      if (hook (ctxt.filename, type | GRUB_FSHELP_CASE_INSENSITIVE,
+		node, hook_data))
+	{
+	  ret = 1;
+	  break;
 	}
     }
 
   grub_fat_iterate_fini (&ctxt);
   if (err == GRUB_ERR_EOF)
-    err = 0;
-
-  return err;
+    grub_errno = GRUB_ERR_NONE;
 
+  return ret;
 }
 
 static grub_err_t
@@ -1001,7 +1338,8 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
 #endif
   };
 
-  err = grub_fshelp_find_file_lookup (path, &root, &found, lookup_file, NULL, GRUB_FSHELP_DIR);
+  err = grub_fshelp_find_file_cached (path, &root, &found, grub_fat_iterate_dir,
+				      NULL, GRUB_FSHELP_DIR, disk, &grub_fat_cache_ops);
   if (err)
     goto fail;
 
@@ -1075,10 +1413,12 @@ grub_fat_open (grub_file_t file, const char *name)
 #endif
   };
 
-  err = grub_fshelp_find_file_lookup (name, &root, &found, lookup_file, NULL, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &root, &found, grub_fat_iterate_dir,
+				      NULL, GRUB_FSHELP_REG, disk, &grub_fat_cache_ops);
   if (err)
     goto fail;
 
+  found->use_runs = 1;
   file->data = found;
   file->size = found->file_size;
 
@@ -1104,11 +1444,57 @@ grub_fat_read (grub_file_t file, char *buf, grub_size_t len)
 			     file->offset, len, buf);
 }
 
+static grub_err_t
+grub_fat_map (grub_file_t file, grub_off_t offset,
+	      struct grub_fs_block *block)
+{
+  grub_fshelp_node_t node = file->data;
+  unsigned logical_cluster_bits = (node->data->cluster_bits
+				   + GRUB_DISK_SECTOR_BITS);
+  struct grub_fat_run *run;
+  grub_disk_addr_t sector;
+  grub_uint64_t run_offset;
+
+  if (offset >= node->file_size)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE,
+		       N_("attempt to read past the end of file"));
+
+#ifdef MODE_EXFAT
+  if (node->is_contiguous)
+    {
+      sector = (node->data->cluster_sector
+		+ ((grub_disk_addr_t) (node->file_cluster - 2)
+		   << node->data->cluster_bits));
+      block->offset = (sector << GRUB_DISK_SECTOR_BITS) + offset;
+      block->length = node->file_size - offset;
+      return GRUB_ERR_NONE;
+    }
+#endif
+
+  run = grub_fat_find_run (node->disk, node, offset >> logical_cluster_bits);
+  if (! run)
+    return grub_errno ? : grub_error (GRUB_ERR_BAD_FS,
+				      "cluster chain is too short");
+
+  run_offset = offset - ((grub_uint64_t) run->logical << logical_cluster_bits);
+  sector = (node->data->cluster_sector
+	    + ((grub_disk_addr_t) (run->cluster - 2)
+	       << node->data->cluster_bits));
+  block->offset = (sector << GRUB_DISK_SECTOR_BITS) + run_offset;
+  block->length = ((grub_uint64_t) run->count << logical_cluster_bits)
+    - run_offset;
+  if (block->length > node->file_size - offset)
+    block->length = node->file_size - offset;
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_fat_close (grub_file_t file)
 {
   grub_fshelp_node_t node = file->data;
 
+  grub_free (node->runs);
   grub_free (node->data);
   grub_free (node);
 
@@ -1282,6 +1668,14 @@ grub_disk_addr_t
 }
 #endif
 
+#ifdef MODE_EXFAT
+static const struct grub_fs_signature grub_exfat_signatures[] =
+  {
+    { 3, 8, "EXFAT   " },
+    { 0, 0, 0 }
+  };
+#endif
+
 static struct grub_fs grub_fat_fs =
   {
 #ifdef MODE_EXFAT
@@ -1295,6 +1689,7 @@ static struct grub_fs grub_fat_fs =
     .fs_close = grub_fat_close,
     .fs_label = grub_fat_label,
     .fs_uuid = grub_fat_uuid,
+    .fs_map = grub_fat_map,
 #ifdef GRUB_UTIL
 #ifdef MODE_EXFAT
     /* ExFAT BPB is 30 larger than FAT32 one.  */
@@ -1305,6 +1700,9 @@ static struct grub_fs grub_fat_fs =
     .blocklist_install = 1,
 #endif
     .fast_blocklist = 1,
+#ifdef MODE_EXFAT
+    .signatures = grub_exfat_signatures,
+#endif
     .next = 0
   };
 
@@ -25,6 +25,8 @@
 #include <grub/dl.h>
 #include <grub/i18n.h>
 #include <grub/env.h>
+#include <grub/fs.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -55,8 +57,205 @@ struct grub_fshelp_find_file_ctx
 
   /* Current file being traversed and its parents.  */
   struct stack_element *currnode;
+
+  /* Directory entry cache, if the filesystem supports it.  */
+  grub_disk_t disk;
+  const struct grub_fshelp_cache_ops *cache;
+};
+
+/* Directory entry cache, shared by all filesystems using
+   grub_fshelp_find_file_cached.  */
+#define DCACHE_SETS	64
+#define DCACHE_WAYS	4
+#define DCACHE_NAME_LEN	48
+
+struct dcache_entry
+{
+  const struct grub_fshelp_cache_ops *cache;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_uint64_t dir;
+  int case_insensitive;
+  char name[DCACHE_NAME_LEN];
+
+  /* The node NAME resolved to, or NULL if it does not exist.  */
+  grub_fshelp_node_t node;
+  enum grub_fshelp_filetype type;
+  int valid;
+};
+
+static struct dcache_entry dcache[DCACHE_SETS][DCACHE_WAYS];
+static unsigned dcache_next[DCACHE_SETS];
+static grub_uint32_t dcache_generation;
+
+/* Name index of whole directories, for filesystems which set
+   INDEX_DIRS in their cache operations.  Directories with fewer
+   entries than DINDEX_MIN_ENTRIES are not worth keeping, and those
+   with more than DINDEX_MAX_ENTRIES are always scanned.  */
+#define DINDEX_DIRS		4
+#define DINDEX_MIN_ENTRIES	32
+#define DINDEX_MAX_ENTRIES	16384
+
+struct dindex_entry
+{
+  struct dindex_entry *next;
+  grub_fshelp_node_t node;
+  enum grub_fshelp_filetype type;
+  char name[0];
+};
+
+struct dindex
+{
+  const struct grub_fshelp_cache_ops *cache;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_uint64_t dir;
+  grub_uint32_t last_use;
+
+  /* Number of hash buckets, a power of 2, or 0 if the directory is
+     too big to be indexed.  */
+  grub_size_t size;
+  struct dindex_entry **buckets;
+  int valid;
 };
 
+static struct dindex dindex[DINDEX_DIRS];
+static grub_uint32_t dindex_clock;
+
+static void
+dindex_free_list (struct dindex_entry *e)
+{
+  struct dindex_entry *next;
+
+  for (; e; e = next)
+    {
+      next = e->next;
+      grub_free (e->node);
+      grub_free (e);
+    }
+}
+
+static void
+dindex_free (struct dindex *d)
+{
+  grub_size_t i;
+
+  for (i = 0; i < d->size; i++)
+    dindex_free_list (d->buckets[i]);
+  grub_free (d->buckets);
+  d->buckets = 0;
+  d->size = 0;
+  d->valid = 0;
+}
+
+static void
+dcache_flush (void)
+{
+  unsigned i, j;
+
+  for (i = 0; i < DCACHE_SETS; i++)
+    for (j = 0; j < DCACHE_WAYS; j++)
+      {
+	grub_free (dcache[i][j].node);
+	dcache[i][j].node = 0;
+	dcache[i][j].valid = 0;
+      }
+}
+
+/* Drop everything cached if grub_fs_cache_flush was called since the
+   last lookup.  */
+static void
+cache_check_generation (void)
+{
+  unsigned i;
+
+  if (dcache_generation == grub_fs_cache_generation)
+    return;
+
+  dcache_flush ();
+  for (i = 0; i < DINDEX_DIRS; i++)
+    dindex_free (&dindex[i]);
+  dcache_generation = grub_fs_cache_generation;
+}
+
+static unsigned
+dcache_set (grub_disk_addr_t start, grub_uint64_t dir, const char *name)
+{
+  grub_uint32_t h = (grub_uint32_t) (start ^ (dir * 31));
+
+  while (*name)
+    h = h * 33 + (grub_uint8_t) *name++;
+
+  return h % DCACHE_SETS;
+}
+
+/* Look NAME up in the directory entry cache, storing the set it
+   belongs to in SET.  */
+static struct dcache_entry *
+dcache_find (struct grub_fshelp_find_file_ctx *ctx, grub_uint64_t dir,
+	     const char *name, int case_insensitive, unsigned *set)
+{
+  grub_disk_addr_t start = grub_partition_get_start (ctx->disk->partition);
+  unsigned i;
+
+  cache_check_generation ();
+
+  *set = dcache_set (start, dir, name);
+  for (i = 0; i < DCACHE_WAYS; i++)
+    {
+      struct dcache_entry *e = &dcache[*set][i];
+
+      if (e->valid
+	  && e->cache == ctx->cache
+	  && e->dir == dir
+	  && e->start == start
+	  && e->dev_id == ctx->disk->dev->id
+	  && e->disk_id == ctx->disk->id
+	  && e->case_insensitive == case_insensitive
+	  && grub_strcmp (e->name, name) == 0)
+	return e;
+    }
+
+  return 0;
+}
+
+/* Remember that NAME in DIR resolved to NODE, which may be NULL.  */
+static void
+dcache_store (struct grub_fshelp_find_file_ctx *ctx, unsigned set,
+	      grub_uint64_t dir, const char *name, int case_insensitive,
+	      grub_fshelp_node_t node, enum grub_fshelp_filetype type)
+{
+  struct dcache_entry *e;
+  grub_fshelp_node_t copy = 0;
+
+  if (node)
+    {
+      copy = ctx->cache->dup_node (node, ctx->currnode->node);
+      if (! copy)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+    }
+
+  e = &dcache[set][dcache_next[set]];
+  dcache_next[set] = (dcache_next[set] + 1) % DCACHE_WAYS;
+
+  grub_free (e->node);
+  e->cache = ctx->cache;
+  e->dev_id = ctx->disk->dev->id;
+  e->disk_id = ctx->disk->id;
+  e->start = grub_partition_get_start (ctx->disk->partition);
+  e->dir = dir;
+  e->case_insensitive = case_insensitive;
+  grub_strcpy (e->name, name);
+  e->node = copy;
+  e->type = type;
+  e->valid = 1;
+}
+
 /* Helper for find_file_iter.  */
 static void
 free_node (grub_fshelp_node_t node, struct grub_fshelp_find_file_ctx *ctx)
@@ -163,6 +362,327 @@ directory_find_file (grub_fshelp_node_t node, const char *name, grub_fshelp_node
   return GRUB_ERR_NONE;
 }
 
+static grub_uint32_t
+dindex_hash (const char *name)
+{
+  grub_uint32_t h = 5381;
+
+  while (*name)
+    h = h * 33 + (grub_uint8_t) grub_tolower (*name++);
+
+  return h;
+}
+
+/* Check whether the entry E matches NAME the way find_file_iter
+   would, returning its file type or GRUB_FSHELP_UNKNOWN.  */
+static enum grub_fshelp_filetype
+dindex_match (struct dindex_entry *e, const char *name, int case_insensitive)
+{
+  enum grub_fshelp_filetype filetype = e->type;
+
+  if (case_insensitive)
+    filetype |= GRUB_FSHELP_CASE_INSENSITIVE;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN
+      || ((filetype & GRUB_FSHELP_CASE_INSENSITIVE)
+	  ? grub_strcasecmp (name, e->name)
+	  : grub_strcmp (name, e->name)))
+    return GRUB_FSHELP_UNKNOWN;
+
+  return filetype;
+}
+
+struct dindex_build_ctx
+{
+  struct grub_fshelp_find_file_ctx *ctx;
+  /* Entries read so far, last one first.  */
+  struct dindex_entry *list;
+  grub_size_t count;
+  int too_big;
+  int failed;
+};
+
+/* Helper for dindex_find_file.  */
+static int
+dindex_build_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		   grub_fshelp_node_t node, void *data)
+{
+  struct dindex_build_ctx *b = data;
+  struct dindex_entry *e;
+  grub_size_t len;
+
+  /* find_file handles these itself.  */
+  if (grub_strcmp (filename, ".") == 0 || grub_strcmp (filename, "..") == 0)
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  if (b->count == DINDEX_MAX_ENTRIES)
+    {
+      grub_free (node);
+      b->too_big = 1;
+      return 1;
+    }
+
+  len = grub_strlen (filename);
+  e = grub_malloc (sizeof (*e) + len + 1);
+  if (e)
+    e->node = b->ctx->cache->dup_node (node, b->ctx->currnode->node);
+  grub_free (node);
+  if (! e || ! e->node)
+    {
+      grub_free (e);
+      grub_errno = GRUB_ERR_NONE;
+      b->failed = 1;
+      return 1;
+    }
+
+  e->type = filetype;
+  grub_memcpy (e->name, filename, len + 1);
+  e->next = b->list;
+  b->list = e;
+  b->count++;
+  return 0;
+}
+
+/* Look NAME up in the index of directory DIR, reading the directory
+   into a new index first if there is none.  Set *INDEXED to 0 if the
+   directory cannot be indexed and has to be scanned instead.  */
+static grub_err_t
+dindex_find_file (struct grub_fshelp_find_file_ctx *ctx, grub_uint64_t dir,
+		  const char *name, int case_insensitive,
+		  grub_fshelp_node_t *foundnode,
+		  enum grub_fshelp_filetype *foundtype,
+		  iterate_dir_func iterate_dir, int *indexed)
+{
+  grub_disk_addr_t start = grub_partition_get_start (ctx->disk->partition);
+  struct dindex_build_ctx b = { .ctx = ctx };
+  struct dindex *d = 0;
+  struct dindex_entry *e, *next, *found = 0;
+  enum grub_fshelp_filetype type, ftype = GRUB_FSHELP_UNKNOWN;
+  grub_size_t size;
+  unsigned i;
+
+  *indexed = 0;
+  cache_check_generation ();
+
+  for (i = 0; i < DINDEX_DIRS; i++)
+    if (dindex[i].valid
+	&& dindex[i].cache == ctx->cache
+	&& dindex[i].dir == dir
+	&& dindex[i].start == start
+	&& dindex[i].dev_id == ctx->disk->dev->id
+	&& dindex[i].disk_id == ctx->disk->id)
+      {
+	d = &dindex[i];
+	break;
+      }
+
+  if (d)
+    {
+      d->last_use = ++dindex_clock;
+      if (! d->size)
+	return GRUB_ERR_NONE;
+
+      *indexed = 1;
+      for (e = d->buckets[dindex_hash (name) & (d->size - 1)]; e; e = e->next)
+	{
+	  type = dindex_match (e, name, case_insensitive);
+	  if (type == GRUB_FSHELP_UNKNOWN)
+	    continue;
+	  *foundnode = ctx->cache->dup_node (e->node, ctx->currnode->node);
+	  if (! *foundnode)
+	    return grub_errno;
+	  *foundtype = type;
+	  break;
+	}
+      return GRUB_ERR_NONE;
+    }
+
+  iterate_dir (ctx->currnode->node, dindex_build_iter, &b);
+  if (grub_errno)
+    {
+      dindex_free_list (b.list);
+      return grub_errno;
+    }
+  if (b.failed)
+    {
+      dindex_free_list (b.list);
+      return GRUB_ERR_NONE;
+    }
+
+  for (i = 0; i < DINDEX_DIRS; i++)
+    if (! d || ! dindex[i].valid
+	|| (d->valid && dindex[i].last_use < d->last_use))
+      d = &dindex[i];
+
+  if (b.too_big)
+    {
+      dindex_free_list (b.list);
+      dindex_free (d);
+      size = 0;
+    }
+  else
+    {
+      /* The list is in reverse directory order, so the last match is
+	 the one a scan would have found.  */
+      for (e = b.list; e; e = e->next)
+	{
+	  type = dindex_match (e, name, case_insensitive);
+	  if (type != GRUB_FSHELP_UNKNOWN)
+	    {
+	      found = e;
+	      ftype = type;
+	    }
+	}
+
+      *indexed = 1;
+      if (b.count < DINDEX_MIN_ENTRIES)
+	{
+	  /* Entries were bound to this mount, hand over the match.  */
+	  if (found)
+	    {
+	      *foundnode = found->node;
+	      *foundtype = ftype;
+	      found->node = 0;
+	    }
+	  dindex_free_list (b.list);
+	  return GRUB_ERR_NONE;
+	}
+
+      if (found)
+	{
+	  *foundnode = ctx->cache->dup_node (found->node, ctx->currnode->node);
+	  if (! *foundnode)
+	    {
+	      dindex_free_list (b.list);
+	      return grub_errno;
+	    }
+	  *foundtype = ftype;
+	}
+
+      dindex_free (d);
+      for (size = 16; size < b.count; size <<= 1);
+      d->buckets = grub_zalloc (size * sizeof (d->buckets[0]));
+      if (! d->buckets)
+	{
+	  dindex_free_list (b.list);
+	  grub_errno = GRUB_ERR_NONE;
+	  return GRUB_ERR_NONE;
+	}
+
+      /* Pushing the entries in reverse order keeps every bucket in
+	 directory order.  */
+      for (e = b.list; e; e = next)
+	{
+	  grub_size_t h = dindex_hash (e->name) & (size - 1);
+
+	  next = e->next;
+	  e->next = d->buckets[h];
+	  d->buckets[h] = e;
+	}
+    }
+
+  d->cache = ctx->cache;
+  d->dev_id = ctx->disk->dev->id;
+  d->disk_id = ctx->disk->id;
+  d->start = start;
+  d->dir = dir;
+  d->size = size;
+  d->last_use = ++dindex_clock;
+  d->valid = 1;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Find NAME in the current directory of CTX, going through the
+   directory entry cache and the directory index if there are any.  */
+/* Return whether NAME has a letter, which a case-insensitive comparison
+   would match in either case.  */
+static int
+has_letters (const char *name)
+{
+  for (; *name; name++)
+    if (grub_isalpha (*name))
+      return 1;
+  return 0;
+}
+
+static grub_err_t
+find_in_dir (struct grub_fshelp_find_file_ctx *ctx, const char *name,
+	     grub_fshelp_node_t *foundnode,
+	     enum grub_fshelp_filetype *foundtype,
+	     iterate_dir_func iterate_dir, lookup_file_func lookup_file)
+{
+  grub_fshelp_node_t dir = ctx->currnode->node;
+  struct dcache_entry *e;
+  const char *case_sensitive;
+  int case_insensitive = 0;
+  grub_uint64_t key = 0;
+  unsigned set = 0;
+  grub_err_t err;
+
+  case_sensitive = grub_env_get ("grub_fs_case_sensitive");
+  case_insensitive = (! case_sensitive || case_sensitive[0] != '1');
+  if (ctx->cache)
+    key = ctx->cache->dir_key (dir);
+
+  if (ctx->cache && grub_strlen (name) < DCACHE_NAME_LEN)
+    {
+      e = dcache_find (ctx, key, name, case_insensitive, &set);
+      if (e)
+	{
+	  if (! e->node)
+	    return GRUB_ERR_NONE;
+
+	  *foundnode = ctx->cache->dup_node (e->node, dir);
+	  if (! *foundnode)
+	    return grub_errno;
+	  *foundtype = e->type;
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  if (lookup_file)
+    {
+      err = lookup_file (dir, name, foundnode, foundtype);
+
+      /* With ITERATE_DIR as well, LOOKUP_FILE only finds exact
+	 spellings, and may not handle every kind of directory.  Names are
+	 folded in ASCII only, so a name without letters has no other
+	 spelling.  */
+      if (iterate_dir && err == GRUB_ERR_NOT_IMPLEMENTED_YET)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  err = GRUB_ERR_NONE;
+	}
+      else if (! iterate_dir || err || *foundnode || ! case_insensitive
+	       || ! has_letters (name))
+	iterate_dir = 0;
+    }
+
+  if (iterate_dir)
+    {
+      int indexed = 0;
+
+      err = GRUB_ERR_NONE;
+      if (ctx->cache && ctx->cache->index_dirs)
+	err = dindex_find_file (ctx, key, name, case_insensitive,
+				foundnode, foundtype, iterate_dir, &indexed);
+      if (! err && ! indexed)
+	err = directory_find_file (dir, name, foundnode, foundtype,
+				   iterate_dir);
+    }
+
+  if (ctx->cache && grub_strlen (name) < DCACHE_NAME_LEN
+      && err == GRUB_ERR_NONE && grub_errno == GRUB_ERR_NONE)
+    dcache_store (ctx, set, key, name, case_insensitive,
+		  *foundnode, *foundtype);
+
+  return err;
+}
+
 static grub_err_t
 find_file (char *currpath,
 	   iterate_dir_func iterate_dir, lookup_file_func lookup_file,
@@ -207,10 +727,8 @@ find_file (char *currpath,
       /* Iterate over the directory.  */
       c = *next;
       *next = '\0';
-      if (lookup_file)
-	err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
-      else
-	err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+      err = find_in_dir (ctx, name, &foundnode, &foundtype,
+			 iterate_dir, lookup_file);
       *next = c;
 
       if (err)
@@ -269,13 +787,17 @@ grub_fshelp_find_file_real (const char *path, grub_fshelp_node_t rootnode,
 			    iterate_dir_func iterate_dir,
 			    lookup_file_func lookup_file,
 			    read_symlink_func read_symlink,
-			    enum grub_fshelp_filetype expecttype)
+			    enum grub_fshelp_filetype expecttype,
+			    grub_disk_t disk,
+			    const struct grub_fshelp_cache_ops *cache)
 {
   struct grub_fshelp_find_file_ctx ctx = {
     .path = path,
     .rootnode = rootnode,
     .symlinknest = 0,
-    .currnode = 0
+    .currnode = 0,
+    .disk = disk,
+    .cache = disk ? cache : 0
   };
   grub_err_t err;
   enum grub_fshelp_filetype foundtype;
@@ -332,7 +854,7 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     iterate_dir, NULL, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
@@ -345,27 +867,91 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     NULL, lookup_file, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      iterate_dir_func iterate_dir,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype,
+			      grub_disk_t disk,
+			      const struct grub_fshelp_cache_ops *cache)
+{
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir, NULL, read_symlink,
+				     expecttype, disk, cache);
+}
+
+grub_err_t
+grub_fshelp_find_file_lookup_cached (const char *path,
+				     grub_fshelp_node_t rootnode,
+				     grub_fshelp_node_t *foundnode,
+				     iterate_dir_func iterate_dir,
+				     lookup_file_func lookup_file,
+				     read_symlink_func read_symlink,
+				     enum grub_fshelp_filetype expecttype,
+				     grub_disk_t disk,
+				     const struct grub_fshelp_cache_ops *cache)
+{
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir, lookup_file, read_symlink,
+				     expecttype, disk, cache);
+}
+
+/* A run of file blocks starting at BLOCK which are stored contiguously
+   on disk from START on, or are all sparse if START is 0.  */
+struct grub_fshelp_run
+{
+  grub_disk_addr_t block;
+  grub_disk_addr_t start;
+  grub_disk_addr_t count;
+};
+
+static grub_err_t
+grub_fshelp_map_run (grub_fshelp_node_t node, grub_disk_addr_t block,
+		     grub_fshelp_get_block_t get_block,
+		     grub_fshelp_get_extent_t get_extent,
+		     struct grub_fshelp_run *run)
+{
+  run->block = block;
+  run->count = 1;
+  if (get_extent)
+    run->start = get_extent (node, block, &run->count);
+  else
+    run->start = get_block (node, block);
+
+  if (! run->count)
+    run->count = 1;
+
+  return grub_errno;
+}
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  READ_HOOK_DATA is passed through as
    the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
-   file blocks to disk blocks.  The file is FILESIZE bytes big and the
-   blocks have a size of LOG2BLOCKSIZE (in log2).  */
+   file blocks to disk blocks, GET_EXTENT, if not NULL, is used instead
+   to translate a file block together with the blocks following it.
+   Blocks which are contiguous on disk are read with one request of at
+   most DISK->max_agglomerate cache units.  The file is FILESIZE bytes
+   big and the blocks have a size of LOG2BLOCKSIZE (in log2).  */
 grub_ssize_t
-grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
-		       grub_disk_read_hook_t read_hook, void *read_hook_data, int blocklist,
-		       grub_off_t pos, grub_size_t len, char *buf,
-		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
-                                                      grub_disk_addr_t block),
-		       grub_off_t filesize, int log2blocksize,
-		       grub_disk_addr_t blocks_start)
+grub_fshelp_read_file_ex (grub_disk_t disk, grub_fshelp_node_t node,
+			  grub_disk_read_hook_t read_hook,
+			  void *read_hook_data, int blocklist,
+			  grub_off_t pos, grub_size_t len, char *buf,
+			  grub_fshelp_get_block_t get_block,
+			  grub_fshelp_get_extent_t get_extent,
+			  grub_off_t filesize, int log2blocksize,
+			  grub_disk_addr_t blocks_start)
 {
-  grub_disk_addr_t i, blockcnt;
-  int blocksize = 1 << (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  grub_disk_addr_t i, firstblock, blockcnt, count, max_count;
+  struct grub_fshelp_run cur, next;
+  int log2bytes = log2blocksize + GRUB_DISK_SECTOR_BITS;
+  int blocksize = 1 << log2bytes;
 
   if (pos > filesize)
     {
@@ -378,48 +964,77 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
   if (pos + len > filesize)
     len = filesize - pos;
 
-  blockcnt = ((len + pos) + blocksize - 1) >> (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  blockcnt = ((len + pos) + blocksize - 1) >> log2bytes;
+  firstblock = pos >> log2bytes;
 
-  for (i = pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS); i < blockcnt; i++)
-    {
-      grub_disk_addr_t blknr;
-      int blockoff = pos & (blocksize - 1);
-      int blockend = blocksize;
+  /* Don't let a single request grow above what the disk accepts.  */
+  max_count = ((grub_disk_addr_t) disk->max_agglomerate
+	       << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS)) >> log2bytes;
+  if (! max_count)
+    max_count = 1;
 
-      int skipfirst = 0;
+  next.count = 0;
+  for (i = firstblock; i < blockcnt; i += count)
+    {
+      grub_size_t skipfirst = 0;
+      grub_size_t runlen;
 
-      blknr = get_block (node, i);
-      if (grub_errno)
+      if (next.count && next.block == i)
+	cur = next;
+      else if (grub_fshelp_map_run (node, i, get_block, get_extent, &cur))
 	return -1;
+      next.count = 0;
 
-      blknr = blknr << log2blocksize;
+      /* Extend the run while the following blocks are contiguous.  */
+      count = cur.count;
+      while (i + count < blockcnt && count < max_count)
+	{
+	  if (grub_fshelp_map_run (node, i + count, get_block, get_extent,
+				   &next))
+	    return -1;
+	  if (next.start != (cur.start ? cur.start + count : 0))
+	    break;
+	  count += next.count;
+	  next.count = 0;
+	}
 
-      /* Last block.  */
-      if (i == blockcnt - 1)
+      if (count > blockcnt - i || count > max_count)
 	{
-	  blockend = (len + pos) & (blocksize - 1);
+	  grub_disk_addr_t mapped = count;
 
-	  /* The last portion is exactly blocksize.  */
-	  if (! blockend)
-	    blockend = blocksize;
+	  if (count > blockcnt - i)
+	    count = blockcnt - i;
+	  if (count > max_count)
+	    count = max_count;
+
+	  /* Remember the rest of the run for the next request.  */
+	  next.block = i + count;
+	  next.start = cur.start ? cur.start + count : 0;
+	  next.count = mapped - count;
 	}
 
+      runlen = (grub_size_t) count << log2bytes;
+
+      /* Last block.  */
+      if (i + count == blockcnt && ((len + pos) & (blocksize - 1)))
+	runlen -= blocksize - ((len + pos) & (blocksize - 1));
+
       /* First block.  */
-      if (i == (pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS)))
+      if (i == firstblock)
 	{
-	  skipfirst = blockoff;
-	  blockend -= skipfirst;
+	  skipfirst = pos & (blocksize - 1);
+	  runlen -= skipfirst;
 	}
 
       /* If the block number is 0 this block is not stored on disk but
 	 is zero filled instead.  */
-      if (blknr)
+      if (cur.start)
 	{
 	  disk->read_hook = read_hook;
 	  disk->read_hook_data = read_hook_data;
 
-	  grub_disk_read_ex (disk, blknr + blocks_start, skipfirst,
-			  blockend, buf, blocklist);
+	  grub_disk_read_ex (disk, (cur.start << log2blocksize) + blocks_start,
+			     skipfirst, runlen, buf, blocklist);
 	  disk->read_hook = 0;
 	  if (grub_errno)
 	    return -1;
@@ -427,12 +1042,71 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
       else
     {
       if (buf)
-        grub_memset (buf, 0, blockend);
+        grub_memset (buf, 0, runlen);
     }
 
       if (buf)
-        buf += blocksize - skipfirst;
+        buf += runlen;
     }
 
   return len;
 }
+
+grub_err_t
+grub_fshelp_map_file (grub_disk_t disk __attribute__ ((unused)),
+		      grub_fshelp_node_t node, grub_off_t pos,
+		      struct grub_fs_block *block,
+		      grub_fshelp_get_block_t get_block,
+		      grub_fshelp_get_extent_t get_extent,
+		      grub_off_t filesize, int log2blocksize,
+		      grub_disk_addr_t blocks_start)
+{
+  int log2bytes = log2blocksize + GRUB_DISK_SECTOR_BITS;
+  grub_off_t skip = pos & ((1 << log2bytes) - 1);
+  grub_disk_addr_t i, last, count;
+  struct grub_fshelp_run cur, next;
+
+  if (pos >= filesize)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE,
+		       N_("attempt to read past the end of file"));
+
+  i = pos >> log2bytes;
+  last = (filesize + (1 << log2bytes) - 1) >> log2bytes;
+
+  if (grub_fshelp_map_run (node, i, get_block, get_extent, &cur))
+    return grub_errno;
+  if (! cur.start)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, "sparse file");
+
+  for (count = cur.count; i + count < last; count += next.count)
+    {
+      if (grub_fshelp_map_run (node, i + count, get_block, get_extent, &next))
+	return grub_errno;
+      if (next.start != cur.start + count)
+	break;
+    }
+  if (count > last - i)
+    count = last - i;
+
+  block->offset = ((((cur.start << log2blocksize) + blocks_start)
+		    << GRUB_DISK_SECTOR_BITS) + skip);
+  block->length = (count << log2bytes) - skip;
+  if (block->length > filesize - pos)
+    block->length = filesize - pos;
+
+  return GRUB_ERR_NONE;
+}
+
+grub_ssize_t
+grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
+		       grub_disk_read_hook_t read_hook, void *read_hook_data, int blocklist,
+		       grub_off_t pos, grub_size_t len, char *buf,
+		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+                                                      grub_disk_addr_t block),
+		       grub_off_t filesize, int log2blocksize,
+		       grub_disk_addr_t blocks_start)
+{
+  return grub_fshelp_read_file_ex (disk, node, read_hook, read_hook_data,
+				   blocklist, pos, len, buf, get_block, NULL,
+				   filesize, log2blocksize, blocks_start);
+}
@@ -1103,6 +1103,15 @@ grub_hfsplus_uuid (grub_device_t device, char **uuid)
 
 
 
+static const struct grub_fs_signature grub_hfsplus_signatures[] =
+  {
+    { GRUB_HFSPLUS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "H+" },
+    { GRUB_HFSPLUS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "HX" },
+    /* HFS wrapper, possibly with an embedded HFS+ volume.  */
+    { GRUB_HFSPLUS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "BD" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_hfsplus_fs =
   {
     .name = "hfsplus",
@@ -1117,6 +1126,7 @@ static struct grub_fs grub_hfsplus_fs =
     .reserved_first_sector = 1,
     .blocklist_install = 1,
 #endif
+    .signatures = grub_hfsplus_signatures,
     .next = 0
   };
 
@@ -57,6 +57,8 @@ struct grub_fshelp_node
   struct grub_iso9660_data *data;
   grub_size_t have_dirents, alloc_dirents;
   int have_symlink;
+  /* Where the first directory record of the node was read from.  */
+  grub_uint64_t dirent_pos, dirent_offset;
   struct grub_iso9660_dir dirents[8];
   char symlink[0];
 };
@@ -414,6 +416,52 @@ get_node_size (grub_fshelp_node_t node)
   return ret;
 }
 
+static grub_uint64_t
+grub_iso9660_dir_key (grub_fshelp_node_t dir)
+{
+  return grub_le_to_cpu32 (dir->dirents[0].first_sector);
+}
+
+static grub_fshelp_node_t
+grub_iso9660_dup_node (grub_fshelp_node_t node, grub_fshelp_node_t dir)
+{
+  grub_fshelp_node_t copy;
+  grub_size_t sz = sizeof (*node);
+
+  if (node->have_dirents > ARRAY_SIZE (node->dirents))
+    sz += ((node->have_dirents - ARRAY_SIZE (node->dirents))
+	   * sizeof (node->dirents[0]));
+  if (node->have_symlink)
+    {
+      const char *symlink = (node->symlink
+			     + node->have_dirents * sizeof (node->dirents[0])
+			     - sizeof (node->dirents));
+      grub_size_t end = (symlink - (const char *) node)
+	+ grub_strlen (symlink) + 1;
+
+      if (end > sz)
+	sz = end;
+    }
+
+  copy = grub_malloc (sz);
+  if (!copy)
+    return 0;
+  grub_memcpy (copy, node, sz);
+  copy->data = dir->data;
+  copy->alloc_dirents = (sz - sizeof (*node)) / sizeof (node->dirents[0])
+    + ARRAY_SIZE (node->dirents);
+  return copy;
+}
+
+/* Directories on CDs are unsorted and every name may need a Rock Ridge
+   or Joliet conversion, so have large ones indexed.  */
+static const struct grub_fshelp_cache_ops grub_iso9660_cache_ops =
+  {
+    .dir_key = grub_iso9660_dir_key,
+    .dup_node = grub_iso9660_dup_node,
+    .index_dirs = 1
+  };
+
 struct iterate_dir_ctx
 {
   char *filename;
@@ -645,6 +693,8 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 	/* Setup a new node.  */
 	node->data = dir->data;
 	node->have_symlink = 0;
+	node->dirent_pos = g_iso_last_read_dirent_pos;
+	node->dirent_offset = g_iso_last_read_dirent_offset;
 
 	/* If the filetype was not stored using rockridge, use
 	   whatever is stored in the iso9660 filesystem.  */
@@ -827,11 +877,12 @@ grub_iso9660_dir (grub_device_t device, const char *path,
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (path, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_cached (path, &rootnode,
+				    &foundnode,
+				    grub_iso9660_iterate_dir,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_DIR, data->disk,
+				    &grub_iso9660_cache_ops))
     goto fail;
 
   /* List the files in the directory.  */
@@ -870,13 +921,19 @@ grub_iso9660_open (struct grub_file *file, const char *name)
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (name, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_cached (name, &rootnode,
+				    &foundnode,
+				    grub_iso9660_iterate_dir,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_REG, data->disk,
+				    &grub_iso9660_cache_ops))
     goto fail;
 
+  /* The node may come from the directory index, which did not go
+     through the hook setting these.  */
+  g_iso_last_file_dirent_pos = foundnode->dirent_pos;
+  g_iso_last_file_dirent_offset = foundnode->dirent_offset;
+
   data->node = foundnode;
   file->data = data;
   file->size = get_node_size (foundnode);
@@ -913,6 +970,48 @@ grub_iso9660_read (grub_file_t file, char *buf, grub_size_t len)
 }
 
 
+static grub_err_t
+grub_iso9660_map (grub_file_t file, grub_off_t offset,
+		  struct grub_fs_block *block)
+{
+  struct grub_iso9660_data *data =
+    (struct grub_iso9660_data *) file->data;
+  struct grub_fshelp_node *node = data->node;
+  grub_off_t off = offset;
+  grub_size_t i = 0;
+
+  while (i < node->have_dirents
+	 && off >= grub_le_to_cpu32 (node->dirents[i].size))
+    {
+      off -= grub_le_to_cpu32 (node->dirents[i].size);
+      i++;
+    }
+  if (i == node->have_dirents)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "read out of range");
+
+  block->offset = ((((grub_disk_addr_t) grub_le_to_cpu32
+		     (node->dirents[i].first_sector)) << GRUB_ISO9660_LOG2_BLKSZ)
+		   << GRUB_DISK_SECTOR_BITS) + off;
+  block->length = grub_le_to_cpu32 (node->dirents[i].size) - off;
+
+  /* Extents of large files usually follow each other.  */
+  for (i++; i < node->have_dirents; i++)
+    {
+      grub_disk_addr_t start = (((grub_disk_addr_t) grub_le_to_cpu32
+				 (node->dirents[i].first_sector))
+				<< GRUB_ISO9660_LOG2_BLKSZ) << GRUB_DISK_SECTOR_BITS;
+
+      if (start != block->offset + block->length)
+	break;
+      block->length += grub_le_to_cpu32 (node->dirents[i].size);
+    }
+
+  if (block->length > file->size - offset)
+    block->length = file->size - offset;
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_iso9660_close (grub_file_t file)
 {
@@ -1049,6 +1148,13 @@ grub_iso9660_get_last_file_dirent_pos(grub_file_t file __attribute__ ((unused)))
           + g_iso_last_file_dirent_offset;
 }
 
+static const struct grub_fs_signature grub_iso9660_signatures[] =
+  {
+    /* First volume descriptor, in block 16.  */
+    { 16 * 2048 + 1, 5, "CD001" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_iso9660_fs =
   {
     .name = "iso9660",
@@ -1059,11 +1165,13 @@ static struct grub_fs grub_iso9660_fs =
     .fs_label = grub_iso9660_label,
     .fs_uuid = grub_iso9660_uuid,
     .fs_mtime = grub_iso9660_mtime,
+    .fs_map = grub_iso9660_map,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
 #endif
     .fast_blocklist = 1,
+    .signatures = grub_iso9660_signatures,
     .next = 0
   };
 
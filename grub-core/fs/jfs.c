@@ -935,6 +935,12 @@ grub_jfs_label (grub_device_t device, char **label)
 }
 
 
+static const struct grub_fs_signature grub_jfs_signatures[] =
+  {
+    { GRUB_JFS_SBLOCK << GRUB_DISK_SECTOR_BITS, 4, "JFS1" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_jfs_fs =
   {
     .name = "jfs",
@@ -949,6 +955,7 @@ static struct grub_fs grub_jfs_fs =
     .blocklist_install = 1,
 #endif
     .fast_blocklist = 1,
+    .signatures = grub_jfs_signatures,
     .next = 0
   };
 
@@ -27,6 +27,7 @@
 #include <grub/fshelp.h>
 #include <grub/ntfs.h>
 #include <grub/charset.h>
+#include <grub/safemath.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -107,7 +108,24 @@ init_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
   at->mft = mft;
   at->flags = (mft == &mft->data->mmft) ? GRUB_NTFS_AF_MMFT : 0;
   at->attr_nxt = mft->buf + u16at (mft->buf, 0x14);
-  at->attr_end = at->emft_buf = at->edat_buf = at->sbuf = NULL;
+  at->attr_end = at->emft_buf = at->edat_buf = NULL;
+  at->units = NULL;
+  at->runs = NULL;
+  at->runs_valid = 0;
+  at->num_runs = at->alloc_runs = at->run_hint = 0;
+}
+
+static void
+free_comp_units (struct grub_ntfs_attr *at)
+{
+  unsigned i;
+
+  if (!at->units)
+    return;
+  for (i = 0; i < GRUB_NTFS_COMP_CACHE_UNITS; i++)
+    grub_free (at->units[i].buf);
+  grub_free (at->units);
+  at->units = NULL;
 }
 
 static void
@@ -115,7 +133,8 @@ free_attr (struct grub_ntfs_attr *at)
 {
   grub_free (at->emft_buf);
   grub_free (at->edat_buf);
-  grub_free (at->sbuf);
+  free_comp_units (at);
+  grub_free (at->runs);
 }
 
 static grub_uint8_t *
@@ -362,6 +381,133 @@ grub_ntfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t block)
 					 ctx->curr_vcn + ctx->curr_lcn);
 }
 
+static grub_err_t
+add_run (struct grub_ntfs_attr *at, grub_disk_addr_t vcn,
+	 grub_disk_addr_t count, grub_disk_addr_t lcn)
+{
+  if (at->num_runs == at->alloc_runs)
+    {
+      struct grub_ntfs_run *runs;
+      grub_size_t sz;
+
+      if (grub_add (at->alloc_runs, at->alloc_runs / 2 + 16, &at->alloc_runs) ||
+	  grub_mul (at->alloc_runs, sizeof (at->runs[0]), &sz))
+	return grub_error (GRUB_ERR_OUT_OF_RANGE, "overflow is detected");
+
+      runs = grub_realloc (at->runs, sz);
+      if (!runs)
+	return grub_errno;
+      at->runs = runs;
+    }
+
+  at->runs[at->num_runs].vcn = vcn;
+  at->runs[at->num_runs].count = count;
+  at->runs[at->num_runs].lcn = lcn;
+  at->num_runs++;
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the whole run list of the non-resident attribute starting with
+   record PA into AT->runs.  Runs in later records of an attribute list
+   are followed by grub_ntfs_read_run_list.  */
+static grub_err_t
+decode_runs (struct grub_ntfs_attr *at, grub_uint8_t *pa)
+{
+  struct grub_ntfs_rlst cc;
+  grub_disk_addr_t nclusters;
+  int log_cs = at->mft->data->log_spc + GRUB_NTFS_BLK_SHR;
+
+  grub_memset (&cc, 0, sizeof (cc));
+  cc.attr = at;
+  cc.comp.log_spc = at->mft->data->log_spc;
+  cc.comp.disk = at->mft->data->disk;
+  cc.cur_run = pa + u16at (pa, 0x20);
+  cc.next_vcn = 0;
+  cc.curr_lcn = 0;
+
+  nclusters = (u64at (pa, 0x28) + (1 << log_cs) - 1) >> log_cs;
+  while (cc.next_vcn < nclusters)
+    {
+      if (grub_ntfs_read_run_list (&cc))
+	return grub_errno;
+      if (cc.next_vcn <= cc.curr_vcn)
+	return grub_error (GRUB_ERR_BAD_FS, "invalid run list");
+      if (add_run (at, cc.curr_vcn, cc.next_vcn - cc.curr_vcn,
+		   (cc.flags & GRUB_NTFS_RF_BLNK) ? 0 : cc.curr_lcn))
+	return grub_errno;
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* Return whether the run list of the $DATA attribute PA is available in
+   AT->runs, decoding it the first time its first record is seen.  */
+static int
+get_run_map (struct grub_ntfs_attr *at, grub_uint8_t *pa)
+{
+  if (at->runs_valid)
+    return at->runs_valid > 0;
+  if (u64at (pa, 0x10) != 0)
+    return 0;
+
+  /* Decoding may read the MFT, and so come back here for $MFT.  */
+  at->runs_valid = -1;
+  if (decode_runs (at, pa))
+    {
+      grub_dprintf ("ntfs", "couldn't decode run list: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (at->runs);
+      at->runs = NULL;
+      at->num_runs = at->alloc_runs = 0;
+      return 0;
+    }
+  at->runs_valid = 1;
+  return 1;
+}
+
+/* Map cluster BLOCK through the decoded run list, and say how many
+   clusters follow it in the same run.  */
+static grub_disk_addr_t
+grub_ntfs_read_extent (grub_fshelp_node_t node, grub_disk_addr_t block,
+		       grub_disk_addr_t *count)
+{
+  struct grub_ntfs_attr *at = ((struct grub_ntfs_rlst *) node)->attr;
+  struct grub_ntfs_run *r;
+  grub_size_t lo, hi;
+
+  /* Sequential reads almost always hit the last run or the next one.  */
+  lo = 0;
+  hi = at->num_runs;
+  if (at->run_hint < at->num_runs && at->runs[at->run_hint].vcn <= block)
+    {
+      lo = at->run_hint;
+      if (lo + 1 < at->num_runs && at->runs[lo + 1].vcn <= block)
+	lo++;
+      else
+	hi = lo + 1;
+    }
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (at->runs[mid].vcn <= block)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  if (lo >= at->num_runs || at->runs[lo].vcn > block
+      || block - at->runs[lo].vcn >= at->runs[lo].count)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "run list overflown");
+      return -1;
+    }
+
+  at->run_hint = lo;
+  r = &at->runs[lo];
+  *count = r->count - (block - r->vcn);
+  return r->lcn ? r->lcn + (block - r->vcn) : 0;
+}
+
 static grub_err_t
 read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
 	   grub_disk_addr_t ofs, grub_size_t len, int cached,
@@ -409,6 +555,17 @@ read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
 		      "ntfscomp");
     }
 
+  if (pa[0] == GRUB_NTFS_AT_DATA && !(at->flags & GRUB_NTFS_AF_GPOS)
+      && get_run_map (at, pa))
+    {
+      grub_fshelp_read_file_ex (ctx->comp.disk, (grub_fshelp_node_t) ctx,
+				read_hook, read_hook_data, blocklist, ofs, len,
+				(char *) dest, grub_ntfs_read_block,
+				grub_ntfs_read_extent, ofs + len,
+				ctx->comp.log_spc, 0);
+      return grub_errno;
+    }
+
   ctx->target_vcn = ofs >> (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc);
   while (ctx->next_vcn <= ctx->target_vcn)
     {
@@ -1101,14 +1258,45 @@ grub_ntfs_read (grub_file_t file, char *buf, grub_size_t len)
   struct grub_ntfs_file *mft;
 
   mft = &((struct grub_ntfs_data *) file->data)->cmft;
-  if (file->read_hook)
-    mft->attr.save_pos = 1;
+  /* Decompressed units must not hide the disk reads from a hook that
+     collects them; the progress hook only counts bytes.  */
+  if (file->read_hook && file->read_hook != grub_file_progress_hook)
+    free_comp_units (&mft->attr);
 
   read_attr (&mft->attr, (grub_uint8_t *) buf, file->offset, len, 1,
 	     file->read_hook, file->read_hook_data, file->blocklist);
   return (grub_errno) ? -1 : (grub_ssize_t) len;
 }
 
+static grub_err_t
+grub_ntfs_map (grub_file_t file, grub_off_t offset,
+	       struct grub_fs_block *block)
+{
+  struct grub_ntfs_data *data = file->data;
+  struct grub_ntfs_attr *at = &data->cmft.attr;
+  struct grub_ntfs_rlst cc;
+
+  /* The run list of $DATA is decoded on its first read, unless it is
+     resident or compressed.  */
+  if (! at->runs_valid)
+    read_attr (at, NULL, 0, 1, 1, 0, 0, 1);
+  if (grub_errno)
+    return grub_errno;
+  if (at->runs_valid <= 0)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "file data is resident or compressed");
+
+  grub_memset (&cc, 0, sizeof (cc));
+  cc.attr = at;
+  cc.comp.log_spc = data->log_spc;
+  cc.comp.disk = data->disk;
+
+  return grub_fshelp_map_file (data->disk, (grub_fshelp_node_t) &cc, offset,
+			       block, grub_ntfs_read_block,
+			       grub_ntfs_read_extent, file->size,
+			       data->log_spc, 0);
+}
+
 static grub_err_t
 grub_ntfs_close (grub_file_t file)
 {
@@ -1216,6 +1404,12 @@ grub_ntfs_uuid (grub_device_t device, char **uuid)
   return grub_errno;
 }
 
+static const struct grub_fs_signature grub_ntfs_signatures[] =
+  {
+    { 3, 4, "NTFS" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_ntfs_fs =
   {
     .name = "ntfs",
@@ -1225,11 +1419,13 @@ static struct grub_fs grub_ntfs_fs =
     .fs_close = grub_ntfs_close,
     .fs_label = grub_ntfs_label,
     .fs_uuid = grub_ntfs_uuid,
+    .fs_map = grub_ntfs_map,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
 #endif
     .fast_blocklist = 1,
+    .signatures = grub_ntfs_signatures,
     .next = 0
 };
 
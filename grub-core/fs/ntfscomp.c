@@ -304,131 +304,142 @@ read_block (struct grub_ntfs_rlst *ctx, grub_uint8_t *buf, grub_size_t num)
   return 0;
 }
 
+/* Decompress NUM whole compression units, the first one starting at
+   cluster VCN, into BUF.  */
 static grub_err_t
-ntfscomp (grub_uint8_t *dest, grub_disk_addr_t ofs,
-	  grub_size_t len, struct grub_ntfs_rlst *ctx)
+read_units (struct grub_ntfs_rlst *ctx, grub_uint8_t *buf,
+	    grub_disk_addr_t vcn, grub_size_t num)
 {
-  grub_err_t ret;
-  grub_disk_addr_t vcn;
-
-  if (ctx->attr->sbuf)
+  if (vcn != ctx->target_vcn)
     {
-      if ((ofs & (~(GRUB_NTFS_COM_LEN - 1))) == ctx->attr->save_pos)
+      ctx->target_vcn = vcn;
+      while (ctx->next_vcn <= ctx->target_vcn)
 	{
-	  grub_disk_addr_t n;
+	  if (grub_ntfs_read_run_list (ctx))
+	    return grub_errno;
+	}
+      ctx->comp.comp_head = ctx->comp.comp_tail = 0;
+    }
 
-	  n = GRUB_NTFS_COM_LEN - (ofs - ctx->attr->save_pos);
-	  if (n > len)
-	    n = len;
+  return read_block (ctx, buf,
+		     num << (4 - (GRUB_NTFS_LOG_COM_SEC - ctx->comp.log_spc)));
+}
 
-	  grub_memcpy (dest, ctx->attr->sbuf + ofs - ctx->attr->save_pos, n);
-	  if (grub_file_progress_hook && ctx->file)
-	    grub_file_progress_hook (0, 0, n, ctx->file);
-	  if (n == len)
-	    return 0;
+/* Return the decompressed unit at offset UNIT_OFS (cluster VCN) of the
+   attribute, decompressing it into the attribute's cache if needed.  */
+static const grub_uint8_t *
+get_unit (struct grub_ntfs_rlst *ctx, grub_disk_addr_t unit_ofs,
+	  grub_disk_addr_t vcn, grub_size_t unit_len)
+{
+  struct grub_ntfs_attr *at = ctx->attr;
+  struct grub_ntfs_comp_unit *u, *victim;
+  void *file;
+  unsigned i;
 
-	  dest += n;
-	  len -= n;
-	  ofs += n;
-	}
-    }
-  else
+  if (!at->units)
     {
-      ctx->attr->sbuf = grub_malloc (GRUB_NTFS_COM_LEN);
-      if (ctx->attr->sbuf == NULL)
-	return grub_errno;
-      ctx->attr->save_pos = 1;
+      at->units = grub_calloc (GRUB_NTFS_COMP_CACHE_UNITS,
+			       sizeof (at->units[0]));
+      if (!at->units)
+	return NULL;
     }
 
-  vcn = ctx->target_vcn = (ofs >> GRUB_NTFS_COM_LOG_LEN) * (GRUB_NTFS_COM_SEC >> ctx->comp.log_spc);
-  ctx->target_vcn &= ~0xFULL;
-  while (ctx->next_vcn <= ctx->target_vcn)
+  victim = &at->units[0];
+  for (i = 0; i < GRUB_NTFS_COMP_CACHE_UNITS; i++)
     {
-      if (grub_ntfs_read_run_list (ctx))
-	return grub_errno;
+      u = &at->units[i];
+      if (u->buf && u->ofs == unit_ofs)
+	{
+	  u->last_use = ++at->unit_clock;
+	  return u->buf;
+	}
+      if (victim->buf && (!u->buf || u->last_use < victim->last_use))
+	victim = u;
     }
 
-  ctx->comp.comp_head = ctx->comp.comp_tail = 0;
-  ctx->comp.cbuf = grub_malloc (1 << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR));
-  if (!ctx->comp.cbuf)
-    return 0;
-
-  ret = 0;
-
-  //ctx->comp.disk->read_hook = read_hook;
-  //ctx->comp.disk->read_hook_data = read_hook_data;
-
-  if ((vcn > ctx->target_vcn) &&
-      (read_block
-       (ctx, NULL, (vcn - ctx->target_vcn) >> (GRUB_NTFS_LOG_COM_SEC - ctx->comp.log_spc))))
+  if (!victim->buf)
     {
-      ret = grub_errno;
-      goto quit;
+      victim->buf = grub_malloc (unit_len);
+      if (!victim->buf)
+	return NULL;
     }
 
-  if (ofs % GRUB_NTFS_COM_LEN)
+  /* Filling the cache isn't progress of the caller's read.  */
+  file = ctx->file;
+  ctx->file = 0;
+  if (read_units (ctx, victim->buf, vcn, 1))
     {
-      grub_uint32_t t, n, o;
-      void *file = ctx->file;
-
-      ctx->file = 0;
+      ctx->file = file;
+      grub_free (victim->buf);
+      victim->buf = NULL;
+      return NULL;
+    }
+  ctx->file = file;
 
-      t = ctx->target_vcn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-      if (read_block (ctx, ctx->attr->sbuf, 1))
-	{
-	  ret = grub_errno;
-	  goto quit;
-	}
+  victim->ofs = unit_ofs;
+  victim->last_use = ++at->unit_clock;
+  return victim->buf;
+}
 
-      ctx->file = file;
+static grub_err_t
+ntfscomp (grub_uint8_t *dest, grub_disk_addr_t ofs,
+	  grub_size_t len, struct grub_ntfs_rlst *ctx)
+{
+  grub_err_t ret = GRUB_ERR_NONE;
+  int log_cs = ctx->comp.log_spc + GRUB_NTFS_BLK_SHR;
+  grub_size_t unit_len = (grub_size_t) 16 << log_cs;
 
-      ctx->attr->save_pos = t;
-
-      o = ofs % GRUB_NTFS_COM_LEN;
-      n = GRUB_NTFS_COM_LEN - o;
-      if (n > len)
-	n = len;
-      grub_memcpy (dest, &ctx->attr->sbuf[o], n);
-      if (grub_file_progress_hook && ctx->file)
-	grub_file_progress_hook (0, 0, n, ctx->file);
-      if (n == len)
-	goto quit;
-      dest += n;
-      len -= n;
-    }
+  if (ctx->comp.log_spc > GRUB_NTFS_LOG_COM_SEC)
+    return grub_error (GRUB_ERR_BAD_FS,
+		       "compression with clusters above 4 KiB");
 
-  if (read_block (ctx, dest, len / GRUB_NTFS_COM_LEN))
-    {
-      ret = grub_errno;
-      goto quit;
-    }
+  ctx->comp.comp_head = ctx->comp.comp_tail = 0;
+  ctx->comp.cbuf = grub_malloc (1 << log_cs);
+  if (!ctx->comp.cbuf)
+    return grub_errno;
 
-  dest += (len / GRUB_NTFS_COM_LEN) * GRUB_NTFS_COM_LEN;
-  len = len % GRUB_NTFS_COM_LEN;
-  if (len)
+  while (len)
     {
-      grub_uint32_t t;
-      void *file = ctx->file;
+      grub_disk_addr_t unit_ofs = ofs & ~((grub_disk_addr_t) unit_len - 1);
+      grub_disk_addr_t vcn = unit_ofs >> log_cs;
+      grub_size_t o = ofs - unit_ofs;
+      grub_size_t n;
 
-      ctx->file = 0;
-      t = ctx->target_vcn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-      if (read_block (ctx, ctx->attr->sbuf, 1))
+      if (o == 0 && len >= unit_len)
 	{
-	  ret = grub_errno;
-	  goto quit;
+	  /* Whole units are decompressed straight into DEST.  */
+	  n = len - len % unit_len;
+	  if (read_units (ctx, dest, vcn, n / unit_len))
+	    {
+	      ret = grub_errno;
+	      break;
+	    }
 	}
+      else
+	{
+	  const grub_uint8_t *u;
 
-      ctx->attr->save_pos = t;
+	  u = get_unit (ctx, unit_ofs, vcn, unit_len);
+	  if (!u)
+	    {
+	      ret = grub_errno;
+	      break;
+	    }
+	  n = unit_len - o;
+	  if (n > len)
+	    n = len;
+	  grub_memcpy (dest, u + o, n);
+	  if (grub_file_progress_hook && ctx->file)
+	    grub_file_progress_hook (0, 0, n, ctx->file);
+	}
 
-      grub_memcpy (dest, ctx->attr->sbuf, len);
-      if (grub_file_progress_hook && file)
-	grub_file_progress_hook (0, 0, len, file);
+      dest += n;
+      ofs += n;
+      len -= n;
     }
 
-quit:
-  //ctx->comp.disk->read_hook = 0;
-  if (ctx->comp.cbuf)
-    grub_free (ctx->comp.cbuf);
+  grub_free (ctx->comp.cbuf);
+  ctx->comp.cbuf = NULL;
   return ret;
 }
 
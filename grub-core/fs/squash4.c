@@ -27,6 +27,7 @@
 #include <grub/fshelp.h>
 #include <grub/deflate.h>
 #include <grub/safemath.h>
+#include <grub/partition.h>
 #include <minilzo.h>
 
 #include "xz.h"
@@ -217,6 +218,179 @@ struct grub_fshelp_node
   } stack[1];
 };
 
+/* Decompressed metadata chunks and data or fragment blocks, shared by
+   all mounts.  Both are dropped when grub_fs_cache_generation
+   changes.  */
+#define SQUASH_META_CACHE_ENTRIES	64
+#define SQUASH_BLOCK_CACHE_ENTRIES	16
+#define SQUASH_BLOCK_CACHE_BYTES	(8 << 20)
+
+struct squash_cache_entry
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  /* Where the compressed block starts on disk.  */
+  grub_uint64_t offset;
+  grub_uint64_t last_use;
+  grub_size_t size;
+  grub_size_t alloc;
+  char *buf;
+};
+
+struct squash_cache
+{
+  const char *name;
+  struct squash_cache_entry *entries;
+  unsigned nentries;
+  grub_size_t bytes;
+  grub_size_t max_bytes;
+  unsigned long hits;
+  unsigned long misses;
+};
+
+static struct squash_cache_entry meta_entries[SQUASH_META_CACHE_ENTRIES];
+static struct squash_cache_entry block_entries[SQUASH_BLOCK_CACHE_ENTRIES];
+
+static struct squash_cache meta_cache =
+  {
+    .name = "metadata",
+    .entries = meta_entries,
+    .nentries = SQUASH_META_CACHE_ENTRIES,
+    .max_bytes = SQUASH_META_CACHE_ENTRIES * SQUASH_CHUNK_SIZE
+  };
+
+static struct squash_cache block_cache =
+  {
+    .name = "block",
+    .entries = block_entries,
+    .nentries = SQUASH_BLOCK_CACHE_ENTRIES,
+    .max_bytes = SQUASH_BLOCK_CACHE_BYTES
+  };
+
+static grub_uint64_t cache_clock;
+static grub_uint32_t cache_generation;
+
+static void
+squash_cache_drop (struct squash_cache *cache, struct squash_cache_entry *e)
+{
+  cache->bytes -= e->alloc;
+  grub_free (e->buf);
+  e->buf = 0;
+}
+
+static void
+squash_cache_flush (struct squash_cache *cache)
+{
+  unsigned i;
+
+  for (i = 0; i < cache->nentries; i++)
+    if (cache->entries[i].buf)
+      squash_cache_drop (cache, &cache->entries[i]);
+}
+
+/* Return the decompressed block stored at OFFSET as CSIZE compressed
+   bytes and decompressing to at most USIZE bytes, and its size in SIZE.
+   The buffer stays valid until the next call.  */
+static const char *
+squash_cache_get (struct grub_squash_data *data, struct squash_cache *cache,
+		  grub_uint64_t offset, grub_size_t csize, grub_size_t usize,
+		  grub_size_t *size)
+{
+  grub_disk_addr_t part_start = grub_partition_get_start (data->disk->partition);
+  struct squash_cache_entry *e, *victim = 0;
+  grub_ssize_t ret;
+  char *tmp, *buf;
+  unsigned i;
+
+  if (cache_generation != grub_fs_cache_generation)
+    {
+      squash_cache_flush (&meta_cache);
+      squash_cache_flush (&block_cache);
+      cache_generation = grub_fs_cache_generation;
+    }
+
+  for (i = 0; i < cache->nentries; i++)
+    {
+      e = &cache->entries[i];
+      if (e->buf && e->offset == offset
+	  && e->part_start == part_start
+	  && e->dev_id == data->disk->dev->id
+	  && e->disk_id == data->disk->id)
+	{
+	  cache->hits++;
+	  e->last_use = ++cache_clock;
+	  *size = e->size;
+	  return e->buf;
+	}
+    }
+  cache->misses++;
+
+  tmp = grub_malloc (csize);
+  if (!tmp)
+    return NULL;
+  buf = grub_malloc (usize);
+  if (!buf)
+    {
+      grub_free (tmp);
+      return NULL;
+    }
+
+  if (grub_disk_read (data->disk, offset >> GRUB_DISK_SECTOR_BITS,
+		      offset & (GRUB_DISK_SECTOR_SIZE - 1), csize, tmp))
+    {
+      grub_free (tmp);
+      grub_free (buf);
+      return NULL;
+    }
+
+  ret = data->decompress (tmp, csize, 0, buf, usize, data);
+  grub_free (tmp);
+  if (ret < 0)
+    {
+      grub_free (buf);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+      return NULL;
+    }
+
+  /* Evict the least recently used blocks until a slot is free and
+     this one fits.  */
+  while (1)
+    {
+      struct squash_cache_entry *oldest = 0;
+
+      victim = 0;
+      for (i = 0; i < cache->nentries; i++)
+	{
+	  e = &cache->entries[i];
+	  if (!e->buf)
+	    {
+	      if (!victim)
+		victim = e;
+	    }
+	  else if (!oldest || e->last_use < oldest->last_use)
+	    oldest = e;
+	}
+      if (!oldest || (victim && cache->bytes + usize <= cache->max_bytes))
+	break;
+      squash_cache_drop (cache, oldest);
+    }
+
+  victim->dev_id = data->disk->dev->id;
+  victim->disk_id = data->disk->id;
+  victim->part_start = part_start;
+  victim->offset = offset;
+  victim->last_use = ++cache_clock;
+  victim->size = ret;
+  victim->alloc = usize;
+  victim->buf = buf;
+  cache->bytes += usize;
+
+  *size = ret;
+  return buf;
+}
+
 static grub_err_t
 read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	    grub_uint64_t chunk_start, grub_off_t offset)
@@ -255,29 +429,17 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	}
       else
 	{
-	  char *tmp;
+	  const char *chunk;
 	  grub_size_t bsize = grub_le_to_cpu16 (d) & ~SQUASH_CHUNK_FLAGS; 
-	  grub_disk_addr_t a = chunk_start + 2;
-	  tmp = grub_malloc (bsize);
-	  if (!tmp)
-	    return grub_errno;
-	  /* FIXME: buffer uncompressed data.  */
-	  err = grub_disk_read (data->disk, (a >> GRUB_DISK_SECTOR_BITS),
-				a & (GRUB_DISK_SECTOR_SIZE - 1),
-				bsize, tmp);
-	  if (err)
-	    {
-	      grub_free (tmp);
-	      return err;
-	    }
+	  grub_size_t size;
 
-	  if (data->decompress (tmp, bsize, offset,
-				buf, csize, data) < 0)
-	    {
-	      grub_free (tmp);
-	      return grub_errno;
-	    }
-	  grub_free (tmp);
+	  chunk = squash_cache_get (data, &meta_cache, chunk_start + 2, bsize,
+				    SQUASH_CHUNK_SIZE, &size);
+	  if (!chunk)
+	    return grub_errno;
+	  if (offset + csize > size)
+	    return grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	  grub_memcpy (buf, chunk + offset, csize);
 	}
       len -= csize;
       offset += csize;
@@ -651,6 +813,11 @@ make_root_node (struct grub_squash_data *data, struct grub_fshelp_node *root)
 static void
 squash_unmount (struct grub_squash_data *data)
 {
+  grub_dprintf ("squash", "%s cache: %lu hits, %lu misses; "
+		"%s cache: %lu hits, %lu misses\n",
+		meta_cache.name, meta_cache.hits, meta_cache.misses,
+		block_cache.name, block_cache.hits, block_cache.misses);
+
   if (data->xzdec)
     xz_dec_end (data->xzdec);
   grub_free (data->xzbuf);
@@ -854,32 +1021,20 @@ direct_read (struct grub_squash_data *data,
       else if (!(ino->block_sizes[i]
 	    & grub_cpu_to_le32_compile_time (SQUASH_BLOCK_UNCOMPRESSED)))
 	{
-	  char *block;
-	  grub_size_t csize;
+	  const char *block;
+	  grub_size_t csize, size;
 	  csize = grub_le_to_cpu32 (ino->block_sizes[i]) & ~SQUASH_BLOCK_FLAGS;
-	  block = grub_malloc (csize);
+	  block = squash_cache_get (data, &block_cache,
+				    ino->cumulated_block_sizes[i] + a,
+				    csize, data->blksz, &size);
 	  if (!block)
 	    return -1;
-	  err = grub_disk_read (data->disk,
-				(ino->cumulated_block_sizes[i] + a)
-				>> GRUB_DISK_SECTOR_BITS,
-				(ino->cumulated_block_sizes[i] + a)
-				& (GRUB_DISK_SECTOR_SIZE - 1),
-				csize, block);
-	  if (err)
+	  if (boff + curread > size)
 	    {
-	      grub_free (block);
+	      grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	      return -1;
 	    }
-	  if (data->decompress (block, csize, boff, buf, curread, data)
-	      != (grub_ssize_t) curread)
-	    {
-	      grub_free (block);
-	      if (!grub_errno)
-		grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
-	      return -1;
-	    }
-	  grub_free (block);
+	  grub_memcpy (buf, block + boff, curread);
 	}
       else
 	err = grub_disk_read (data->disk, 
@@ -958,32 +1113,22 @@ grub_squash_read (grub_file_t file, char *buf, grub_size_t len)
   else
     b = grub_le_to_cpu32 (ino->ino.file.offset) + off;
   
-  /* FIXME: cache uncompressed chunks.  */
   if (compressed)
     {
-      char *block;
-      block = grub_malloc (grub_le_to_cpu32 (frag.size));
+      const char *block;
+      grub_size_t size;
+
+      block = squash_cache_get (data, &block_cache, a,
+				grub_le_to_cpu32 (frag.size), data->blksz,
+				&size);
       if (!block)
 	return -1;
-      err = grub_disk_read (data->disk,
-			    a >> GRUB_DISK_SECTOR_BITS,
-			    a & (GRUB_DISK_SECTOR_SIZE - 1),
-			    grub_le_to_cpu32 (frag.size), block);
-      if (err)
-	{
-	  grub_free (block);
-	  return -1;
-	}
-      if (data->decompress (block, grub_le_to_cpu32 (frag.size),
-			    b, buf, len, data)
-	  != (grub_ssize_t) len)
+      if (b + len > size)
 	{
-	  grub_free (block);
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	  grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	  return -1;
 	}
-      grub_free (block);
+      grub_memcpy (buf, block + b, len);
     }
   else
     {
@@ -1015,6 +1160,12 @@ grub_squash_mtime (grub_device_t dev, grub_int32_t *tm)
   return GRUB_ERR_NONE;
 } 
 
+static const struct grub_fs_signature grub_squash_signatures[] =
+  {
+    { 0, 4, "hsqs" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_squash_fs =
   {
     .name = "squash4",
@@ -1027,6 +1178,7 @@ static struct grub_fs grub_squash_fs =
     .reserved_first_sector = 0,
     .blocklist_install = 0,
 #endif
+    .signatures = grub_squash_signatures,
     .next = 0
   };
 
@@ -1038,5 +1190,7 @@ GRUB_MOD_INIT(squash4)
 GRUB_MOD_FINI(squash4)
 {
   grub_fs_unregister (&grub_squash_fs);
+  squash_cache_flush (&meta_cache);
+  squash_cache_flush (&block_cache);
 }
 
@@ -60,6 +60,8 @@ struct grub_fshelp_node
 {
   struct grub_udf_data *data;
   int part_ref;
+  /* Block the file entry was read from.  */
+  grub_uint32_t icb_block;
   union
   {
     struct grub_udf_file_entry fe;
@@ -123,6 +125,7 @@ grub_udf_read_icb (struct grub_udf_data *data,
     return grub_error (GRUB_ERR_BAD_FS, "invalid fe/efe descriptor");
 
   node->part_ref = icb->block.part_ref;
+  node->icb_block = block;
   node->data = data;
   return 0;
 }
@@ -606,6 +609,61 @@ read_dstring (const grub_uint8_t *raw, grub_size_t sz)
   return read_string (raw, len, NULL);
 }
 
+static grub_uint64_t
+grub_udf_dir_key (grub_fshelp_node_t dir)
+{
+  return ((grub_uint64_t) U16 (dir->part_ref) << 32) | dir->icb_block;
+}
+
+/* Copy NODE into a buffer only as large as its file entry, which is
+   all that is ever read from a node.  */
+static grub_fshelp_node_t
+grub_udf_dup_node (grub_fshelp_node_t node, grub_fshelp_node_t dir)
+{
+  grub_fshelp_node_t copy;
+  grub_size_t sz, max = get_fshelp_size (dir->data);
+  grub_uint64_t len;
+
+  if (U16 (node->block.fe.tag.tag_ident) == GRUB_UDF_TAG_IDENT_FE)
+    {
+      sz = (char *) &node->block.fe.ext_attr[0] - (char *) node;
+      len = (grub_uint64_t) U32 (node->block.fe.ext_attr_length)
+	+ U32 (node->block.fe.alloc_descs_length);
+    }
+  else
+    {
+      sz = (char *) &node->block.efe.ext_attr[0] - (char *) node;
+      len = (grub_uint64_t) U32 (node->block.efe.ext_attr_length)
+	+ U32 (node->block.efe.alloc_descs_length);
+    }
+  /* Data stored in the ICB is read up to the file size.  */
+  if ((U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
+      == GRUB_UDF_ICBTAG_FLAG_AD_IN_ICB)
+    len = max;
+  if (len >= max - sz)
+    sz = max;
+  else
+    sz += len;
+  if (sz < sizeof (*node))
+    sz = sizeof (*node);
+
+  copy = grub_malloc (sz);
+  if (!copy)
+    return 0;
+  grub_memcpy (copy, node, sz);
+  copy->data = dir->data;
+  return copy;
+}
+
+/* UDF directories are unsorted and every entry costs a file entry read
+   and a name conversion, so have large ones indexed.  */
+static const struct grub_fshelp_cache_ops grub_udf_cache_ops =
+  {
+    .dir_key = grub_udf_dir_key,
+    .dup_node = grub_udf_dup_node,
+    .index_dirs = 1
+  };
+
 static int
 grub_udf_iterate_dir (grub_fshelp_node_t dir,
 		      grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -614,13 +672,12 @@ grub_udf_iterate_dir (grub_fshelp_node_t dir,
   struct grub_udf_file_ident dirent;
   grub_off_t offset = 0;
 
-  child = grub_malloc (get_fshelp_size (dir->data));
+  /* The current directory is not stored.  DIR may be a copy made by
+     grub_udf_dup_node, so do not read past its file entry.  */
+  child = grub_udf_dup_node (dir, dir);
   if (!child)
     return 0;
 
-  /* The current directory is not stored.  */
-  grub_memcpy (child, dir, get_fshelp_size (dir->data));
-
   if (hook (".", GRUB_FSHELP_DIR, child, hook_data))
     return 1;
 
@@ -865,10 +922,10 @@ grub_udf_dir (grub_device_t device, const char *path,
   if (grub_udf_read_icb (data, &data->root_icb, rootnode))
     goto fail;
 
-  if (grub_fshelp_find_file (path, rootnode,
-			     &foundnode,
-			     grub_udf_iterate_dir, grub_udf_read_symlink,
-			     GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_cached (path, rootnode,
+				    &foundnode,
+				    grub_udf_iterate_dir, grub_udf_read_symlink,
+				    GRUB_FSHELP_DIR, data->disk, &grub_udf_cache_ops))
     goto fail;
 
   grub_udf_iterate_dir (foundnode, grub_udf_dir_iter, &ctx);
@@ -906,12 +963,20 @@ grub_udf_open (struct grub_file *file, const char *name)
   if (grub_udf_read_icb (data, &data->root_icb, rootnode))
     goto fail;
 
-  if (grub_fshelp_find_file (name, rootnode,
-			     &foundnode,
-			     grub_udf_iterate_dir, grub_udf_read_symlink,
-			     GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_cached (name, rootnode,
+				    &foundnode,
+				    grub_udf_iterate_dir, grub_udf_read_symlink,
+				    GRUB_FSHELP_REG, data->disk, &grub_udf_cache_ops))
     goto fail;
 
+  /* The node may come from the directory index, which did not go
+     through the hook setting these.  */
+  g_last_fileattr_read_sector = foundnode->icb_block;
+  g_last_fileattr_read_sector_tag_ident = U16 (foundnode->block.fe.tag.tag_ident);
+  g_last_fileattr_offset = (grub_uint32_t)
+    ((foundnode->block.fe.ext_attr + foundnode->block.fe.ext_attr_length)
+     - (grub_uint8_t *) &(foundnode->block.fe));
+
   file->data = foundnode;
   file->offset = 0;
   file->size = U64 (foundnode->block.fe.file_size);
@@ -938,6 +1003,28 @@ grub_udf_read (grub_file_t file, char *buf, grub_size_t len)
 			     file->blocklist, file->offset, len, buf);
 }
 
+static grub_err_t
+grub_udf_map (grub_file_t file, grub_off_t offset,
+	      struct grub_fs_block *block)
+{
+  struct grub_fshelp_node *node = (struct grub_fshelp_node *) file->data;
+
+  switch (U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
+    {
+    case GRUB_UDF_ICBTAG_FLAG_AD_IN_ICB:
+      return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			 "file data is embedded in the ICB");
+
+    case GRUB_UDF_ICBTAG_FLAG_AD_EXT:
+      return grub_error (GRUB_ERR_BAD_FS, "invalid extent type");
+    }
+
+  return grub_fshelp_map_file (node->data->disk, node, offset, block,
+			       grub_udf_read_block, NULL,
+			       U64 (node->block.fe.file_size),
+			       node->data->lbshift, 0);
+}
+
 static grub_err_t
 grub_udf_close (grub_file_t file)
 {
@@ -1097,6 +1184,7 @@ static struct grub_fs grub_udf_fs = {
   .fs_dir = grub_udf_dir,
   .fs_open = grub_udf_open,
   .fs_read = grub_udf_read,
+  .fs_map = grub_udf_map,
   .fs_close = grub_udf_close,
   .fs_label = grub_udf_label,
   .fs_uuid = grub_udf_uuid,
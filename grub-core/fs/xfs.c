@@ -46,6 +46,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define	XFS_SB_VERSION_SECTORBIT	0x0800
 #define	XFS_SB_VERSION_EXTFLGBIT	0x1000
 #define	XFS_SB_VERSION_DIRV2BIT		0x2000
+#define	XFS_SB_VERSION_BORGBIT		0x4000	/* ASCII case-insensitive */
 #define XFS_SB_VERSION_MOREBITSBIT	0x8000
 #define XFS_SB_VERSION_BITS_SUPPORTED \
 	(XFS_SB_VERSION_NUMBITS | \
@@ -211,6 +212,47 @@ struct grub_xfs_dirblock_tail
   grub_uint32_t leaf_stale;
 } GRUB_PACKED;
 
+/* Hash index of block, leaf and node directories.  Node and leaf blocks
+   live from XFS_DIR2_LEAF_OFFSET on in the directory, and point at the
+   entries of the data blocks by their offset in units of 8 bytes.  */
+#define XFS_DIR2_LEAF_OFFSET_LOG	35
+#define XFS_DIR2_DATA_ALIGN_LOG		3
+
+#define XFS_DA_NODE_MAGIC	0xfebe
+#define XFS_DA3_NODE_MAGIC	0x3ebe
+#define XFS_DIR2_LEAF1_MAGIC	0xd2f1
+#define XFS_DIR3_LEAF1_MAGIC	0x3df1
+#define XFS_DIR2_LEAFN_MAGIC	0xd2ff
+#define XFS_DIR3_LEAFN_MAGIC	0x3dff
+
+/* Bounds the depth of the node tree we follow.  */
+#define XFS_DA_NODE_MAXDEPTH	5
+
+/* Hash entry of a leaf block or of the tail of a block directory.  */
+struct grub_xfs_dir2_leaf_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t address;
+} GRUB_PACKED;
+
+/* Entry of a node block, pointing at the block holding hashes up to
+   HASHVAL.  */
+struct grub_xfs_da_node_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t before;
+} GRUB_PACKED;
+
+/* Start of every node and leaf block.  Version 5 filesystems add a CRC,
+   owner and so on, which we skip.  */
+struct grub_xfs_da_blkinfo
+{
+  grub_uint32_t forw;
+  grub_uint32_t back;
+  grub_uint16_t magic;
+  grub_uint16_t pad;
+} GRUB_PACKED;
+
 struct grub_fshelp_node
 {
   struct grub_xfs_data *data;
@@ -510,14 +552,18 @@ get_fsb (const void *keys, int idx)
   return grub_be_to_cpu64 (grub_get_unaligned64 (p));
 }
 
+/* Map FILEBLOCK of NODE, and set *COUNT to how many blocks from it on
+   are mapped the same way.  */
 static grub_disk_addr_t
-grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_xfs_read_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		      grub_disk_addr_t *count)
 {
   struct grub_xfs_btree_node *leaf = 0;
   int ex, nrec;
   struct grub_xfs_extent *exts;
   grub_uint64_t ret = 0;
 
+  *count = 1;
   if (node->inode.format == XFS_INODE_FORMAT_BTREE)
     {
       struct grub_xfs_btree_root *root;
@@ -601,10 +647,14 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
       /* Sparse block.  */
       if (fileblock < offset)
-        break;
+        {
+          *count = offset - fileblock;
+          break;
+        }
       else if (fileblock < offset + size)
         {
           ret = (fileblock - offset + start);
+          *count = offset + size - fileblock;
           break;
         }
     }
@@ -614,6 +664,14 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   return GRUB_XFS_FSB_TO_BLOCK(node->data, ret);
 }
 
+static grub_disk_addr_t
+grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+{
+  grub_disk_addr_t count;
+
+  return grub_xfs_read_extent (node, fileblock, &count);
+}
+
 
 /* Read LEN bytes from the file described by DATA starting with byte
    POS.  Return the amount of read bytes in READ.  */
@@ -622,12 +680,13 @@ grub_xfs_read_file (grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data, int blocklist,
 		    grub_off_t pos, grub_size_t len, char *buf, grub_uint32_t header_size)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data, blocklist,
-				pos, len, buf, grub_xfs_read_block,
-				grub_be_to_cpu64 (node->inode.size) + header_size,
-				node->data->sblock.log2_bsize
-				- GRUB_DISK_SECTOR_BITS, 0);
+  return grub_fshelp_read_file_ex (node->data->disk, node,
+				   read_hook, read_hook_data, blocklist,
+				   pos, len, buf, grub_xfs_read_block,
+				   grub_xfs_read_extent,
+				   grub_be_to_cpu64 (node->inode.size) + header_size,
+				   node->data->sblock.log2_bsize
+				   - GRUB_DISK_SECTOR_BITS, 0);
 }
 
 
@@ -692,6 +751,297 @@ grub_xfs_mode_to_filetype (grub_uint16_t mode)
 }
 
 
+/* The name hash used by the directory index.  */
+static grub_uint32_t
+grub_xfs_da_hashname (const grub_uint8_t *name, grub_size_t namelen)
+{
+  grub_uint32_t hash;
+
+#define rol32(x, y)	(((x) << (y)) | ((x) >> (32 - (y))))
+  for (hash = 0; namelen >= 4; namelen -= 4, name += 4)
+    hash = ((grub_uint32_t) name[0] << 21) ^ ((grub_uint32_t) name[1] << 14)
+      ^ ((grub_uint32_t) name[2] << 7) ^ name[3] ^ rol32 (hash, 7 * 4);
+
+  switch (namelen)
+    {
+    case 3:
+      return ((grub_uint32_t) name[0] << 14) ^ ((grub_uint32_t) name[1] << 7)
+	^ name[2] ^ rol32 (hash, 7 * 3);
+    case 2:
+      return ((grub_uint32_t) name[0] << 7) ^ name[1] ^ rol32 (hash, 7 * 2);
+    case 1:
+      return name[0] ^ rol32 (hash, 7 * 1);
+    default:
+      return hash;
+    }
+#undef rol32
+}
+
+/* Read the directory block starting at file block DABLK of DIR, which
+   unlike grub_xfs_read_file may lie past the size of the directory.
+   Set *HOLE if it is not allocated.  */
+static grub_err_t
+grub_xfs_read_dirblk (grub_fshelp_node_t dir, grub_uint64_t dablk,
+		      char *buf, int *hole)
+{
+  struct grub_xfs_data *data = dir->data;
+  int i, n = 1 << data->sblock.log2_dirblk;
+
+  *hole = 0;
+  for (i = 0; i < n; i++)
+    {
+      grub_disk_addr_t blk;
+
+      blk = grub_xfs_read_block (dir, dablk + i);
+      if (grub_errno)
+	return grub_errno;
+      if (!blk)
+	{
+	  *hole = 1;
+	  return GRUB_ERR_NONE;
+	}
+      if (grub_disk_read (data->disk,
+			  blk << (data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
+			  0, data->bsize, buf + ((grub_size_t) i << data->sblock.log2_bsize)))
+	return grub_errno;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Index of the first of the COUNT entries of SIZE bytes at ENTS, sorted by
+   their leading big-endian hash, whose hash is not below HASH.  */
+static grub_uint32_t
+grub_xfs_hash_lower_bound (const char *ents, grub_uint32_t count,
+			   grub_size_t size, grub_uint32_t hash)
+{
+  grub_uint32_t lo = 0, hi = count;
+
+  while (lo < hi)
+    {
+      grub_uint32_t mid = lo + (hi - lo) / 2;
+      grub_uint32_t h = grub_be_to_cpu32 (grub_get_unaligned32 (ents + mid * size));
+
+      if (h < hash)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return lo;
+}
+
+/* Check whether ADDRESS from a hash entry points at NAME, reading the
+   data block it is in into DATABLK unless it is block *CUR already.  */
+static grub_err_t
+grub_xfs_check_dataptr (grub_fshelp_node_t dir, grub_uint32_t address,
+			const char *name, grub_size_t namelen,
+			char *datablk, grub_uint64_t *cur, grub_uint64_t *ino)
+{
+  struct grub_xfs_data *data = dir->data;
+  int dirblk_log2 = data->sblock.log2_bsize + data->sblock.log2_dirblk;
+  grub_uint64_t byte = (grub_uint64_t) address << XFS_DIR2_DATA_ALIGN_LOG;
+  grub_uint64_t db = byte >> dirblk_log2;
+  grub_size_t off = byte & ((1 << dirblk_log2) - 1);
+  struct grub_xfs_dir2_entry *de;
+  int hole;
+
+  if (db != *cur)
+    {
+      *cur = ~0ULL;
+      if (grub_xfs_read_dirblk (dir, db << data->sblock.log2_dirblk,
+				datablk, &hole))
+	return grub_errno;
+      if (hole)
+	return grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory entry");
+      *cur = db;
+    }
+
+  if (off + sizeof (*de) + namelen > (grub_size_t) 1 << dirblk_log2)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory entry");
+
+  de = (struct grub_xfs_dir2_entry *) (datablk + off);
+  if (de->len == namelen && grub_memcmp (de + 1, name, namelen) == 0)
+    *ino = grub_be_to_cpu64 (de->inode);
+
+  return GRUB_ERR_NONE;
+}
+
+/* Find the inode number of NAME in DIR through the hash index of its
+   block, leaf or node format, setting *INO to 0 if it is not there.  */
+static grub_err_t
+grub_xfs_hash_lookup (grub_fshelp_node_t dir, const char *name,
+		      grub_uint64_t *ino)
+{
+  struct grub_xfs_data *data = dir->data;
+  int dirblk_log2 = data->sblock.log2_bsize + data->sblock.log2_dirblk;
+  grub_size_t dirblk_size = (grub_size_t) 1 << dirblk_log2;
+  grub_size_t namelen = grub_strlen (name);
+  grub_size_t hdr = data->hascrc ? 64 : 16;
+  grub_uint32_t hash, count, i;
+  grub_uint64_t dablk, cur = ~0ULL;
+  char *blk, *datablk = 0;
+  const char *ents;
+  int hole, depth;
+
+  *ino = 0;
+  if (namelen > 255)
+    return GRUB_ERR_NONE;
+
+  hash = grub_xfs_da_hashname ((const grub_uint8_t *) name, namelen);
+
+  blk = grub_malloc (dirblk_size);
+  if (!blk)
+    return grub_errno;
+
+  dablk = 1ULL << (XFS_DIR2_LEAF_OFFSET_LOG - data->sblock.log2_bsize);
+  if (grub_xfs_read_dirblk (dir, dablk, blk, &hole))
+    goto out;
+
+  if (hole)
+    {
+      /* Block directory, with the hashes at the end of its only block.  */
+      struct grub_xfs_dirblock_tail *tail;
+
+      if (grub_xfs_read_dirblk (dir, 0, blk, &hole))
+	goto out;
+      if (hole || (grub_memcmp (blk, "XD2B", 4) && grub_memcmp (blk, "XDB3", 4)))
+	{
+	  grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, "unknown XFS directory format");
+	  goto out;
+	}
+
+      tail = grub_xfs_dir_tail (data, blk);
+      count = grub_be_to_cpu32 (tail->leaf_count);
+      if (count > (dirblk_size - hdr - sizeof (*tail))
+	  / sizeof (struct grub_xfs_dir2_leaf_entry))
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory block");
+	  goto out;
+	}
+      ents = (char *) tail - count * sizeof (struct grub_xfs_dir2_leaf_entry);
+
+      for (i = grub_xfs_hash_lower_bound (ents, count,
+					  sizeof (struct grub_xfs_dir2_leaf_entry),
+					  hash);
+	   i < count && !*ino; i++)
+	{
+	  const struct grub_xfs_dir2_leaf_entry *e
+	    = (const struct grub_xfs_dir2_leaf_entry *) ents + i;
+
+	  if (grub_be_to_cpu32 (e->hashval) != hash)
+	    break;
+	  if (!e->address)
+	    continue;
+	  /* Everything is in this one block.  */
+	  if (((grub_uint64_t) grub_be_to_cpu32 (e->address)
+	       << XFS_DIR2_DATA_ALIGN_LOG) >> dirblk_log2)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory entry");
+	      goto out;
+	    }
+	  cur = 0;
+	  if (grub_xfs_check_dataptr (dir, grub_be_to_cpu32 (e->address),
+				      name, namelen, blk, &cur, ino))
+	    goto out;
+	}
+      goto out;
+    }
+
+  /* Walk down the node blocks to the leaf holding HASH.  */
+  for (depth = 0; ; depth++)
+    {
+      struct grub_xfs_da_blkinfo *info = (struct grub_xfs_da_blkinfo *) blk;
+      grub_uint16_t magic = grub_be_to_cpu16 (info->magic);
+
+      if (magic != XFS_DA_NODE_MAGIC && magic != XFS_DA3_NODE_MAGIC)
+	break;
+
+      count = grub_be_to_cpu16 (grub_get_unaligned16 (blk + hdr - (data->hascrc ? 8 : 4)));
+      if (depth == XFS_DA_NODE_MAXDEPTH || count == 0
+	  || count > (dirblk_size - hdr) / sizeof (struct grub_xfs_da_node_entry))
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory node");
+	  goto out;
+	}
+      ents = blk + hdr;
+      i = grub_xfs_hash_lower_bound (ents, count,
+				     sizeof (struct grub_xfs_da_node_entry),
+				     hash);
+      if (i == count)
+	i--;
+      dablk = grub_be_to_cpu32 (((const struct grub_xfs_da_node_entry *) ents)[i].before);
+      if (grub_xfs_read_dirblk (dir, dablk, blk, &hole))
+	goto out;
+      if (hole)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory node");
+	  goto out;
+	}
+    }
+
+  datablk = grub_malloc (dirblk_size);
+  if (!datablk)
+    goto out;
+
+  /* Hashes may continue into the next leaf blocks.  */
+  while (1)
+    {
+      struct grub_xfs_da_blkinfo *info = (struct grub_xfs_da_blkinfo *) blk;
+      grub_uint16_t magic = grub_be_to_cpu16 (info->magic);
+
+      if (magic != XFS_DIR2_LEAF1_MAGIC && magic != XFS_DIR3_LEAF1_MAGIC
+	  && magic != XFS_DIR2_LEAFN_MAGIC && magic != XFS_DIR3_LEAFN_MAGIC)
+	{
+	  grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, "unknown XFS directory format");
+	  goto out;
+	}
+
+      count = grub_be_to_cpu16 (grub_get_unaligned16 (blk + hdr - (data->hascrc ? 8 : 4)));
+      if (count > (dirblk_size - hdr) / sizeof (struct grub_xfs_dir2_leaf_entry))
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory leaf");
+	  goto out;
+	}
+      ents = blk + hdr;
+
+      for (i = grub_xfs_hash_lower_bound (ents, count,
+					  sizeof (struct grub_xfs_dir2_leaf_entry),
+					  hash);
+	   i < count; i++)
+	{
+	  const struct grub_xfs_dir2_leaf_entry *e
+	    = (const struct grub_xfs_dir2_leaf_entry *) ents + i;
+
+	  if (grub_be_to_cpu32 (e->hashval) != hash)
+	    goto out;
+	  if (!e->address)
+	    continue;
+	  if (grub_xfs_check_dataptr (dir, grub_be_to_cpu32 (e->address),
+				      name, namelen, datablk, &cur, ino))
+	    goto out;
+	  if (*ino)
+	    goto out;
+	}
+
+      dablk = grub_be_to_cpu32 (info->forw);
+      if (!dablk || (magic != XFS_DIR2_LEAFN_MAGIC && magic != XFS_DIR3_LEAFN_MAGIC))
+	goto out;
+      if (grub_xfs_read_dirblk (dir, dablk, blk, &hole))
+	goto out;
+      if (hole)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory leaf");
+	  goto out;
+	}
+    }
+
+ out:
+  grub_free (datablk);
+  grub_free (blk);
+  return grub_errno;
+}
+
 /* Context for grub_xfs_iterate_dir.  */
 struct grub_xfs_iterate_dir_ctx
 {
@@ -895,6 +1245,48 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+/* Find NAME in DIR through the hash index of the directory, leaving the
+   short form directories stored in the inode, and the filesystems hashing
+   case-folded names, to grub_xfs_iterate_dir.  */
+static grub_err_t
+grub_xfs_lookup_file (grub_fshelp_node_t dir, const char *name,
+		      grub_fshelp_node_t *foundnode,
+		      enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_fshelp_node *fdiro;
+  grub_uint64_t ino;
+
+  if (dir->inode.format != XFS_INODE_FORMAT_EXT
+      && dir->inode.format != XFS_INODE_FORMAT_BTREE)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "XFS directory has no hash index");
+  if (dir->data->sblock.version
+      & grub_cpu_to_be16_compile_time (XFS_SB_VERSION_BORGBIT))
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "XFS case-insensitive hash is not supported");
+
+  if (grub_xfs_hash_lookup (dir, name, &ino))
+    return grub_errno;
+  if (!ino)
+    return GRUB_ERR_NONE;
+
+  fdiro = grub_malloc (grub_xfs_fshelp_size (dir->data) + 1);
+  if (!fdiro)
+    return grub_errno;
+
+  fdiro->ino = ino;
+  fdiro->inode_read = 1;
+  fdiro->data = dir->data;
+  if (grub_xfs_read_inode (dir->data, ino, &fdiro->inode))
+    {
+      grub_free (fdiro);
+      return grub_errno;
+    }
+
+  *foundnode = fdiro;
+  *foundtype = grub_xfs_mode_to_filetype (fdiro->inode.mode);
+  return GRUB_ERR_NONE;
+}
 
 static struct grub_xfs_data *
 grub_xfs_mount (grub_disk_t disk)
@@ -977,6 +1369,33 @@ grub_xfs_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
   return ctx->hook (filename, &info, ctx->hook_data);
 }
 
+static grub_uint64_t
+grub_xfs_dir_key (grub_fshelp_node_t dir)
+{
+  return dir->ino;
+}
+
+static grub_fshelp_node_t
+grub_xfs_dup_node (grub_fshelp_node_t node, grub_fshelp_node_t dir)
+{
+  struct grub_fshelp_node *copy;
+  grub_size_t sz = grub_xfs_fshelp_size (dir->data);
+
+  copy = grub_malloc (sz + 1);
+  if (! copy)
+    return 0;
+
+  grub_memcpy (copy, node, sz);
+  copy->data = dir->data;
+  return copy;
+}
+
+static const struct grub_fshelp_cache_ops grub_xfs_cache_ops =
+  {
+    .dir_key = grub_xfs_dir_key,
+    .dup_node = grub_xfs_dup_node
+  };
+
 static grub_err_t
 grub_xfs_dir (grub_device_t device, const char *path,
 	      grub_fs_dir_hook_t hook, void *hook_data)
@@ -991,8 +1410,11 @@ grub_xfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_lookup_cached (path, &data->diropen, &fdiro,
+				       grub_xfs_iterate_dir,
+				       grub_xfs_lookup_file,
+				       grub_xfs_read_symlink, GRUB_FSHELP_DIR,
+				       data->disk, &grub_xfs_cache_ops);
   if (grub_errno)
     goto fail;
 
@@ -1024,8 +1446,11 @@ grub_xfs_open (struct grub_file *file, const char *name)
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_lookup_cached (name, &data->diropen, &fdiro,
+				       grub_xfs_iterate_dir,
+				       grub_xfs_lookup_file,
+				       grub_xfs_read_symlink, GRUB_FSHELP_REG,
+				       data->disk, &grub_xfs_cache_ops);
   if (grub_errno)
     goto fail;
 
@@ -1072,6 +1497,25 @@ grub_xfs_read (grub_file_t file, char *buf, grub_size_t len)
 }
 
 
+static grub_err_t
+grub_xfs_map (grub_file_t file, grub_off_t offset,
+	      struct grub_fs_block *block)
+{
+  struct grub_xfs_data *data =
+    (struct grub_xfs_data *) file->data;
+
+  if (data->diropen.inode.format != XFS_INODE_FORMAT_EXT
+      && data->diropen.inode.format != XFS_INODE_FORMAT_BTREE)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "file data is not stored in extents");
+
+  return grub_fshelp_map_file (data->disk, &data->diropen, offset, block,
+			       grub_xfs_read_block, grub_xfs_read_extent,
+			       grub_be_to_cpu64 (data->diropen.inode.size),
+			       data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS,
+			       0);
+}
+
 static grub_err_t
 grub_xfs_close (grub_file_t file)
 {
@@ -1135,12 +1579,19 @@ grub_xfs_uuid (grub_device_t device, char **uuid)
   return grub_errno;
 }
 
+static const struct grub_fs_signature grub_xfs_signatures[] =
+  {
+    { 0, 4, "XFSB" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_xfs_fs =
   {
     .name = "xfs",
     .fs_dir = grub_xfs_dir,
     .fs_open = grub_xfs_open,
     .fs_read = grub_xfs_read,
+    .fs_map = grub_xfs_map,
     .fs_close = grub_xfs_close,
     .fs_label = grub_xfs_label,
     .fs_uuid = grub_xfs_uuid,
@@ -1149,6 +1600,7 @@ static struct grub_fs grub_xfs_fs =
     .blocklist_install = 1,
 #endif
     .fast_blocklist = 1,
+    .signatures = grub_xfs_signatures,
     .next = 0
   };
 
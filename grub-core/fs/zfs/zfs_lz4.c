@@ -36,9 +36,11 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/types.h>
+#include <grub/lz4.h>
 
 static int LZ4_uncompress_unknownOutputSize(const char *source, char *dest,
-					    int isize, int maxOutputSize);
+					    int isize, int maxOutputSize,
+					    int prefixSize);
 
 /*
  * CPU Feature Detection
@@ -150,12 +152,31 @@ lz4_decompress(void *s_start, void *d_start, grub_size_t s_len, grub_size_t d_le
 	 * and appropriate error on failure (decompression function returned negative).
 	 */
 	return (LZ4_uncompress_unknownOutputSize((char*)s_start + 4, d_start, bufsiz,
-	    d_len) < 0)?grub_error(GRUB_ERR_BAD_FS,"lz4 decompression failed."):0;
+	    d_len, 0) < 0)?grub_error(GRUB_ERR_BAD_FS,"lz4 decompression failed."):0;
 }
 
+grub_ssize_t
+grub_lz4_decompress_block(const void *src, grub_size_t s_len, void *dest,
+    grub_size_t d_len, grub_size_t prefix_len)
+{
+	int ret;
+
+	if (s_len > GRUB_INT_MAX || d_len > GRUB_INT_MAX ||
+	    prefix_len > GRUB_LZ4_MAX_DISTANCE)
+		return -1;
+
+	ret = LZ4_uncompress_unknownOutputSize(src, dest, s_len, d_len,
+	    prefix_len);
+	return (ret < 0) ? -1 : ret;
+}
+
+/*
+ * Matches may refer to up to prefixSize bytes of earlier output that
+ * precede dest, as with linked blocks of an LZ4 frame.
+ */
 static int
 LZ4_uncompress_unknownOutputSize(const char *source,
-    char *dest, int isize, int maxOutputSize)
+    char *dest, int isize, int maxOutputSize, int prefixSize)
 {
 	/* Local Variables */
 	const BYTE * ip = (const BYTE *) source;
@@ -216,7 +237,7 @@ LZ4_uncompress_unknownOutputSize(const char *source,
 		/* get offset */
 		LZ4_READ_LITTLEENDIAN_16(ref, cpy, ip);
 		ip += 2;
-		if (ref < (BYTE * const) dest)
+		if (ref < (BYTE * const) dest - prefixSize)
 			/*
 			 * Error: offset creates reference outside of
 			 * destination buffer.
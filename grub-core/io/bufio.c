@@ -142,6 +142,13 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
 
   /* Need to read some more.  */
   next_buf = (grub_divmod64 (file->offset + res + len - 1, bufio->block_size, NULL)) * bufio->block_size;
+
+  /* A request which ends on a block boundary or at the end of the file
+     leaves no unaligned tail to keep, read all of it straight into BUF.  */
+  if (((file->offset + res + len) & (bufio->block_size - 1)) == 0
+      || (file->size != GRUB_FILE_SIZE_UNKNOWN
+	  && file->offset + res + len >= file->size))
+    next_buf = file->offset + res + len;
   /* Now read between file->offset + res and bufio->buffer_at.  */
   if (file->offset + res < next_buf)
     {
@@ -170,6 +177,8 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
 	  return res;
 	}
     }
+  if (len == 0)
+    return res;
 
   /* Read into buffer.  */
   grub_file_seek (bufio->file, next_buf);
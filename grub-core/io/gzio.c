@@ -44,6 +44,9 @@
 #include <grub/deflate.h>
 #include <grub/i18n.h>
 #include <grub/crypto.h>
+#include <grub/env.h>
+#include <grub/disk.h>
+#include <grub/command.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -58,6 +61,66 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define INBUFSIZ  0x2000
 
+/* The bits decoded by the first lookup in the literal/length and the
+   distance code tables, and the room for the first level with all the
+   subtables any complete set of codes can need.  */
+#define GRUB_GZIO_LBITS		10
+#define GRUB_GZIO_DBITS		8
+#define GRUB_GZIO_LTABLE_SIZE	2560
+#define GRUB_GZIO_DTABLE_SIZE	1024
+
+/* The default distance between two inflate checkpoints, and the most
+   checkpoints kept for one file.  When the index is full the distance
+   is doubled and every other checkpoint is dropped.  */
+#define GRUB_GZIO_INDEX_INTERVAL	0x100000
+#define GRUB_GZIO_INDEX_MAX		256
+
+#define GRUB_GZIO_INDEX_MAGIC		"GRUBGZI2"
+#define GRUB_GZIO_INDEX_SUFFIX		".gzi"
+
+/* The inflate state at a window boundary, stored little-endian in index
+   files, followed by the WSIZE bytes of the window.  */
+struct grub_gzio_index_entry
+{
+  /* The uncompressed offset, a multiple of WSIZE.  */
+  grub_uint64_t out_offset;
+  /* The offset of the next unread compressed byte.  */
+  grub_uint64_t in_offset;
+  grub_uint64_t bb;
+  grub_uint32_t bk;
+  grub_uint32_t block_type;
+  grub_uint32_t block_len;
+  grub_uint32_t last_block;
+  grub_uint32_t code_state;
+  grub_uint32_t inflate_n;
+  grub_uint32_t inflate_d;
+  /* The CRC32 of the output before OUT_OFFSET.  */
+  grub_uint32_t crc;
+  /* The code lengths of the current dynamic block.  */
+  grub_uint16_t nl;
+  grub_uint16_t nd;
+  grub_uint8_t lens[286 + 30];
+} GRUB_PACKED;
+
+/* The header of an index file.  */
+struct grub_gzio_index_header
+{
+  char magic[8];
+  grub_uint64_t compressed_size;
+  grub_uint64_t data_offset;
+  grub_uint32_t orig_checksum;
+  grub_uint32_t orig_len;
+  grub_uint32_t count;
+  grub_uint32_t window_size;
+} GRUB_PACKED;
+
+struct grub_gzio_checkpoint
+{
+  /* In host byte order.  */
+  struct grub_gzio_index_entry entry;
+  grub_uint8_t slide[WSIZE];
+};
+
 /* The state stored in filesystem-specific data.  */
 struct grub_gzio
 {
@@ -83,8 +146,10 @@ struct grub_gzio
   /* The input buffer.  */
   grub_uint8_t inbuf[INBUFSIZ];
   int inbuf_d;
+  /* The offset of the input buffer in the underlying file.  */
+  grub_off_t inbuf_off;
   /* The bit buffer.  */
-  unsigned long bb;
+  grub_uint64_t bb;
   /* The bits in the bit buffer.  */
   unsigned bk;
   /* The sliding window in uncompressed data.  */
@@ -92,9 +157,9 @@ struct grub_gzio
   /* Current position in the slide.  */
   unsigned wp;
   /* The literal/length code table.  */
-  struct huft *tl;
+  grub_uint32_t tl[GRUB_GZIO_LTABLE_SIZE];
   /* The distance code table.  */
-  struct huft *td;
+  grub_uint32_t td[GRUB_GZIO_DTABLE_SIZE];
   /* The checksum algorithm */
   const gcry_md_spec_t *hdesc;
   /* The wanted checksum */
@@ -103,12 +168,24 @@ struct grub_gzio
   grub_size_t orig_len;
   /* Context for checksum calculation */
   grub_uint8_t *hcontext;
-  /* The lookup bits for the literal/length code table. */
-  int bl;
-  /* The lookup bits for the distance code table.  */
-  int bd;
   /* The original offset value.  */
   grub_off_t saved_offset;
+  /* After resuming from a checkpoint, the CRC32 of the CRC_BASE_LEN bytes
+     of output before it.  The checksum context covers the rest.  */
+  grub_uint32_t crc_base;
+  grub_off_t crc_base_len;
+  /* The code lengths of the current dynamic block.  */
+  unsigned nl;
+  unsigned nd;
+  grub_uint8_t lens[286 + 30];
+  /* The inflate checkpoints, sorted by uncompressed offset.  */
+  struct grub_gzio_checkpoint *index[GRUB_GZIO_INDEX_MAX];
+  unsigned index_num;
+  /* The distance between two checkpoints.  */
+  grub_off_t index_interval;
+  /* Whether checkpoints are recorded: from the start for disk images, and
+     for other files, which are mostly read once, after a backward seek.  */
+  int index_active;
 };
 typedef struct grub_gzio *grub_gzio_t;
 
@@ -175,7 +252,7 @@ eat_field (grub_file_t file, int len)
 
 typedef unsigned char uch;
 typedef unsigned short ush;
-typedef unsigned long ulg;
+typedef grub_uint64_t ulg;
 
 static int
 test_gzip_header (grub_file_t file)
@@ -239,26 +316,27 @@ test_gzip_header (grub_file_t file)
 
   return 1;
 }
-
-
-/* Huffman code lookup table entry--this entry is four bytes for machines
-   that have 16-bit pointers (e.g. PC's in the small or medium model).
-   Valid extra bits are 0..13.  e == 15 is EOB (end of block), e == 16
-   means that v is a literal, 16 < e < 32 means that v is a pointer to
-   the next table, which codes e - 16 bits, and lastly e == 99 indicates
-   an unused code.  If a code with e == 99 is looked up, this implies an
-   error in the data. */
-struct huft
-{
-  uch e;			/* number of extra bits or operation */
-  uch b;			/* number of bits in this code or subcode */
-  union
-    {
-      ush n;			/* literal, length base, or distance base */
-      struct huft *t;		/* pointer to next level of table */
-    }
-  v;
-};
+/* Huffman code lookup table entry.  The low five bits are the number of
+   bits the entry decodes and the next three its kind.  The second byte
+   is the number of extra bits of a length or distance base, the number
+   of bits indexing a subtable, or the length of the first code of a
+   literal pair.  The high half is the literal (a pair has the first one
+   in its low byte), the length or distance base, or the index of the
+   subtable in the same array.  Decoding a code that is not part of the
+   set finds an invalid entry, which is an error in the data.  */
+#define HUFT_LITERAL	0
+#define HUFT_LITERAL2	1
+#define HUFT_BASE	2
+#define HUFT_EOB	3
+#define HUFT_SUBTABLE	4
+#define HUFT_INVALID	5
+
+#define HUFT_ENTRY(bits, kind, aux, val) \
+  ((bits) | ((kind) << 5) | ((aux) << 8) | ((grub_uint32_t) (val) << 16))
+#define HUFT_BITS(e)	((e) & 0x1f)
+#define HUFT_KIND(e)	(((e) >> 5) & 7)
+#define HUFT_AUX(e)	(((e) >> 8) & 0xff)
+#define HUFT_VALUE(e)	((e) >> 16)
 
 
 /* The inflate algorithm uses a sliding 32K byte window on the uncompressed
@@ -297,43 +375,24 @@ static ush cpdext[] =
 
 
 /*
-   Huffman code decoding is performed using a multi-level table lookup.
-   The fastest way to decode is to simply build a lookup table whose
-   size is determined by the longest code.  However, the time it takes
-   to build this table can also be a factor if the data being decoded
-   is not very long.  The most common codes are necessarily the
-   shortest codes, so those codes dominate the decoding time, and hence
-   the speed.  The idea is you can have a shorter table that decodes the
-   shorter, more probable codes, and then point to subsidiary tables for
-   the longer codes.  The time it costs to decode the longer codes is
-   then traded against the time it takes to make longer tables.
-
-   This results of this trade are in the variables lbits and dbits
-   below.  lbits is the number of bits the first level table for literal/
-   length codes can decode in one step, and dbits is the same thing for
-   the distance codes.  Subsequent tables are also less than or equal to
-   those sizes.  These values may be adjusted either when all of the
-   codes are shorter than that, in which case the longest code length in
-   bits is used, or when the shortest code is *longer* than the requested
-   table size, in which case the length of the shortest code in bits is
-   used.
-
-   There are two different values for the two tables, since they code a
-   different number of possibilities each.  The literal/length table
-   codes 286 possible values, or in a flat code, a little over eight
-   bits.  The distance table codes 30 possible values, or a little less
-   than five bits, flat.  The optimum values for speed end up being
-   about one bit more than those, so lbits is 8+1 and dbits is 5+1.
-   The optimum values may differ though from machine to machine, and
-   possibly even between compilers.  Your mileage may vary.
+   Huffman code decoding is performed using a table lookup on the next
+   bits of the stream.  The first level is indexed by GRUB_GZIO_LBITS
+   bits for the literal/length codes and GRUB_GZIO_DBITS bits for the
+   distance codes, which resolves nearly every code in a single lookup.
+   Codes longer than that find an entry pointing to a subtable, indexed
+   by the remaining bits of the longest code sharing the same first
+   bits, which is stored after the first level in the same array.
+
+   When the codes of two literals fit in the first level together, the
+   literal/length entry decodes both of them, so that runs of literals
+   take one lookup for every two bytes.
+
+   The tables are rebuilt in place for every block, their sizes being
+   enough for any complete set of codes, so no memory is allocated while
+   inflating.
  */
 
 
-static int lbits = 9;		/* bits in base literal/length lookup table */
-static int dbits = 6;		/* bits in base distance lookup table */
-
-
-/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
 #define BMAX 16			/* maximum bit length of any code (16 for explode) */
 #define N_MAX 288		/* maximum number of codes in any set */
 
@@ -351,21 +410,13 @@ static int dbits = 6;		/* bits in base distance lookup table */
    variables for speed, and are initialized at the beginning of a
    routine that uses these macros from a global bit buffer and count.
 
-   If we assume that EOB will be the longest code, then we will never
-   ask for bits with NEEDBITS that are beyond the end of the stream.
-   So, NEEDBITS should not read any more bytes than are needed to
-   meet the request.  Then no bytes need to be "returned" to the buffer
-   at the end of the last block.
-
-   However, this assumption is not true for fixed blocks--the EOB code
-   is 7 bits, but the other literal/length codes can be 8 or 9 bits.
-   (The EOB code is shorter than other codes because fixed blocks are
-   generally short.  So, while a block always has an EOB, many other
-   literal/length codes have a significantly lower probability of
-   showing up at all.)  However, by making the first table have a
-   lookup of seven bits, the EOB code will be found in that first
-   lookup, and so will not require that too many bits be pulled from
-   the stream.
+   The bit buffer is 64 bits wide.  NEEDBITS tops it up to at least 56
+   bits whenever it holds fewer than asked for, loading eight bytes at
+   once when they are in the input buffer, so that several literals or a
+   whole length/distance pair are decoded between two refills.  The bytes read ahead stay in
+   the bit buffer, which is saved along with the input offset, so
+   nothing needs to be returned to the input at the end of a block.  A
+   stored block takes its first bytes from the bit buffer.
  */
 
 static ush mask_bits[] =
@@ -375,7 +426,7 @@ static ush mask_bits[] =
   0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
 };
 
-#define NEEDBITS(n) do {while(k<(n)){b|=((ulg)get_byte(gzio))<<k;k+=8;}} while (0)
+#define NEEDBITS(n) do {if(k<(n))fill_bits(gzio,&b,&k);} while (0)
 #define DUMPBITS(n) do {b>>=(n);k-=(n);} while (0)
 
 static int
@@ -393,12 +444,74 @@ get_byte (grub_gzio_t gzio)
 		     || gzio->inbuf_d == INBUFSIZ))
     {
       gzio->inbuf_d = 0;
+      gzio->inbuf_off = grub_file_tell (gzio->file);
       grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
     }
 
   return gzio->inbuf[gzio->inbuf_d++];
 }
 
+/* Return the input bytes that can be read without refilling the input
+   buffer, and set AVAIL to their number.  */
+static const grub_uint8_t *
+buffered_input (grub_gzio_t gzio, grub_size_t *avail)
+{
+  if (gzio->mem_input)
+    {
+      *avail = gzio->mem_input_size - gzio->mem_input_off;
+      return gzio->mem_input + gzio->mem_input_off;
+    }
+
+  if (grub_file_tell (gzio->file) == (grub_off_t) gzio->data_offset
+      || gzio->inbuf_d >= INBUFSIZ)
+    {
+      *avail = 0;
+      return NULL;
+    }
+
+  *avail = INBUFSIZ - gzio->inbuf_d;
+  return gzio->inbuf + gzio->inbuf_d;
+}
+
+static void
+skip_input (grub_gzio_t gzio, grub_size_t len)
+{
+  if (gzio->mem_input)
+    gzio->mem_input_off += len;
+  else
+    gzio->inbuf_d += len;
+}
+
+static inline void
+fill_bits (grub_gzio_t gzio, ulg *bp, unsigned *kp)
+{
+  const grub_uint8_t *p;
+  grub_size_t avail;
+  ulg b = *bp;
+  unsigned k = *kp;
+
+  p = buffered_input (gzio, &avail);
+  if (avail >= 8)
+    {
+      unsigned n = (63 - k) >> 3;
+
+      b |= grub_le_to_cpu64 (grub_get_unaligned64 (p)) << k;
+      k += n << 3;
+      /* Keep the bits above K clear for the next refill.  */
+      b &= ((ulg) 1 << k) - 1;
+      skip_input (gzio, n);
+    }
+  else
+    while (k <= 56)
+      {
+	b |= ((ulg) get_byte (gzio)) << k;
+	k += 8;
+      }
+
+  *bp = b;
+  *kp = k;
+}
+
 static void
 gzio_seek (grub_gzio_t gzio, grub_off_t off)
 {
@@ -414,228 +527,155 @@ gzio_seek (grub_gzio_t gzio, grub_off_t off)
     grub_file_seek (gzio->file, off);
 }
 
-/* more function prototypes */
-static int huft_build (unsigned *, unsigned, unsigned, ush *, ush *,
-		       struct huft **, int *);
-static int huft_free (struct huft *);
-static int inflate_codes_in_window (grub_gzio_t);
-
 
-/* Given a list of code lengths and a maximum table size, make a set of
-   tables to decode that set of codes.  Return zero on success, one if
-   the given code set is incomplete (the tables are still built in this
-   case), two if the input is invalid (all zero length codes or an
-   oversubscribed set of lengths), and three if not enough memory. */
+/* Build in TABLE, which has room for SIZE entries, the lookup table for
+   the N codes whose lengths are in LENS, with ROOT bits in the first
+   level.  Symbols below S are literals, or the end of block for 256,
+   and the others have the base values in BASE and the extra bits in
+   EXTRA.  Return zero on success, or one if a length is over BMAX or
+   the set of lengths is oversubscribed or needs more room.  An
+   incomplete set is accepted, its missing codes being invalid.  */
 
 static int
-huft_build (unsigned *b,	/* code lengths in bits (all assumed <= BMAX) */
-	    unsigned n,		/* number of codes (assumed <= N_MAX) */
-	    unsigned s,		/* number of simple-valued codes (0..s-1) */
-	    ush * d,		/* list of base values for non-simple codes */
-	    ush * e,		/* list of extra bits for non-simple codes */
-	    struct huft **t,	/* result: starting table */
-	    int *m)		/* maximum lookup bits, returns actual */
+huft_build (grub_uint32_t *table, unsigned size, const grub_uint8_t *lens,
+	    unsigned n, unsigned s, const ush *base, const ush *extra,
+	    unsigned root)
 {
-  unsigned a;			/* counter for codes of length k */
-  unsigned c[BMAX + 1];		/* bit length count table */
-  unsigned f;			/* i repeats in table every f entries */
-  int g;			/* maximum code length */
-  int h;			/* table level */
-  register unsigned i;		/* counter, current code */
-  register unsigned j;		/* counter */
-  register int k;		/* number of bits in current code */
-  int l;			/* bits per table (returned in m) */
-  register unsigned *p;		/* pointer into c[], b[], or v[] */
-  register struct huft *q;	/* points to current table */
-  struct huft r;		/* table entry for structure assignment */
-  struct huft *u[BMAX];		/* table stack */
-  unsigned v[N_MAX];		/* values in order of bit length */
-  register int w;		/* bits before this table == (l * h) */
-  unsigned x[BMAX + 1];		/* bit offsets, then code stack */
-  unsigned *xp;			/* pointer into x */
-  int y;			/* number of dummy codes added */
-  unsigned z;			/* number of entries in current table */
-
-  /* Generate counts for each bit length */
-  grub_memset ((char *) c, 0, sizeof (c));
-  p = b;
-  i = n;
-  do
+  unsigned count[BMAX + 1];	/* number of codes of each length */
+  unsigned offs[BMAX + 1];	/* offsets in sorted of each length */
+  ush sorted[N_MAX];		/* symbols sorted by code length */
+  unsigned len, max, sym, i, j;
+  unsigned code;		/* current code, bit-reversed */
+  unsigned used;		/* entries in use in table */
+  unsigned low;			/* first level index of the subtable */
+  unsigned sub, sub_bits;	/* index and size of the current subtable */
+  int left;
+
+  for (len = 0; len <= BMAX; len++)
+    count[len] = 0;
+  for (sym = 0; sym < n; sym++)
     {
-      c[*p]++;			/* assume all entries <= BMAX */
-      p++;			/* Can't combine with above line (Solaris bug) */
-    }
-  while (--i);
-  if (c[0] == n)		/* null input--all zero length codes */
-    {
-      *t = (struct huft *) NULL;
-      *m = 0;
-      return 0;
+      if (lens[sym] > BMAX)
+	return 1;
+      count[lens[sym]]++;
     }
+  count[0] = 0;
+  for (max = BMAX; max && ! count[max]; max--);
 
-  /* Find minimum and maximum length, bound *m by those */
-  l = *m;
-  for (j = 1; j <= BMAX; j++)
-    if (c[j])
-      break;
-  k = j;			/* minimum code length */
-  if ((unsigned) l < j)
-    l = j;
-  for (i = BMAX; i; i--)
-    if (c[i])
-      break;
-  g = i;			/* maximum code length */
-  if ((unsigned) l > i)
-    l = i;
-  *m = l;
-
-  /* Adjust last length count to fill out codes, if needed */
-  for (y = 1 << j; j < i; j++, y <<= 1)
-    if ((y -= c[j]) < 0)
-      return 2;			/* bad input: more codes than bits */
-  if ((y -= c[i]) < 0)
-    return 2;
-  c[i] += y;
-
-  /* Generate starting offsets into the value table for each length */
-  x[1] = j = 0;
-  p = c + 1;
-  xp = x + 2;
-  while (--i)
-    {				/* note that i == g from above */
-      *xp++ = (j += *p++);
-    }
+  used = 1U << root;
+  for (i = 0; i < used; i++)
+    table[i] = HUFT_ENTRY (0, HUFT_INVALID, 0, 0);
 
-  /* Make a table of values in order of bit lengths */
-  p = b;
-  i = 0;
-  do
+  /* A block without any match has no distance codes.  */
+  if (! max)
+    return 0;
+
+  left = 1;
+  for (len = 1; len <= BMAX; len++)
     {
-      if ((j = *p++) != 0)
-	v[x[j]++] = i;
+      left <<= 1;
+      left -= count[len];
+      if (left < 0)
+	return 1;
     }
-  while (++i < n);
-
-  /* Generate the Huffman codes and for each, make the table entries */
-  x[0] = i = 0;			/* first Huffman code is zero */
-  p = v;			/* grab values in bit order */
-  h = -1;			/* no tables yet--level -1 */
-  w = -l;			/* bits decoded == (l * h) */
-  u[0] = (struct huft *) NULL;	/* just to keep compilers happy */
-  q = (struct huft *) NULL;	/* ditto */
-  z = 0;			/* ditto */
-
-  /* go through the bit lengths (k already is bits in shortest code) */
-  for (; k <= g; k++)
-    {
-      a = c[k];
-      while (a--)
-	{
-	  /* here i is the Huffman code of length k bits for value *p */
-	  /* make tables up to required level */
-	  while (k > w + l)
-	    {
-	      h++;
-	      w += l;		/* previous table always l bits */
-
-	      /* compute minimum size table less than or equal to l bits */
-	      z = (z = (unsigned) (g - w)) > (unsigned) l ? (unsigned) l : z;	/* upper limit on table size */
-	      if ((f = 1 << (j = k - w)) > a + 1)	/* try a k-w bit table */
-		{		/* too few codes for k-w bit table */
-		  f -= a + 1;	/* deduct codes from patterns left */
-		  xp = c + k;
-		  while (++j < z)	/* try smaller tables up to z bits */
-		    {
-		      if ((f <<= 1) <= *++xp)
-			break;	/* enough codes to use up j bits */
-		      f -= *xp;	/* else deduct codes from patterns */
-		    }
-		}
-	      z = 1 << j;	/* table entries for j-bit table */
 
-	      /* allocate and link in new table */
-	      q = (struct huft *) grub_calloc (z + 1, sizeof (struct huft));
-	      if (! q)
-		{
-		  if (h)
-		    huft_free (u[0]);
-		  return 3;
-		}
+  offs[1] = 0;
+  for (len = 1; len < BMAX; len++)
+    offs[len + 1] = offs[len] + count[len];
+  for (sym = 0; sym < n; sym++)
+    if (lens[sym])
+      sorted[offs[lens[sym]]++] = sym;
+
+  code = 0;
+  low = (unsigned) -1;
+  sub = sub_bits = 0;
+  for (i = 0, len = 1; len <= max; len++)
+    for (; count[len]; count[len]--, i++)
+      {
+	grub_uint32_t e;
+	unsigned incr;
+
+	sym = sorted[i];
+	if (sym < s)
+	  e = (sym == 256) ? HUFT_ENTRY (0, HUFT_EOB, 0, 0)
+	    : HUFT_ENTRY (0, HUFT_LITERAL, 0, sym);
+	else if (extra[sym - s] != 99)
+	  e = HUFT_ENTRY (0, HUFT_BASE, extra[sym - s], base[sym - s]);
+	else
+	  e = HUFT_ENTRY (0, HUFT_INVALID, 0, 0);
+
+	if (len <= root)
+	  for (j = code; j < (1U << root); j += 1U << len)
+	    table[j] = e | len;
+	else
+	  {
+	    if ((code & ((1U << root) - 1)) != low)
+	      {
+		/* Start a subtable for the codes sharing these first bits,
+		   large enough for the longest of them.  */
+		low = code & ((1U << root) - 1);
+		sub_bits = len - root;
+		left = 1 << sub_bits;
+		while (sub_bits + root < max)
+		  {
+		    left -= count[sub_bits + root];
+		    if (left <= 0)
+		      break;
+		    sub_bits++;
+		    left <<= 1;
+		  }
 
-	      *t = q + 1;	/* link to list for huft_free() */
-	      *(t = &(q->v.t)) = (struct huft *) NULL;
-	      u[h] = ++q;	/* table starts after link */
+		sub = used;
+		used += 1U << sub_bits;
+		if (used > size)
+		  return 1;
+		for (j = sub; j < used; j++)
+		  table[j] = HUFT_ENTRY (0, HUFT_INVALID, 0, 0);
+		table[low] = HUFT_ENTRY (root, HUFT_SUBTABLE, sub_bits, sub);
+	      }
 
-	      /* connect to last table, if there is one */
-	      if (h)
-		{
-		  x[h] = i;	/* save pattern for backing up */
-		  r.b = (uch) l;	/* bits to dump before this table */
-		  r.e = (uch) (16 + j);		/* bits in this table */
-		  r.v.t = q;	/* pointer to this table */
-		  j = i >> (w - l);	/* (get around Turbo C bug) */
-		  u[h - 1][j] = r;	/* connect to last table */
-		}
-	    }
+	    for (j = code >> root; j < (1U << sub_bits); j += 1U << (len - root))
+	      table[sub + j] = e | (len - root);
+	  }
 
-	  /* set up table entry in r */
-	  r.b = (uch) (k - w);
-	  if (p >= v + n)
-	    r.e = 99;		/* out of values--invalid code */
-	  else if (*p < s)
-	    {
-	      r.e = (uch) (*p < 256 ? 16 : 15);		/* 256 is end-of-block code */
-	      r.v.n = (ush) (*p);	/* simple code is just the value */
-	      p++;		/* one compiler does not like *p++ */
-	    }
-	  else
-	    {
-	      r.e = (uch) e[*p - s];	/* non-simple--look up in lists */
-	      r.v.n = d[*p++ - s];
-	    }
+	/* Increment the bit-reversed code.  */
+	incr = 1U << (len - 1);
+	while (code & incr)
+	  incr >>= 1;
+	code = incr ? (code & (incr - 1)) + incr : 0;
+      }
 
-	  /* fill code-like entries with r */
-	  f = 1 << (k - w);
-	  for (j = i >> w; j < z; j += f)
-	    q[j] = r;
+  return 0;
+}
 
-	  /* backwards increment the k-bit code i */
-	  for (j = 1 << (k - 1); i & j; j >>= 1)
-	    i ^= j;
-	  i ^= j;
 
-	  /* backup over finished tables */
-	  while ((i & ((1 << w) - 1)) != x[h])
-	    {
-	      h--;		/* don't need to update q */
-	      w -= l;
-	    }
-	}
-    }
+/* Let the first level entries of the literal/length table TABLE decode
+   two literals when both codes fit in ROOT bits.  The entry for the
+   second literal is found at the index of the bits following the first
+   code, which is lower than the current index, so walking down leaves
+   it unchanged until it's used.  */
 
-  /* Return true (1) if we were given an incomplete table */
-  return y != 0 && g != 1;
-}
+static void
+huft_pair_literals (grub_uint32_t *table, unsigned root)
+{
+  unsigned i;
 
+  for (i = 1U << root; i-- > 0; )
+    {
+      grub_uint32_t e = table[i], e2;
 
-/* Free the malloc'ed tables built by huft_build(), which makes a linked
-   list of the tables it made, with the links in a dummy first entry of
-   each table.  */
-static int
-huft_free (struct huft *t)
-{
-  register struct huft *p, *q;
+      if (HUFT_KIND (e) != HUFT_LITERAL || HUFT_BITS (e) >= root)
+	continue;
 
+      e2 = table[i >> HUFT_BITS (e)];
+      if (HUFT_KIND (e2) != HUFT_LITERAL
+	  || HUFT_BITS (e) + HUFT_BITS (e2) > root)
+	continue;
 
-  /* Go through linked list, freeing from the malloced (t[-1]) address. */
-  p = t;
-  while (p != (struct huft *) NULL)
-    {
-      q = (--p)->v.t;
-      grub_free ((char *) p);
-      p = q;
+      table[i] = HUFT_ENTRY (HUFT_BITS (e) + HUFT_BITS (e2), HUFT_LITERAL2,
+			     HUFT_BITS (e),
+			     HUFT_VALUE (e) | (HUFT_VALUE (e2) << 8));
     }
-  return 0;
 }
 
 
@@ -647,13 +687,13 @@ huft_free (struct huft *t)
 static int
 inflate_codes_in_window (grub_gzio_t gzio)
 {
-  register unsigned e;		/* table entry flag/number of extra bits */
+  grub_uint32_t e;		/* table entry */
   unsigned n, d;		/* length and index for copy */
   unsigned w;			/* current window position */
-  struct huft *t;		/* pointer to table entry */
-  unsigned ml, md;		/* masks for bl and bd bits */
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  unsigned c;			/* bytes to copy before wrapping */
+  uch *slide = gzio->slide;
+  ulg b;			/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local copies of globals */
   d = gzio->inflate_d;
@@ -663,73 +703,84 @@ inflate_codes_in_window (grub_gzio_t gzio)
   w = gzio->wp;			/* initialize window position */
 
   /* inflate the coded data */
-  ml = mask_bits[gzio->bl];		/* precompute masks for speed */
-  md = mask_bits[gzio->bd];
   for (;;)			/* do until end of block */
     {
       if (! gzio->code_state)
 	{
-	  NEEDBITS ((unsigned) gzio->bl);
-	  if ((e = (t = gzio->tl + ((unsigned) b & ml))->e) > 16)
-	    do
-	      {
-		if (e == 99)
-		  {
-		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-				"an unused code found");
-		    return 1;
-		  }
-		DUMPBITS (t->b);
-		e -= 16;
-		NEEDBITS (e);
-	      }
-	    while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
-	  DUMPBITS (t->b);
-
-	  if (e == 16)		/* then it's a literal */
+	  NEEDBITS (BMAX - 1);
+	  e = gzio->tl[(unsigned) b & ((1U << GRUB_GZIO_LBITS) - 1)];
+	  if (HUFT_KIND (e) == HUFT_SUBTABLE)
 	    {
-	      gzio->slide[w++] = (uch) t->v.n;
-	      if (w == WSIZE)
-		break;
+	      DUMPBITS (GRUB_GZIO_LBITS);
+	      e = gzio->tl[HUFT_VALUE (e)
+			   + ((unsigned) b & mask_bits[HUFT_AUX (e)])];
 	    }
-	  else
-	    /* it's an EOB or a length */
+
+	  if (HUFT_KIND (e) == HUFT_LITERAL2)
 	    {
-	      /* exit if end of block */
-	      if (e == 15)
+	      slide[w++] = (uch) HUFT_VALUE (e);
+	      if (w == WSIZE)
 		{
-		  gzio->block_len = 0;
+		  /* the second literal goes to the next window */
+		  DUMPBITS (HUFT_AUX (e));
 		  break;
 		}
+	      slide[w++] = (uch) (HUFT_VALUE (e) >> 8);
+	      DUMPBITS (HUFT_BITS (e));
+	      if (w == WSIZE)
+		break;
+	      continue;
+	    }
 
-	      /* get length of block to copy */
-	      NEEDBITS (e);
-	      n = t->v.n + ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
+	  if (HUFT_KIND (e) == HUFT_LITERAL)
+	    {
+	      DUMPBITS (HUFT_BITS (e));
+	      slide[w++] = (uch) HUFT_VALUE (e);
+	      if (w == WSIZE)
+		break;
+	      continue;
+	    }
 
-	      /* decode distance of block to copy */
-	      NEEDBITS ((unsigned) gzio->bd);
-	      if ((e = (t = gzio->td + ((unsigned) b & md))->e) > 16)
-		do
-		  {
-		    if (e == 99)
-		      {
-			grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-				    "an unused code found");
-			return 1;
-		      }
-		    DUMPBITS (t->b);
-		    e -= 16;
-		    NEEDBITS (e);
-		  }
-		while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e)
-		       > 16);
-	      DUMPBITS (t->b);
-	      NEEDBITS (e);
-	      d = w - t->v.n - ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
-	      gzio->code_state++;
+	  /* exit if end of block */
+	  if (HUFT_KIND (e) == HUFT_EOB)
+	    {
+	      DUMPBITS (HUFT_BITS (e));
+	      gzio->block_len = 0;
+	      break;
 	    }
+
+	  if (HUFT_KIND (e) != HUFT_BASE)
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  "an unused code found");
+	      return 1;
+	    }
+
+	  /* get length of block to copy, a single refill being enough for
+	     the extra bits and the distance code with its extra bits */
+	  DUMPBITS (HUFT_BITS (e));
+	  NEEDBITS (5 + BMAX - 1 + 13);
+	  n = HUFT_VALUE (e) + ((unsigned) b & mask_bits[HUFT_AUX (e)]);
+	  DUMPBITS (HUFT_AUX (e));
+
+	  /* decode distance of block to copy */
+	  e = gzio->td[(unsigned) b & ((1U << GRUB_GZIO_DBITS) - 1)];
+	  if (HUFT_KIND (e) == HUFT_SUBTABLE)
+	    {
+	      DUMPBITS (GRUB_GZIO_DBITS);
+	      e = gzio->td[HUFT_VALUE (e)
+			   + ((unsigned) b & mask_bits[HUFT_AUX (e)])];
+	    }
+	  if (HUFT_KIND (e) != HUFT_BASE)
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  "an unused code found");
+	      return 1;
+	    }
+	  DUMPBITS (HUFT_BITS (e));
+	  d = w - HUFT_VALUE (e) - ((unsigned) b & mask_bits[HUFT_AUX (e)]);
+	  DUMPBITS (HUFT_AUX (e));
+	  gzio->code_state++;
 	}
 
       if (gzio->code_state)
@@ -737,21 +788,28 @@ inflate_codes_in_window (grub_gzio_t gzio)
 	  /* do the copy */
 	  do
 	    {
-	      n -= (e = (e = WSIZE - ((d &= WSIZE - 1) > w ? d : w)) > n ? n
-		    : e);
-
-	      if (w - d >= e)
+	      d &= WSIZE - 1;
+	      c = WSIZE - (d > w ? d : w);
+	      if (c > n)
+		c = n;
+	      n -= c;
+
+	      /* A word at a time as long as every word is read before the
+		 copy overwrites it, one byte at a time otherwise, so that
+		 short distances repeat the pattern.  */
+	      if (d > w || w - d >= 8)
+		for (; c >= 8; c -= 8, w += 8, d += 8)
+		  grub_set_unaligned64 (slide + w,
+					grub_get_unaligned64 (slide + d));
+	      else if (w - d == 1)
 		{
-		  grub_memmove (gzio->slide + w, gzio->slide + d, e);
-		  w += e;
-		  d += e;
-		}
-	      else
-		/* purposefully use the overlap for extra copies here!! */
-		{
-		  while (e--)
-		    gzio->slide[w++] = gzio->slide[d++];
+		  grub_memset (slide + w, slide[d], c);
+		  w += c;
+		  d += c;
+		  c = 0;
 		}
+	      while (c--)
+		slide[w++] = slide[d++];
 
 	      if (w == WSIZE)
 		break;
@@ -783,8 +841,8 @@ inflate_codes_in_window (grub_gzio_t gzio)
 static void
 init_stored_block (grub_gzio_t gzio)
 {
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  ulg b;			/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local copies of globals */
   b = gzio->bb;			/* initialize bit buffer */
@@ -809,15 +867,13 @@ init_stored_block (grub_gzio_t gzio)
 }
 
 
-/* get header for an inflated type 1 (fixed Huffman codes) block.  We should
-   either replace this with a custom decoder, or at least precompute the
-   Huffman tables. */
+/* build the decoding tables for a type 1 (fixed Huffman codes) block.  */
 
-static void
-init_fixed_block (grub_gzio_t gzio)
+static int
+build_fixed_tables (grub_gzio_t gzio)
 {
   int i;			/* temporary variable */
-  unsigned l[288];		/* length list for huft_build */
+  grub_uint8_t l[288];		/* length list for huft_build */
 
   /* set up literal table */
   for (i = 0; i < 144; i++)
@@ -828,35 +884,69 @@ init_fixed_block (grub_gzio_t gzio)
     l[i] = 7;
   for (; i < 288; i++)		/* make a complete, but wrong code set */
     l[i] = 8;
-  gzio->bl = 7;
-  if (huft_build (l, 288, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
+  if (huft_build (gzio->tl, GRUB_GZIO_LTABLE_SIZE, l, 288, 257,
+		  cplens, cplext, GRUB_GZIO_LBITS) != 0)
     {
-      if (grub_errno == GRUB_ERR_NONE)
-	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		    "failed in building a Huffman code table");
-      return;
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
+      return 1;
     }
+  huft_pair_literals (gzio->tl, GRUB_GZIO_LBITS);
 
   /* set up distance table */
   for (i = 0; i < 30; i++)	/* make an incomplete code set */
     l[i] = 5;
-  gzio->bd = 5;
-  if (huft_build (l, 30, 0, cpdist, cpdext, &gzio->td, &gzio->bd) > 1)
+  if (huft_build (gzio->td, GRUB_GZIO_DTABLE_SIZE, l, 30, 0,
+		  cpdist, cpdext, GRUB_GZIO_DBITS) != 0)
     {
-      if (grub_errno == GRUB_ERR_NONE)
-	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		    "failed in building a Huffman code table");
-      huft_free (gzio->tl);
-      gzio->tl = 0;
-      return;
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
+      return 1;
     }
 
+  return 0;
+}
+
+static void
+init_fixed_block (grub_gzio_t gzio)
+{
+  if (build_fixed_tables (gzio))
+    return;
+
   /* indicate we're now working on a block */
   gzio->code_state = 0;
   gzio->block_len++;
 }
 
 
+/* build the decoding tables for literal/length and distance codes from
+   the NL + ND code lengths in LL.  */
+
+static int
+build_dynamic_tables (grub_gzio_t gzio, const grub_uint8_t *ll,
+		      unsigned nl, unsigned nd)
+{
+  if (huft_build (gzio->tl, GRUB_GZIO_LTABLE_SIZE, ll, nl, 257,
+		  cplens, cplext, GRUB_GZIO_LBITS) != 0)
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
+      return 1;
+    }
+  huft_pair_literals (gzio->tl, GRUB_GZIO_LBITS);
+
+  if (huft_build (gzio->td, GRUB_GZIO_DTABLE_SIZE, ll + nl, nd, 0,
+		  cpdist, cpdext, GRUB_GZIO_DBITS) != 0)
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
+      return 1;
+    }
+
+  return 0;
+}
+
+
 /* get header for an inflated type 2 (dynamic Huffman codes) block. */
 
 static void
@@ -865,14 +955,15 @@ init_dynamic_block (grub_gzio_t gzio)
   int i;			/* temporary variables */
   unsigned j;
   unsigned l;			/* last length */
-  unsigned m;			/* mask for bit lengths table */
   unsigned n;			/* number of lengths to get */
   unsigned nb;			/* number of bit length codes */
   unsigned nl;			/* number of literal/length codes */
   unsigned nd;			/* number of distance codes */
-  unsigned ll[286 + 30];	/* literal/length and distance code lengths */
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  grub_uint32_t e;		/* table entry */
+  grub_uint8_t *ll = gzio->lens; /* literal/length and distance code lengths */
+  grub_uint8_t bl[19];		/* bit length code lengths */
+  ulg b;			/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local bit buffer */
   b = gzio->bb;
@@ -898,15 +989,15 @@ init_dynamic_block (grub_gzio_t gzio)
   for (j = 0; j < nb; j++)
     {
       NEEDBITS (3);
-      ll[bitorder[j]] = (unsigned) b & 7;
+      bl[bitorder[j]] = (unsigned) b & 7;
       DUMPBITS (3);
     }
   for (; j < 19; j++)
-    ll[bitorder[j]] = 0;
+    bl[bitorder[j]] = 0;
 
   /* build decoding table for trees--single level, 7 bit lookup */
-  gzio->bl = 7;
-  if (huft_build (ll, 19, 19, NULL, NULL, &gzio->tl, &gzio->bl) != 0)
+  if (huft_build (gzio->tl, GRUB_GZIO_LTABLE_SIZE, bl, 19, 19,
+		  NULL, NULL, 7) != 0)
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
@@ -915,14 +1006,18 @@ init_dynamic_block (grub_gzio_t gzio)
 
   /* read in literal and distance code lengths */
   n = nl + nd;
-  m = mask_bits[gzio->bl];
   i = l = 0;
   while ((unsigned) i < n)
     {
-      NEEDBITS ((unsigned) gzio->bl);
-      j = (gzio->td = gzio->tl + ((unsigned) b & m))->b;
-      DUMPBITS (j);
-      j = gzio->td->v.n;
+      NEEDBITS (7);
+      e = gzio->tl[(unsigned) b & 0x7f];
+      if (HUFT_KIND (e) != HUFT_LITERAL)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  return;
+	}
+      DUMPBITS (HUFT_BITS (e));
+      j = HUFT_VALUE (e);
       if (j < 16)		/* length of code in bits (0..15) */
 	ll[i++] = l = j;	/* save last length in l */
       else if (j == 16)		/* repeat last length 3 to 6 times */
@@ -969,32 +1064,17 @@ init_dynamic_block (grub_gzio_t gzio)
 	}
     }
 
-  /* free decoding table for trees */
-  huft_free (gzio->tl);
-  gzio->td = 0;
-  gzio->tl = 0;
-
   /* restore the global bit buffer */
   gzio->bb = b;
   gzio->bk = k;
 
+  /* remember the code lengths for inflate checkpoints */
+  gzio->nl = nl;
+  gzio->nd = nd;
+
   /* build the decoding tables for literal/length and distance codes */
-  gzio->bl = lbits;
-  if (huft_build (ll, nl, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
-    {
-      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		  "failed in building a Huffman code table");
-      return;
-    }
-  gzio->bd = dbits;
-  if (huft_build (ll + nl, nd, 0, cpdist, cpdext, &gzio->td, &gzio->bd) != 0)
-    {
-      huft_free (gzio->tl);
-      gzio->tl = 0;
-      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		  "failed in building a Huffman code table");
-      return;
-    }
+  if (build_dynamic_tables (gzio, ll, nl, nd))
+    return;
 
   /* indicate we're now working on a block */
   gzio->code_state = 0;
@@ -1005,8 +1085,8 @@ init_dynamic_block (grub_gzio_t gzio)
 static void
 get_new_block (grub_gzio_t gzio)
 {
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  ulg b;			/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local bit buffer */
   b = gzio->bb;
@@ -1043,6 +1123,217 @@ get_new_block (grub_gzio_t gzio)
 }
 
 
+/* Return the CRC32 of A followed by LEN_B bytes whose CRC32 is B, by
+   running the CRC of A over LEN_B zero bytes, squaring the operator for
+   each bit of LEN_B (see zlib's crc32_combine).  */
+
+static grub_uint32_t
+crc32_times (const grub_uint32_t *mat, grub_uint32_t vec)
+{
+  grub_uint32_t sum = 0;
+
+  for (; vec; vec >>= 1, mat++)
+    if (vec & 1)
+      sum ^= *mat;
+  return sum;
+}
+
+static void
+crc32_square (grub_uint32_t *square, const grub_uint32_t *mat)
+{
+  unsigned n;
+
+  for (n = 0; n < 32; n++)
+    square[n] = crc32_times (mat, mat[n]);
+}
+
+static grub_uint32_t
+crc32_combine (grub_uint32_t a, grub_uint32_t b, grub_uint64_t len_b)
+{
+  grub_uint32_t even[32], odd[32];
+  unsigned n;
+
+  if (! len_b)
+    return a;
+
+  /* The operator for one zero bit.  */
+  odd[0] = 0xedb88320;
+  for (n = 1; n < 32; n++)
+    odd[n] = 1U << (n - 1);
+  crc32_square (even, odd);
+  crc32_square (odd, even);
+
+  do
+    {
+      crc32_square (even, odd);
+      if (len_b & 1)
+	a = crc32_times (even, a);
+      len_b >>= 1;
+      if (! len_b)
+	break;
+      crc32_square (odd, even);
+      if (len_b & 1)
+	a = crc32_times (odd, a);
+      len_b >>= 1;
+    }
+  while (len_b);
+
+  return a ^ b;
+}
+
+/* Return the CRC32 of all the output so far.  */
+
+static grub_uint32_t
+gzio_crc (grub_gzio_t gzio)
+{
+  grub_uint8_t context[GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE];
+  grub_uint32_t crc;
+
+  grub_memcpy (context, gzio->hcontext, gzio->hdesc->contextsize);
+  gzio->hdesc->final (context);
+  crc = grub_be_to_cpu32 (grub_get_unaligned32 (gzio->hdesc->read (context)));
+
+  if (! gzio->crc_base_len)
+    return crc;
+  return crc32_combine (gzio->crc_base, crc,
+			gzio->saved_offset - gzio->crc_base_len);
+}
+
+/* Record the state after a full window, so that the data following it
+   can be inflated again without starting over.  */
+
+static void
+add_checkpoint (grub_gzio_t gzio)
+{
+  struct grub_gzio_checkpoint *cp;
+  struct grub_gzio_index_entry *e;
+  unsigned i;
+
+  if (gzio->mem_input || ! gzio->index_active || ! gzio->index_interval
+      || ! gzio->hcontext)
+    return;
+
+  if (gzio->index_num)
+    {
+      e = &gzio->index[gzio->index_num - 1]->entry;
+      if (gzio->saved_offset < e->out_offset + gzio->index_interval)
+	return;
+    }
+  else if (gzio->saved_offset < gzio->index_interval)
+    return;
+
+  if (gzio->index_num == GRUB_GZIO_INDEX_MAX)
+    {
+      for (i = 0; i < GRUB_GZIO_INDEX_MAX / 2; i++)
+	{
+	  grub_free (gzio->index[2 * i]);
+	  gzio->index[i] = gzio->index[2 * i + 1];
+	}
+      gzio->index_num = GRUB_GZIO_INDEX_MAX / 2;
+      gzio->index_interval *= 2;
+      return;
+    }
+
+  cp = grub_malloc (sizeof (*cp));
+  if (! cp)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  e = &cp->entry;
+  e->out_offset = gzio->saved_offset;
+  e->in_offset = gzio->inbuf_off + gzio->inbuf_d;
+  e->bb = gzio->bb;
+  e->bk = gzio->bk;
+  e->block_type = gzio->block_type;
+  e->block_len = gzio->block_len;
+  e->last_block = gzio->last_block;
+  e->code_state = gzio->code_state;
+  e->inflate_n = gzio->inflate_n;
+  e->inflate_d = gzio->inflate_d;
+  e->crc = gzio_crc (gzio);
+  e->nl = gzio->nl;
+  e->nd = gzio->nd;
+  grub_memcpy (e->lens, gzio->lens, sizeof (e->lens));
+  grub_memcpy (cp->slide, gzio->slide, WSIZE);
+
+  gzio->index[gzio->index_num++] = cp;
+}
+
+/* Return the last checkpoint at or before OFFSET.  */
+
+static struct grub_gzio_checkpoint *
+find_checkpoint (grub_gzio_t gzio, grub_off_t offset)
+{
+  unsigned lo = 0, hi = gzio->index_num;
+
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (gzio->index[mid]->entry.out_offset <= offset)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return lo ? gzio->index[lo - 1] : NULL;
+}
+
+/* Resume inflating from CP.  */
+
+static int
+restore_checkpoint (grub_gzio_t gzio, struct grub_gzio_checkpoint *cp)
+{
+  struct grub_gzio_index_entry *e = &cp->entry;
+
+  gzio->saved_offset = e->out_offset;
+  gzio->wp = WSIZE;
+  grub_memcpy (gzio->slide, cp->slide, WSIZE);
+  gzio->bb = e->bb;
+  gzio->bk = e->bk;
+  gzio->block_type = e->block_type;
+  gzio->block_len = e->block_len;
+  gzio->last_block = e->last_block;
+  gzio->code_state = e->code_state;
+  gzio->inflate_n = e->inflate_n;
+  gzio->inflate_d = e->inflate_d;
+  gzio->nl = e->nl;
+  gzio->nd = e->nd;
+  grub_memcpy (gzio->lens, e->lens, sizeof (gzio->lens));
+  gzio->crc_base = e->crc;
+  gzio->crc_base_len = e->out_offset;
+  gzio->hdesc->init (gzio->hcontext);
+
+  gzio_seek (gzio, e->in_offset);
+  gzio->inbuf_d = INBUFSIZ;
+
+  if (gzio->block_len && gzio->block_type == INFLATE_FIXED)
+    build_fixed_tables (gzio);
+  else if (gzio->block_len && gzio->block_type == INFLATE_DYNAMIC)
+    build_dynamic_tables (gzio, gzio->lens, gzio->nl, gzio->nd);
+
+  if (grub_errno != GRUB_ERR_NONE)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      initialize_tables (gzio);
+      return 0;
+    }
+
+  return 1;
+}
+
+static void
+free_index (grub_gzio_t gzio)
+{
+  unsigned i;
+
+  for (i = 0; i < gzio->index_num; i++)
+    grub_free (gzio->index[i]);
+  gzio->index_num = 0;
+}
+
 static void
 inflate_window (grub_gzio_t gzio)
 {
@@ -1075,18 +1366,45 @@ inflate_window (grub_gzio_t gzio)
        */
       if (gzio->block_type == INFLATE_STORED)
 	{
-	  int w = gzio->wp;
+	  unsigned w = gzio->wp;
 
 	  /*
-	   *  This is basically a glorified pass-through
+	   *  This is basically a glorified pass-through, the bytes read
+	   *  ahead into the bit buffer coming first.
 	   */
 
-	  while (gzio->block_len && w < WSIZE && grub_errno == GRUB_ERR_NONE)
+	  while (gzio->block_len && w < WSIZE && gzio->bk >= 8)
 	    {
-	      gzio->slide[w++] = get_byte (gzio);
+	      gzio->slide[w++] = (uch) gzio->bb;
+	      gzio->bb >>= 8;
+	      gzio->bk -= 8;
 	      gzio->block_len--;
 	    }
 
+	  while (gzio->block_len && w < WSIZE && grub_errno == GRUB_ERR_NONE)
+	    {
+	      const grub_uint8_t *p;
+	      grub_size_t n;
+
+	      p = buffered_input (gzio, &n);
+	      if (n > (unsigned) gzio->block_len)
+		n = gzio->block_len;
+	      if (n > WSIZE - w)
+		n = WSIZE - w;
+	      if (n)
+		{
+		  grub_memcpy (gzio->slide + w, p, n);
+		  skip_input (gzio, n);
+		}
+	      else
+		{
+		  gzio->slide[w] = get_byte (gzio);
+		  n = 1;
+		}
+	      w += n;
+	      gzio->block_len -= n;
+	    }
+
 	  gzio->wp = w;
 
 	  continue;
@@ -1096,13 +1414,7 @@ inflate_window (grub_gzio_t gzio)
        *  Expand other kind of block.
        */
 
-      if (inflate_codes_in_window (gzio))
-	{
-	  huft_free (gzio->tl);
-	  huft_free (gzio->td);
-	  gzio->tl = 0;
-	  gzio->td = 0;
-	}
+      inflate_codes_in_window (gzio);
     }
 
   gzio->saved_offset += gzio->wp;
@@ -1115,15 +1427,16 @@ inflate_window (grub_gzio_t gzio)
 	{
 	  grub_uint32_t csum;
 
-	  gzio->hdesc->final (gzio->hcontext);
-	  csum = grub_get_unaligned32 (gzio->hdesc->read (gzio->hcontext));
-	  csum = grub_be_to_cpu32 (csum);
+	  csum = gzio_crc (gzio);
 	  if (csum != gzio->orig_checksum)
 	    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 			"checksum mismatch %08x/%08x",
 			gzio->orig_checksum, csum);
 	}
     }
+
+  if (gzio->wp == WSIZE && grub_errno == GRUB_ERR_NONE)
+    add_checkpoint (gzio);
 }
 
 
@@ -1131,6 +1444,8 @@ static void
 initialize_tables (grub_gzio_t gzio)
 {
   gzio->saved_offset = 0;
+  gzio->crc_base = 0;
+  gzio->crc_base_len = 0;
   gzio_seek (gzio, gzio->data_offset);
 
   /* Initialize the bit buffer.  */
@@ -1141,17 +1456,153 @@ initialize_tables (grub_gzio_t gzio)
   gzio->last_block = 0;
   gzio->block_len = 0;
 
-  /* Reset memory allocation stuff.  */
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
-  gzio->tl = NULL;
-  gzio->td = NULL;
-
   if (gzio->hcontext)
     gzio->hdesc->init(gzio->hcontext);
 }
 
 
+static void
+index_entry_swap (struct grub_gzio_index_entry *dst,
+		  const struct grub_gzio_index_entry *src, int to_disk)
+{
+  grub_memcpy (dst, src, sizeof (*dst));
+  if (to_disk)
+    {
+      dst->out_offset = grub_cpu_to_le64 (src->out_offset);
+      dst->in_offset = grub_cpu_to_le64 (src->in_offset);
+      dst->bb = grub_cpu_to_le64 (src->bb);
+      dst->bk = grub_cpu_to_le32 (src->bk);
+      dst->block_type = grub_cpu_to_le32 (src->block_type);
+      dst->block_len = grub_cpu_to_le32 (src->block_len);
+      dst->last_block = grub_cpu_to_le32 (src->last_block);
+      dst->code_state = grub_cpu_to_le32 (src->code_state);
+      dst->inflate_n = grub_cpu_to_le32 (src->inflate_n);
+      dst->inflate_d = grub_cpu_to_le32 (src->inflate_d);
+      dst->crc = grub_cpu_to_le32 (src->crc);
+      dst->nl = grub_cpu_to_le16 (src->nl);
+      dst->nd = grub_cpu_to_le16 (src->nd);
+    }
+  else
+    {
+      dst->out_offset = grub_le_to_cpu64 (src->out_offset);
+      dst->in_offset = grub_le_to_cpu64 (src->in_offset);
+      dst->bb = grub_le_to_cpu64 (src->bb);
+      dst->bk = grub_le_to_cpu32 (src->bk);
+      dst->block_type = grub_le_to_cpu32 (src->block_type);
+      dst->block_len = grub_le_to_cpu32 (src->block_len);
+      dst->last_block = grub_le_to_cpu32 (src->last_block);
+      dst->code_state = grub_le_to_cpu32 (src->code_state);
+      dst->inflate_n = grub_le_to_cpu32 (src->inflate_n);
+      dst->inflate_d = grub_le_to_cpu32 (src->inflate_d);
+      dst->crc = grub_le_to_cpu32 (src->crc);
+      dst->nl = grub_le_to_cpu16 (src->nl);
+      dst->nd = grub_le_to_cpu16 (src->nd);
+    }
+}
+
+static void
+index_header_init (grub_gzio_t gzio, struct grub_gzio_index_header *hdr)
+{
+  grub_memcpy (hdr->magic, GRUB_GZIO_INDEX_MAGIC, sizeof (hdr->magic));
+  hdr->compressed_size = grub_cpu_to_le64 (grub_file_size (gzio->file));
+  hdr->data_offset = grub_cpu_to_le64 (gzio->data_offset);
+  hdr->orig_checksum = grub_cpu_to_le32 (gzio->orig_checksum);
+  hdr->orig_len = grub_cpu_to_le32 (gzio->orig_len);
+  hdr->count = grub_cpu_to_le32 (gzio->index_num);
+  hdr->window_size = grub_cpu_to_le32 (WSIZE);
+}
+
+/* Return whether the restored checkpoint E can be resumed from safely.  The
+   lengths must be checked before they reach huft_build, the rest before
+   they index the window or the bit buffer.  */
+
+static int
+index_entry_valid (const struct grub_gzio_index_entry *e)
+{
+  unsigned i;
+
+  if (e->out_offset & (WSIZE - 1)
+      || e->bk >= 8 * sizeof (e->bb)
+      || e->block_type > INFLATE_DYNAMIC
+      || e->block_len > 0xffff
+      || e->code_state > 1
+      || e->inflate_n > 258
+      || e->nl > 286 || e->nd > 30)
+    return 0;
+
+  for (i = 0; i < e->nl + e->nd; i++)
+    if (e->lens[i] > 15)
+      return 0;
+
+  return 1;
+}
+
+/* Load the checkpoints of the file NAME from NAME.gzi, if there is an index
+   file matching it.  Only the CRC32 at the end of the file vouches for the
+   resumed output, so this is limited to the files allowed by
+   grub_gzio_open.  */
+
+static void
+load_index (grub_gzio_t gzio, const char *name)
+{
+  struct grub_gzio_index_header hdr, expected;
+  struct grub_gzio_index_entry e;
+  struct grub_gzio_checkpoint *cp;
+  grub_file_t index;
+  char *index_name;
+  grub_uint32_t count, i;
+
+  index_name = grub_xasprintf ("%s" GRUB_GZIO_INDEX_SUFFIX, name);
+  if (! index_name)
+    goto quit;
+  index = grub_file_open (index_name, GRUB_FILE_TYPE_LOOPBACK
+			  | GRUB_FILE_TYPE_NO_DECOMPRESS);
+  grub_free (index_name);
+  if (! index)
+    goto quit;
+
+  index_header_init (gzio, &expected);
+  if (grub_file_read (index, &hdr, sizeof (hdr)) != sizeof (hdr))
+    goto close;
+  count = grub_le_to_cpu32 (hdr.count);
+  hdr.count = expected.count;
+  if (grub_memcmp (&hdr, &expected, sizeof (hdr)) != 0
+      || count > GRUB_GZIO_INDEX_MAX)
+    goto close;
+
+  for (i = 0; i < count; i++)
+    {
+      cp = grub_malloc (sizeof (*cp));
+      if (! cp)
+	break;
+      if (grub_file_read (index, &e, sizeof (e)) != sizeof (e)
+	  || grub_file_read (index, cp->slide, WSIZE) != WSIZE)
+	{
+	  grub_free (cp);
+	  break;
+	}
+      index_entry_swap (&cp->entry, &e, 0);
+      if (! index_entry_valid (&cp->entry)
+	  || (gzio->index_num && cp->entry.out_offset
+	      <= gzio->index[gzio->index_num - 1]->entry.out_offset))
+	{
+	  grub_free (cp);
+	  break;
+	}
+      gzio->index[gzio->index_num++] = cp;
+    }
+
+  if (i != count)
+    free_index (gzio);
+  else
+    grub_dprintf ("gzio", "loaded %u checkpoints for %s\n", count, name);
+
+ close:
+  grub_file_close (index);
+ quit:
+  grub_errno = GRUB_ERR_NONE;
+}
+
 /* Open a new decompressing object on the top of IO. If TRANSPARENT is true,
    even if IO does not contain data compressed by gzip, return a valid file
    object. Note that this function won't close IO, even if an error occurs.  */
@@ -1160,6 +1611,7 @@ grub_gzio_open (grub_file_t io, enum grub_file_type type)
 {
   grub_file_t file;
   grub_gzio_t gzio = 0;
+  const char *interval;
 
   if (type & GRUB_FILE_TYPE_NO_DECOMPRESS)
     return io;
@@ -1196,6 +1648,29 @@ grub_gzio_open (grub_file_t io, enum grub_file_type type)
       return io;
     }
 
+  gzio->index_active
+    = (type & GRUB_FILE_TYPE_MASK) == GRUB_FILE_TYPE_LOOPBACK;
+  gzio->index_interval = GRUB_GZIO_INDEX_INTERVAL;
+  interval = grub_env_get ("gzio_index_interval");
+  if (interval)
+    {
+      gzio->index_interval = grub_strtoull (interval, 0, 0) << 20;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  /* Small files inflate from the start fast enough.  A saved index is only
+     trusted for disk images and when asked for, since it is not covered by
+     the verifiers of the file.  */
+  if (gzio->index_interval && gzio->hcontext && io->name
+      && (type & GRUB_FILE_TYPE_MASK) == GRUB_FILE_TYPE_LOOPBACK
+      && grub_file_size (io) >= gzio->index_interval)
+    {
+      const char *use = grub_env_get ("gzio_use_index");
+
+      if (use && grub_strcmp (use, "1") == 0)
+	load_index (gzio, io->name);
+    }
+
   return file;
 }
 
@@ -1257,9 +1732,20 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 {
   grub_ssize_t ret = 0;
 
-  /* Do we reset decompression to the beginning of the file?  */
-  if (gzio->saved_offset > offset + WSIZE)
-    initialize_tables (gzio);
+  struct grub_gzio_checkpoint *cp;
+
+  /* Do we resume decompression from a checkpoint, or reset it to the
+     beginning of the file?  The window holds the WP bytes before
+     SAVED_OFFSET, fewer than WSIZE after the last one.  */
+  cp = find_checkpoint (gzio, offset);
+  if (offset + gzio->wp < gzio->saved_offset)
+    {
+      gzio->index_active = 1;
+      if (! cp || ! restore_checkpoint (gzio, cp))
+	initialize_tables (gzio);
+    }
+  else if (cp && cp->entry.out_offset > gzio->saved_offset)
+    restore_checkpoint (gzio, cp);
 
   /*
    *  This loop operates upon uncompressed data only.  The only
@@ -1323,8 +1809,7 @@ grub_gzio_close (grub_file_t file)
   grub_gzio_t gzio = file->data;
 
   grub_file_close (gzio->file);
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
+  free_index (gzio);
   grub_free (gzio->hcontext);
   grub_free (gzio);
 
@@ -1386,6 +1871,101 @@ grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 
 
 
+/* Inflate the whole gzip file ARGS[0] and write its checkpoints to the
+   existing file ARGS[1], which is overwritten in place.  */
+static grub_err_t
+grub_cmd_gzindex (grub_command_t cmd __attribute__ ((unused)),
+		  int argc, char **args)
+{
+  struct grub_gzio_index_header hdr;
+  struct grub_gzio_index_entry e;
+  grub_file_t file, out = 0;
+  grub_gzio_t gzio;
+  grub_off_t size;
+  char *buf;
+  unsigned i;
+
+  if (argc != 2)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("two arguments expected"));
+
+  if (! grub_disk_write_weak)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "disk write support isn't loaded");
+
+  file = grub_file_open (args[0], GRUB_FILE_TYPE_LOOPBACK);
+  if (! file)
+    return grub_errno;
+  if (file->fs != &grub_gzio_fs)
+    {
+      grub_file_close (file);
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE, "`%s' is not a gzip file",
+			 args[0]);
+    }
+  gzio = file->data;
+  gzio->index_active = 1;
+  gzio->index_interval = grub_file_size (file) / GRUB_GZIO_INDEX_MAX;
+  if (gzio->index_interval < GRUB_GZIO_INDEX_INTERVAL)
+    gzio->index_interval = GRUB_GZIO_INDEX_INTERVAL;
+  free_index (gzio);
+  initialize_tables (gzio);
+
+  buf = grub_malloc (GRUB_GZIO_INDEX_INTERVAL);
+  if (! buf)
+    goto fail;
+  while (grub_file_read (file, buf, GRUB_GZIO_INDEX_INTERVAL) > 0);
+  grub_free (buf);
+  if (grub_errno)
+    goto fail;
+
+  size = sizeof (hdr) + (grub_off_t) gzio->index_num * (sizeof (e) + WSIZE);
+  out = grub_file_open (args[1], GRUB_FILE_TYPE_SAVEENV
+			| GRUB_FILE_TYPE_NO_DECOMPRESS);
+  if (! out)
+    goto fail;
+  if (grub_file_size (out) < size)
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE,
+		  "index needs %llu bytes but `%s' has only %llu",
+		  (unsigned long long) size, args[1],
+		  (unsigned long long) grub_file_size (out));
+      goto fail;
+    }
+  if (! grub_blocklist_convert (out))
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE,
+		  "`%s' can't be written as a blocklist", args[1]);
+      goto fail;
+    }
+
+  index_header_init (gzio, &hdr);
+  if (grub_blocklist_write (out, (char *) &hdr, sizeof (hdr)) != sizeof (hdr))
+    goto fail;
+  out->offset += sizeof (hdr);
+  for (i = 0; i < gzio->index_num; i++)
+    {
+      index_entry_swap (&e, &gzio->index[i]->entry, 1);
+      if (grub_blocklist_write (out, (char *) &e, sizeof (e)) != sizeof (e))
+	goto fail;
+      out->offset += sizeof (e);
+      if (grub_blocklist_write (out, (char *) gzio->index[i]->slide, WSIZE)
+	  != WSIZE)
+	goto fail;
+      out->offset += WSIZE;
+    }
+
+  grub_printf ("%u checkpoints written to %s\n", gzio->index_num, args[1]);
+
+ fail:
+  if (! grub_errno && out && out->offset != size)
+    grub_error (GRUB_ERR_WRITE_ERROR, "failed to write `%s'", args[1]);
+  if (out)
+    grub_file_close (out);
+  grub_file_close (file);
+  return grub_errno;
+}
+
+static grub_command_t cmd;
+
 static struct grub_fs grub_gzio_fs =
   {
     .name = "gzio",
@@ -1400,9 +1980,14 @@ static struct grub_fs grub_gzio_fs =
 GRUB_MOD_INIT(gzio)
 {
   grub_file_filter_register (GRUB_FILE_FILTER_GZIO, grub_gzio_open);
+  cmd = grub_register_command ("gzindex", grub_cmd_gzindex,
+			       N_("FILE INDEX_FILE"),
+			       N_("Write the random access index of a gzip"
+				  " file to an existing file."));
 }
 
 GRUB_MOD_FINI(gzio)
 {
   grub_file_filter_unregister (GRUB_FILE_FILTER_GZIO);
+  grub_unregister_command (cmd);
 }
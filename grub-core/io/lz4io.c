@@ -0,0 +1,655 @@
+/* lz4io.c - decompression support for lz4 */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define XXH_STATIC_LINKING_ONLY
+#include <xxhash.h>
+
+#define LZ4IO_MAGIC		0x184D2204
+#define LZ4IO_LEGACY_MAGIC	0x184C2102
+#define LZ4IO_SKIPPABLE_MAGIC	0x184D2A50
+#define LZ4IO_SKIPPABLE_MASK	0xfffffff0
+
+/* Frame descriptor flags.  */
+#define LZ4IO_FLG_VERSION_MASK	0xc0
+#define LZ4IO_FLG_VERSION	0x40
+#define LZ4IO_FLG_BLOCK_INDEP	0x20
+#define LZ4IO_FLG_BLOCK_CHECKSUM	0x10
+#define LZ4IO_FLG_CONTENT_SIZE	0x08
+#define LZ4IO_FLG_CONTENT_CHECKSUM	0x04
+#define LZ4IO_FLG_RESERVED	0x02
+#define LZ4IO_FLG_DICT_ID	0x01
+#define LZ4IO_BD_MASK		0x70
+#define LZ4IO_BD_SHIFT		4
+
+#define LZ4IO_BLOCK_UNCOMPRESSED	0x80000000
+#define LZ4IO_LEGACY_BLOCK_SIZE		(8 << 20)
+
+/* Window kept in front of a block so that linked blocks can refer to the
+   output of the previous ones.  */
+#define LZ4IO_PREFIX_SIZE	(GRUB_LZ4_MAX_DISTANCE + 1)
+
+struct grub_lz4io_frame
+{
+  grub_size_t first_block;
+  grub_uint32_t block_max;
+  grub_uint8_t flags;
+  int legacy;
+  /* Offset of the content checksum, if any.  */
+  grub_off_t checksum_offset;
+};
+
+/* Every block of a frame but the last decompresses to BLOCK_MAX bytes.  */
+struct grub_lz4io_block
+{
+  grub_off_t in_offset;
+  grub_off_t out_offset;
+  grub_size_t frame;
+};
+
+struct grub_lz4io
+{
+  grub_file_t file;
+  /* NUM_BLOCKS entries, plus one for the end of the stream.  */
+  struct grub_lz4io_block *blocks;
+  grub_size_t num_blocks;
+  grub_size_t alloc_blocks;
+  struct grub_lz4io_frame *frames;
+  grub_size_t num_frames;
+  grub_size_t alloc_frames;
+  grub_uint32_t block_max;
+  grub_uint8_t *cbuf;
+  /* LZ4IO_PREFIX_SIZE bytes of earlier output followed by the block.  */
+  grub_uint8_t *window;
+  /* Block whose data is in the window, or NUM_BLOCKS.  */
+  grub_size_t cur;
+  grub_size_t cur_len;
+  /* Next block to feed into the content checksum, or NUM_BLOCKS if a
+     block of the current frame was skipped.  */
+  grub_size_t hash_next;
+  XXH32_state_t hash;
+};
+
+typedef struct grub_lz4io *grub_lz4io_t;
+static struct grub_fs grub_lz4io_fs;
+
+static int
+read_at (grub_file_t file, grub_off_t offset, void *buf, grub_size_t len)
+{
+  if (offset > file->size || len > file->size - offset)
+    return 0;
+  grub_file_seek (file, offset);
+  return grub_file_read (file, buf, len) == (grub_ssize_t) len;
+}
+
+static int
+read_u32 (grub_file_t file, grub_off_t offset, grub_uint32_t *val)
+{
+  if (! read_at (file, offset, val, sizeof (*val)))
+    return 0;
+  *val = grub_le_to_cpu32 (*val);
+  return 1;
+}
+
+static grub_err_t
+add_block (grub_lz4io_t lz4io, grub_off_t in_offset, grub_off_t out_offset)
+{
+  struct grub_lz4io_block *blocks;
+  grub_size_t n;
+
+  if (lz4io->num_blocks == lz4io->alloc_blocks)
+    {
+      n = lz4io->alloc_blocks ? lz4io->alloc_blocks * 2 : 64;
+      blocks = grub_realloc (lz4io->blocks, n * sizeof (*blocks));
+      if (! blocks)
+	return grub_errno;
+      lz4io->blocks = blocks;
+      lz4io->alloc_blocks = n;
+    }
+
+  blocks = &lz4io->blocks[lz4io->num_blocks++];
+  blocks->in_offset = in_offset;
+  blocks->out_offset = out_offset;
+  blocks->frame = lz4io->num_frames - 1;
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_lz4io_frame *
+add_frame (grub_lz4io_t lz4io, grub_uint32_t block_max, grub_uint8_t flags,
+	   int legacy)
+{
+  struct grub_lz4io_frame *frames;
+  grub_uint8_t *buf;
+  grub_size_t n;
+
+  /* The buffers only grow as large as the blocks of the frames seen.  */
+  if (block_max > lz4io->block_max)
+    {
+      buf = grub_realloc (lz4io->cbuf, block_max + 0x10000);
+      if (! buf)
+	return 0;
+      lz4io->cbuf = buf;
+      buf = grub_realloc (lz4io->window, LZ4IO_PREFIX_SIZE + block_max);
+      if (! buf)
+	return 0;
+      if (! lz4io->window)
+	grub_memset (buf, 0, LZ4IO_PREFIX_SIZE);
+      lz4io->window = buf;
+      lz4io->block_max = block_max;
+    }
+
+  if (lz4io->num_frames == lz4io->alloc_frames)
+    {
+      n = lz4io->alloc_frames ? lz4io->alloc_frames * 2 : 4;
+      frames = grub_realloc (lz4io->frames, n * sizeof (*frames));
+      if (! frames)
+	return 0;
+      lz4io->frames = frames;
+      lz4io->alloc_frames = n;
+    }
+
+  frames = &lz4io->frames[lz4io->num_frames++];
+  frames->first_block = lz4io->num_blocks;
+  frames->block_max = block_max;
+  frames->flags = flags;
+  frames->legacy = legacy;
+  frames->checksum_offset = 0;
+  return frames;
+}
+
+static int
+frame_is_linked (struct grub_lz4io_frame *frame)
+{
+  return ! frame->legacy && ! (frame->flags & LZ4IO_FLG_BLOCK_INDEP);
+}
+
+/* Read block I into CBUF and check its checksum.  Return the number of
+   bytes stored, with LZ4IO_BLOCK_UNCOMPRESSED set for stored blocks.  */
+static grub_ssize_t
+load_block (grub_lz4io_t lz4io, grub_size_t i)
+{
+  struct grub_lz4io_block *b = &lz4io->blocks[i];
+  struct grub_lz4io_frame *f = &lz4io->frames[b->frame];
+  grub_uint32_t csize, sum;
+
+  if (! read_u32 (lz4io->file, b->in_offset, &csize))
+    goto corrupted;
+
+  if (f->legacy)
+    csize &= ~LZ4IO_BLOCK_UNCOMPRESSED;
+  if ((csize & ~LZ4IO_BLOCK_UNCOMPRESSED) > lz4io->block_max + 0x10000
+      || ! read_at (lz4io->file, b->in_offset + 4, lz4io->cbuf,
+		    csize & ~LZ4IO_BLOCK_UNCOMPRESSED))
+    goto corrupted;
+
+  if (f->flags & LZ4IO_FLG_BLOCK_CHECKSUM)
+    {
+      if (! read_u32 (lz4io->file, lz4io->file->offset, &sum)
+	  || XXH32 (lz4io->cbuf, csize & ~LZ4IO_BLOCK_UNCOMPRESSED, 0) != sum)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      N_("lz4 block checksum mismatch"));
+	  return -1;
+	}
+    }
+
+  return csize;
+
+ corrupted:
+  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("lz4 file corrupted"));
+  return -1;
+}
+
+/* Decompress the loaded block to DEST, preceded by PREFIX_LEN bytes of
+   earlier output.  */
+static grub_ssize_t
+expand_block (grub_lz4io_t lz4io, grub_uint32_t csize, grub_uint8_t *dest,
+	      grub_size_t d_len, grub_size_t prefix_len)
+{
+  grub_ssize_t ret;
+
+  if (csize & LZ4IO_BLOCK_UNCOMPRESSED)
+    {
+      csize &= ~LZ4IO_BLOCK_UNCOMPRESSED;
+      if (csize > d_len)
+	goto corrupted;
+      grub_memcpy (dest, lz4io->cbuf, csize);
+      return csize;
+    }
+
+  ret = grub_lz4_decompress_block (lz4io->cbuf, csize, dest, d_len,
+				   prefix_len);
+  if (ret >= 0)
+    return ret;
+
+ corrupted:
+  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("lz4 file corrupted"));
+  return -1;
+}
+
+/* Find the uncompressed size of the last block of the current frame.
+   Matches into earlier blocks only need some prefix to point at.  */
+static grub_ssize_t
+measure_block (grub_lz4io_t lz4io, grub_size_t i)
+{
+  grub_ssize_t csize;
+
+  csize = load_block (lz4io, i);
+  if (csize < 0)
+    return -1;
+  return expand_block (lz4io, csize, lz4io->window + LZ4IO_PREFIX_SIZE,
+		       lz4io->frames[lz4io->blocks[i].frame].block_max,
+		       LZ4IO_PREFIX_SIZE - 1);
+}
+
+/* Parse the frame starting at *OFFSET and add its blocks.  */
+static grub_err_t
+scan_frame (grub_lz4io_t lz4io, grub_off_t *offset, grub_off_t *out)
+{
+  grub_file_t io = lz4io->file;
+  struct grub_lz4io_frame *f;
+  grub_uint8_t desc[2 + 8 + 4 + 1];
+  grub_uint64_t content_size = 0;
+  grub_uint32_t block_max, size, magic;
+  grub_off_t in = *offset + 4, start = *out;
+  grub_size_t desc_len;
+  grub_ssize_t last;
+  int legacy;
+
+  if (! read_u32 (io, *offset, &magic))
+    goto corrupted;
+
+  legacy = (magic == LZ4IO_LEGACY_MAGIC);
+  if (legacy)
+    {
+      block_max = LZ4IO_LEGACY_BLOCK_SIZE;
+      desc[0] = LZ4IO_FLG_BLOCK_INDEP;
+    }
+  else
+    {
+      if (! read_at (io, in, desc, 2))
+	goto corrupted;
+      if ((desc[0] & LZ4IO_FLG_VERSION_MASK) != LZ4IO_FLG_VERSION
+	  || (desc[0] & LZ4IO_FLG_RESERVED) || (desc[1] & ~LZ4IO_BD_MASK)
+	  || ((desc[1] & LZ4IO_BD_MASK) >> LZ4IO_BD_SHIFT) < 4)
+	goto corrupted;
+      /* Frames compressed against an external dictionary can't be read
+	 on their own.  */
+      if (desc[0] & LZ4IO_FLG_DICT_ID)
+	return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			   "lz4 dictionaries aren't supported");
+
+      block_max = 1 << (2 * ((desc[1] & LZ4IO_BD_MASK) >> LZ4IO_BD_SHIFT) + 8);
+      desc_len = 2 + ((desc[0] & LZ4IO_FLG_CONTENT_SIZE) ? 8 : 0);
+      if (! read_at (io, in, desc, desc_len + 1)
+	  || ((XXH32 (desc, desc_len, 0) >> 8) & 0xff) != desc[desc_len])
+	goto corrupted;
+      if (desc[0] & LZ4IO_FLG_CONTENT_SIZE)
+	content_size = grub_le_to_cpu64 (grub_get_unaligned64 (desc + 2));
+      in += desc_len + 1;
+    }
+
+  f = add_frame (lz4io, block_max, desc[0], legacy);
+  if (! f)
+    return grub_errno;
+
+  while (1)
+    {
+      if (legacy && in == io->size)
+	break;
+      if (! read_u32 (io, in, &size))
+	goto corrupted;
+      if (legacy && (size == LZ4IO_LEGACY_MAGIC || size == 0))
+	break;
+      if (! legacy && size == 0)
+	{
+	  in += 4;
+	  break;
+	}
+      if (legacy)
+	size &= ~LZ4IO_BLOCK_UNCOMPRESSED;
+      if ((size & ~LZ4IO_BLOCK_UNCOMPRESSED) > block_max + 0x10000)
+	goto corrupted;
+
+      if (add_block (lz4io, in, *out))
+	return grub_errno;
+      in += 4 + (size & ~LZ4IO_BLOCK_UNCOMPRESSED);
+      if (f->flags & LZ4IO_FLG_BLOCK_CHECKSUM)
+	in += 4;
+      *out += block_max;
+    }
+
+  if (f->flags & LZ4IO_FLG_CONTENT_CHECKSUM)
+    {
+      f->checksum_offset = in;
+      in += 4;
+    }
+  if (in > io->size)
+    goto corrupted;
+  *offset = in;
+
+  if (lz4io->num_blocks == f->first_block)
+    return GRUB_ERR_NONE;
+
+  /* Only the last block can be short.  */
+  *out -= block_max;
+  if (f->flags & LZ4IO_FLG_CONTENT_SIZE)
+    last = content_size - (*out - start);
+  else
+    last = measure_block (lz4io, lz4io->num_blocks - 1);
+  if (last < 0 || last > block_max)
+    goto corrupted;
+  *out += last;
+  return GRUB_ERR_NONE;
+
+ corrupted:
+  return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("lz4 file corrupted"));
+}
+
+static grub_err_t
+scan_frames (grub_lz4io_t lz4io)
+{
+  grub_file_t io = lz4io->file;
+  grub_off_t in = 0, out = 0;
+  grub_uint32_t magic, size;
+
+  while (in < io->size)
+    {
+      if (! read_u32 (io, in, &magic))
+	return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			   N_("lz4 file corrupted"));
+
+      if ((magic & LZ4IO_SKIPPABLE_MASK) == LZ4IO_SKIPPABLE_MAGIC)
+	{
+	  if (! read_u32 (io, in + 4, &size))
+	    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			       N_("lz4 file corrupted"));
+	  in += 8 + (grub_off_t) size;
+	  continue;
+	}
+
+      /* Initrds may be followed by padding.  */
+      if (magic != LZ4IO_MAGIC && magic != LZ4IO_LEGACY_MAGIC
+	  && lz4io->num_frames)
+	break;
+
+      if (scan_frame (lz4io, &in, &out))
+	return grub_errno;
+    }
+
+  return add_block (lz4io, in, out);
+}
+
+static grub_size_t
+find_block (grub_lz4io_t lz4io, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = lz4io->num_blocks, mid;
+
+  while (hi - lo > 1)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (lz4io->blocks[mid].out_offset <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static grub_size_t
+block_len (grub_lz4io_t lz4io, grub_size_t i)
+{
+  return lz4io->blocks[i + 1].out_offset - lz4io->blocks[i].out_offset;
+}
+
+/* Decompress block I to DEST, or into the window if DEST is NULL.  */
+static grub_err_t
+decode_block (grub_lz4io_t lz4io, grub_size_t i, grub_uint8_t *dest)
+{
+  struct grub_lz4io_frame *f = &lz4io->frames[lz4io->blocks[i].frame];
+  grub_size_t len = block_len (lz4io, i), prefix = 0;
+  grub_ssize_t csize, ret;
+  grub_uint32_t sum;
+
+  if (frame_is_linked (f) && i != f->first_block)
+    {
+      /* Linked blocks need the previous block in the window.  */
+      if (lz4io->cur != i - 1)
+	{
+	  grub_size_t j = f->first_block;
+
+	  if (lz4io->cur >= j && lz4io->cur < i)
+	    j = lz4io->cur + 1;
+	  for (; j < i; j++)
+	    if (decode_block (lz4io, j, 0))
+	      return grub_errno;
+	}
+      prefix = lz4io->cur_len + LZ4IO_PREFIX_SIZE - 1;
+      if (prefix > LZ4IO_PREFIX_SIZE - 1)
+	prefix = LZ4IO_PREFIX_SIZE - 1;
+      grub_memmove (lz4io->window + LZ4IO_PREFIX_SIZE - prefix,
+		    lz4io->window + LZ4IO_PREFIX_SIZE + lz4io->cur_len - prefix,
+		    prefix);
+      dest = 0;
+    }
+
+  lz4io->cur = lz4io->num_blocks;
+  if (! dest)
+    dest = lz4io->window + LZ4IO_PREFIX_SIZE;
+
+  csize = load_block (lz4io, i);
+  if (csize < 0)
+    return grub_errno;
+  ret = expand_block (lz4io, csize, dest, len, prefix);
+  if (ret < 0)
+    return grub_errno;
+  if ((grub_size_t) ret != len)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("lz4 block has an unexpected size"));
+
+  if (dest == lz4io->window + LZ4IO_PREFIX_SIZE)
+    {
+      lz4io->cur = i;
+      lz4io->cur_len = len;
+    }
+
+  if (! (f->flags & LZ4IO_FLG_CONTENT_CHECKSUM))
+    return GRUB_ERR_NONE;
+
+  /* The content checksum can only be checked after reading the frame in
+     order.  */
+  if (i == f->first_block)
+    {
+      XXH32_reset (&lz4io->hash, 0);
+      lz4io->hash_next = i;
+    }
+  if (lz4io->hash_next != i)
+    {
+      lz4io->hash_next = lz4io->num_blocks;
+      return GRUB_ERR_NONE;
+    }
+  XXH32_update (&lz4io->hash, dest, len);
+  lz4io->hash_next = i + 1;
+
+  if (lz4io->blocks[i + 1].in_offset < f->checksum_offset)
+    return GRUB_ERR_NONE;
+  if (! read_u32 (lz4io->file, f->checksum_offset, &sum)
+      || XXH32_digest (&lz4io->hash) != sum)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("lz4 content checksum mismatch"));
+  return GRUB_ERR_NONE;
+}
+
+static grub_file_t
+grub_lz4io_open (grub_file_t io, enum grub_file_type type)
+{
+  grub_file_t file;
+  grub_lz4io_t lz4io;
+  grub_uint32_t magic;
+
+  if (type & GRUB_FILE_TYPE_NO_DECOMPRESS)
+    return io;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+
+  if (grub_file_read (io, &magic, sizeof (magic)) != sizeof (magic)
+      || (grub_le_to_cpu32 (magic) != LZ4IO_MAGIC
+	  && grub_le_to_cpu32 (magic) != LZ4IO_LEGACY_MAGIC
+	  && ((grub_le_to_cpu32 (magic) & LZ4IO_SKIPPABLE_MASK)
+	      != LZ4IO_SKIPPABLE_MAGIC)))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (! file)
+    return 0;
+
+  lz4io = grub_zalloc (sizeof (*lz4io));
+  if (! lz4io)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  lz4io->file = io;
+
+  file->device = io->device;
+  file->data = lz4io;
+  file->fs = &grub_lz4io_fs;
+
+  if (scan_frames (lz4io) || ! lz4io->num_frames)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (lz4io->blocks);
+      grub_free (lz4io->frames);
+      grub_free (lz4io->cbuf);
+      grub_free (lz4io->window);
+      grub_free (lz4io);
+      grub_free (file);
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  lz4io->num_blocks--;
+  lz4io->cur = lz4io->hash_next = lz4io->num_blocks;
+  file->size = lz4io->blocks[lz4io->num_blocks].out_offset;
+  /* Only linked blocks have to be decompressed in order.  */
+  file->not_easily_seekable = 0;
+
+  return file;
+}
+
+static grub_ssize_t
+grub_lz4io_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_lz4io_t lz4io = file->data;
+  grub_off_t offset = file->offset;
+  grub_ssize_t ret = 0;
+  grub_size_t i, n, skip;
+
+  while (len > 0)
+    {
+      i = find_block (lz4io, offset);
+      if (i >= lz4io->num_blocks)
+	break;
+      skip = offset - lz4io->blocks[i].out_offset;
+      n = block_len (lz4io, i) - skip;
+      if (n > len)
+	n = len;
+
+      if (lz4io->cur != i)
+	{
+	  struct grub_lz4io_frame *f
+	    = &lz4io->frames[lz4io->blocks[i].frame];
+
+	  /* Whole independent blocks go straight to the caller.  */
+	  if (skip == 0 && n == block_len (lz4io, i) && ! frame_is_linked (f))
+	    {
+	      if (decode_block (lz4io, i, (grub_uint8_t *) buf))
+		return -1;
+	      goto next;
+	    }
+	  if (decode_block (lz4io, i, 0))
+	    return -1;
+	}
+      grub_memcpy (buf, lz4io->window + LZ4IO_PREFIX_SIZE + skip, n);
+
+    next:
+      buf += n;
+      len -= n;
+      ret += n;
+      offset += n;
+    }
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_lz4io_close (grub_file_t file)
+{
+  grub_lz4io_t lz4io = file->data;
+
+  grub_free (lz4io->blocks);
+  grub_free (lz4io->frames);
+  grub_free (lz4io->cbuf);
+  grub_free (lz4io->window);
+
+  grub_file_close (lz4io->file);
+  grub_free (lz4io);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_lz4io_fs = {
+  .name = "lz4io",
+  .fs_dir = 0,
+  .fs_open = 0,
+  .fs_read = grub_lz4io_read,
+  .fs_close = grub_lz4io_close,
+  .fs_label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (lz4io)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_LZ4IO, grub_lz4io_open);
+}
+
+GRUB_MOD_FINI (lz4io)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_LZ4IO);
+}
@@ -0,0 +1,539 @@
+/* zstdio.c - decompression support for zstd */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+#define ZSTDIO_SKIPPABLE_MASK		0xfffffff0
+#define ZSTDIO_SKIPPABLE_HEADER_SIZE	8
+#define ZSTDIO_BLOCK_HEADER_SIZE	3
+#define ZSTDIO_CHECKSUM_SIZE		4
+
+/* Seekable format, see contrib/seekable_format in the zstd sources.  The
+   seek table is stored in a skippable frame at the end of the file and
+   ends with this footer.  */
+#define ZSTDIO_SEEKABLE_MAGIC		0x8F92EAB1
+#define ZSTDIO_SEEKABLE_SKIPPABLE_MAGIC	0x184D2A5E
+#define ZSTDIO_SEEKABLE_CHECKSUM_FLAG	0x80
+#define ZSTDIO_SEEKABLE_RESERVED	0x7c
+#define ZSTDIO_SEEKABLE_MAX_FRAMES	0x8000000
+
+struct grub_zstdio_seek_footer
+{
+  grub_uint32_t num_frames;
+  grub_uint8_t descriptor;
+  grub_uint32_t magic;
+} GRUB_PACKED;
+
+/* Start of a frame in the compressed and in the decompressed stream.  */
+struct grub_zstdio_frame
+{
+  grub_off_t in_offset;
+  grub_off_t out_offset;
+};
+
+struct grub_zstdio
+{
+  grub_file_t file;
+  ZSTD_DStream *dstream;
+  ZSTD_inBuffer in;
+  grub_uint8_t *inbuf;
+  grub_size_t inbuf_size;
+  grub_uint8_t *outbuf;
+  grub_size_t outbuf_size;
+  /* Decompressed offset the stream is positioned at.  */
+  grub_off_t saved_offset;
+  /* NUM_FRAMES entries, plus one for the end of the stream.  */
+  struct grub_zstdio_frame *frames;
+  grub_size_t num_frames;
+  grub_size_t alloc_frames;
+};
+
+typedef struct grub_zstdio *grub_zstdio_t;
+static struct grub_fs grub_zstdio_fs;
+
+static void *
+grub_zstdio_malloc (void *state __attribute__ ((unused)), size_t size)
+{
+  return grub_malloc (size);
+}
+
+static void
+grub_zstdio_free (void *state __attribute__ ((unused)), void *address)
+{
+  grub_free (address);
+}
+
+static const ZSTD_customMem grub_zstdio_allocator =
+  {
+    .customAlloc = grub_zstdio_malloc,
+    .customFree = grub_zstdio_free,
+    .opaque = NULL
+  };
+
+static int
+read_at (grub_file_t file, grub_off_t offset, void *buf, grub_size_t len)
+{
+  if (offset > file->size || len > file->size - offset)
+    return 0;
+  grub_file_seek (file, offset);
+  return grub_file_read (file, buf, len) == (grub_ssize_t) len;
+}
+
+static grub_err_t
+add_frame (grub_zstdio_t zstdio, grub_off_t in_offset, grub_off_t out_offset)
+{
+  struct grub_zstdio_frame *frames;
+  grub_size_t n;
+
+  if (zstdio->num_frames == zstdio->alloc_frames)
+    {
+      n = zstdio->alloc_frames ? zstdio->alloc_frames * 2 : 16;
+      frames = grub_realloc (zstdio->frames, n * sizeof (*frames));
+      if (! frames)
+	return grub_errno;
+      zstdio->frames = frames;
+      zstdio->alloc_frames = n;
+    }
+
+  zstdio->frames[zstdio->num_frames].in_offset = in_offset;
+  zstdio->frames[zstdio->num_frames].out_offset = out_offset;
+  zstdio->num_frames++;
+  return GRUB_ERR_NONE;
+}
+
+/* Load the frame table of a file in seekable format.  Return 0 if there
+   is no valid seek table.  */
+static int
+read_seek_table (grub_zstdio_t zstdio)
+{
+  grub_file_t io = zstdio->file;
+  struct grub_zstdio_seek_footer footer;
+  grub_uint32_t header[2];
+  grub_uint32_t *entries = 0;
+  grub_off_t table_offset, in = 0, out = 0;
+  grub_size_t entry_size, table_size, i;
+  grub_uint32_t n;
+
+  if (io->size < sizeof (footer) + ZSTDIO_SKIPPABLE_HEADER_SIZE
+      || ! read_at (io, io->size - sizeof (footer), &footer, sizeof (footer))
+      || grub_le_to_cpu32 (footer.magic) != ZSTDIO_SEEKABLE_MAGIC
+      || (footer.descriptor & ZSTDIO_SEEKABLE_RESERVED))
+    return 0;
+
+  n = grub_le_to_cpu32 (footer.num_frames);
+  entry_size = (footer.descriptor & ZSTDIO_SEEKABLE_CHECKSUM_FLAG) ? 12 : 8;
+  if (n == 0 || n > ZSTDIO_SEEKABLE_MAX_FRAMES)
+    return 0;
+  table_size = n * entry_size + sizeof (footer);
+  if (io->size < table_size + ZSTDIO_SKIPPABLE_HEADER_SIZE)
+    return 0;
+  table_offset = io->size - table_size;
+
+  if (! read_at (io, table_offset - ZSTDIO_SKIPPABLE_HEADER_SIZE,
+		 header, sizeof (header))
+      || grub_le_to_cpu32 (header[0]) != ZSTDIO_SEEKABLE_SKIPPABLE_MAGIC
+      || grub_le_to_cpu32 (header[1]) != table_size)
+    return 0;
+
+  entries = grub_malloc (n * entry_size);
+  if (! entries)
+    return 0;
+  if (! read_at (io, table_offset, entries, n * entry_size))
+    goto fail;
+
+  for (i = 0; i < n; i++)
+    {
+      grub_uint32_t *e = (grub_uint32_t *) ((char *) entries + i * entry_size);
+
+      if (add_frame (zstdio, in, out))
+	goto fail;
+      in += grub_le_to_cpu32 (e[0]);
+      out += grub_le_to_cpu32 (e[1]);
+    }
+
+  /* The frames must fill the file up to the seek table.  */
+  if (in != table_offset - ZSTDIO_SKIPPABLE_HEADER_SIZE
+      || add_frame (zstdio, in, out))
+    goto fail;
+
+  grub_free (entries);
+  return 1;
+
+ fail:
+  grub_free (entries);
+  zstdio->num_frames = 0;
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+/* Decompress the frame at OFFSET only to learn its size.  */
+static grub_err_t
+measure_frame (grub_zstdio_t zstdio, grub_off_t offset, grub_off_t end,
+	       grub_uint64_t *size)
+{
+  ZSTD_outBuffer out;
+  grub_size_t ret = 1;
+  grub_ssize_t readret;
+
+  *size = 0;
+  ZSTD_resetDStream (zstdio->dstream);
+  grub_file_seek (zstdio->file, offset);
+  zstdio->in.size = zstdio->in.pos = 0;
+
+  do
+    {
+      if (zstdio->in.pos == zstdio->in.size)
+	{
+	  if (offset == end)
+	    break;
+	  readret = zstdio->inbuf_size;
+	  if ((grub_off_t) readret > end - offset)
+	    readret = end - offset;
+	  readret = grub_file_read (zstdio->file, zstdio->inbuf, readret);
+	  if (readret <= 0)
+	    break;
+	  offset += readret;
+	  zstdio->in.size = readret;
+	  zstdio->in.pos = 0;
+	}
+
+      out.dst = zstdio->outbuf;
+      out.size = zstdio->outbuf_size;
+      out.pos = 0;
+      ret = ZSTD_decompressStream (zstdio->dstream, &out, &zstdio->in);
+      if (ZSTD_isError (ret))
+	break;
+      *size += out.pos;
+    }
+  while (ret);
+
+  if (ret)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("zstd file corrupted"));
+  return GRUB_ERR_NONE;
+}
+
+/* Walk the frame and block headers to find where every frame starts.
+   Only frames that don't record their size are decompressed.  Return 0
+   if the file doesn't contain a zstd frame.  */
+static int
+scan_frames (grub_zstdio_t zstdio)
+{
+  grub_file_t io = zstdio->file;
+  grub_uint8_t hdr[ZSTD_FRAMEHEADERSIZE_MAX];
+  ZSTD_frameHeader fh;
+  grub_off_t in = 0, out = 0, start;
+  grub_uint64_t usize;
+  grub_uint32_t magic, bh;
+  grub_size_t n;
+  int last;
+
+  while (in < io->size)
+    {
+      n = ZSTD_FRAMEHEADERSIZE_MAX;
+      if (n > io->size - in)
+	n = io->size - in;
+      if (n < ZSTDIO_SKIPPABLE_HEADER_SIZE || ! read_at (io, in, hdr, n))
+	goto fail;
+
+      magic = grub_get_unaligned32 (hdr);
+      magic = grub_le_to_cpu32 (magic);
+      if ((magic & ZSTDIO_SKIPPABLE_MASK) == ZSTD_MAGIC_SKIPPABLE_START)
+	{
+	  in += ZSTDIO_SKIPPABLE_HEADER_SIZE
+	    + grub_le_to_cpu32 (grub_get_unaligned32 (hdr + 4));
+	  continue;
+	}
+
+      if (ZSTD_getFrameHeader (&fh, hdr, n) != 0)
+	goto fail;
+
+      start = in;
+      in += fh.headerSize;
+      usize = 0;
+      do
+	{
+	  if (! read_at (io, in, hdr, ZSTDIO_BLOCK_HEADER_SIZE))
+	    goto fail;
+	  bh = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16);
+	  last = bh & 1;
+	  in += ZSTDIO_BLOCK_HEADER_SIZE;
+	  switch ((bh >> 1) & 3)
+	    {
+	    case 0:		/* Raw.  */
+	      in += bh >> 3;
+	      usize += bh >> 3;
+	      break;
+	    case 1:		/* RLE.  */
+	      in += 1;
+	      usize += bh >> 3;
+	      break;
+	    case 2:		/* Compressed.  */
+	      in += bh >> 3;
+	      break;
+	    default:
+	      goto fail;
+	    }
+	}
+      while (! last);
+      if (fh.checksumFlag)
+	in += ZSTDIO_CHECKSUM_SIZE;
+      if (in > io->size)
+	goto fail;
+
+      if (fh.frameContentSize != ZSTD_CONTENTSIZE_UNKNOWN)
+	usize = fh.frameContentSize;
+      else if (measure_frame (zstdio, start, in, &usize))
+	goto fail;
+
+      if (add_frame (zstdio, start, out))
+	goto fail;
+      out += usize;
+    }
+
+  if (zstdio->num_frames && add_frame (zstdio, in, out) == GRUB_ERR_NONE)
+    return 1;
+
+ fail:
+  zstdio->num_frames = 0;
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+/* Return the last frame starting at or before OFFSET.  */
+static grub_size_t
+find_frame (grub_zstdio_t zstdio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = zstdio->num_frames - 1, mid;
+
+  while (hi - lo > 1)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (zstdio->frames[mid].out_offset <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static void
+seek_frame (grub_zstdio_t zstdio, grub_size_t i)
+{
+  ZSTD_resetDStream (zstdio->dstream);
+  grub_file_seek (zstdio->file, zstdio->frames[i].in_offset);
+  zstdio->in.size = zstdio->in.pos = 0;
+  zstdio->saved_offset = zstdio->frames[i].out_offset;
+}
+
+static grub_file_t
+grub_zstdio_open (grub_file_t io, enum grub_file_type type)
+{
+  grub_file_t file;
+  grub_zstdio_t zstdio;
+  grub_uint32_t magic;
+
+  if (type & GRUB_FILE_TYPE_NO_DECOMPRESS)
+    return io;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+
+  if (grub_file_read (io, &magic, sizeof (magic)) != sizeof (magic)
+      || (grub_le_to_cpu32 (magic) != ZSTD_MAGICNUMBER
+	  && ((grub_le_to_cpu32 (magic) & ZSTDIO_SKIPPABLE_MASK)
+	      != ZSTD_MAGIC_SKIPPABLE_START)))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (! file)
+    return 0;
+
+  zstdio = grub_zalloc (sizeof (*zstdio));
+  if (! zstdio)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  zstdio->file = io;
+
+  file->device = io->device;
+  file->data = zstdio;
+  file->fs = &grub_zstdio_fs;
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 1;
+
+  zstdio->inbuf_size = ZSTD_DStreamInSize ();
+  zstdio->outbuf_size = ZSTD_DStreamOutSize ();
+  zstdio->inbuf = grub_malloc (zstdio->inbuf_size);
+  zstdio->outbuf = grub_malloc (zstdio->outbuf_size);
+  zstdio->dstream = ZSTD_createDStream_advanced (grub_zstdio_allocator);
+  if (! zstdio->inbuf || ! zstdio->outbuf || ! zstdio->dstream)
+    goto fail;
+  ZSTD_initDStream (zstdio->dstream);
+  zstdio->in.src = zstdio->inbuf;
+
+  if (! read_seek_table (zstdio) && ! scan_frames (zstdio))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      goto fail;
+    }
+
+  file->size = zstdio->frames[zstdio->num_frames - 1].out_offset;
+  /* Every seekable frame can be decompressed on its own.  */
+  if (zstdio->num_frames > 2)
+    file->not_easily_seekable = 0;
+  seek_frame (zstdio, 0);
+
+  return file;
+
+ fail:
+  ZSTD_freeDStream (zstdio->dstream);
+  grub_free (zstdio->inbuf);
+  grub_free (zstdio->outbuf);
+  grub_free (zstdio->frames);
+  grub_free (zstdio);
+  grub_free (file);
+  if (grub_errno)
+    return 0;
+  grub_file_seek (io, 0);
+  return io;
+}
+
+static grub_ssize_t
+grub_zstdio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_zstdio_t zstdio = file->data;
+  grub_ssize_t ret = 0, readret;
+  grub_size_t zret, i;
+  ZSTD_outBuffer out;
+
+  /* Restart from the frame holding the data if it is behind us, or if
+     it starts after the current position.  */
+  i = find_frame (zstdio, file->offset);
+  if (file->offset < zstdio->saved_offset
+      || zstdio->frames[i].out_offset > zstdio->saved_offset)
+    seek_frame (zstdio, i);
+
+  while (len > 0)
+    {
+      if (zstdio->in.pos == zstdio->in.size)
+	{
+	  readret = grub_file_read (zstdio->file, zstdio->inbuf,
+				    zstdio->inbuf_size);
+	  if (readret < 0)
+	    return -1;
+	  zstdio->in.size = readret;
+	  zstdio->in.pos = 0;
+	}
+
+      /* Decompress straight into BUF once the skipped part is behind.  */
+      out.pos = 0;
+      if (zstdio->saved_offset == file->offset + ret)
+	{
+	  out.dst = buf;
+	  out.size = len;
+	}
+      else
+	{
+	  out.dst = zstdio->outbuf;
+	  out.size = zstdio->outbuf_size;
+	  if (out.size > file->offset - zstdio->saved_offset)
+	    out.size = file->offset - zstdio->saved_offset;
+	}
+
+      zret = ZSTD_decompressStream (zstdio->dstream, &out, &zstdio->in);
+      if (ZSTD_isError (zret))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      N_("zstd file corrupted"));
+	  return -1;
+	}
+
+      /* Nothing left to flush at the end of the input.  */
+      if (out.pos == 0 && zstdio->in.size == 0)
+	break;
+
+      if (out.dst == buf)
+	{
+	  buf += out.pos;
+	  len -= out.pos;
+	  ret += out.pos;
+	}
+      zstdio->saved_offset += out.pos;
+    }
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_zstdio_close (grub_file_t file)
+{
+  grub_zstdio_t zstdio = file->data;
+
+  ZSTD_freeDStream (zstdio->dstream);
+  grub_free (zstdio->inbuf);
+  grub_free (zstdio->outbuf);
+  grub_free (zstdio->frames);
+
+  grub_file_close (zstdio->file);
+  grub_free (zstdio);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_zstdio_fs = {
+  .name = "zstdio",
+  .fs_dir = 0,
+  .fs_open = 0,
+  .fs_read = grub_zstdio_read,
+  .fs_close = grub_zstdio_close,
+  .fs_label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (zstdio)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_ZSTDIO, grub_zstdio_open);
+}
+
+GRUB_MOD_FINI (zstdio)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_ZSTDIO);
+}
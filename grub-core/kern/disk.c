@@ -25,17 +25,41 @@
 #include <grub/time.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL) \
+  && !defined (GRUB_MACHINE_EMU)
+#include <grub/i386/tsc.h>
+#define GRUB_DISK_STAT_HAVE_TSC	1
+#endif
 
 #define	GRUB_CACHE_TIMEOUT	2
 
 /* The last time the disk was used.  */
 static grub_uint64_t grub_last_time = 0;
 
-struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
+/* The cache entries, GRUB_DISK_CACHE_WAYS per set.  */
+static struct grub_disk_cache *grub_disk_cache_table;
+
+/* The number of sets in the cache table, zero if the cache is disabled.  */
+static unsigned grub_disk_cache_sets;
+
+/* One slab of GRUB_DISK_CACHE_WAYS cache units per set. Slabs are allocated
+   on the first store into a set and reused afterwards.  */
+static char **grub_disk_cache_slabs;
+
+/* Monotonic counter used to find the least recently used way of a set.  */
+static grub_uint32_t grub_disk_cache_clock;
+
+/* Whether the cache table has been set up.  */
+static int grub_disk_cache_initialized;
 
 void (*grub_disk_firmware_fini) (void);
 int grub_disk_firmware_is_tainted;
 
+unsigned int grub_disk_readahead_max = GRUB_DISK_READAHEAD_MAX;
+
+/* I/O statistics of every disk opened so far.  */
+struct grub_disk_stat *grub_disk_stat_list;
+
 #if DISK_CACHE_STATS
 static unsigned long grub_disk_cache_hits;
 static unsigned long grub_disk_cache_misses;
@@ -55,37 +79,166 @@ grub_err_t (*grub_disk_write_weak) (grub_disk_t disk,
 				    const void *buf);
 #include "disk_common.c"
 
+#define GRUB_DISK_CACHE_UNIT_SIZE (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS)
+
+static void
+grub_disk_cache_free_table (void)
+{
+  unsigned i;
+
+  if (grub_disk_cache_slabs)
+    for (i = 0; i < grub_disk_cache_sets; i++)
+      grub_free (grub_disk_cache_slabs[i]);
+  grub_free (grub_disk_cache_slabs);
+  grub_free (grub_disk_cache_table);
+  grub_disk_cache_slabs = 0;
+  grub_disk_cache_table = 0;
+  grub_disk_cache_sets = 0;
+}
+
+grub_err_t
+grub_disk_cache_set_size (grub_size_t size)
+{
+  unsigned sets;
+
+  sets = (size / GRUB_DISK_CACHE_UNIT_SIZE) / GRUB_DISK_CACHE_WAYS;
+
+  grub_disk_cache_free_table ();
+  grub_disk_cache_initialized = 1;
+
+  if (! sets)
+    return GRUB_ERR_NONE;
+
+  grub_disk_cache_table = grub_zalloc (sets * GRUB_DISK_CACHE_WAYS
+				       * sizeof (grub_disk_cache_table[0]));
+  grub_disk_cache_slabs = grub_zalloc (sets * sizeof (grub_disk_cache_slabs[0]));
+  if (! grub_disk_cache_table || ! grub_disk_cache_slabs)
+    {
+      grub_free (grub_disk_cache_table);
+      grub_free (grub_disk_cache_slabs);
+      grub_disk_cache_table = 0;
+      grub_disk_cache_slabs = 0;
+      return grub_errno;
+    }
+
+  grub_disk_cache_sets = sets;
+  return GRUB_ERR_NONE;
+}
+
+grub_size_t
+grub_disk_cache_get_size (void)
+{
+  return ((grub_size_t) grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS
+	  * GRUB_DISK_CACHE_UNIT_SIZE);
+}
+
+static struct grub_disk_cache *
+grub_disk_cache_get_set (unsigned long dev_id, unsigned long disk_id,
+			 grub_disk_addr_t sector, unsigned *set_index)
+{
+  if (! grub_disk_cache_initialized)
+    grub_disk_cache_set_size ((grub_size_t) GRUB_DISK_CACHE_NUM
+			      * GRUB_DISK_CACHE_UNIT_SIZE);
+
+  if (! grub_disk_cache_sets)
+    return 0;
+
+  /* Consecutive cache units land in consecutive sets.  */
+  *set_index = ((dev_id * 524287UL + disk_id * 2606459UL
+		 + ((unsigned) (sector >> GRUB_DISK_CACHE_BITS)))
+		% grub_disk_cache_sets);
+  return grub_disk_cache_table + *set_index * GRUB_DISK_CACHE_WAYS;
+}
+
+static struct grub_disk_cache *
+grub_disk_cache_lookup (unsigned long dev_id, unsigned long disk_id,
+			grub_disk_addr_t sector)
+{
+  struct grub_disk_cache *set;
+  unsigned set_index, i;
+
+  set = grub_disk_cache_get_set (dev_id, disk_id, sector, &set_index);
+  if (! set)
+    return 0;
+
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+    if (set[i].data && set[i].dev_id == dev_id && set[i].disk_id == disk_id
+	&& set[i].sector == sector)
+      return set + i;
+
+  return 0;
+}
+
 void
 grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
-  for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
+  grub_fs_cache_flush ();
+
+  if (! grub_disk_cache_table)
+    return;
+
+  for (i = 0; i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
 
       if (cache->data && ! cache->lock)
+	cache->data = 0;
+    }
+}
+
+void
+grub_disk_cache_release (void)
+{
+  unsigned i, j;
+
+  if (! grub_disk_cache_table)
+    return;
+
+  grub_disk_cache_invalidate_all ();
+
+  for (i = 0; i < grub_disk_cache_sets; i++)
+    {
+      struct grub_disk_cache *set;
+
+      set = grub_disk_cache_table + i * GRUB_DISK_CACHE_WAYS;
+      for (j = 0; j < GRUB_DISK_CACHE_WAYS; j++)
+	if (set[j].data)
+	  break;
+
+      /* Keep the slab of a set which still has a locked entry.  */
+      if (j == GRUB_DISK_CACHE_WAYS)
 	{
-	  grub_free (cache->data);
-	  cache->data = 0;
+	  grub_free (grub_disk_cache_slabs[i]);
+	  grub_disk_cache_slabs[i] = 0;
 	}
     }
 }
 
+void
+grub_disk_cache_invalidate (unsigned long dev_id, unsigned long disk_id,
+			    grub_disk_addr_t sector)
+{
+  struct grub_disk_cache *cache;
+
+  sector &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
+    cache->data = 0;
+}
+
 static char *
 grub_disk_cache_fetch (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
-
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     {
       cache->lock = 1;
+      cache->age = ++grub_disk_cache_clock;
 #if DISK_CACHE_STATS
       grub_disk_cache_hits++;
 #endif
@@ -104,13 +257,9 @@ grub_disk_cache_unlock (unsigned long dev_id, unsigned long disk_id,
 			grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     cache->lock = 0;
 }
 
@@ -118,31 +267,174 @@ static grub_err_t
 grub_disk_cache_store (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector, const char *data)
 {
-  unsigned cache_index;
-  struct grub_disk_cache *cache;
+  struct grub_disk_cache *set, *cache = 0;
+  unsigned set_index, i;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  set = grub_disk_cache_get_set (dev_id, disk_id, sector, &set_index);
+  if (! set)
+    return GRUB_ERR_NONE;
 
-  cache->lock = 1;
-  grub_free (cache->data);
-  cache->data = 0;
-  cache->lock = 0;
+  /* Reuse the entry of the same unit, else an empty way, else evict the
+     least recently used unlocked way.  A unit is never cached twice, since
+     lookups only see its first copy; if it is locked, keep it as it is.  */
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+    if (set[i].data && set[i].dev_id == dev_id && set[i].disk_id == disk_id
+	&& set[i].sector == sector)
+      {
+	if (set[i].lock)
+	  return GRUB_ERR_NONE;
+	cache = set + i;
+	break;
+      }
 
-  cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  if (! cache->data)
-    return grub_errno;
+  if (! cache)
+    for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+      {
+	if (set[i].lock)
+	  continue;
+	if (! cache
+	    || (cache->data
+		&& (! set[i].data
+		    || (grub_int32_t) (set[i].age - cache->age) < 0)))
+	  cache = set + i;
+      }
+
+  if (! cache)
+    return GRUB_ERR_NONE;
+
+  if (! grub_disk_cache_slabs[set_index])
+    {
+      grub_disk_cache_slabs[set_index]
+	= grub_malloc (GRUB_DISK_CACHE_WAYS * GRUB_DISK_CACHE_UNIT_SIZE);
+      if (! grub_disk_cache_slabs[set_index])
+	return grub_errno;
+    }
 
-  grub_memcpy (cache->data, data,
-	       GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+  cache->data = grub_disk_cache_slabs[set_index]
+    + (cache - set) * GRUB_DISK_CACHE_UNIT_SIZE;
+  grub_memcpy (cache->data, data, GRUB_DISK_CACHE_UNIT_SIZE);
   cache->dev_id = dev_id;
   cache->disk_id = disk_id;
   cache->sector = sector;
+  cache->age = ++grub_disk_cache_clock;
 
   return GRUB_ERR_NONE;
 }
 
-
+
+
+/* Current time in microseconds, as precise as the platform allows.  */
+static grub_uint64_t
+grub_disk_stat_time_us (void)
+{
+#ifdef GRUB_DISK_STAT_HAVE_TSC
+  if (grub_tsc_rate)
+    {
+      grub_uint64_t a = grub_get_tsc ();
+
+      return (((a & 0xffffffff) * grub_tsc_rate * 1000) >> 32)
+	+ (a >> 32) * grub_tsc_rate * 1000;
+    }
+#endif
+  return grub_get_time_ms () * 1000;
+}
+
+/* Find or create the statistics record of DISK.  Statistics are kept per
+   whole disk and survive closing it.  */
+static struct grub_disk_stat *
+grub_disk_stat_get (grub_disk_t disk)
+{
+  struct grub_disk_stat *stat;
+
+  for (stat = grub_disk_stat_list; stat; stat = stat->next)
+    if (stat->dev_id == disk->dev->id && stat->disk_id == disk->id)
+      return stat;
+
+  stat = grub_zalloc (sizeof (*stat));
+  if (! stat)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  stat->name = grub_strdup (disk->name);
+  if (! stat->name)
+    {
+      grub_free (stat);
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  stat->dev_id = disk->dev->id;
+  stat->disk_id = disk->id;
+  stat->next = grub_disk_stat_list;
+  grub_disk_stat_list = stat;
+
+  return stat;
+}
+
+void
+grub_disk_stat_reset (void)
+{
+  struct grub_disk_stat *stat;
+
+  for (stat = grub_disk_stat_list; stat; stat = stat->next)
+    {
+      stat->reads = 0;
+      stat->device_reads = 0;
+      stat->sectors = 0;
+      stat->cache_hits = 0;
+      stat->cache_misses = 0;
+      stat->cache_bytes = 0;
+      stat->ra_hits = 0;
+      stat->ra_misses = 0;
+      stat->read_time = 0;
+      grub_memset (stat->latency, 0, sizeof (stat->latency));
+    }
+}
+
+/* Read SIZE native sectors from the device, accounting the request.  */
+static grub_err_t
+grub_disk_dev_read (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size, char *buf)
+{
+  struct grub_disk_stat *stat = disk->stat;
+  grub_uint64_t start, elapsed;
+  grub_err_t err;
+  unsigned bucket;
+
+  if (! stat)
+    return (disk->dev->disk_read) (disk, sector, size, buf);
+
+  start = grub_disk_stat_time_us ();
+  err = (disk->dev->disk_read) (disk, sector, size, buf);
+  elapsed = grub_disk_stat_time_us () - start;
+
+  stat->device_reads++;
+  stat->sectors += (grub_uint64_t) size << (disk->log_sector_size
+					    - GRUB_DISK_SECTOR_BITS);
+  stat->read_time += elapsed;
+
+  /* Bucket N counts requests which took less than 2^N microseconds.  */
+  for (bucket = 0; bucket < GRUB_DISK_STAT_BUCKETS - 1
+	 && (elapsed >> bucket); bucket++);
+  stat->latency[bucket]++;
+
+  return err;
+}
+
+static void
+grub_disk_stat_cache (grub_disk_t disk, const char *data, grub_size_t size)
+{
+  if (! disk->stat)
+    return;
+
+  if (data)
+    {
+      disk->stat->cache_hits++;
+      disk->stat->cache_bytes += size;
+    }
+  else
+    disk->stat->cache_misses++;
+}
 
 grub_disk_dev_t grub_disk_dev_list;
 
@@ -202,6 +494,7 @@ grub_disk_open (const char *name)
   /* Default 1MiB of maximum agglomerate.  */
   disk->max_agglomerate = 1048576 >> (GRUB_DISK_SECTOR_BITS
 				      + GRUB_DISK_CACHE_BITS);
+  disk->ra_next = ~(grub_disk_addr_t) 0;
 
   p = find_part_sep (name);
   if (p)
@@ -247,6 +540,7 @@ grub_disk_open (const char *name)
     }
 
   disk->dev = dev;
+  disk->stat = grub_disk_stat_get (disk);
 
   if (p)
     {
@@ -293,6 +587,14 @@ grub_disk_close (grub_disk_t disk)
 {
   grub_partition_t part;
   grub_dprintf ("disk", "Closing `%s'.\n", disk->name);
+  if (disk->ra_hits || disk->ra_misses)
+    grub_dprintf ("disk", "readahead hits = %lu, misses = %lu\n",
+		  disk->ra_hits, disk->ra_misses);
+  if (disk->stat)
+    {
+      disk->stat->ra_hits += disk->ra_hits;
+      disk->stat->ra_misses += disk->ra_misses;
+    }
 
   if (disk->dev && disk->dev->disk_close)
     (disk->dev->disk_close) (disk);
@@ -322,6 +624,7 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
 
   /* Fetch the cache.  */
   data = grub_disk_cache_fetch (disk->dev->id, disk->id, sector);
+  grub_disk_stat_cache (disk, data, size);
   if (data)
     {
       /* Just copy it!  */
@@ -342,7 +645,7 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
       < (disk->total_sectors << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS)))
     {
       grub_err_t err;
-      err = (disk->dev->disk_read) (disk, transform_sector (disk, sector),
+      err = grub_disk_dev_read (disk, transform_sector (disk, sector),
 				    1U << (GRUB_DISK_CACHE_BITS
 					   + GRUB_DISK_SECTOR_BITS
 					   - disk->log_sector_size), tmp_buf);
@@ -379,7 +682,7 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
     if (!tmp_buf)
       return grub_errno;
     
-    if ((disk->dev->disk_read) (disk, transform_sector (disk, aligned_sector),
+    if (grub_disk_dev_read (disk, transform_sector (disk, aligned_sector),
 				num, tmp_buf))
       {
 	grub_error_push ();
@@ -411,21 +714,125 @@ grub_disk_read_small (grub_disk_t disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
-/* Read data from the disk.  */
-grub_err_t
-grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
-		grub_off_t offset, grub_size_t size, void *buf)
+/* Account the request for the cache units FIRST to LAST and adjust the
+   readahead window: it grows while the units are read in order and is
+   closed on the first random access.  */
+static void
+grub_disk_readahead_update (grub_disk_t disk, grub_disk_addr_t first,
+			    grub_disk_addr_t last)
 {
-  /* First of all, check if the region is within the disk.  */
-  if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+  grub_disk_addr_t hits = 0;
+  unsigned int max_window;
+
+  max_window = grub_disk_readahead_max;
+  if (max_window > disk->max_agglomerate)
+    max_window = disk->max_agglomerate;
+  /* Don't let the window evict itself from the cache.  */
+  if (max_window > (grub_disk_cache_get_size ()
+		    >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS + 2)))
+    max_window = (grub_disk_cache_get_size ()
+		  >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS + 2));
+
+  if (first == disk->ra_next)
     {
-      grub_error_push ();
-      grub_dprintf ("disk", "Read out of range: sector 0x%llx (%s).\n",
-		    (unsigned long long) sector, grub_errmsg);
-      grub_error_pop ();
-      return grub_errno;
+      if (first < disk->ra_end && last >= disk->ra_start)
+	hits = ((last < disk->ra_end ? last + 1 : disk->ra_end)
+		- (first > disk->ra_start ? first : disk->ra_start));
+      disk->ra_hits += hits;
+      if (disk->ra_window)
+	disk->ra_misses += last - first + 1 - hits;
+      disk->ra_window = disk->ra_window ? disk->ra_window * 2 : 1;
+      if (disk->ra_window > max_window)
+	disk->ra_window = max_window;
+    }
+  /* Reading on within the last unit keeps the stream going.  */
+  else if (first + 1 == disk->ra_next)
+    {
+      if (disk->ra_window > max_window)
+	disk->ra_window = max_window;
+    }
+  else
+    {
+      disk->ra_window = 0;
+      disk->ra_start = disk->ra_end = 0;
     }
 
+  disk->ra_next = last + 1;
+}
+
+/* Prefetch the readahead window into the disk cache with one request
+   once the reader has consumed the previous one.  Failures are not
+   reported, the data is read again on demand.  */
+static void
+grub_disk_readahead (grub_disk_t disk)
+{
+  grub_disk_addr_t unit = disk->ra_next;
+  grub_disk_addr_t count = disk->ra_window;
+  grub_disk_addr_t i;
+  char *tmp_buf;
+
+  if (grub_disk_cache_lookup (disk->dev->id, disk->id,
+			      unit << GRUB_DISK_CACHE_BITS))
+    return;
+
+  if (disk->total_sectors != GRUB_DISK_SIZE_UNKNOWN)
+    {
+      grub_disk_addr_t total;
+
+      total = (disk->total_sectors << (disk->log_sector_size
+				       - GRUB_DISK_SECTOR_BITS))
+	>> GRUB_DISK_CACHE_BITS;
+      if (unit >= total)
+	return;
+      if (count > total - unit)
+	count = total - unit;
+    }
+
+  /* Stop before units which are cached already.  */
+  for (i = 1; i < count; i++)
+    if (grub_disk_cache_lookup (disk->dev->id, disk->id,
+				(unit + i) << GRUB_DISK_CACHE_BITS))
+      break;
+  count = i;
+
+  tmp_buf = grub_malloc (count << (GRUB_DISK_CACHE_BITS
+				   + GRUB_DISK_SECTOR_BITS));
+  if (! tmp_buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  if (grub_disk_dev_read (disk,
+			  transform_sector (disk, unit << GRUB_DISK_CACHE_BITS),
+			  count << (GRUB_DISK_CACHE_BITS
+				    + GRUB_DISK_SECTOR_BITS
+				    - disk->log_sector_size), tmp_buf))
+    {
+      grub_dprintf ("disk", "%s readahead failed\n", disk->name);
+      grub_errno = GRUB_ERR_NONE;
+      disk->ra_window = 0;
+      grub_free (tmp_buf);
+      return;
+    }
+
+  for (i = 0; i < count; i++)
+    grub_disk_cache_store (disk->dev->id, disk->id,
+			   (unit + i) << GRUB_DISK_CACHE_BITS,
+			   tmp_buf + (i << (GRUB_DISK_CACHE_BITS
+					    + GRUB_DISK_SECTOR_BITS)));
+  grub_errno = GRUB_ERR_NONE;
+  grub_free (tmp_buf);
+
+  disk->ra_start = unit;
+  disk->ra_end = unit + count;
+}
+
+/* Read SIZE bytes at the already adjusted SECTOR and OFFSET.  */
+static grub_err_t
+grub_disk_read_real (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_off_t offset, grub_size_t size, void *buf)
+{
   /* First read until first cache boundary.   */
   if (offset || (sector & (GRUB_DISK_CACHE_SIZE - 1)))
     {
@@ -468,6 +875,8 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	  data = grub_disk_cache_fetch (disk->dev->id, disk->id,
 					sector + (agglomerate
 						  << GRUB_DISK_CACHE_BITS));
+	  grub_disk_stat_cache (disk, data,
+				GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS);
 	  if (data)
 	    break;
 	}
@@ -488,7 +897,7 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	{
 	  grub_disk_addr_t i;
       if (buf)
-        err = (disk->dev->disk_read) (disk, transform_sector (disk, sector),
+        err = grub_disk_dev_read (disk, transform_sector (disk, sector),
 					agglomerate << (GRUB_DISK_CACHE_BITS
 							+ GRUB_DISK_SECTOR_BITS
 							- disk->log_sector_size),
@@ -540,6 +949,40 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
   return grub_errno;
 }
 
+/* Read data from the disk.  */
+grub_err_t
+grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_off_t offset, grub_size_t size, void *buf)
+{
+  grub_err_t err;
+
+  /* First of all, check if the region is within the disk.  */
+  if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+    {
+      grub_error_push ();
+      grub_dprintf ("disk", "Read out of range: sector 0x%llx (%s).\n",
+		    (unsigned long long) sector, grub_errmsg);
+      grub_error_pop ();
+      return grub_errno;
+    }
+
+  if (disk->stat)
+    disk->stat->reads++;
+
+  if (buf && size)
+    grub_disk_readahead_update (disk, sector >> GRUB_DISK_CACHE_BITS,
+				(sector + ((offset + size - 1)
+					   >> GRUB_DISK_SECTOR_BITS))
+				>> GRUB_DISK_CACHE_BITS);
+
+  err = grub_disk_read_real (disk, sector, offset, size, buf);
+
+  if (! err && buf && disk->ra_window)
+    grub_disk_readahead (disk);
+
+  return err;
+}
+
 grub_err_t
 grub_disk_read_ex (grub_disk_t disk, grub_disk_addr_t sector,
                    grub_off_t offset, grub_size_t size, void *buf, int blocklist)
@@ -566,7 +1009,7 @@ grub_disk_read_ex (grub_disk_t disk, grub_disk_addr_t sector,
 
       if (buf)
       {
-        if ((disk->dev->disk_read) (disk, sector, 1, tmp_buf) != GRUB_ERR_NONE)
+        if (grub_disk_dev_read (disk, sector, 1, tmp_buf) != GRUB_ERR_NONE)
           break;
         grub_memcpy (buf, tmp_buf + real_offset, len);
       }
@@ -585,7 +1028,7 @@ grub_disk_read_ex (grub_disk_t disk, grub_disk_addr_t sector,
       n = size >> GRUB_DISK_SECTOR_BITS;
 
       if ((buf) &&
-          ((disk->dev->disk_read) (disk, sector, n, buf) != GRUB_ERR_NONE))
+          (grub_disk_dev_read (disk, sector, n, buf) != GRUB_ERR_NONE))
         break;
 
       if (disk->read_hook)
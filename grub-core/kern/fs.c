@@ -26,6 +26,7 @@
 #include <grub/misc.h>
 #include <grub/types.h>
 #include <grub/mm.h>
+#include <grub/safemath.h>
 #include <grub/term.h>
 #include <grub/i18n.h>
 
@@ -33,6 +34,101 @@ grub_fs_t grub_fs_list = 0;
 
 grub_fs_autoload_hook_t grub_fs_autoload_hook = 0;
 
+/* Results of successful probes, keyed by device and partition.  Valid
+   until the disk cache is invalidated or a filesystem is unregistered.  */
+#define GRUB_FS_PROBE_CACHE_SIZE 8
+
+struct grub_fs_probe_cache
+{
+  grub_fs_t fs;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_uint64_t len;
+};
+
+static struct grub_fs_probe_cache probe_cache[GRUB_FS_PROBE_CACHE_SIZE];
+static unsigned probe_cache_next;
+
+grub_uint32_t grub_fs_cache_generation;
+
+void
+grub_fs_cache_flush (void)
+{
+  unsigned i;
+
+  grub_fs_cache_generation++;
+  for (i = 0; i < GRUB_FS_PROBE_CACHE_SIZE; i++)
+    probe_cache[i].fs = 0;
+}
+
+static struct grub_fs_probe_cache *
+probe_cache_find (grub_disk_t disk)
+{
+  grub_disk_addr_t start = grub_partition_get_start (disk->partition);
+  grub_uint64_t len = grub_disk_get_size (disk);
+  unsigned i;
+
+  for (i = 0; i < GRUB_FS_PROBE_CACHE_SIZE; i++)
+    if (probe_cache[i].fs
+	&& probe_cache[i].dev_id == disk->dev->id
+	&& probe_cache[i].disk_id == disk->id
+	&& probe_cache[i].start == start
+	&& probe_cache[i].len == len)
+      return &probe_cache[i];
+
+  return 0;
+}
+
+static grub_fs_t
+probe_cache_store (grub_disk_t disk, grub_fs_t fs)
+{
+  struct grub_fs_probe_cache *c;
+
+  c = &probe_cache[probe_cache_next];
+  probe_cache_next = (probe_cache_next + 1) % GRUB_FS_PROBE_CACHE_SIZE;
+
+  c->dev_id = disk->dev->id;
+  c->disk_id = disk->id;
+  c->start = grub_partition_get_start (disk->partition);
+  c->len = grub_disk_get_size (disk);
+  c->fs = fs;
+
+  return fs;
+}
+
+/* Return non-zero if FS has no signatures or one of them is present
+   on DISK.  The reads go through the disk cache, so drivers sharing
+   a superblock sector only cost one device access.  */
+static int
+signature_match (grub_fs_t fs, grub_disk_t disk)
+{
+  const struct grub_fs_signature *sig;
+  char buf[16];
+
+  if (! fs->signatures)
+    return 1;
+
+  for (sig = fs->signatures; sig->len; sig++)
+    {
+      if (sig->len > sizeof (buf))
+	return 1;
+
+      if (grub_disk_read (disk, sig->offset >> GRUB_DISK_SECTOR_BITS,
+			  sig->offset & (GRUB_DISK_SECTOR_SIZE - 1),
+			  sig->len, buf) != GRUB_ERR_NONE)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      if (grub_memcmp (buf, sig->magic, sig->len) == 0)
+	return 1;
+    }
+
+  return 0;
+}
+
 /* Helper for grub_fs_probe.  */
 static int
 probe_dummy_iter (const char *filename __attribute__ ((unused)),
@@ -51,6 +147,7 @@ grub_fs_probe (grub_device_t device)
     {
       /* Make it sure not to have an infinite recursive calls.  */
       static int count = 0;
+      struct grub_fs_probe_cache *cached;
 
       if (grub_strcmp (device->disk->name, "vfat") == 0)
       {
@@ -60,8 +157,18 @@ grub_fs_probe (grub_device_t device)
             return p;
       }
 
+      cached = probe_cache_find (device->disk);
+      if (cached)
+	{
+	  grub_dprintf ("fs", "Using cached %s\n", cached->fs->name);
+	  return cached->fs;
+	}
+
       for (p = grub_fs_list; p; p = p->next)
 	{
+	  if (! signature_match (p, device->disk))
+	    continue;
+
 	  grub_dprintf ("fs", "Detecting %s...\n", p->name);
 
 	  /* This is evil: newly-created just mounted BtrFS after copying all
@@ -81,7 +188,7 @@ grub_fs_probe (grub_device_t device)
 #endif
 	    (p->fs_dir) (device, "/", probe_dummy_iter, NULL);
 	  if (grub_errno == GRUB_ERR_NONE)
-	    return p;
+	    return probe_cache_store (device->disk, p);
 
 	  grub_error_push ();
 	  grub_dprintf ("fs", "%s detection failed.\n", p->name);
@@ -103,11 +210,14 @@ grub_fs_probe (grub_device_t device)
 	    {
 	      p = grub_fs_list;
 
+	      if (! signature_match (p, device->disk))
+		continue;
+
 	      (p->fs_dir) (device, "/", probe_dummy_iter, NULL);
 	      if (grub_errno == GRUB_ERR_NONE)
 		{
 		  count--;
-		  return p;
+		  return probe_cache_store (device->disk, p);
 		}
 
 	      if (grub_errno != GRUB_ERR_BAD_FS
@@ -132,6 +242,70 @@ grub_fs_probe (grub_device_t device)
 
 /* Block list support routines.  */
 
+/* FILE->data of a block list file points to a zero-terminated array of
+   extents, which other modules walk directly.  It is preceded by this
+   header, which holds the file offset each extent starts at so reads
+   can find their first extent by bisection.  */
+struct blocklist_table
+{
+  grub_uint64_t num;
+  grub_off_t *starts;
+};
+
+#define BLOCKLIST_TABLE(blocks) (((struct blocklist_table *) (blocks)) - 1)
+#define BLOCKLIST_BLOCKS(table) ((struct grub_fs_block *) ((table) + 1))
+
+/* Build the extent table for the NUM extents in BLOCKS, merging those
+   which follow each other on disk.  */
+static struct grub_fs_block *
+blocklist_table_new (const struct grub_fs_block *blocks, grub_size_t num)
+{
+  struct blocklist_table *t;
+  struct grub_fs_block *p;
+  grub_size_t i, n, sz;
+  grub_off_t pos = 0;
+
+  for (i = 0, n = 0; i < num; i++)
+    if (! i || blocks[i - 1].offset + blocks[i - 1].length != blocks[i].offset)
+      n++;
+
+  if (grub_mul (n + 1, sizeof (*p) + sizeof (grub_off_t), &sz)
+      || grub_add (sz, sizeof (*t), &sz))
+  {
+    grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+    return 0;
+  }
+
+  t = grub_zalloc (sz);
+  if (! t)
+    return 0;
+
+  p = BLOCKLIST_BLOCKS (t);
+  t->starts = (grub_off_t *) (p + n + 1);
+  for (i = 0, n = 0; i < num; i++)
+  {
+    if (n && p[n - 1].offset + p[n - 1].length == blocks[i].offset)
+      p[n - 1].length += blocks[i].length;
+    else
+    {
+      t->starts[n] = pos;
+      p[n++] = blocks[i];
+    }
+    pos += blocks[i].length;
+  }
+  t->starts[n] = pos;
+  t->num = n;
+
+  return p;
+}
+
+static void
+blocklist_table_free (struct grub_fs_block *blocks)
+{
+  if (blocks)
+    grub_free (BLOCKLIST_TABLE (blocks));
+}
+
 static grub_err_t
 grub_fs_blocklist_open (grub_file_t file, const char *name)
 {
@@ -198,9 +372,10 @@ grub_fs_blocklist_open (grub_file_t file, const char *name)
     p++;
   }
 
-  file->data = blocks;
+  file->data = blocklist_table_new (blocks, num);
+  grub_free (blocks);
 
-  return GRUB_ERR_NONE;
+  return grub_errno;
 
 fail:
   grub_free (blocks);
@@ -210,39 +385,54 @@ fail:
 static grub_ssize_t
 grub_fs_blocklist_rw (int write, grub_file_t file, char *buf, grub_size_t len)
 {
-  struct grub_fs_block *p;
+  struct grub_fs_block *blocks = file->data;
+  struct blocklist_table *t = BLOCKLIST_TABLE (blocks);
   grub_off_t offset;
   grub_ssize_t ret = 0;
+  grub_uint64_t lo, hi;
 
   if (len > file->size - file->offset)
     len = file->size - file->offset;
 
   offset = file->offset;
-  for (p = file->data; p->length && len > 0; p++)
+
+  /* Find the extent holding OFFSET.  */
+  lo = 0;
+  hi = t->num;
+  while (hi - lo > 1)
   {
-    if (offset < p->length)
-    {
-      grub_size_t size;
-
-      size = len;
-      if (offset + size > p->length)
-        size = p->length - offset;
-
-      if ((write) ?
-           grub_disk_write_weak (file->device->disk, 0, p->offset + offset,
-              size, buf) :
-           grub_disk_read_ex (file->device->disk, 0, p->offset + offset,
-              size, buf, file->blocklist) != GRUB_ERR_NONE)
-        return -1;
-
-      ret += size;
-      len -= size;
-      if (buf)
-        buf += size;
-      offset += size;
-    }
+    grub_uint64_t mid = lo + (hi - lo) / 2;
+
+    if (t->starts[mid] <= offset)
+      lo = mid;
     else
-      offset -= p->length;
+      hi = mid;
+  }
+
+  /* Extents are merged, so each one the request spans takes one
+     disk request.  */
+  for (; lo < t->num && len > 0; lo++)
+  {
+    struct grub_fs_block *p = &blocks[lo];
+    grub_off_t skip = offset - t->starts[lo];
+    grub_size_t size;
+
+    size = len;
+    if (skip + size > p->length)
+      size = p->length - skip;
+
+    if ((write) ?
+         grub_disk_write_weak (file->device->disk, 0, p->offset + skip,
+            size, buf) :
+         grub_disk_read_ex (file->device->disk, 0, p->offset + skip,
+            size, buf, file->blocklist) != GRUB_ERR_NONE)
+      return -1;
+
+    ret += size;
+    len -= size;
+    if (buf)
+      buf += size;
+    offset += size;
   }
 
   return ret;
@@ -269,7 +459,7 @@ grub_blocklist_write (grub_file_t file, const char *buf, grub_size_t len)
 static grub_err_t
 grub_fs_blocklist_close (grub_file_t file)
 {
-  grub_free (file->data);
+  blocklist_table_free (file->data);
   return grub_errno;
 }
 
@@ -284,15 +474,11 @@ struct read_blocklist_ctx
 };
 
 static void
-read_blocklist (grub_disk_addr_t sector, unsigned offset,
-                unsigned length, void *ctx)
+blocklist_add (struct read_blocklist_ctx *c, grub_disk_addr_t offset,
+               grub_off_t length)
 {
-  struct read_blocklist_ctx *c = ctx;
-
-  sector = ((sector - c->part_start) << GRUB_DISK_SECTOR_BITS) + offset;
-
   if ((c->num) &&
-      (c->blocks[c->num - 1].offset + c->blocks[c->num - 1].length == sector))
+      (c->blocks[c->num - 1].offset + c->blocks[c->num - 1].length == offset))
   {
     c->blocks[c->num - 1].length += length;
     goto quit;
@@ -306,7 +492,7 @@ read_blocklist (grub_disk_addr_t sector, unsigned offset,
       return;
   }
 
-  c->blocks[c->num].offset = sector;
+  c->blocks[c->num].offset = offset;
   c->blocks[c->num].length = length;
   c->num++;
 
@@ -314,6 +500,42 @@ quit:
   c->total_size += length;
 }
 
+static void
+read_blocklist (grub_disk_addr_t sector, unsigned offset,
+                unsigned length, void *ctx)
+{
+  struct read_blocklist_ctx *c = ctx;
+
+  blocklist_add (c, ((sector - c->part_start) << GRUB_DISK_SECTOR_BITS)
+                 + offset, length);
+}
+
+/* Build the block list of FILE from the extents its filesystem reports.  */
+static grub_err_t
+map_blocklist (grub_file_t file, struct read_blocklist_ctx *c)
+{
+  grub_off_t pos = 0;
+
+  while (pos < file->size)
+  {
+    struct grub_fs_block block;
+
+    if (file->fs->fs_map (file, pos, &block))
+      return grub_errno;
+    if (! block.length)
+      return grub_error (GRUB_ERR_BAD_FS, "empty extent");
+    if (block.length > file->size - pos)
+      block.length = file->size - pos;
+
+    blocklist_add (c, block.offset, block.length);
+    if (! c->blocks)
+      return grub_errno;
+    pos += block.length;
+  }
+
+  return GRUB_ERR_NONE;
+}
+
 int
 grub_blocklist_convert (grub_file_t file)
 {
@@ -329,10 +551,23 @@ grub_blocklist_convert (grub_file_t file)
   c.blocks = 0;
   c.total_size = 0;
   c.part_start = grub_partition_get_start (file->device->disk->partition);
+
+  /* Ask the filesystem for whole extents if it can tell them, which
+     saves walking the file block by block.  */
+  if (file->fs->fs_map && map_blocklist (file, &c) == GRUB_ERR_NONE)
+    goto done;
+
+  grub_errno = GRUB_ERR_NONE;
+  grub_free (c.blocks);
+  c.num = 0;
+  c.blocks = 0;
+  c.total_size = 0;
   file->read_hook = read_blocklist;
   file->read_hook_data = &c;
   grub_file_dummy_read (file);
   file->read_hook = 0;
+
+ done:
   if ((grub_errno) || (c.total_size != file->size))
   {
     grub_errno = 0;
@@ -341,10 +576,22 @@ grub_blocklist_convert (grub_file_t file)
   }
   else
   {
+    struct grub_fs_block *blocks;
+
+    blocks = blocklist_table_new (c.blocks, c.num);
+    grub_free (c.blocks);
+    if (! blocks)
+    {
+      grub_errno = 0;
+      file->offset = 0;
+      return 0;
+    }
+
     if (file->fs->fs_close)
       (file->fs->fs_close) (file);
     file->fs = &grub_fs_blocklist;
-    file->data = c.blocks;
+    file->data = blocks;
+    c.num = BLOCKLIST_TABLE (blocks)->num;
   }
 
   file->offset = 0;
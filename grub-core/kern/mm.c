@@ -355,8 +355,8 @@ grub_memalign (grub_size_t align, grub_size_t size)
   switch (count)
     {
     case 0:
-      /* Invalidate disk caches.  */
-      grub_disk_cache_invalidate_all ();
+      /* Release disk caches.  */
+      grub_disk_cache_release ();
       count++;
       goto again;
 
@@ -0,0 +1,256 @@
+/* memload.c - copy files to memory for RAM disks  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/crypto.h>
+#include <grub/dl.h>
+#include <grub/err.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/i18n.h>
+#include <grub/memload.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/safemath.h>
+#include <grub/term.h>
+#include <grub/time.h>
+#ifdef GRUB_MACHINE_EFI
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+#include <grub/cpu/efi/memory.h>
+#endif
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Files are read in pieces of this size, which is large enough for disk
+   requests to run at full speed and small enough to retry cheaply.  */
+#define MEMLOAD_CHUNK_SIZE	(8 << 20)
+#define MEMLOAD_RETRIES		3
+#define MEMLOAD_UPDATE_INTERVAL	500
+#define MEMLOAD_PAGE_SHIFT	12
+
+static grub_size_t
+memload_pages (grub_size_t size)
+{
+  return (size + (1 << MEMLOAD_PAGE_SHIFT) - 1) >> MEMLOAD_PAGE_SHIFT;
+}
+
+void *
+grub_memload_alloc (grub_size_t size, int flags)
+{
+#ifdef GRUB_MACHINE_EFI
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_physical_address_t address = GRUB_EFI_MAX_USABLE_ADDRESS;
+  grub_efi_memory_type_t type;
+  grub_efi_status_t status;
+
+  type = (flags & GRUB_MEMLOAD_RUNTIME) ? GRUB_EFI_RUNTIME_SERVICES_DATA
+	 : GRUB_EFI_BOOT_SERVICES_DATA;
+
+  /* Take the pages from the firmware rather than through
+     grub_efi_allocate_any_pages, which returns them when GRUB hands over
+     to the next loader while the RAM disk must stay.  */
+  status = efi_call_4 (b->allocate_pages, GRUB_EFI_ALLOCATE_MAX_ADDRESS,
+		       type, memload_pages (size), &address);
+  if (status != GRUB_EFI_SUCCESS || ! address)
+    {
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+      return NULL;
+    }
+
+  return (void *) (grub_addr_t) address;
+#else
+  (void) flags;
+  return grub_memalign (1 << MEMLOAD_PAGE_SHIFT, size);
+#endif
+}
+
+void
+grub_memload_free (void *addr, grub_size_t size)
+{
+  if (! addr)
+    return;
+#ifdef GRUB_MACHINE_EFI
+  efi_call_2 (grub_efi_system_table->boot_services->free_pages,
+	      (grub_efi_physical_address_t) (grub_addr_t) addr,
+	      memload_pages (size));
+#else
+  (void) size;
+  grub_free (addr);
+#endif
+}
+
+static grub_err_t
+parse_digest (const char *hex, grub_uint8_t *digest, grub_size_t len)
+{
+  grub_size_t i;
+
+  for (i = 0; i < len * 2; i++)
+    {
+      int c = grub_tolower (hex[i]);
+
+      if (c >= '0' && c <= '9')
+	c -= '0';
+      else if (c >= 'a' && c <= 'f')
+	c -= 'a' - 10;
+      else
+	break;
+      digest[i / 2] = (i & 1) ? (digest[i / 2] | c) : (c << 4);
+    }
+
+  if (i != len * 2 || hex[i])
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid digest `%s'"), hex);
+
+  return GRUB_ERR_NONE;
+}
+
+static void
+show_progress (grub_off_t done, grub_off_t total, grub_uint64_t elapsed)
+{
+  grub_uint64_t speed = 0;
+  grub_uint64_t eta = 0;
+  grub_uint64_t sec;
+
+  if (elapsed)
+    speed = grub_divmod64 (done * 1000, elapsed, 0);
+  if (speed)
+    eta = grub_divmod64 (total - done, speed, 0);
+  eta = grub_divmod64 (eta, 60, &sec);
+
+  grub_printf ("\r  %llu / %llu MiB  %llu MiB/s  ETA %02u:%02u   ",
+	       (unsigned long long) (done >> 20),
+	       (unsigned long long) (total >> 20),
+	       (unsigned long long) (speed >> 20),
+	       (unsigned) eta, (unsigned) sec);
+  grub_refresh ();
+}
+
+void *
+grub_memload_file (grub_file_t file, grub_size_t pad, int flags,
+		   const char *sha256)
+{
+  const gcry_md_spec_t *hash = NULL;
+  grub_uint8_t expected[GRUB_CRYPTO_MAX_MDLEN];
+  void *context = NULL;
+  grub_uint8_t *addr = NULL;
+  grub_off_t size = file->size;
+  grub_off_t pos;
+  grub_size_t total;
+  grub_uint64_t start, last;
+
+  if ((grub_size_t) size != size || grub_add ((grub_size_t) size, pad, &total))
+    {
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+      return NULL;
+    }
+
+  if (sha256)
+    {
+      hash = grub_crypto_lookup_md_by_name ("sha256");
+      if (! hash)
+	{
+	  grub_error (GRUB_ERR_BAD_ARGUMENT, N_("unknown hash"));
+	  return NULL;
+	}
+      if (parse_digest (sha256, expected, hash->mdlen))
+	return NULL;
+      context = grub_zalloc (hash->contextsize);
+      if (! context)
+	return NULL;
+      hash->init (context);
+    }
+
+  /* Read extents straight from the disk where the filesystem allows.  */
+  if (file->fs && file->fs->fast_blocklist)
+    grub_blocklist_convert (file);
+
+  addr = grub_memload_alloc (total, flags);
+  if (! addr)
+    goto fail;
+
+  start = last = grub_get_time_ms ();
+  for (pos = 0; pos < size; )
+    {
+      grub_size_t len = MEMLOAD_CHUNK_SIZE;
+      grub_uint64_t now;
+      int tries;
+
+      if (len > size - pos)
+	len = size - pos;
+
+      /* A flaky read shouldn't throw away what was copied so far.  */
+      for (tries = 1; ; tries++)
+	{
+	  grub_file_seek (file, pos);
+	  if (grub_file_read (file, addr + pos, len) == (grub_ssize_t) len)
+	    break;
+	  if (tries == MEMLOAD_RETRIES)
+	    {
+	      if (! grub_errno)
+		grub_error (GRUB_ERR_FILE_READ_ERROR,
+			    N_("premature end of file %s"), file->name);
+	      goto fail;
+	    }
+	  grub_dprintf ("memload", "retrying read at %llu\n",
+			(unsigned long long) pos);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+
+      if (hash)
+	hash->write (context, addr + pos, len);
+      pos += len;
+
+      now = grub_get_time_ms ();
+      if (now - last >= MEMLOAD_UPDATE_INTERVAL || pos == size)
+	{
+	  show_progress (pos, size, now - start);
+	  last = now;
+	}
+
+      if (grub_getkey_noblock () == GRUB_TERM_ESC)
+	{
+	  grub_printf ("\n");
+	  grub_error (GRUB_ERR_IO, N_("interrupted"));
+	  goto fail;
+	}
+    }
+  if (size)
+    grub_printf ("\n");
+
+  grub_memset (addr + size, 0, pad);
+
+  if (hash)
+    {
+      hash->final (context);
+      if (grub_crypto_memcmp (expected, hash->read (context), hash->mdlen))
+	{
+	  grub_error (GRUB_ERR_TEST_FAILURE, N_("hash of '%s' mismatches"),
+		      file->name);
+	  goto fail;
+	}
+      grub_free (context);
+    }
+
+  return addr;
+
+ fail:
+  grub_free (context);
+  grub_memload_free (addr, total);
+  return NULL;
+}
@@ -252,6 +252,8 @@ static const struct grub_arg_option options_map[] =
     N_("Mount UEFI Eltorito image at the same time."), N_("disk"), ARG_TYPE_STRING},
   {"nb", 'n', 0, N_("Don't boot virtual disk."), 0, 0},
   {"unmap", 'x', 0, N_("Unmap devices."), N_("disk"), ARG_TYPE_STRING},
+  {"sha256", 0, 0, N_("Verify the SHA-256 of the copy in RAM."),
+    N_("HEX"), ARG_TYPE_STRING},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -278,7 +280,8 @@ grub_cmd_map (grub_extcmd_context_t ctxt, int argc, char **args)
   if (!disk)
     return grub_error (GRUB_ERR_BAD_OS, "out of memory");
   file = file_open (args[0],
-                    state[MAP_MEM].set, state[MAP_BLOCK].set, state[MAP_RT].set);
+                    state[MAP_MEM].set, state[MAP_BLOCK].set, state[MAP_RT].set,
+                    state[MAP_SHA256].set ? state[MAP_SHA256].arg : NULL);
   if (!file)
   {
     grub_free (disk);
@@ -362,7 +365,7 @@ grub_cmd_iso (grub_extcmd_context_t ctxt, int argc, char **args)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
   if (argc < 2 && (state[ISO_OFS].set || state[ISO_LEN].set))
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("varname expected"));
-  file = file_open (args[0], 0, 0, 0);
+  file = file_open (args[0], 0, 0, 0, NULL);
   if (!file)
     return grub_error (GRUB_ERR_FILE_READ_ERROR, "failed to open file");
 
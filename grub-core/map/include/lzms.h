@@ -0,0 +1,205 @@
+#ifndef _LZMS_H
+#define _LZMS_H
+
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * LZMS decompression
+ *
+ * LZMS has no published specification; the wimlib source code is the
+ * reference for the format.
+ *
+ */
+
+#include <stdint.h>
+
+/** Number of repeated offsets for LZ and delta matches */
+#define LZMS_REPEATED_OFFSETS 3
+
+/** Number of states for the main bit */
+#define LZMS_MAIN_STATES 16
+/** Number of states for the match bit */
+#define LZMS_MATCH_STATES 32
+/** Number of states for the LZ, LZ repeat, delta and delta repeat bits */
+#define LZMS_OTHER_STATES 64
+
+/** Number of bits in a probability */
+#define LZMS_PROBABILITY_BITS 6
+/** Probability denominator */
+#define LZMS_PROBABILITY_MAX ( 1 << LZMS_PROBABILITY_BITS )
+/** Initial number of zeroes amongst the recent bits */
+#define LZMS_INITIAL_PROBABILITY 48
+/** Initial recent bits */
+#define LZMS_INITIAL_RECENT_BITS 0x0000000055555555ULL
+
+/** Number of literal codes */
+#define LZMS_LITERAL_CODES 256
+/** Number of length codes */
+#define LZMS_LENGTH_CODES 54
+/** Number of delta power codes */
+#define LZMS_DELTA_POWER_CODES 8
+/** Maximum number of offset codes */
+#define LZMS_MAX_OFFSET_CODES 799
+/** Maximum Huffman code length */
+#define LZMS_MAX_CODE_LEN 15
+/** Number of bits looked up in a single Huffman table access */
+#define LZMS_TABLE_BITS 10
+
+/** Number of literals decoded between rebuilds of the literal code */
+#define LZMS_LITERAL_REBUILD 1024
+/** Number of symbols decoded between rebuilds of the LZ offset code */
+#define LZMS_LZ_OFFSET_REBUILD 1024
+/** Number of symbols decoded between rebuilds of the length code */
+#define LZMS_LENGTH_REBUILD 512
+/** Number of symbols decoded between rebuilds of the delta offset code */
+#define LZMS_DELTA_OFFSET_REBUILD 1024
+/** Number of symbols decoded between rebuilds of the delta power code */
+#define LZMS_DELTA_POWER_REBUILD 512
+
+/** Maximum distance from the last likely x86 instruction to translate */
+#define LZMS_X86_MAX_TRANSLATION_OFFSET 1023
+/** Maximum distance between two uses of a target to call it likely */
+#define LZMS_X86_ID_WINDOW 65535
+
+/** An adaptive probability */
+struct lzms_probability {
+	/** Number of zeroes amongst the recent bits */
+	uint32_t zeroes;
+	/** Recent bits, most recent in the least significant bit */
+	uint64_t recent;
+};
+
+/** An adaptively-coded bit */
+struct lzms_bit {
+	/** Current state */
+	unsigned int state;
+	/** Number of states */
+	unsigned int states;
+	/** Probabilities, indexed by state */
+	struct lzms_probability probability[LZMS_OTHER_STATES];
+};
+
+/** An adaptive Huffman code */
+struct lzms_huffman {
+	/** Number of symbols */
+	unsigned int count;
+	/** Number of symbols decoded between rebuilds */
+	unsigned int rebuild;
+	/** Number of symbols to decode before the next rebuild */
+	unsigned int remaining;
+	/** Symbol frequencies */
+	uint32_t freq[LZMS_MAX_OFFSET_CODES];
+	/** Code lengths */
+	uint8_t lengths[LZMS_MAX_OFFSET_CODES];
+	/** Symbols, sorted by code length */
+	uint16_t sorted[LZMS_MAX_OFFSET_CODES];
+	/** First code of each length */
+	uint32_t first[ LZMS_MAX_CODE_LEN + 1 ];
+	/** Number of codes of each length */
+	uint16_t codes[ LZMS_MAX_CODE_LEN + 1 ];
+	/** Index in sorted symbols of the first code of each length */
+	uint16_t index[ LZMS_MAX_CODE_LEN + 1 ];
+	/** Lookup table of short codes
+	 *
+	 * Each entry holds the symbol and the code length, or zero if
+	 * the code is longer than LZMS_TABLE_BITS.
+	 */
+	uint16_t table[ 1 << LZMS_TABLE_BITS ];
+};
+
+/** LZMS decompressor */
+struct lzms {
+	/** Output buffer */
+	uint8_t *out;
+	/** Length of output */
+	size_t out_len;
+	/** Offset within output */
+	size_t out_offset;
+
+	/** Range decoder range */
+	uint32_t range;
+	/** Range decoder code */
+	uint32_t code;
+	/** Next range decoder input word */
+	const uint16_t *range_next;
+	/** End of range decoder input */
+	const uint16_t *range_end;
+
+	/** Bitstream accumulator, most significant bit first */
+	uint64_t accumulator;
+	/** Number of bits in accumulator */
+	unsigned int bits;
+	/** Word following the next bitstream input word */
+	const uint16_t *bits_next;
+	/** Start of bitstream input (which is read backwards) */
+	const uint16_t *bits_start;
+
+	/** Main bit: literal or match */
+	struct lzms_bit main;
+	/** Match bit: LZ or delta match */
+	struct lzms_bit match;
+	/** LZ bit: explicit or repeated offset */
+	struct lzms_bit lz;
+	/** LZ repeat bits: which repeated offset */
+	struct lzms_bit lz_repeat[ LZMS_REPEATED_OFFSETS - 1 ];
+	/** Delta bit: explicit or repeated offset */
+	struct lzms_bit delta;
+	/** Delta repeat bits: which repeated offset */
+	struct lzms_bit delta_repeat[ LZMS_REPEATED_OFFSETS - 1 ];
+
+	/** Literal Huffman code */
+	struct lzms_huffman literal;
+	/** LZ offset Huffman code */
+	struct lzms_huffman lz_offset;
+	/** Length Huffman code */
+	struct lzms_huffman length;
+	/** Delta offset Huffman code */
+	struct lzms_huffman delta_offset;
+	/** Delta power Huffman code */
+	struct lzms_huffman delta_power;
+
+	/** Repeated LZ offsets
+	 *
+	 * The offset of a match only enters the queue once the
+	 * following item has been decoded, hence the extra entry.
+	 */
+	uint32_t lz_repeated[ LZMS_REPEATED_OFFSETS + 1 ];
+	/** LZ offset waiting to enter the queue, or zero */
+	uint32_t lz_pending;
+	/** Repeated delta offsets */
+	uint32_t delta_repeated[ LZMS_REPEATED_OFFSETS + 1 ];
+	/** Repeated delta powers */
+	uint32_t power_repeated[ LZMS_REPEATED_OFFSETS + 1 ];
+	/** Delta offset waiting to enter the queue, or zero */
+	uint32_t delta_pending;
+	/** Delta power waiting to enter the queue */
+	uint32_t power_pending;
+
+	/** Last position of each x86 call target */
+	int32_t x86_target[65536];
+	/** Position of the start of the chunk, for x86 call targets */
+	int32_t x86_base;
+};
+
+extern ssize_t lzms_decompress_max ( const void *data, size_t len, void *buf,
+				     size_t max_len );
+
+#endif /* _LZMS_H */
@@ -60,6 +60,7 @@ enum options_map
   MAP_ELT,
   MAP_NB,
   MAP_UNMAP,
+  MAP_SHA256,
 };
 
 enum grub_efivdisk_type
@@ -93,7 +94,8 @@ void grub_pause_boot (void);
 
 void grub_pause_fatal (const char *fmt, ...);
 
-grub_file_t file_open (const char *name, int mem, int bl, int rt);
+grub_file_t file_open (const char *name, int mem, int bl, int rt,
+                       const char *sha256);
 
 void file_read (grub_file_t file, void *buf, grub_size_t len, grub_off_t offset);
 
@@ -60,6 +60,47 @@ enum wim_resource_header_flags {
 	WIM_RESHDR_PACKED_STREAMS = ( 0x10ULL << 56 ),
 };
 
+/**
+ * Uncompressed length of a solid resource in the lookup table
+ *
+ * A solid (packed streams) resource compresses many streams together.
+ * Its lookup table entry has this length, and the real length is in
+ * the solid resource header at the start of the resource.  Each
+ * stream within it has a lookup table entry of its own, flagged as
+ * packed, whose offset is the stream's position within the run of
+ * consecutive solid resources and whose compressed length is the
+ * stream's length.
+ *
+ * wim_file() turns such an entry into one that wim_read() can use:
+ * the offset is that of the solid resource holding the stream, the
+ * length field of @c zlen__flags is the stream's position within the
+ * uncompressed solid resource, and the uncompressed length is the
+ * stream's length.
+ */
+#define WIM_SOLID_LEN 0x100000000ULL
+
+/** A solid resource header */
+struct wim_solid_header {
+	/** Uncompressed length */
+	uint64_t len;
+	/** Chunk length */
+	uint32_t chunk_len;
+	/** Compression format */
+	uint32_t format;
+} __attribute__ (( packed ));
+
+/** Solid resource compression formats */
+enum wim_solid_format {
+	/** Uncompressed */
+	WIM_SOLID_NONE = 0,
+	/** Xpress compression */
+	WIM_SOLID_XPRESS = 1,
+	/** LZX compression */
+	WIM_SOLID_LZX = 2,
+	/** LZMS compression */
+	WIM_SOLID_LZMS = 3,
+};
+
 /** A WIM header */
 struct wim_header {
 	/** Signature */
@@ -127,6 +168,15 @@ struct wim_lookup_entry {
 /** WIM chunk length */
 #define WIM_CHUNK_LEN 32768
 
+/**
+ * Maximum chunk length given by a WIM or solid resource header
+ *
+ * The format allows chunks of up to 1GB, but a decompressed chunk and
+ * its compressed data are held in memory.  Solid resources are
+ * normally written with chunks of 64MB at most.
+ */
+#define WIM_CHUNK_LEN_MAX ( 1UL << 26 )
+
 /** A WIM chunk buffer */
 struct wim_chunk_buffer {
 	/** Data */
@@ -84,5 +84,7 @@ static inline unsigned int xca_huf_len ( const struct xca_huf_len *lengths,
 #define XCA_BLOCK_SIZE ( 64 * 1024 )
 
 extern ssize_t xca_decompress ( const void *data, size_t len, void *buf );
+extern ssize_t xca_decompress_max ( const void *data, size_t len, void *buf,
+				    size_t max_len );
 
 #endif /* _XCA_H */
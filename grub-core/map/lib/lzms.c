@@ -0,0 +1,919 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * LZMS decompression
+ *
+ * An LZMS chunk holds two streams of little-endian 16-bit words: a
+ * range-coded stream of adaptive bits read forwards from the start,
+ * and a bitstream of adaptive Huffman codes and extra bits read
+ * backwards from the end.  The decompressed data is then passed
+ * through a filter undoing the translation of x86 relative addresses.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <lzms.h>
+
+#pragma GCC diagnostic ignored "-Wcast-align"
+
+/** Number of bits holding the symbol in a Huffman tree node */
+#define LZMS_SYMBOL_BITS 10
+
+/** Mask for the symbol in a Huffman tree node */
+#define LZMS_SYMBOL_MASK ( ( 1 << LZMS_SYMBOL_BITS ) - 1 )
+
+/** Base values, indexed by offset slot */
+static uint32_t lzms_offset_base[ LZMS_MAX_OFFSET_CODES + 1 ];
+
+/** Number of extra bits, indexed by offset slot */
+static uint8_t lzms_offset_extra[LZMS_MAX_OFFSET_CODES];
+
+/** Base values, indexed by length slot */
+static uint32_t lzms_length_base[ LZMS_LENGTH_CODES + 1 ];
+
+/** Number of extra bits, indexed by length slot */
+static uint8_t lzms_length_extra[LZMS_LENGTH_CODES];
+
+/**
+ * Number of consecutive offset slots sharing each power-of-two range
+ *
+ * Each slot covers the values from its own base up to the base of the
+ * following slot.  The bases of the first nine slots step by one, none
+ * by two, and the next nine by four, so the first eight slots cover one
+ * value each and the ninth covers four.
+ */
+static const uint8_t lzms_offset_runs[] = {
+	9, 0, 9, 7, 10, 15, 15, 20, 20, 30, 33, 40, 42, 45, 60, 73,
+	80, 85, 95, 105, 6,
+};
+
+/** Number of consecutive length slots sharing each power-of-two range */
+static const uint8_t lzms_length_runs[] = {
+	27, 4, 6, 4, 5, 2, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 1,
+};
+
+/**
+ * Construct slot tables
+ *
+ * @v base		Base values to fill in
+ * @v extra		Numbers of extra bits to fill in
+ * @v runs		Number of slots sharing each power-of-two range
+ * @v count		Number of ranges
+ * @v last		Base value of the slot following the last slot
+ */
+static void lzms_init_slots ( uint32_t *base, uint8_t *extra,
+			      const uint8_t *runs, unsigned int count,
+			      uint32_t last ) {
+	uint32_t value = 0;
+	uint32_t delta = 1;
+	unsigned int slot = 0;
+	unsigned int i;
+	unsigned int j;
+
+	/* Construct base values */
+	for ( i = 0 ; i < count ; i++ ) {
+		for ( j = 0 ; j < runs[i] ; j++ ) {
+			value += delta;
+			base[slot++] = value;
+		}
+		delta <<= 1;
+	}
+	base[slot] = last;
+
+	/* Each slot covers a power-of-two range of values */
+	for ( i = 0 ; i < slot ; i++ )
+		extra[i] = ( 31 - __builtin_clz ( base[ i + 1 ] - base[i] ) );
+}
+
+/**
+ * Calculate number of offset slots usable within a chunk
+ *
+ * @v len		Length of decompressed chunk
+ * @ret count		Number of offset slots
+ */
+static unsigned int lzms_offset_codes ( size_t len ) {
+	unsigned int slot;
+
+	if ( len < 2 )
+		return 0;
+	for ( slot = 0 ; ( ( slot < ( LZMS_MAX_OFFSET_CODES - 1 ) ) &&
+			   ( lzms_offset_base[ slot + 1 ] <= ( len - 1 ) ) ) ;
+	      slot++ ) {
+	}
+	return ( slot + 1 );
+}
+
+/**
+ * Initialise adaptive bit
+ *
+ * @v bit		Adaptive bit
+ * @v states		Number of states
+ */
+static void lzms_init_bit ( struct lzms_bit *bit, unsigned int states ) {
+	unsigned int i;
+
+	bit->state = 0;
+	bit->states = states;
+	for ( i = 0 ; i < states ; i++ ) {
+		bit->probability[i].zeroes = LZMS_INITIAL_PROBABILITY;
+		bit->probability[i].recent = LZMS_INITIAL_RECENT_BITS;
+	}
+}
+
+/**
+ * Decode adaptive bit from range-coded stream
+ *
+ * @v lzms		Decompressor
+ * @v bit		Adaptive bit
+ * @ret value		Bit value
+ */
+static unsigned int lzms_bit ( struct lzms *lzms, struct lzms_bit *bit ) {
+	struct lzms_probability *probability =
+		&bit->probability[bit->state];
+	uint32_t zeroes = probability->zeroes;
+	uint32_t bound;
+	unsigned int value;
+
+	/* Neither bit value may be certain */
+	if ( zeroes == 0 )
+		zeroes = 1;
+	else if ( zeroes == LZMS_PROBABILITY_MAX )
+		zeroes = ( LZMS_PROBABILITY_MAX - 1 );
+
+	/* Normalise range */
+	if ( lzms->range <= 0xffff ) {
+		lzms->range <<= 16;
+		lzms->code <<= 16;
+		if ( lzms->range_next < lzms->range_end )
+			lzms->code |= *(lzms->range_next++);
+	}
+
+	/* Decode bit */
+	bound = ( ( lzms->range >> LZMS_PROBABILITY_BITS ) * zeroes );
+	if ( lzms->code < bound ) {
+		lzms->range = bound;
+		value = 0;
+	} else {
+		lzms->range -= bound;
+		lzms->code -= bound;
+		value = 1;
+	}
+
+	/* Slide the window of recent bits */
+	probability->zeroes += ( ( probability->recent >> 63 ) - value );
+	probability->recent = ( ( probability->recent << 1 ) | value );
+	bit->state = ( ( ( bit->state << 1 ) | value ) & ( bit->states - 1 ) );
+
+	return value;
+}
+
+/**
+ * Ensure bits are available in the bitstream accumulator
+ *
+ * @v lzms		Decompressor
+ * @v bits		Number of bits (at most 32)
+ *
+ * The bitstream is read backwards from the end of the chunk.  Bits
+ * beyond its start read as zero.
+ */
+static inline void lzms_fill ( struct lzms *lzms, unsigned int bits ) {
+
+	while ( lzms->bits < bits ) {
+		if ( lzms->bits_next > lzms->bits_start ) {
+			lzms->bits_next--;
+			lzms->accumulator |= ( ( ( uint64_t ) *lzms->bits_next )
+					       << ( 48 - lzms->bits ) );
+		}
+		lzms->bits += 16;
+	}
+}
+
+/**
+ * Peek at bits in the bitstream accumulator
+ *
+ * @v lzms		Decompressor
+ * @v bits		Number of bits
+ * @ret value		Value
+ */
+static inline uint32_t lzms_peek ( struct lzms *lzms, unsigned int bits ) {
+
+	/* Shift in two steps, since the number of bits may be zero */
+	return ( ( lzms->accumulator >> 1 ) >> ( 63 - bits ) );
+}
+
+/**
+ * Consume bits from the bitstream accumulator
+ *
+ * @v lzms		Decompressor
+ * @v bits		Number of bits
+ */
+static inline void lzms_consume ( struct lzms *lzms, unsigned int bits ) {
+
+	lzms->accumulator <<= bits;
+	lzms->bits -= bits;
+}
+
+/**
+ * Read bits from the bitstream
+ *
+ * @v lzms		Decompressor
+ * @v bits		Number of bits
+ * @ret value		Value
+ */
+static uint32_t lzms_read ( struct lzms *lzms, unsigned int bits ) {
+	uint32_t value;
+
+	lzms_fill ( lzms, bits );
+	value = lzms_peek ( lzms, bits );
+	lzms_consume ( lzms, bits );
+	return value;
+}
+
+/**
+ * Restore heap order below a Huffman tree node
+ *
+ * @v nodes		Nodes
+ * @v root		Root of the subtree to fix up
+ * @v count		Number of nodes in the heap
+ */
+static void lzms_sift ( uint32_t *nodes, unsigned int root,
+			unsigned int count ) {
+	uint32_t node = nodes[root];
+	unsigned int child;
+
+	while ( ( child = ( ( 2 * root ) + 1 ) ) < count ) {
+		if ( ( ( child + 1 ) < count ) &&
+		     ( nodes[ child + 1 ] > nodes[child] ) )
+			child++;
+		if ( node >= nodes[child] )
+			break;
+		nodes[root] = nodes[child];
+		root = child;
+	}
+	nodes[root] = node;
+}
+
+/**
+ * Rebuild adaptive Huffman code from symbol frequencies
+ *
+ * @v huf		Huffman code
+ *
+ * The code lengths must come out exactly as in the compressor, so
+ * this follows the construction used by wimlib: a Huffman tree built
+ * over the symbols sorted by frequency and then by value, with the
+ * deepest nodes pulled up to the maximum code length.
+ */
+static void lzms_huffman_build ( struct lzms_huffman *huf ) {
+	uint32_t nodes[LZMS_MAX_OFFSET_CODES];
+	unsigned int counts[ LZMS_MAX_CODE_LEN + 1 ];
+	unsigned int count = huf->count;
+	unsigned int next_leaf;
+	unsigned int next_node;
+	unsigned int next_free;
+	unsigned int parent;
+	unsigned int depth;
+	unsigned int len;
+	unsigned int i;
+	unsigned int a;
+	unsigned int b;
+	uint32_t freq;
+	uint32_t code;
+	uint32_t tmp;
+	int node;
+
+	/* Sort symbols by frequency, then by value */
+	for ( i = 0 ; i < count ; i++ )
+		nodes[i] = ( ( huf->freq[i] << LZMS_SYMBOL_BITS ) | i );
+	for ( i = ( count / 2 ) ; i-- ; )
+		lzms_sift ( nodes, i, count );
+	for ( i = count ; i-- > 1 ; ) {
+		tmp = nodes[0];
+		nodes[0] = nodes[i];
+		nodes[i] = tmp;
+		lzms_sift ( nodes, 0, i );
+	}
+
+	/* Assign code lengths */
+	memset ( huf->lengths, 0, sizeof ( huf->lengths ) );
+	if ( count == 1 ) {
+		huf->lengths[0] = 1;
+	} else if ( count > 1 ) {
+
+		/* Build the internal nodes of the tree in place, each
+		 * pointing to its parent.  The leaves are consumed in
+		 * order of frequency and need no nodes of their own.
+		 */
+		next_leaf = next_node = next_free = 0;
+		do {
+			if ( ( next_leaf != count ) &&
+			     ( ( next_node == next_free ) ||
+			       ( ( nodes[next_leaf] >> LZMS_SYMBOL_BITS ) <=
+				 ( nodes[next_node] >> LZMS_SYMBOL_BITS ) ) ) ) {
+				a = next_leaf++;
+			} else {
+				a = next_node++;
+			}
+			if ( ( next_leaf != count ) &&
+			     ( ( next_node == next_free ) ||
+			       ( ( nodes[next_leaf] >> LZMS_SYMBOL_BITS ) <=
+				 ( nodes[next_node] >> LZMS_SYMBOL_BITS ) ) ) ) {
+				b = next_leaf++;
+			} else {
+				b = next_node++;
+			}
+			freq = ( ( nodes[a] & ~LZMS_SYMBOL_MASK ) +
+				 ( nodes[b] & ~LZMS_SYMBOL_MASK ) );
+			nodes[a] = ( ( nodes[a] & LZMS_SYMBOL_MASK ) |
+				     ( next_free << LZMS_SYMBOL_BITS ) );
+			nodes[b] = ( ( nodes[b] & LZMS_SYMBOL_MASK ) |
+				     ( next_free << LZMS_SYMBOL_BITS ) );
+			nodes[next_free] = ( ( nodes[next_free] &
+					       LZMS_SYMBOL_MASK ) | freq );
+			next_free++;
+		} while ( ( count - next_free ) > 1 );
+
+		/* Count codes of each length, walking from the root
+		 * (which is the last internal node) towards the leaves.
+		 * Each internal node turns one code of its depth into
+		 * two codes one bit longer; nodes too deep for the
+		 * maximum length split the longest code available.
+		 */
+		memset ( counts, 0, sizeof ( counts ) );
+		counts[1] = 2;
+		nodes[ count - 2 ] &= LZMS_SYMBOL_MASK;
+		for ( node = ( count - 3 ) ; node >= 0 ; node-- ) {
+			parent = ( nodes[node] >> LZMS_SYMBOL_BITS );
+			depth = ( ( nodes[parent] >> LZMS_SYMBOL_BITS ) + 1 );
+			nodes[node] = ( ( nodes[node] & LZMS_SYMBOL_MASK ) |
+					( depth << LZMS_SYMBOL_BITS ) );
+			len = depth;
+			if ( len >= LZMS_MAX_CODE_LEN ) {
+				len = LZMS_MAX_CODE_LEN;
+				do {
+					len--;
+				} while ( ! counts[len] );
+			}
+			counts[len]--;
+			counts[ len + 1 ] += 2;
+		}
+
+		/* Hand out lengths, longest first, to the symbols in
+		 * order of increasing frequency.
+		 */
+		for ( i = 0, len = LZMS_MAX_CODE_LEN ; len ; len-- ) {
+			for ( a = counts[len] ; a ; a-- )
+				huf->lengths[ nodes[i++] & LZMS_SYMBOL_MASK ] = len;
+		}
+	}
+
+	/* Construct canonical code */
+	memset ( huf->codes, 0, sizeof ( huf->codes ) );
+	for ( i = 0 ; i < count ; i++ )
+		huf->codes[ huf->lengths[i] ]++;
+	huf->codes[0] = 0;
+	for ( code = 0, a = 0, len = 1 ; len <= LZMS_MAX_CODE_LEN ; len++ ) {
+		code = ( ( code + huf->codes[ len - 1 ] ) << 1 );
+		huf->first[len] = code;
+		huf->index[len] = a;
+		a += huf->codes[len];
+	}
+	for ( len = 1, a = 0 ; len <= LZMS_MAX_CODE_LEN ; len++ ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			if ( huf->lengths[i] == len )
+				huf->sorted[a++] = i;
+		}
+	}
+
+	/* Construct lookup table of short codes */
+	memset ( huf->table, 0, sizeof ( huf->table ) );
+	for ( len = 1 ; len <= LZMS_TABLE_BITS ; len++ ) {
+		for ( i = 0 ; i < huf->codes[len] ; i++ ) {
+			code = ( ( huf->first[len] + i ) <<
+				 ( LZMS_TABLE_BITS - len ) );
+			for ( b = 0 ; b < ( 1U << ( LZMS_TABLE_BITS - len ) ) ;
+			      b++ ) {
+				huf->table[ code + b ] =
+					( ( huf->sorted[ huf->index[len] + i ]
+					    << 4 ) | len );
+			}
+		}
+	}
+}
+
+/**
+ * Initialise adaptive Huffman code
+ *
+ * @v huf		Huffman code
+ * @v count		Number of symbols
+ * @v rebuild		Number of symbols decoded between rebuilds
+ */
+static void lzms_init_huffman ( struct lzms_huffman *huf, unsigned int count,
+				unsigned int rebuild ) {
+	unsigned int i;
+
+	huf->count = count;
+	huf->rebuild = rebuild;
+	huf->remaining = rebuild;
+	for ( i = 0 ; i < count ; i++ )
+		huf->freq[i] = 1;
+	lzms_huffman_build ( huf );
+}
+
+/**
+ * Decode adaptive Huffman-coded symbol from bitstream
+ *
+ * @v lzms		Decompressor
+ * @v huf		Huffman code
+ * @ret symbol		Symbol, or negative error
+ */
+static int lzms_huffman ( struct lzms *lzms, struct lzms_huffman *huf ) {
+	unsigned int entry;
+	unsigned int symbol;
+	unsigned int len;
+	uint32_t peek;
+	uint32_t code;
+
+	/* Look up short codes directly, and search for longer codes */
+	lzms_fill ( lzms, LZMS_MAX_CODE_LEN );
+	peek = lzms_peek ( lzms, LZMS_MAX_CODE_LEN );
+	entry = huf->table[ peek >> ( LZMS_MAX_CODE_LEN - LZMS_TABLE_BITS ) ];
+	if ( entry ) {
+		len = ( entry & 0x0f );
+		symbol = ( entry >> 4 );
+	} else {
+		for ( len = ( LZMS_TABLE_BITS + 1 ) ; ; len++ ) {
+			if ( len > LZMS_MAX_CODE_LEN ) {
+				printf ( "LZMS invalid Huffman code\n" );
+				return -1;
+			}
+			code = ( ( peek >> ( LZMS_MAX_CODE_LEN - len ) ) -
+				 huf->first[len] );
+			if ( code < huf->codes[len] )
+				break;
+		}
+		symbol = huf->sorted[ huf->index[len] + code ];
+	}
+	lzms_consume ( lzms, len );
+
+	/* Adapt the code to the symbols seen, halving the weight of
+	 * older symbols at each rebuild.
+	 */
+	huf->freq[symbol]++;
+	if ( ! --huf->remaining ) {
+		lzms_huffman_build ( huf );
+		for ( entry = 0 ; entry < huf->count ; entry++ )
+			huf->freq[entry] = ( ( huf->freq[entry] >> 1 ) + 1 );
+		huf->remaining = huf->rebuild;
+	}
+
+	return symbol;
+}
+
+/**
+ * Decode slot-coded value
+ *
+ * @v lzms		Decompressor
+ * @v huf		Huffman code for slots
+ * @v base		Base values, indexed by slot
+ * @v extra		Numbers of extra bits, indexed by slot
+ * @v value		Value to fill in
+ * @ret rc		Return status code
+ */
+static int lzms_value ( struct lzms *lzms, struct lzms_huffman *huf,
+			const uint32_t *base, const uint8_t *extra,
+			uint32_t *value ) {
+	int slot;
+
+	slot = lzms_huffman ( lzms, huf );
+	if ( slot < 0 )
+		return slot;
+	*value = ( base[slot] + lzms_read ( lzms, extra[slot] ) );
+	return 0;
+}
+
+/**
+ * Decode LZ match
+ *
+ * @v lzms		Decompressor
+ * @v pending		Offset to enter the repeated offset queue
+ * @ret rc		Return status code
+ */
+static int lzms_lz_match ( struct lzms *lzms, uint32_t *pending ) {
+	uint32_t offset;
+	uint32_t length;
+	unsigned int i;
+	int rc;
+
+	/* Decode offset */
+	if ( ! lzms_bit ( lzms, &lzms->lz ) ) {
+		if ( ( rc = lzms_value ( lzms, &lzms->lz_offset,
+					 lzms_offset_base, lzms_offset_extra,
+					 &offset ) ) != 0 )
+			return rc;
+	} else {
+		for ( i = 0 ; i < ( LZMS_REPEATED_OFFSETS - 1 ) ; i++ ) {
+			if ( ! lzms_bit ( lzms, &lzms->lz_repeat[i] ) )
+				break;
+		}
+		offset = lzms->lz_repeated[i];
+		for ( ; i < LZMS_REPEATED_OFFSETS ; i++ )
+			lzms->lz_repeated[i] = lzms->lz_repeated[ i + 1 ];
+	}
+	*pending = offset;
+
+	/* Decode length */
+	if ( ( rc = lzms_value ( lzms, &lzms->length, lzms_length_base,
+				 lzms_length_extra, &length ) ) != 0 )
+		return rc;
+
+	/* Copy data */
+	if ( length > ( lzms->out_len - lzms->out_offset ) ) {
+		printf ( "LZMS match overruns output buffer\n" );
+		return -1;
+	}
+	if ( offset > lzms->out_offset ) {
+		printf ( "LZMS match offset lies outside output\n" );
+		return -1;
+	}
+	for ( ; length ; length-- ) {
+		lzms->out[lzms->out_offset] =
+			lzms->out[ lzms->out_offset - offset ];
+		lzms->out_offset++;
+	}
+
+	return 0;
+}
+
+/**
+ * Decode delta match
+ *
+ * @v lzms		Decompressor
+ * @v pending		Offset to enter the repeated offset queue
+ * @v pending_power	Power to enter the repeated offset queue
+ * @ret rc		Return status code
+ *
+ * A delta match adds the byte 2^power back to the difference between
+ * the bytes (raw offset * 2^power) and (raw offset + 1) * 2^power back,
+ * which suits tables of fixed-width integers.
+ */
+static int lzms_delta_match ( struct lzms *lzms, uint32_t *pending,
+			      uint32_t *pending_power ) {
+	uint32_t raw_offset;
+	uint32_t power;
+	uint32_t length;
+	uint64_t offset1;
+	uint64_t offset2;
+	uint64_t offset;
+	unsigned int i;
+	int rc;
+
+	/* Decode offset and power */
+	if ( ! lzms_bit ( lzms, &lzms->delta ) ) {
+		if ( ( rc = lzms_huffman ( lzms, &lzms->delta_power ) ) < 0 )
+			return rc;
+		power = rc;
+		if ( ( rc = lzms_value ( lzms, &lzms->delta_offset,
+					 lzms_offset_base, lzms_offset_extra,
+					 &raw_offset ) ) != 0 )
+			return rc;
+	} else {
+		for ( i = 0 ; i < ( LZMS_REPEATED_OFFSETS - 1 ) ; i++ ) {
+			if ( ! lzms_bit ( lzms, &lzms->delta_repeat[i] ) )
+				break;
+		}
+		raw_offset = lzms->delta_repeated[i];
+		power = lzms->power_repeated[i];
+		for ( ; i < LZMS_REPEATED_OFFSETS ; i++ ) {
+			lzms->delta_repeated[i] = lzms->delta_repeated[ i + 1 ];
+			lzms->power_repeated[i] = lzms->power_repeated[ i + 1 ];
+		}
+	}
+	*pending = raw_offset;
+	*pending_power = power;
+
+	/* Decode length */
+	if ( ( rc = lzms_value ( lzms, &lzms->length, lzms_length_base,
+				 lzms_length_extra, &length ) ) != 0 )
+		return rc;
+
+	/* Copy data */
+	offset1 = ( 1ULL << power );
+	offset2 = ( ( ( uint64_t ) raw_offset ) << power );
+	offset = ( offset1 + offset2 );
+	if ( length > ( lzms->out_len - lzms->out_offset ) ) {
+		printf ( "LZMS match overruns output buffer\n" );
+		return -1;
+	}
+	if ( offset > lzms->out_offset ) {
+		printf ( "LZMS match offset lies outside output\n" );
+		return -1;
+	}
+	for ( ; length ; length-- ) {
+		lzms->out[lzms->out_offset] =
+			( lzms->out[ lzms->out_offset - offset1 ] +
+			  lzms->out[ lzms->out_offset - offset2 ] -
+			  lzms->out[ lzms->out_offset - offset ] );
+		lzms->out_offset++;
+	}
+
+	return 0;
+}
+
+/**
+ * Update repeated offset queues after decoding an item
+ *
+ * @v lzms		Decompressor
+ * @v lz		LZ offset of this item, or zero
+ * @v delta		Delta offset of this item, or zero
+ * @v power		Delta power of this item
+ *
+ * An offset enters its queue only after the following item, so that
+ * an item never repeats the offset of the item immediately before.
+ */
+static void lzms_update ( struct lzms *lzms, uint32_t lz, uint32_t delta,
+			  uint32_t power ) {
+	unsigned int i;
+
+	if ( lzms->lz_pending ) {
+		for ( i = LZMS_REPEATED_OFFSETS ; i ; i-- )
+			lzms->lz_repeated[i] = lzms->lz_repeated[ i - 1 ];
+		lzms->lz_repeated[0] = lzms->lz_pending;
+	}
+	lzms->lz_pending = lz;
+
+	if ( lzms->delta_pending ) {
+		for ( i = LZMS_REPEATED_OFFSETS ; i ; i-- ) {
+			lzms->delta_repeated[i] = lzms->delta_repeated[ i - 1 ];
+			lzms->power_repeated[i] = lzms->power_repeated[ i - 1 ];
+		}
+		lzms->delta_repeated[0] = lzms->delta_pending;
+		lzms->power_repeated[0] = lzms->power_pending;
+	}
+	lzms->delta_pending = delta;
+	lzms->power_pending = power;
+}
+
+/**
+ * Undo translation of a possible x86 relative address
+ *
+ * @v data		Data
+ * @v pos		Position of instruction
+ * @v opcode_len	Length of opcode preceding the address
+ * @v max_offset	Maximum distance from the last likely instruction
+ * @v last		Position of the last likely instruction
+ * @v target		Last position of each target, counted from @c base
+ * @v base		Position of the start of the data
+ * @ret pos		Position following the address
+ *
+ * The compressor turned relative addresses into absolute ones where
+ * the data seemed to be x86 code, which makes calls to the same
+ * target repeat.  Data is taken to be code if it recently used the
+ * same target twice in a row.
+ */
+static int32_t lzms_x86_translate ( uint8_t *data, int32_t pos,
+				    int32_t opcode_len, int32_t max_offset,
+				    int32_t *last, int32_t *target,
+				    int32_t base ) {
+	uint8_t *address = ( data + pos + opcode_len );
+	uint16_t id;
+
+	if ( ( pos - *last ) <= max_offset )
+		*( ( uint32_t * ) address ) -= pos;
+	id = ( pos + *( ( uint16_t * ) address ) );
+
+	pos += ( opcode_len + 3 );
+	if ( ( base + pos - target[id] ) <= LZMS_X86_ID_WINDOW )
+		*last = pos;
+	target[id] = ( base + pos );
+
+	return ( pos + 1 );
+}
+
+/**
+ * Undo x86 address translation
+ *
+ * @v data		Data
+ * @v len		Length of data
+ * @v target		Table of target positions
+ * @v base		Position of the start of the data
+ *
+ * Positions run on from one chunk to the next, and each chunk starts
+ * further on than the window reaches, so that the targets of earlier
+ * chunks are too old to count and the table needs refilling only when
+ * positions would overflow.
+ */
+static void lzms_x86_filter ( uint8_t *data, int32_t len, int32_t *target,
+			      int32_t *base ) {
+	int32_t last = ( - LZMS_X86_MAX_TRANSLATION_OFFSET - 1 );
+	int32_t opcode_len;
+	int32_t limit;
+	int32_t pos;
+	int32_t i;
+
+	if ( *base > ( 0x7fffffffL - len - LZMS_X86_ID_WINDOW - 1 ) ) {
+		for ( i = 0 ; i < 65536 ; i++ )
+			target[i] = ( - LZMS_X86_ID_WINDOW - 1 );
+		*base = 0;
+	}
+
+	/* The first byte is never an instruction, and no address is
+	 * translated in the last sixteen bytes.
+	 */
+	for ( pos = 1 ; pos < ( len - 16 ) ; ) {
+		uint8_t *p = ( data + pos );
+
+		opcode_len = 0;
+		limit = LZMS_X86_MAX_TRANSLATION_OFFSET;
+		switch ( p[0] ) {
+		case 0x48:
+			/* RIP-relative MOV or LEA (x86-64) */
+			if ( ( ( p[1] == 0x8b ) &&
+			       ( ( p[2] == 0x05 ) || ( p[2] == 0x0d ) ) ) ||
+			     ( ( p[1] == 0x8d ) && ( ( p[2] & 0x07 ) == 0x05 ) ) )
+				opcode_len = 3;
+			break;
+		case 0x4c:
+			/* RIP-relative LEA (x86-64) */
+			if ( ( p[1] == 0x8d ) && ( ( p[2] & 0x07 ) == 0x05 ) )
+				opcode_len = 3;
+			break;
+		case 0xe8:
+			/* Relative CALL, too common to trust from as far */
+			opcode_len = 1;
+			limit /= 2;
+			break;
+		case 0xe9:
+			/* Relative JMP, skipped without translation */
+			pos += 5;
+			continue;
+		case 0xf0:
+			/* RIP-relative LOCK ADD */
+			if ( ( p[1] == 0x83 ) && ( p[2] == 0x05 ) )
+				opcode_len = 3;
+			break;
+		case 0xff:
+			/* RIP-relative indirect CALL */
+			if ( p[1] == 0x15 )
+				opcode_len = 2;
+			break;
+		}
+
+		if ( opcode_len ) {
+			pos = lzms_x86_translate ( data, pos, opcode_len,
+						   limit, &last, target,
+						   *base );
+		} else {
+			pos++;
+		}
+	}
+
+	*base += ( len + LZMS_X86_ID_WINDOW + 1 );
+}
+
+/** Decompressor, kept from one chunk to the next */
+static struct lzms *lzms_context;
+
+/**
+ * Decompress LZMS-compressed data into a bounded buffer
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompressed data
+ * @ret out_len		Length of decompressed data, or negative error
+ *
+ * An LZMS chunk carries no end marker, so exactly @c max_len bytes
+ * are decompressed.
+ */
+ssize_t lzms_decompress_max ( const void *data, size_t len, void *buf,
+			      size_t max_len ) {
+	const uint16_t *words = data;
+	struct lzms *lzms;
+	uint32_t lz;
+	uint32_t delta;
+	uint32_t power;
+	unsigned int i;
+	int rc;
+
+	/* Sanity checks */
+	if ( ( ! buf ) || ( len < ( 2 * sizeof ( words[0] ) ) ) ||
+	     ( max_len > 0x7fffffffUL ) ) {
+		printf ( "LZMS cannot decompress 0x%lx bytes into 0x%lx\n",
+			 ( unsigned long ) len, ( unsigned long ) max_len );
+		return -1;
+	}
+
+	/* Construct slot tables, if not already done */
+	if ( ! lzms_offset_base[0] ) {
+		lzms_init_slots ( lzms_offset_base, lzms_offset_extra,
+				  lzms_offset_runs,
+				  ( sizeof ( lzms_offset_runs ) /
+				    sizeof ( lzms_offset_runs[0] ) ),
+				  0x7fffffffUL );
+		lzms_init_slots ( lzms_length_base, lzms_length_extra,
+				  lzms_length_runs,
+				  ( sizeof ( lzms_length_runs ) /
+				    sizeof ( lzms_length_runs[0] ) ),
+				  0x400108abUL );
+	}
+
+	/* Allocate decompressor, which is too large for the stack, if
+	 * not already done
+	 */
+	lzms = lzms_context;
+	if ( ! lzms ) {
+		lzms = malloc ( sizeof ( *lzms ) );
+		if ( ! lzms ) {
+			printf ( "LZMS out of memory\n" );
+			return -1;
+		}
+		lzms->x86_base = 0x7fffffffL;
+		lzms_context = lzms;
+	}
+
+	/* Initialise decompressor */
+	lzms->out = buf;
+	lzms->out_len = max_len;
+	lzms->out_offset = 0;
+	lzms->range = 0xffffffffUL;
+	lzms->code = ( ( ( ( uint32_t ) words[0] ) << 16 ) | words[1] );
+	lzms->range_next = &words[2];
+	lzms->range_end = &words[ len / sizeof ( words[0] ) ];
+	lzms->accumulator = 0;
+	lzms->bits = 0;
+	lzms->bits_next = lzms->range_end;
+	lzms->bits_start = words;
+	lzms_init_bit ( &lzms->main, LZMS_MAIN_STATES );
+	lzms_init_bit ( &lzms->match, LZMS_MATCH_STATES );
+	lzms_init_bit ( &lzms->lz, LZMS_OTHER_STATES );
+	lzms_init_bit ( &lzms->delta, LZMS_OTHER_STATES );
+	for ( i = 0 ; i < ( LZMS_REPEATED_OFFSETS - 1 ) ; i++ ) {
+		lzms_init_bit ( &lzms->lz_repeat[i], LZMS_OTHER_STATES );
+		lzms_init_bit ( &lzms->delta_repeat[i], LZMS_OTHER_STATES );
+	}
+	lzms_init_huffman ( &lzms->literal, LZMS_LITERAL_CODES,
+			    LZMS_LITERAL_REBUILD );
+	lzms_init_huffman ( &lzms->lz_offset, lzms_offset_codes ( max_len ),
+			    LZMS_LZ_OFFSET_REBUILD );
+	lzms_init_huffman ( &lzms->length, LZMS_LENGTH_CODES,
+			    LZMS_LENGTH_REBUILD );
+	lzms_init_huffman ( &lzms->delta_offset,
+			    lzms_offset_codes ( max_len ),
+			    LZMS_DELTA_OFFSET_REBUILD );
+	lzms_init_huffman ( &lzms->delta_power, LZMS_DELTA_POWER_CODES,
+			    LZMS_DELTA_POWER_REBUILD );
+	for ( i = 0 ; i < ( LZMS_REPEATED_OFFSETS + 1 ) ; i++ ) {
+		lzms->lz_repeated[i] = ( i + 1 );
+		lzms->delta_repeated[i] = ( i + 1 );
+		lzms->power_repeated[i] = 0;
+	}
+	lzms->lz_pending = 0;
+	lzms->delta_pending = 0;
+	lzms->power_pending = 0;
+
+	/* Decode items */
+	while ( lzms->out_offset < lzms->out_len ) {
+		lz = delta = power = 0;
+		if ( ! lzms_bit ( lzms, &lzms->main ) ) {
+			if ( ( rc = lzms_huffman ( lzms,
+						   &lzms->literal ) ) < 0 )
+				return rc;
+			lzms->out[lzms->out_offset++] = rc;
+		} else if ( ! lzms_bit ( lzms, &lzms->match ) ) {
+			if ( ( rc = lzms_lz_match ( lzms, &lz ) ) != 0 )
+				return rc;
+		} else {
+			if ( ( rc = lzms_delta_match ( lzms, &delta,
+						       &power ) ) != 0 )
+				return rc;
+		}
+		lzms_update ( lzms, lz, delta, power );
+	}
+
+	/* Undo x86 address translation */
+	lzms_x86_filter ( buf, max_len, lzms->x86_target, &lzms->x86_base );
+
+	return max_len;
+}
@@ -456,6 +456,8 @@ static int lzx_uncompressed ( struct lzx *lzx ) {
   data = ( lzx->output.data ?
      ( lzx->output.data + lzx->output.offset ) : NULL );
   len = ( lzx->output.threshold - lzx->output.offset );
+  if ( lzx->output.threshold > lzx->output.len )
+    return -1;
   if ( ( rc = lzx_getbytes ( lzx, data, len ) ) != 0 )
     return rc;
 
@@ -495,6 +497,8 @@ static int lzx_token ( struct lzx *lzx ) {
 
   /* Check for literals */
   if ( lzx_main < LZX_MAIN_LIT_CODES ) {
+    if ( lzx->output.offset >= lzx->output.len )
+      return -1;
     if ( lzx->output.data )
       lzx->output.data[lzx->output.offset] = lzx_main;
     lzx->output.offset++;
@@ -554,6 +558,8 @@ static int lzx_token ( struct lzx *lzx ) {
   if ( match_offset > lzx->output.offset ) {
     return -1;
   }
+  if ( match_length > ( lzx->output.len - lzx->output.offset ) )
+    return -1;
   if ( lzx->output.data ) {
     copy = &lzx->output.data[lzx->output.offset];
     for ( i = 0 ; i < match_length ; i++ )
@@ -598,14 +604,16 @@ static void lzx_translate_jumps ( struct lzx *lzx ) {
 }
 
 /**
- * Decompress LZX-compressed data
+ * Decompress LZX-compressed data into a bounded buffer
  *
  * @v data    Compressed data
  * @v len    Length of compressed data
  * @v buf    Decompression buffer, or NULL
+ * @v max_len    Length of decompression buffer
  * @ret out_len    Length of decompressed data, or negative error
  */
-ssize_t lzx_decompress ( const void *data, size_t len, void *buf ) {
+ssize_t lzx_decompress_max ( const void *data, size_t len, void *buf,
+                             size_t max_len ) {
   struct lzx lzx;
   unsigned int i;
   int rc;
@@ -630,6 +638,7 @@ ssize_t lzx_decompress ( const void *data, size_t len, void *buf ) {
   lzx.input.data = data;
   lzx.input.len = len;
   lzx.output.data = buf;
+  lzx.output.len = max_len;
   for ( i = 0 ; i < LZX_REPEATED_OFFSETS ; i++ )
     lzx.repeated_offset[i] = 1;
 
@@ -663,3 +672,15 @@ ssize_t lzx_decompress ( const void *data, size_t len, void *buf ) {
 
   return lzx.output.offset;
 }
+
+/**
+ * Decompress LZX-compressed data
+ *
+ * @v data    Compressed data
+ * @v len    Length of compressed data
+ * @v buf    Decompression buffer, or NULL
+ * @ret out_len    Length of decompressed data, or negative error
+ */
+ssize_t lzx_decompress ( const void *data, size_t len, void *buf ) {
+  return lzx_decompress_max ( data, len, buf, ( ( size_t ) -1 ) );
+}
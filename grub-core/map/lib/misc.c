@@ -23,6 +23,7 @@
 #include <grub/file.h>
 #include <grub/msdos_partition.h>
 #include <grub/eltorito.h>
+#include <grub/memload.h>
 
 #include <misc.h>
 
@@ -117,7 +118,7 @@ grub_pause_fatal (const char *fmt, ...)
 }
 
 grub_file_t
-file_open (const char *name, int mem, int bl, int rt)
+file_open (const char *name, int mem, int bl, int rt, const char *sha256)
 {
   grub_file_t file = 0;
   grub_size_t size = 0;
@@ -133,25 +134,19 @@ file_open (const char *name, int mem, int bl, int rt)
   {
     void *addr = NULL;
     char newname[100];
-#ifdef GRUB_MACHINE_EFI
-    grub_efi_allocate_pool (rt ? GRUB_EFI_RUNTIME_SERVICES_DATA :
-                            GRUB_EFI_BOOT_SERVICES_DATA, size, &addr);
-#else
-    (void)rt;
-    addr = grub_malloc (size);
-#endif
+    grub_printf ("Loading %s ...\n", name);
+    grub_refresh ();
+    addr = grub_memload_file (file, 0, rt ? GRUB_MEMLOAD_RUNTIME : 0, sha256);
+    grub_file_close (file);
     if (!addr)
     {
-      grub_printf ("out of memory\n");
-      grub_file_close (file);
+      grub_printf ("%s\n", grub_errmsg);
       return NULL;
     }
-    grub_printf ("Loading %s ...\n", name);
-    grub_refresh ();
-    grub_file_read (file, addr, size);
-    grub_file_close (file);
     grub_snprintf (newname, 100, "mem:%p:size:%lld", addr, (unsigned long long)size);
     file = grub_file_open (newname, type);
+    if (!file)
+      grub_memload_free (addr, size);
   }
   return file;
 }
@@ -183,13 +178,7 @@ file_close (grub_file_t file)
   if (!file)
     return;
   if (grub_ismemfile (file->name))
-  {
-#ifdef GRUB_MACHINE_EFI
-    grub_efi_free_pool (file->data);
-#else
-    grub_free (file->data);
-#endif
-  }
+    grub_memload_free (file->data, file->size);
   grub_file_close (file);
 }
 
@@ -31,6 +31,7 @@
 #include <vfat.h>
 #include <lzx.h>
 #include <xpress.h>
+#include <lzms.h>
 #include <wim.h>
 
 /**
@@ -42,6 +43,94 @@
 static struct wim_chunk_buffer wim_chunk_buffer
   __attribute__ (( section ( ".stack" ) ));
 
+/** Number of decompressed chunks kept in the chunk cache */
+#define WIM_CHUNK_CACHE_SIZE 16
+
+/**
+ * Total length of chunk buffers beyond which the cache stops growing
+ *
+ * This holds a full cache of the usual chunks.  Chunks which do not
+ * fit, such as the large chunks of solid resources, share a single
+ * buffer outside of this budget.
+ */
+#define WIM_CHUNK_CACHE_MAX_LEN ( 2 * 1024 * 1024 )
+
+/** A cached decompressed chunk */
+struct wim_chunk_cache_entry {
+  /** Virtual file, or NULL if the entry holds no chunk */
+  struct vfat_file *file;
+  /** Resource offset within the file */
+  size_t resource_offset;
+  /** Chunk number */
+  unsigned int chunk;
+  /** Time of last use */
+  unsigned long used;
+  /** Chunk buffer, or NULL if not yet allocated */
+  uint8_t *data;
+  /** Length of chunk buffer */
+  size_t size;
+};
+
+/**
+ * WIM chunk cache
+ *
+ * The first entry uses the static chunk buffer, so that a chunk can
+ * always be cached even if no more buffers can be allocated.
+ */
+static struct wim_chunk_cache_entry wim_chunk_cache[WIM_CHUNK_CACHE_SIZE] = {
+  { .data = wim_chunk_buffer.data, .size = sizeof ( wim_chunk_buffer.data ) },
+};
+
+/** WIM chunk cache clock */
+static unsigned long wim_chunk_cache_clock;
+
+/** Total length of allocated chunk buffers, except the large buffer */
+static size_t wim_chunk_cache_len;
+
+/** Entry holding the buffer for chunks beyond the budget, or NULL */
+static struct wim_chunk_cache_entry *wim_chunk_cache_large;
+
+/**
+ * Get length of a chunk buffer counted against the cache budget
+ *
+ * @v entry    Chunk cache entry
+ * @ret len    Length of buffer counted against the budget
+ */
+static size_t wim_chunk_cache_counted ( struct wim_chunk_cache_entry *entry ) {
+
+  if ( ( ! entry->data ) || ( entry->data == wim_chunk_buffer.data ) ||
+       ( entry == wim_chunk_cache_large ) )
+    return 0;
+  return entry->size;
+}
+
+/** A parsed solid resource */
+struct wim_solid_resource {
+  /** Next parsed solid resource */
+  struct wim_solid_resource *next;
+  /** Virtual file */
+  struct vfat_file *file;
+  /** Resource offset within the file */
+  size_t offset;
+  /** Solid resource header */
+  struct wim_solid_header header;
+  /** Chunk length (as a power of two) */
+  unsigned int shift;
+  /** Number of chunks */
+  size_t chunks;
+  /** Offset of each chunk within the resource, then the end of the last */
+  uint64_t chunk_offset[0];
+};
+
+/** Parsed solid resources */
+static struct wim_solid_resource *wim_solid_resources;
+
+/** Compressed chunk buffer, kept for the next chunk */
+static uint8_t *wim_zbuf;
+
+/** Length of compressed chunk buffer */
+static size_t wim_zbuf_len;
+
 /**
  * Get WIM header
  *
@@ -63,18 +152,162 @@ int wim_header ( struct vfat_file *file, struct wim_header *header ) {
   return 0;
 }
 
+/**
+ * Check chunk length
+ *
+ * @v chunk_len    Chunk length
+ * @v shift    Chunk length (as a power of two) to fill in
+ * @ret rc    Return status code
+ */
+static int wim_chunk_len_shift ( size_t chunk_len, unsigned int *shift ) {
+
+  /* Sanity check */
+  if ( ( ! chunk_len ) || ( chunk_len > WIM_CHUNK_LEN_MAX ) ||
+       ( chunk_len & ( chunk_len - 1 ) ) ) {
+    printf ( "Unsupported chunk length 0x%lx\n", (unsigned long)chunk_len );
+    return -1;
+  }
+
+  for ( *shift = 0 ; ( 1UL << *shift ) < chunk_len ; (*shift)++ ) {
+  }
+  return 0;
+}
+
+/**
+ * Get chunk length of compressed resources
+ *
+ * @v header    WIM header
+ * @v shift    Chunk length (as a power of two) to fill in
+ * @ret rc    Return status code
+ *
+ * Solid resources have a chunk length of their own.
+ */
+static int wim_chunk_shift ( struct wim_header *header, unsigned int *shift ) {
+
+  return wim_chunk_len_shift ( ( header->chunk_len ? header->chunk_len :
+                                 WIM_CHUNK_LEN ), shift );
+}
+
+/**
+ * Find parsed solid resource
+ *
+ * @v file    Virtual file
+ * @v offset    Resource offset within the file
+ * @ret solid    Solid resource, or NULL if not yet parsed
+ */
+static struct wim_solid_resource * wim_solid_find ( struct vfat_file *file,
+                                                   size_t offset ) {
+  struct wim_solid_resource *solid;
+
+  for ( solid = wim_solid_resources ; solid ; solid = solid->next ) {
+    if ( ( solid->file == file ) && ( solid->offset == offset ) )
+      return solid;
+  }
+  return NULL;
+}
+
+/**
+ * Parse solid resource
+ *
+ * @v file    Virtual file
+ * @v resource    Solid resource, as found in the lookup table
+ * @ret solid    Solid resource, or NULL on error
+ *
+ * The solid resource header is followed by the compressed length of
+ * each chunk, and then by the chunks themselves.  The chunk offsets
+ * are worked out once, when the resource is first used.
+ */
+static struct wim_solid_resource *
+wim_solid_parse ( struct vfat_file *file,
+                  struct wim_resource_header *resource ) {
+  size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
+  struct wim_solid_resource *solid;
+  struct wim_solid_header header;
+  uint32_t *lens;
+  uint64_t chunks;
+  uint64_t offset;
+  unsigned int shift;
+  size_t i;
+
+  /* Use the resource if already parsed */
+  solid = wim_solid_find ( file, resource->offset );
+  if ( solid )
+    return solid;
+
+  /* Sanity checks */
+  if ( ( resource->offset + zlen ) > file->len ) {
+    printf ( "Resource exceeds length of file\n" );
+    return NULL;
+  }
+  if ( zlen < sizeof ( header ) ) {
+    printf ( "Solid resource too short\n" );
+    return NULL;
+  }
+  file->read ( file, &header, resource->offset, sizeof ( header ) );
+  if ( wim_chunk_len_shift ( header.chunk_len, &shift ) != 0 )
+    return NULL;
+  chunks = ( ( header.len >> shift ) +
+             ( ( header.len & ( ( 1ULL << shift ) - 1 ) ) != 0 ) );
+  if ( chunks > ( ( zlen - sizeof ( header ) ) / sizeof ( lens[0] ) ) ) {
+    printf ( "Solid resource too short for its chunks\n" );
+    return NULL;
+  }
+
+  /* Read compressed chunk lengths */
+  solid = malloc ( sizeof ( *solid ) +
+                   ( ( chunks + 1 ) * sizeof ( solid->chunk_offset[0] ) ) );
+  lens = malloc ( ( chunks + 1 ) * sizeof ( lens[0] ) );
+  if ( ( ! solid ) || ( ! lens ) ) {
+    printf ( "Out of memory for chunk table\n" );
+    goto err;
+  }
+  file->read ( file, lens, ( resource->offset + sizeof ( header ) ),
+               ( chunks * sizeof ( lens[0] ) ) );
+
+  /* Calculate chunk offsets */
+  offset = ( sizeof ( header ) + ( chunks * sizeof ( lens[0] ) ) );
+  for ( i = 0 ; i < chunks ; i++ ) {
+    solid->chunk_offset[i] = offset;
+    offset += lens[i];
+    if ( ( lens[i] > ( 1UL << shift ) ) || ( offset > zlen ) ) {
+      printf ( "Chunk %ld lies outside solid resource\n", (long)i );
+      goto err;
+    }
+  }
+  solid->chunk_offset[chunks] = offset;
+  free ( lens );
+
+  /* Record parsed resource */
+  solid->file = file;
+  solid->offset = resource->offset;
+  memcpy ( &solid->header, &header, sizeof ( solid->header ) );
+  solid->shift = shift;
+  solid->chunks = chunks;
+  solid->next = wim_solid_resources;
+  wim_solid_resources = solid;
+
+  return solid;
+
+ err:
+  free ( lens );
+  free ( solid );
+  return NULL;
+}
+
 /**
  * Get compressed chunk offset
  *
  * @v file    Virtual file
  * @v resource    Resource
+ * @v shift    Chunk length (as a power of two)
  * @v chunk    Chunk number
  * @v offset    Offset to fill in
  * @ret rc    Return status code
  */
 static int wim_chunk_offset ( struct vfat_file *file,
             struct wim_resource_header *resource,
-            unsigned int chunk, size_t *offset ) {
+            unsigned int shift, unsigned int chunk,
+            size_t *offset ) {
   size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
   unsigned int chunks;
   size_t offset_offset;
@@ -92,7 +325,7 @@ static int wim_chunk_offset ( struct vfat_file *file,
   }
 
   /* Calculate chunk parameters */
-  chunks = ( ( resource->len + WIM_CHUNK_LEN - 1 ) / WIM_CHUNK_LEN );
+  chunks = ( ( resource->len + ( 1ULL << shift ) - 1 ) >> shift );
   offset_len = ( ( resource->len > 0xffffffffULL ) ?
            sizeof ( u.offset_64 ) : sizeof ( u.offset_32 ) );
   chunks_len = ( ( chunks - 1 ) * offset_len );
@@ -137,15 +370,21 @@ static int wim_chunk_offset ( struct vfat_file *file,
  * @v file    Virtual file
  * @v header    WIM header
  * @v resource    Resource
+ * @v solid    Solid resource, or NULL
+ * @v shift    Chunk length (as a power of two)
  * @v chunk    Chunk number
- * @v buf    Chunk buffer
+ * @v data    Chunk buffer
  * @ret rc    Return status code
  */
 static int wim_chunk ( struct vfat_file *file, struct wim_header *header,
            struct wim_resource_header *resource,
-           unsigned int chunk, struct wim_chunk_buffer *buf ) {
-  ssize_t ( * decompress ) ( const void *data, size_t len, void *buf );
-  unsigned int chunks;
+           struct wim_solid_resource *solid,
+           unsigned int shift, unsigned int chunk, uint8_t *data ) {
+  ssize_t ( * decompress ) ( const void *data, size_t len, void *buf,
+                             size_t max_len );
+  uint64_t resource_len;
+  uint64_t chunk_start;
+  uint32_t format;
   size_t offset;
   size_t next_offset;
   size_t len;
@@ -154,56 +393,222 @@ static int wim_chunk ( struct vfat_file *file, struct wim_header *header,
   int rc;
 
   /* Get chunk compressed data offset and length */
-  if ( ( rc = wim_chunk_offset ( file, resource, chunk,
-               &offset ) ) != 0 )
-    return rc;
-  if ( ( rc = wim_chunk_offset ( file, resource, ( chunk + 1 ),
-               &next_offset ) ) != 0 )
-    return rc;
+  if ( solid ) {
+    if ( chunk >= solid->chunks ) {
+      printf ( "Chunk %d lies outside solid resource\n", chunk );
+      return -1;
+    }
+    offset = solid->chunk_offset[chunk];
+    next_offset = solid->chunk_offset[ chunk + 1 ];
+    resource_len = solid->header.len;
+    format = solid->header.format;
+  } else {
+    if ( ( rc = wim_chunk_offset ( file, resource, shift, chunk,
+                 &offset ) ) != 0 )
+      return rc;
+    if ( ( rc = wim_chunk_offset ( file, resource, shift, ( chunk + 1 ),
+                 &next_offset ) ) != 0 )
+      return rc;
+    resource_len = resource->len;
+    if ( header->flags & WIM_HDR_LZX ) {
+      format = WIM_SOLID_LZX;
+    } else if ( header->flags & WIM_HDR_XPRESS ) {
+      format = WIM_SOLID_XPRESS;
+    } else if ( header->flags & WIM_HDR_LZMS ) {
+      format = WIM_SOLID_LZMS;
+    } else {
+      format = WIM_SOLID_NONE;
+    }
+  }
   len = ( next_offset - offset );
 
   /* Calculate uncompressed length */
-  chunks = ( ( resource->len + WIM_CHUNK_LEN - 1 ) / WIM_CHUNK_LEN );
-  expected_out_len = ( ( chunk >= ( chunks - 1 ) ) ?
-           ( resource->len % WIM_CHUNK_LEN ) : WIM_CHUNK_LEN);
+  chunk_start = ( ( uint64_t ) chunk << shift );
+  expected_out_len = ( 1UL << shift );
+  if ( ( resource_len - chunk_start ) < expected_out_len )
+    expected_out_len = ( resource_len - chunk_start );
 
-  /* Read possibly-compressed data */
+  /* Sanity check */
+  if ( ( next_offset < offset ) || ( len > ( 1UL << shift ) ) ) {
+    printf ( "Chunk %d has invalid length 0x%lx\n",
+             chunk, (unsigned long)len );
+    return -1;
+  }
+
+  /* Chunk did not compress; read raw data */
   if ( len == expected_out_len ) {
+    file->read ( file, data, ( resource->offset + offset ), len );
+    return 0;
+  }
 
-    /* Chunk did not compress; read raw data */
-    file->read ( file, buf->data, ( resource->offset + offset ),
-           len );
+  /* Identify decompressor */
+  switch ( format ) {
+  case WIM_SOLID_XPRESS:
+    decompress = xca_decompress_max;
+    break;
+  case WIM_SOLID_LZX:
+    decompress = lzx_decompress_max;
+    break;
+  case WIM_SOLID_LZMS:
+    decompress = lzms_decompress_max;
+    break;
+  default:
+    printf ( "Unsupported compression format %d\n", format );
+    return -1;
+  }
 
-  } else {
-    uint8_t zbuf[len];
+  /* Read compressed data into the compressed chunk buffer, which may
+   * be too large for the stack, enlarging it if needed.
+   */
+  if ( len > wim_zbuf_len ) {
+    free ( wim_zbuf );
+    wim_zbuf_len = 0;
+    wim_zbuf = malloc ( len );
+    if ( ! wim_zbuf ) {
+      printf ( "Out of memory for 0x%lx-byte compressed chunk\n",
+               (unsigned long)len );
+      return -1;
+    }
+    wim_zbuf_len = len;
+  }
+  file->read ( file, wim_zbuf, ( resource->offset + offset ), len );
+
+  /* Decompress data, which may not overrun the chunk */
+  out_len = decompress ( wim_zbuf, len, data, expected_out_len );
+  if ( out_len < 0 )
+    return out_len;
+  if ( ( ( size_t ) out_len ) != expected_out_len ) {
+    printf ( "Unexpected output length 0x%lx (expected 0x%lx)\n",
+          out_len, (unsigned long)expected_out_len );
+    return -1;
+  }
 
-    /* Read compressed data into a temporary buffer */
-    file->read ( file, zbuf, ( resource->offset + offset ), len );
+  return 0;
+}
 
-    /* Identify decompressor */
-    if ( header->flags & WIM_HDR_LZX ) {
-      decompress = lzx_decompress;
-    } else if ( header->flags & WIM_HDR_XPRESS ) {
-      decompress = xca_decompress;
-    } else if ( header->flags & WIM_HDR_LZMS ) {
-      printf ( "LZMS compression is not supported.\n" );
-      return -1;
+/**
+ * Choose between chunk cache entries to hold a chunk
+ *
+ * @v entry    Candidate entry
+ * @v best    Best entry so far
+ * @v len    Chunk length
+ * @ret better    Candidate entry is better
+ *
+ * Prefer the smallest buffer that holds the chunk, so that the large
+ * buffers of solid resource chunks are reused rather than duplicated,
+ * and then the least recently used entry.
+ */
+static int wim_chunk_cache_better ( struct wim_chunk_cache_entry *entry,
+            struct wim_chunk_cache_entry *best, size_t len ) {
+  int entry_fits = ( entry->size >= len );
+  int best_fits = ( best->size >= len );
+
+  if ( entry_fits != best_fits )
+    return entry_fits;
+  if ( entry_fits && ( entry->size != best->size ) )
+    return ( entry->size < best->size );
+  return ( entry->used < best->used );
+}
+
+/**
+ * Get decompressed chunk, using the chunk cache
+ *
+ * @v file    Virtual file
+ * @v header    WIM header
+ * @v resource    Resource
+ * @v solid    Solid resource, or NULL
+ * @v shift    Chunk length (as a power of two)
+ * @v chunk    Chunk number
+ * @v data    Chunk data to fill in
+ * @ret rc    Return status code
+ */
+static int wim_chunk_cached ( struct vfat_file *file,
+            struct wim_header *header,
+            struct wim_resource_header *resource,
+            struct wim_solid_resource *solid,
+            unsigned int shift, unsigned int chunk,
+            uint8_t **data ) {
+  struct wim_chunk_cache_entry *entry;
+  struct wim_chunk_cache_entry *victim = NULL;
+  struct wim_chunk_cache_entry *unallocated = NULL;
+  size_t len = ( 1UL << shift );
+  uint8_t *buf;
+  unsigned int i;
+  int rc;
+
+  /* Look for the chunk, and for the entry to replace */
+  for ( i = 0 ; i < WIM_CHUNK_CACHE_SIZE ; i++ ) {
+    entry = &wim_chunk_cache[i];
+    if ( ( entry->file == file ) &&
+         ( entry->resource_offset == resource->offset ) &&
+         ( entry->chunk == chunk ) ) {
+      entry->used = ++wim_chunk_cache_clock;
+      *data = entry->data;
+      return 0;
+    }
+    if ( ! entry->data ) {
+      if ( ! unallocated )
+        unallocated = entry;
+      continue;
+    }
+    if ( ( ! victim ) || wim_chunk_cache_better ( entry, victim, len ) )
+      victim = entry;
+  }
+
+  /* Grow the cache rather than evict a chunk, if possible */
+  if ( ( victim->file || ( victim->size < len ) ) && unallocated &&
+       ( ( wim_chunk_cache_len + len ) <= WIM_CHUNK_CACHE_MAX_LEN ) ) {
+    unallocated->data = malloc ( len );
+    if ( unallocated->data ) {
+      unallocated->size = len;
+      wim_chunk_cache_len += len;
+      victim = unallocated;
+    }
+  }
+
+  /* A chunk which the buffer cannot hold, and which would take the
+   * cache beyond its budget, goes to the large buffer instead.
+   */
+  if ( ( victim->size < len ) && ( victim != wim_chunk_cache_large ) &&
+       ( ( wim_chunk_cache_len - wim_chunk_cache_counted ( victim ) + len ) >
+         WIM_CHUNK_CACHE_MAX_LEN ) ) {
+    if ( wim_chunk_cache_large ) {
+      victim = wim_chunk_cache_large;
     } else {
-      return -1;
+      wim_chunk_cache_len -= wim_chunk_cache_counted ( victim );
+      wim_chunk_cache_large = victim;
     }
+  }
 
-    /* Decompress data */
-    out_len = decompress ( zbuf, len, NULL );
-    if ( out_len < 0 )
-      return out_len;
-    if ( ( ( size_t ) out_len ) != expected_out_len ) {
-      printf ( "Unexpected output length 0x%lx (expected 0x%lx)\n",
-            out_len, (unsigned long)expected_out_len );
+  /* Enlarge the buffer if it cannot hold the chunk */
+  victim->file = NULL;
+  victim->used = 0;
+  if ( victim->size < len ) {
+    buf = malloc ( len );
+    if ( ! buf ) {
+      printf ( "Out of memory for 0x%lx-byte chunk\n", (unsigned long)len );
       return -1;
     }
-    decompress ( zbuf, len, buf->data );
+    wim_chunk_cache_len -= wim_chunk_cache_counted ( victim );
+    if ( victim->data != wim_chunk_buffer.data )
+      free ( victim->data );
+    victim->data = buf;
+    victim->size = len;
+    wim_chunk_cache_len += wim_chunk_cache_counted ( victim );
   }
 
+  /* Read chunk */
+  if ( ( rc = wim_chunk ( file, header, resource, solid, shift, chunk,
+                          victim->data ) ) != 0 )
+    return rc;
+
+  /* Update cache */
+  victim->file = file;
+  victim->resource_offset = resource->offset;
+  victim->chunk = chunk;
+  victim->used = ++wim_chunk_cache_clock;
+  *data = victim->data;
+
   return 0;
 }
 
@@ -221,10 +626,11 @@ static int wim_chunk ( struct vfat_file *file, struct wim_header *header,
 int wim_read ( struct vfat_file *file, struct wim_header *header,
          struct wim_resource_header *resource, void *data,
          size_t offset, size_t len ) {
-  static struct vfat_file *cached_file;
-  static size_t cached_resource_offset;
-  static unsigned int cached_chunk;
   size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
+  struct wim_solid_resource *solid = NULL;
+  uint8_t *buf;
+  uint64_t pos;
+  unsigned int shift;
   unsigned int chunk;
   size_t skip_len;
   size_t frag_len;
@@ -234,9 +640,24 @@ int wim_read ( struct vfat_file *file, struct wim_header *header,
   if ( ( offset + len ) > resource->len ) {
     return -1;
   }
-  if ( ( resource->offset + zlen ) > file->len ) {
+  if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) {
+    /* Stream within a solid resource, as located by wim_file() */
+    solid = wim_solid_find ( file, resource->offset );
+    if ( ! solid ) {
+      printf ( "Unknown solid resource\n" );
+      return -1;
+    }
+    pos = ( zlen + offset );
+    if ( ( pos + len ) > solid->header.len ) {
+      printf ( "Stream exceeds solid resource\n" );
+      return -1;
+    }
+    shift = solid->shift;
+  } else if ( ( resource->offset + zlen ) > file->len ) {
     printf ( "Resource exceeds length of file\n" );
     return -1;
+  } else {
+    pos = offset;
   }
 
   /* If resource is uncompressed, just read the raw data */
@@ -246,44 +667,97 @@ int wim_read ( struct vfat_file *file, struct wim_header *header,
     return 0;
   }
 
+  /* Get chunk length */
+  if ( ( ! solid ) && ( ( rc = wim_chunk_shift ( header, &shift ) ) != 0 ) )
+    return rc;
+
   /* Read from each chunk overlapping the target region */
   while ( len ) {
 
     /* Calculate chunk number */
-    chunk = ( offset / WIM_CHUNK_LEN );
-
-    /* Read chunk, if not already cached */
-    if ( ( file != cached_file ) ||
-         ( resource->offset != cached_resource_offset ) ||
-         ( chunk != cached_chunk ) ) {
-
-      /* Read chunk */
-      if ( ( rc = wim_chunk ( file, header, resource, chunk,
-            &wim_chunk_buffer ) ) != 0 )
-        return rc;
-
-      /* Update cache */
-      cached_file = file;
-      cached_resource_offset = resource->offset;
-      cached_chunk = chunk;
-    }
+    chunk = ( pos >> shift );
+
+    /* Get chunk */
+    if ( ( rc = wim_chunk_cached ( file, header, resource, solid, shift,
+                                   chunk, &buf ) ) != 0 )
+      return rc;
 
     /* Copy fragment from this chunk */
-    skip_len = ( offset % WIM_CHUNK_LEN );
-    frag_len = ( WIM_CHUNK_LEN - skip_len );
+    skip_len = ( pos & ( ( 1ULL << shift ) - 1 ) );
+    frag_len = ( ( 1UL << shift ) - skip_len );
     if ( frag_len > len )
       frag_len = len;
-    memcpy ( data, ( wim_chunk_buffer.data + skip_len ), frag_len );
+    memcpy ( data, ( buf + skip_len ), frag_len );
 
     /* Move to next chunk */
     data = (char *)data + frag_len;
-    offset += frag_len;
+    pos += frag_len;
     len -= frag_len;
   }
 
   return 0;
 }
 
+/**
+ * Locate a stream within the solid resources
+ *
+ * @v file    Virtual file
+ * @v header    WIM header
+ * @v index    Offset of the stream's lookup table entry
+ * @v resource    Stream resource to update
+ * @ret rc    Return status code
+ *
+ * The stream's offset counts from the start of the first solid
+ * resource in the run of packed lookup table entries holding the
+ * stream's own entry.
+ */
+static int wim_solid ( struct vfat_file *file, struct wim_header *header,
+           size_t index, struct wim_resource_header *resource ) {
+  struct wim_lookup_entry entry;
+  struct wim_solid_resource *solid;
+  uint64_t pos = resource->offset;
+  uint64_t len = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
+  size_t offset;
+  int rc;
+
+  /* Find the start of the run */
+  for ( offset = index ; offset ; offset -= sizeof ( entry ) ) {
+    if ( ( rc = wim_read ( file, header, &header->lookup, &entry,
+               ( offset - sizeof ( entry ) ),
+               sizeof ( entry ) ) ) != 0 )
+      return rc;
+    if ( ! ( entry.resource.zlen__flags & WIM_RESHDR_PACKED_STREAMS ) )
+      break;
+  }
+
+  /* Walk the solid resources of the run in order */
+  for ( ; ( offset + sizeof ( entry ) ) <= header->lookup.len ;
+        offset += sizeof ( entry ) ) {
+    if ( ( rc = wim_read ( file, header, &header->lookup, &entry,
+               offset, sizeof ( entry ) ) ) != 0 )
+      return rc;
+    if ( ! ( entry.resource.zlen__flags & WIM_RESHDR_PACKED_STREAMS ) )
+      break;
+    if ( entry.resource.len != WIM_SOLID_LEN )
+      continue;
+    solid = wim_solid_parse ( file, &entry.resource );
+    if ( ! solid )
+      return -1;
+    if ( pos < solid->header.len ) {
+      if ( ( pos + len ) > solid->header.len )
+        break;
+      resource->zlen__flags = ( WIM_RESHDR_PACKED_STREAMS | pos );
+      resource->offset = entry.resource.offset;
+      resource->len = len;
+      return 0;
+    }
+    pos -= solid->header.len;
+  }
+
+  printf ( "Cannot find solid resource holding stream\n" );
+  return -1;
+}
+
 /**
  * Get number of images
  *
@@ -517,6 +991,8 @@ int wim_file ( struct vfat_file *file, struct wim_header *header,
       free (str);
       memcpy ( resource, &entry.resource,
          sizeof ( *resource ) );
+      if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS )
+        return wim_solid ( file, header, offset, resource );
       return 0;
     }
   }
@@ -26,6 +26,7 @@
 
 #include <grub/misc.h>
 #include <grub/file.h>
+#include <grub/time.h>
 
 #include <stddef.h>
 #include <stdio.h>
@@ -33,6 +34,8 @@
 #include <string.h>
 #include <lzx.h>
 #include <xpress.h>
+#include <lzms.h>
+#include <sha1.h>
 #include <wim.h>
 #include <misc.h>
 #include <grub/wimtools.h>
@@ -56,18 +59,40 @@ static int grub_wim_header (grub_file_t file, struct wim_header *header)
   return 0;
 }
 
+/**
+ * Get chunk length of compressed resources
+ *
+ * @v header    WIM header
+ * @v shift    Chunk length (as a power of two) to fill in
+ * @ret rc    Return status code
+ */
+static int
+grub_wim_chunk_shift (struct wim_header *header, unsigned int *shift)
+{
+  size_t chunk_len = (header->chunk_len ? header->chunk_len : WIM_CHUNK_LEN);
+
+  /* Sanity check */
+  if ((chunk_len > WIM_CHUNK_LEN_MAX) || (chunk_len & (chunk_len - 1)))
+    return -1;
+
+  for (*shift = 0 ; (1UL << *shift) < chunk_len ; (*shift)++)
+    ;
+  return 0;
+}
+
 /**
  * Get compressed chunk offset
  *
  * @v file    Virtual file
  * @v resource    Resource
+ * @v shift    Chunk length (as a power of two)
  * @v chunk    Chunk number
  * @v offset    Offset to fill in
  * @ret rc    Return status code
  */
 static int
 grub_wim_chunk_offset (grub_file_t file, struct wim_resource_header *resource,
-                       unsigned int chunk, size_t *offset)
+                       unsigned int shift, unsigned int chunk, size_t *offset)
 {
   size_t zlen = (resource->zlen__flags & WIM_RESHDR_ZLEN_MASK);
   unsigned int chunks;
@@ -88,7 +113,7 @@ grub_wim_chunk_offset (grub_file_t file, struct wim_resource_header *resource,
   }
 
   /* Calculate chunk parameters */
-  chunks = ((resource->len + WIM_CHUNK_LEN - 1) / WIM_CHUNK_LEN);
+  chunks = ((resource->len + (1ULL << shift) - 1) >> shift);
   offset_len = ((resource->len > 0xffffffffULL) ?
            sizeof (u.offset_64) : sizeof (u.offset_32));
   chunks_len = ((chunks - 1) * offset_len);
@@ -130,67 +155,71 @@ grub_wim_chunk_offset (grub_file_t file, struct wim_resource_header *resource,
  * @v file    Virtual file
  * @v header    WIM header
  * @v resource    Resource
+ * @v shift    Chunk length (as a power of two)
  * @v chunk    Chunk number
- * @v buf    Chunk buffer
+ * @v data    Chunk buffer
  * @ret rc    Return status code
  */
 static int
 grub_wim_chunk (grub_file_t file, struct wim_header *header,
                 struct wim_resource_header *resource,
-                unsigned int chunk, struct wim_chunk_buffer *buf)
+                unsigned int shift, unsigned int chunk, uint8_t *data)
 {
-  ssize_t (* decompress) (const void *data, size_t len, void *buf);
-  unsigned int chunks;
+  ssize_t (* decompress) (const void *data, size_t len, void *buf,
+                           size_t max_len);
   size_t offset;
   size_t next_offset;
   size_t len;
   size_t expected_out_len;
   ssize_t out_len;
+  uint8_t *zbuf;
   int rc;
 
   /* Get chunk compressed data offset and length */
-  if ((rc = grub_wim_chunk_offset (file, resource, chunk,
+  if ((rc = grub_wim_chunk_offset (file, resource, shift, chunk,
                &offset)) != 0)
     return rc;
-  if ((rc = grub_wim_chunk_offset (file, resource, (chunk + 1),
+  if ((rc = grub_wim_chunk_offset (file, resource, shift, (chunk + 1),
                &next_offset)) != 0)
     return rc;
   len = (next_offset - offset);
 
   /* Calculate uncompressed length */
-  chunks = ((resource->len + WIM_CHUNK_LEN - 1) / WIM_CHUNK_LEN);
-  expected_out_len = ((chunk >= (chunks - 1)) ?
-           (resource->len % WIM_CHUNK_LEN) : WIM_CHUNK_LEN);
+  expected_out_len = (1UL << shift);
+  if ((resource->len - ((uint64_t) chunk << shift)) < expected_out_len)
+    expected_out_len = resource->len - ((uint64_t) chunk << shift);
 
   /* Read possibly-compressed data */
   if (len == expected_out_len)
   {
     /* Chunk did not compress; read raw data */
-    file_read (file, buf->data, len, resource->offset + offset);
+    file_read (file, data, len, resource->offset + offset);
+    return 0;
   }
-  else
-  {
-    uint8_t zbuf[len];
-    /* Read compressed data into a temporary buffer */
-    file_read (file, zbuf, len, resource->offset + offset);
-
-    /* Identify decompressor */
-    if (header->flags & WIM_HDR_LZX)
-      decompress = lzx_decompress;
-    else if (header->flags & WIM_HDR_XPRESS)
-      decompress = xca_decompress;
-    else
-      return -1;
 
-    /* Decompress data */
-    out_len = decompress (zbuf, len, NULL);
-    if (out_len < 0)
-      return out_len;
-    if (((size_t) out_len) != expected_out_len)
-      return -1;
+  /* Identify decompressor */
+  if (header->flags & WIM_HDR_LZX)
+    decompress = lzx_decompress_max;
+  else if (header->flags & WIM_HDR_XPRESS)
+    decompress = xca_decompress_max;
+  else if (header->flags & WIM_HDR_LZMS)
+    decompress = lzms_decompress_max;
+  else
+    return -1;
 
-    decompress (zbuf, len, buf->data);
-  }
+  /* Read compressed data into a temporary buffer */
+  zbuf = malloc (len);
+  if (! zbuf)
+    return -1;
+  file_read (file, zbuf, len, resource->offset + offset);
+
+  /* Decompress data, which may not overrun the chunk buffer */
+  out_len = decompress (zbuf, len, data, expected_out_len);
+  free (zbuf);
+  if (out_len < 0)
+    return out_len;
+  if (((size_t) out_len) != expected_out_len)
+    return -1;
   return 0;
 }
 
@@ -204,17 +233,21 @@ grub_wim_chunk (grub_file_t file, struct wim_header *header,
  * @v offset    Starting offset
  * @v len    Length
  * @ret rc    Return status code
+ *
+ * Streams within solid resources are not supported.
  */
 static int
 grub_wim_read (grub_file_t file, struct wim_header *header,
                struct wim_resource_header *resource, void *data,
                size_t offset, size_t len)
 {
-  static struct wim_chunk_buffer grub_wim_chunk_buffer;
+  static uint8_t *grub_wim_chunk_data;
+  static size_t grub_wim_chunk_size;
   static grub_file_t cached_file;
   static size_t cached_resource_offset;
   static unsigned int cached_chunk;
   size_t zlen = (resource->zlen__flags & WIM_RESHDR_ZLEN_MASK);
+  unsigned int shift;
   unsigned int chunk;
   size_t skip_len;
   size_t frag_len;
@@ -227,19 +260,35 @@ grub_wim_read (grub_file_t file, struct wim_header *header,
   if ((resource->offset + zlen) > file->size)
     return -1;
 
+  if (resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS)
+    return -1;
+
   /* If resource is uncompressed, just read the raw data */
-  if (! (resource->zlen__flags & (WIM_RESHDR_COMPRESSED |
-             WIM_RESHDR_PACKED_STREAMS)))
+  if (! (resource->zlen__flags & WIM_RESHDR_COMPRESSED))
   {
     file_read (file, data, len, resource->offset + offset);
     return 0;
   }
 
+  /* Get chunk buffer */
+  if ((rc = grub_wim_chunk_shift (header, &shift)) != 0)
+    return rc;
+  if (grub_wim_chunk_size < (1UL << shift))
+  {
+    free (grub_wim_chunk_data);
+    cached_file = NULL;
+    grub_wim_chunk_size = 0;
+    grub_wim_chunk_data = malloc (1UL << shift);
+    if (! grub_wim_chunk_data)
+      return -1;
+    grub_wim_chunk_size = (1UL << shift);
+  }
+
   /* Read from each chunk overlapping the target region */
   while (len)
   {
     /* Calculate chunk number */
-    chunk = offset / WIM_CHUNK_LEN;
+    chunk = offset >> shift;
 
     /* Read chunk, if not already cached */
     if ((file != cached_file) ||
@@ -247,8 +296,9 @@ grub_wim_read (grub_file_t file, struct wim_header *header,
          (chunk != cached_chunk))
     {
       /* Read chunk */
-      if ((rc = grub_wim_chunk (file, header, resource, chunk,
-            &grub_wim_chunk_buffer)) != 0)
+      cached_file = NULL;
+      if ((rc = grub_wim_chunk (file, header, resource, shift, chunk,
+            grub_wim_chunk_data)) != 0)
         return rc;
 
       /* Update cache */
@@ -258,11 +308,11 @@ grub_wim_read (grub_file_t file, struct wim_header *header,
     }
 
     /* Copy fragment from this chunk */
-    skip_len = (offset % WIM_CHUNK_LEN);
-    frag_len = (WIM_CHUNK_LEN - skip_len);
+    skip_len = (offset & ((1UL << shift) - 1));
+    frag_len = ((1UL << shift) - skip_len);
     if (frag_len > len)
       frag_len = len;
-    memcpy (data, (grub_wim_chunk_buffer.data + skip_len), frag_len);
+    memcpy (data, (grub_wim_chunk_data + skip_len), frag_len);
 
     /* Move to next chunk */
     data = (char *)data + frag_len;
@@ -567,3 +617,354 @@ grub_wim_boot_index (grub_file_t file)
     return 0;
   return header.boot_index;
 }
+
+/** Length of each read when benchmarking */
+#define GRUB_WIM_BENCH_LEN 0x10000
+
+/**
+ * LZMS chunk with a known decompressed length and SHA-1
+ *
+ * The chunk holds text, a table of counters and x86 code with repeated
+ * call targets.  Decoding it takes literals past a rebuild of the
+ * literal code and matches past a rebuild of the length code, LZ and
+ * delta matches with explicit and repeated offsets, and the x86 filter.
+ */
+static const uint8_t grub_wim_lzms_test[] =
+{
+  0x14, 0x06, 0x45, 0xf5, 0x6b, 0x0f, 0x52, 0x22, 0x09, 0xc0, 0xe4, 0x46,
+  0x90, 0x1b, 0x51, 0x45, 0xbf, 0x2a, 0x3f, 0xd8, 0x7c, 0xd8, 0x7e, 0xb4,
+  0x1d, 0xa2, 0x2b, 0xee, 0x07, 0xe6, 0x2a, 0x80, 0x3c, 0x5f, 0x50, 0xc4,
+  0x12, 0xd8, 0x03, 0x79, 0xef, 0x53, 0x76, 0xc5, 0x2d, 0x5f, 0xd3, 0x91,
+  0x71, 0x43, 0xd2, 0x72, 0xbf, 0x6e, 0xbe, 0xce, 0xcf, 0xef, 0x68, 0x01,
+  0x33, 0x70, 0x0e, 0x14, 0x5d, 0xca, 0x95, 0xbf, 0x3b, 0x11, 0x3a, 0x9e,
+  0xa5, 0x37, 0x02, 0xf2, 0x7b, 0xfe, 0x9a, 0x3e, 0x41, 0xe0, 0x15, 0x2d,
+  0x90, 0x8a, 0xe8, 0x24, 0xaf, 0x33, 0x24, 0x58, 0x4d, 0xd2, 0x1c, 0xb9,
+  0x0b, 0xd8, 0x1b, 0x36, 0x20, 0xfc, 0x26, 0x4c, 0x9a, 0x77, 0x12, 0x71,
+  0x75, 0x2d, 0xf8, 0x26, 0x02, 0xad, 0x4f, 0x52, 0xee, 0x66, 0xb6, 0xcb,
+  0x0f, 0xdc, 0x9b, 0x53, 0x37, 0x4a, 0xbf, 0xbf, 0xbc, 0xec, 0x11, 0xdd,
+  0x31, 0x49, 0x8c, 0x05, 0x1e, 0x6b, 0xfc, 0x37, 0x2a, 0xc5, 0xe2, 0xff,
+  0xcd, 0x09, 0x4d, 0xf9, 0x5b, 0xc2, 0xe8, 0x12, 0x40, 0x45, 0xdf, 0xdb,
+  0xc5, 0x16, 0x53, 0x4f, 0xa1, 0x15, 0xbe, 0x60, 0x75, 0xd8, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x67, 0xe9, 0x93, 0x8f, 0xa8, 0xe1, 0x26, 0x38,
+  0x7a, 0xf9, 0x5b, 0x3c, 0xcc, 0xf4, 0x7d, 0xe3, 0xd6, 0x05, 0x81, 0x1f,
+  0xa7, 0x6e, 0x17, 0x3e, 0x09, 0x7b, 0x93, 0x7d, 0xc6, 0xf1, 0x9d, 0xd3,
+  0x82, 0x7a, 0x47, 0xf2, 0xf1, 0xdb, 0xb2, 0xdc, 0xbf, 0xf6, 0xbe, 0x12,
+  0xa7, 0x5d, 0xff, 0x19, 0x04, 0xb8, 0x7b, 0x9e, 0xaf, 0x4f, 0xac, 0x11,
+  0x89, 0x3f, 0x7b, 0xd3, 0xe1, 0x44, 0x4e, 0xa3, 0xd6, 0x76, 0x75, 0x63,
+  0xd2, 0xe7, 0x20, 0xd4, 0x3e, 0x3c, 0x28, 0x0b, 0x24, 0xa6, 0x6a, 0x19,
+  0x6a, 0x3d, 0x62, 0xd5, 0x51, 0x6f, 0x73, 0xa0, 0x6c, 0x10, 0xfc, 0x92,
+  0x89, 0xb9, 0xa6, 0x79, 0xc6, 0xb9, 0x55, 0xa2, 0x05, 0xfd, 0xe9, 0x6c,
+  0x3e, 0xae, 0x33, 0xa5, 0xb4, 0x3b, 0x07, 0x1b, 0xfc, 0xc1, 0xb9, 0x4b,
+  0x6e, 0x3f, 0xc1, 0xa5, 0xa2, 0xe0, 0xc0, 0xa4, 0x40, 0xa5, 0xbc, 0x87,
+  0xe0, 0x3f, 0x95, 0x4f, 0xc3, 0xfa, 0x1b, 0x7e, 0x6e, 0xf8, 0x79, 0x77,
+  0x2c, 0x1e, 0x54, 0xb8, 0xdf, 0x29, 0x97, 0xad, 0x77, 0x5a, 0x3e, 0xe0,
+  0xe2, 0x97, 0xdb, 0xf7, 0x3f, 0x7e, 0xae, 0xbc, 0xbd, 0xae, 0x70, 0xf0,
+  0x45, 0xad, 0x21, 0x67, 0xf2, 0x8a, 0xf3, 0xd1, 0x1c, 0xfa, 0xf6, 0x4f,
+  0xb7, 0x73, 0x4f, 0x4a, 0x21, 0x86, 0x90, 0x27, 0xdf, 0x1b, 0x57, 0x5d,
+  0xc7, 0xa6, 0xa3, 0xb7, 0xef, 0x20, 0x75, 0xbe, 0xdd, 0xff, 0xdd, 0xee,
+  0x20, 0xd5, 0xf4, 0xbe, 0xe5, 0xb5, 0x97, 0xcf, 0x0e, 0xed, 0xbc, 0x2b,
+  0x7c, 0xb3, 0xf8, 0x01, 0xcc, 0xbd, 0x06, 0x1f, 0x08, 0x6d, 0xd8, 0x38,
+  0xe6, 0xa7, 0x4c, 0x93, 0x30, 0xae, 0x7c, 0xff, 0xc5, 0x76, 0x8a, 0x6a,
+  0xe6, 0x97, 0xd5, 0x2f, 0x96, 0x65, 0xb5, 0xf0, 0x90, 0xae, 0x42, 0xa3,
+  0x77, 0x5a, 0xcf, 0xfe, 0xbe, 0x8a, 0xd1, 0x2b, 0x4f, 0xb4, 0x3e, 0xfd,
+  0xf3, 0x44, 0xf0, 0x8d, 0x4b, 0xa6, 0xf9, 0xad, 0x49, 0x3d, 0xb6, 0x84,
+  0xcb, 0x5d, 0xf8, 0xb3, 0x8b, 0x35, 0x5e, 0xcf, 0xfe, 0x1e, 0x14, 0x79,
+  0xdb, 0x32, 0x9d, 0x74, 0x18, 0x26, 0x56, 0x63, 0x2f, 0x96, 0xfb, 0xf0,
+  0xec, 0x0a, 0xc6, 0xfa, 0x44, 0x6c, 0x91, 0x67, 0x4e, 0x99, 0x97, 0x4d,
+  0xc0, 0xc1, 0xe3, 0x07, 0x3e, 0x8e, 0x53, 0x3c, 0x92, 0x24, 0x7f, 0xf7,
+  0x0d, 0xa8, 0x56, 0x3b, 0x14, 0x1f, 0xb2, 0x3c, 0xdd, 0xf7, 0xaa, 0xf6,
+  0xaa, 0xf6, 0x5f, 0xa9, 0xb7, 0x87, 0xa5, 0xa5, 0x5a, 0xef, 0x74, 0xcc,
+  0x31, 0x5a, 0x0e, 0xfc, 0x3f, 0x9d, 0x74, 0xe9, 0x70, 0xc1, 0x6c, 0x6c,
+  0xc2, 0x37, 0xb5, 0xa5, 0xdb, 0x32, 0xa3, 0x9a, 0x97, 0x91, 0x47, 0xf3,
+  0x5f, 0xaf, 0x3d, 0xa1, 0x70, 0x2c, 0x26, 0xe1, 0x01, 0xf0, 0x93, 0xa6,
+  0xaa, 0x4b, 0xae, 0x85, 0x4f, 0x81, 0xa8, 0x81, 0xbc, 0xff, 0xa6, 0xf2,
+  0x63, 0x98, 0xb4, 0xcf, 0xb6, 0x87, 0x84, 0xdc, 0x56, 0xc0, 0x77, 0x4a,
+  0x62, 0xf7, 0xeb, 0x0f, 0x91, 0x88, 0x3e, 0xfa, 0xc0, 0x85, 0x1f, 0x72,
+  0x35, 0x96, 0x03, 0x3a, 0xa4, 0xe0, 0xac, 0x53, 0xcc, 0x28, 0x2d, 0x8b,
+  0xb1, 0x9f, 0x05, 0x85, 0x2c, 0xab, 0x8e, 0xcb, 0x88, 0xab, 0xf1, 0x2d,
+  0x9a, 0xc2, 0x1b, 0xf7, 0x4b, 0x12, 0x40, 0xfc, 0xc8, 0x55, 0x1c, 0x21,
+  0xc9, 0xb2, 0x63, 0x8a, 0x9a, 0xf2, 0x38, 0x26, 0x4f, 0xaf, 0xb0, 0x5b,
+  0xf7, 0x6c, 0xb0, 0x47, 0x92, 0x9e, 0xad, 0xc3, 0x49, 0xe7, 0x3e, 0x5d,
+  0xf4, 0x66, 0xbf, 0xb0, 0x6a, 0xf5, 0x52, 0xb1, 0xe1, 0xc9, 0x4f, 0xda,
+  0x1a, 0x91, 0x09, 0x5c, 0xe9, 0x9c, 0xab, 0x23, 0x2e, 0x35, 0x69, 0x77,
+  0x87, 0xfe, 0xae, 0xb4, 0xf5, 0xdc, 0x64, 0xa1, 0x38, 0x86, 0xfc, 0xe8,
+  0xf7, 0x04, 0x0e, 0x4a, 0x62, 0xec, 0xdd, 0x20, 0x49, 0x2f, 0xdc, 0x4a,
+  0xd8, 0xfe, 0xf7, 0xe7, 0x78, 0xd0, 0xb7, 0x34, 0xbe, 0x26, 0x1c, 0xb3,
+  0x4c, 0x40, 0x54, 0x69, 0x86, 0xe3, 0x9e, 0x10, 0xc3, 0xc1, 0x83, 0x76,
+  0x70, 0x02, 0x2b, 0x0e, 0xaf, 0x37, 0xaa, 0xbc, 0x2b, 0xb9, 0xe5, 0x6e,
+  0x74, 0xd0, 0xa5, 0x67, 0x19, 0x24, 0x5f, 0xbd, 0x37, 0x42, 0xc3, 0x41,
+  0x25, 0x98, 0xcb, 0xac, 0x75, 0x42, 0x70, 0x88, 0x3c, 0x46, 0xfb, 0xb1,
+  0xb0, 0x0d, 0x1f, 0x2d, 0x02, 0x46, 0xe1, 0x11, 0xf6, 0x21, 0xf4, 0x29,
+  0xa5, 0xdd, 0xd7, 0xe6, 0x97, 0xdf, 0xc2, 0x8f, 0xc9, 0xf9, 0x36, 0x97,
+  0x92, 0xeb, 0x45, 0x8c, 0x0d, 0xec, 0x8c, 0x9e, 0x94, 0x70, 0xf9, 0x0e,
+  0xa4, 0x96, 0x65, 0xbd, 0x98, 0x40, 0x30, 0xcd, 0x5d, 0xb9, 0xc3, 0xf3,
+  0xce, 0x6c, 0x18, 0x7f, 0x25, 0xf6, 0x9f, 0x71, 0x09, 0x69, 0xb2, 0x02,
+  0x0a, 0x3b, 0xd1, 0x90, 0x14, 0x20, 0xf2, 0xfc, 0x0e, 0xd8, 0x18, 0xd8,
+  0x6f, 0xdb, 0xb3, 0xe9, 0x40, 0xf5, 0xe3, 0xb1, 0x52, 0x75, 0xf1, 0xbc,
+  0x98, 0xbe, 0x7a, 0x2a, 0x77, 0x47, 0xa9, 0x0a, 0x1e, 0x9c, 0x37, 0xd4,
+  0x23, 0x9f, 0xea, 0xf3, 0xf3, 0x18, 0xe5, 0xe0, 0xa3, 0x00, 0x42, 0x43,
+  0x70, 0xfd, 0xdf, 0x72, 0x45, 0x69, 0x37, 0xe3, 0xcb, 0x9c, 0xaf, 0x31,
+  0x21, 0x5e, 0xc8, 0xe7, 0xad, 0xc5, 0x47, 0xda, 0xfe, 0xa0, 0x66, 0x7f,
+  0x94, 0x07, 0xfb, 0x80, 0x76, 0xfe, 0xec, 0xbc, 0xfa, 0x83, 0x5f, 0x0e,
+  0x00, 0x40, 0xc0, 0x67, 0x57, 0x27, 0xaf, 0x01, 0xc8, 0xe1, 0x2e, 0x00,
+  0x80, 0x06, 0xf3, 0x82, 0x46, 0xa4, 0xff, 0xff, 0xf8, 0x75, 0xf4, 0xf2,
+  0xc4, 0xaa, 0xf0, 0x72, 0x79, 0x86, 0xe0, 0xcb, 0xe5, 0x18, 0xb6, 0x97,
+  0x43, 0xc9, 0x89, 0xe4, 0x38, 0x72, 0x16, 0x39, 0x88, 0x5c, 0x7e, 0xe1,
+  0xf7, 0x72, 0x12, 0x39, 0x86, 0x5c, 0xbe, 0x5f, 0x0b, 0xd9, 0xcb, 0xb1,
+  0xe4, 0x1b, 0x99, 0xe4, 0x40, 0x72, 0x1a, 0xf9, 0x46, 0x14, 0x39, 0x87,
+  0x5c, 0x5e, 0x21, 0xf8, 0x72, 0x39, 0x85, 0xe1, 0xcb, 0xe5, 0xfb, 0x9d,
+  0xd0, 0x7b, 0x39, 0x8a, 0xbc, 0x9f, 0x00, 0x00, 0x24, 0xf4, 0x5e, 0xce,
+  0x22, 0x2f, 0x82, 0xc8, 0x29, 0x00, 0x00, 0x22, 0x04, 0xdf, 0x27, 0x39,
+  0x86, 0x3c, 0xc8, 0x00, 0x00, 0x00, 0x01, 0x40, 0x20, 0xa0, 0x7d, 0xd0,
+  0xc4, 0x16, 0xaf, 0x42, 0x33, 0x3d, 0xff, 0x64, 0x7c, 0x20, 0x42, 0xfe,
+  0x7c, 0xcd, 0x43, 0xe1, 0xbf, 0x91, 0xa1, 0xee, 0xa9, 0x49, 0xe8, 0x79,
+  0xc4, 0x6b, 0x30, 0x73, 0x2d, 0xc1, 0x35, 0x93, 0xa5, 0x4e, 0xc1, 0xa6,
+  0xb2, 0x04, 0xec, 0xa1, 0x29, 0x13, 0x64, 0x51, 0x52, 0xad, 0xa4, 0x7c,
+  0xed, 0xa3, 0x8e, 0x6d, 0xd0, 0x34, 0x1a, 0xb2, 0x92, 0x74, 0xb3, 0xc2,
+  0x31, 0x93, 0x30, 0x0a, 0xcb, 0x1c, 0x2d, 0xb2, 0xdc, 0xd4, 0xe9, 0x2c,
+  0x45, 0x9d, 0x6a, 0xea, 0x85, 0x82, 0x03, 0x2e, 0x97, 0x89, 0xb5, 0xf6,
+  0xaf, 0xfb, 0xa5, 0xff, 0xbb, 0x9b, 0xd2, 0x27, 0x91, 0x75, 0xd2, 0x84,
+  0xc9, 0x64, 0x91, 0xba, 0xea, 0x58, 0xf1, 0x8f, 0x0d, 0x96, 0xef, 0x4a,
+  0x9e, 0x84, 0x54, 0xac, 0x9a, 0xaf, 0x13, 0xe4, 0xe4, 0xd7, 0x5d, 0xd2,
+  0x0c, 0xa0, 0x65, 0xc2, 0x0c, 0xe5, 0xb1, 0xe4, 0x0c, 0xb5, 0xcd, 0x14,
+  0x67, 0x1c, 0xcd, 0x2c, 0x9f, 0x16, 0x49, 0xd1, 0x09, 0x5d, 0xdb, 0x33,
+  0x43, 0x35, 0xdb, 0xad, 0x56, 0x5a, 0xcc, 0x63, 0x76, 0xf2, 0xc2, 0xc8,
+  0xe5, 0x89, 0x8d, 0xcc, 0x52, 0x5e, 0xb0, 0xc5, 0xb0, 0x9c, 0x59, 0x76,
+  0x5e, 0x4c, 0xd1, 0x0b, 0xb1, 0x17, 0x9e, 0xd9, 0x30, 0x63, 0x63, 0xed,
+  0xd3, 0xec, 0xb4, 0x9d, 0x61, 0x33, 0x4e, 0xaf, 0x32, 0xc6, 0x40, 0x66,
+  0x31, 0xc3, 0xb0, 0x40, 0xb1, 0x98, 0x08, 0xf3, 0x68, 0xe9, 0x33, 0xb2,
+  0x66, 0x52, 0x6f, 0x80, 0x13, 0x36, 0xfa, 0xc7, 0x05, 0xa7, 0x5d, 0xd8,
+  0x71, 0xb5, 0x47, 0xb9, 0x97, 0x9e, 0xf5, 0x15, 0xd3, 0xe1, 0x8c, 0x53,
+  0xcc, 0x63, 0x76, 0x6d, 0xca, 0xe1, 0xc4, 0x5e, 0x66, 0x5a, 0x5a, 0xaf,
+  0x8c, 0x98, 0xa7, 0x18, 0x48, 0x8c, 0xb3, 0xd7, 0xc8, 0x2b, 0x7b, 0xe5,
+  0x59, 0xca, 0xab, 0x66, 0x76, 0x21, 0x9a, 0xad, 0xcc, 0x46, 0x9b, 0x65,
+  0x29, 0xaf, 0x8f, 0xde, 0xa4, 0x1e, 0x49, 0x4d, 0xbc, 0x97, 0xc9, 0xcb,
+  0x63, 0x76, 0x12, 0xe3, 0x78, 0xb1, 0xf6, 0x02, 0x2d, 0xa6, 0x31, 0xab,
+  0x89, 0xa9, 0x9a, 0x25, 0x72, 0xc6, 0xc5, 0xb2, 0x11, 0x40, 0xeb, 0x77,
+  0xc2, 0x57, 0xdb, 0x86, 0x9b, 0xd8, 0xaa, 0x5b, 0xf5, 0x86, 0xb1, 0x3d,
+  0xad, 0xd9, 0x4f, 0xc1, 0xa1, 0xfa, 0xb7, 0x6b, 0x8b, 0x8c, 0x2a, 0x8c,
+  0xed, 0xf7, 0xda, 0x87, 0xb9, 0x32, 0x66, 0x7c, 0x5e, 0xa0, 0x66, 0x9f,
+  0xa7, 0xd7, 0x66, 0x31, 0x9b, 0xb1, 0x32, 0xdf, 0x0f, 0xd3, 0x0f, 0x93,
+  0xf3, 0xa4, 0xbc, 0x18, 0x90, 0x99, 0x6d, 0x31, 0x4b, 0xbd, 0x8f, 0xd8,
+  0x6b, 0xb1, 0x9c, 0x59, 0xc8, 0xcb, 0xbf, 0xd7, 0x5d, 0x2f, 0x56, 0x33,
+  0xf3, 0x66, 0x39, 0x35, 0x6c, 0x54, 0x6d, 0x23, 0x66, 0x52, 0xfb, 0x34,
+  0xe4, 0x42, 0xa4, 0xc2, 0x28, 0xd3, 0x14, 0x03, 0x61, 0x29, 0x9b, 0x9c,
+  0x06, 0x08, 0xa5, 0xab, 0x13, 0x64, 0xb6, 0x4e, 0x6d, 0x20, 0x1e, 0x5e,
+  0x58, 0x0f, 0xf5, 0x58, 0xec, 0x34, 0xea, 0x0c, 0xef, 0xea, 0x78, 0xf5,
+  0x99, 0x5d, 0x18, 0xb1, 0x9b, 0x17, 0xa7, 0x17, 0x48, 0x8d, 0x66, 0xc6,
+  0xda, 0x4e, 0xd3, 0x2b, 0x4f, 0xcc, 0xb3, 0x18, 0x9e, 0x9a, 0xa4, 0xc0,
+  0x03, 0xf4, 0x18, 0x99, 0x20, 0x9e, 0x59, 0xd4, 0x66, 0xd3, 0x48, 0x64,
+  0x06, 0x35, 0x1d, 0x51, 0x79, 0x5f, 0xcf, 0x0c, 0x5b, 0xab, 0x57, 0xa7,
+  0x98, 0x05, 0x67, 0x82, 0x5e, 0x97, 0xa4, 0xd9, 0x30, 0x6b, 0xad, 0x26,
+  0x6a, 0x56, 0xd6, 0x2c, 0xa3, 0xe5, 0x58, 0x70, 0x63, 0x36, 0x69, 0x66,
+  0xda, 0x6b, 0xa4, 0xad, 0xcd, 0x66, 0xed, 0x86, 0xd7, 0xeb, 0xe6, 0xf5,
+  0xb2, 0xba, 0x9b, 0x92, 0x49, 0xdb, 0x2c, 0xb6, 0xf1, 0x53, 0xf4, 0xa2,
+  0x79, 0x61, 0x9a, 0xa9, 0x35, 0x53, 0xd9, 0x09, 0xb5, 0xb9, 0xbe, 0x32,
+  0x66, 0xa5, 0x5e, 0x78, 0xac, 0x09, 0x8a, 0xe9, 0xf5, 0xca, 0x94, 0x7b,
+  0xeb, 0xf4, 0x17, 0x07, 0x5f, 0xc7, 0xcd, 0x34, 0x62, 0x99, 0x27, 0x6b,
+  0x85, 0x66, 0x1b, 0xb3, 0x93, 0x59, 0x9e, 0x19, 0x5e, 0x33, 0xb6, 0x66,
+  0x1e, 0xaf, 0x49, 0x31, 0x9a, 0x60, 0x9f, 0x99, 0xab, 0x21, 0x0d, 0x45,
+  0xc1, 0x1b, 0x28, 0xa0, 0x2a, 0xd8, 0x59, 0xb1, 0xcb, 0x62, 0x0b, 0xbc,
+  0x25, 0x9a, 0x05, 0xaa, 0x25, 0x7a, 0x69, 0x96, 0x1c, 0xcf, 0x5d, 0x3f,
+  0x60, 0x61, 0x0b, 0x9c, 0x9c, 0xf7, 0x38, 0xfb, 0xaf, 0xf3, 0x9a, 0x33,
+  0xfd, 0x98, 0xa7, 0x74, 0xe2, 0xca, 0x04, 0xcd, 0x2e, 0x9b, 0x65, 0xba,
+  0xe9, 0xd4, 0x4a, 0x66, 0x97, 0xa8, 0x58, 0x5a, 0x35, 0x43, 0xb7, 0x44,
+  0xce, 0x6a, 0x6e, 0x84, 0xde, 0x5b, 0x00, 0x69, 0x96, 0xed, 0x13, 0xdf,
+  0x88, 0x5c, 0x49, 0x45, 0xca, 0x2a, 0x5d, 0xf5, 0xb6, 0x2c, 0x23, 0x65,
+  0x27, 0xb1, 0xbe, 0x62, 0x39, 0x37, 0x95, 0x1f, 0x17, 0x5f, 0x95, 0x5e,
+  0x72, 0xcc, 0xfd, 0x76, 0xb6, 0xd6, 0x0b, 0x26, 0x56, 0xd9, 0xeb, 0x63,
+  0x46, 0x69, 0x66, 0xc2, 0x57, 0x1a, 0x5f, 0x9e, 0x7c, 0xf1, 0x89, 0x76,
+  0xf2, 0xe9, 0xe5, 0x1b, 0x7d, 0x5a, 0x80, 0x36, 0x21, 0x88, 0x66, 0x81,
+  0x74, 0x95, 0x9c, 0xb5, 0x19, 0x28, 0x2c, 0xdf, 0xf2, 0x35, 0x19, 0x0b,
+  0xcb, 0xe8, 0xb9, 0xc3, 0x0a, 0xbd, 0x4c, 0x62, 0x90, 0xbd, 0xda, 0x9b,
+  0x75, 0xbc, 0xae, 0x8f, 0x19, 0x66, 0xb3, 0xed, 0x5e, 0xc1, 0x4b, 0x4f,
+  0x6f, 0xd2, 0x0c, 0x51, 0x4b, 0x4b, 0x1f, 0xbc, 0xf5, 0x6a, 0xa2, 0x3b,
+  0x2c, 0xf2, 0xff, 0xeb, 0x18, 0xb5, 0x95, 0x43, 0x92, 0x1a, 0x6d, 0x29,
+  0x53, 0xec, 0xae, 0x59, 0x7a, 0xcb, 0x50, 0x72, 0xd7, 0x47, 0x4f, 0xf1,
+  0x9a, 0x36, 0x09, 0xba, 0xfc, 0x87, 0xf8, 0xb9, 0x01, 0x8b, 0xdd, 0xe7,
+  0x6d, 0xee, 0x18, 0x42, 0xb2, 0x4c, 0x31, 0x98, 0x19, 0xa5, 0x86, 0x16,
+  0xab, 0x8b, 0xb9, 0xad, 0x20, 0x63, 0x83, 0x1f, 0x20, 0xed, 0x11, 0xc0,
+  0x14, 0xcf, 0x7e, 0x58, 0x46, 0xec, 0x25, 0x76, 0xd7, 0x4b, 0xb0, 0xf2,
+  0x19, 0x2c, 0xdd, 0x9e, 0xb6, 0xc2, 0x6a, 0x3f, 0xd7, 0xb3, 0x29, 0x99,
+  0x4c, 0xec, 0xe4, 0x46, 0xd8, 0xac, 0x24, 0x16, 0x28, 0x76, 0xc2, 0x59,
+  0xa1, 0xd9, 0x30, 0x2b, 0x6e, 0x9e, 0x66, 0x91, 0xcd, 0xf8, 0x77, 0x66,
+  0x5d, 0x0c, 0xd3, 0x0b, 0xcb, 0xc2, 0x7a, 0xb9, 0xc4, 0x0a, 0xd5, 0x3c,
+  0x5e, 0x41, 0x5c, 0x28, 0xb5, 0xbb, 0x5e, 0xd7, 0xb5, 0x7e, 0x61, 0x99,
+  0xa2, 0x99, 0x1e, 0x67, 0x63, 0xc5, 0x10, 0xc5, 0x78, 0x3b, 0xb6, 0xc0,
+  0xd1, 0x29, 0xed, 0xe0, 0x87, 0x37, 0xcf, 0x17, 0xea, 0xb8, 0x7e, 0xc9,
+  0xf5, 0x0a, 0x5e, 0x99, 0x5e, 0x1f, 0xb3, 0x4a, 0x33, 0xb6, 0x5e, 0x96,
+  0x66, 0x2d, 0x31, 0x9d, 0x13, 0x77, 0x40, 0x00, 0x14, 0x2b, 0xea, 0x37,
+  0x4d, 0x4f, 0x72, 0x37, 0x7f, 0xe5, 0xef, 0xc8, 0x25, 0x00, 0xfa, 0x19,
+  0x9e, 0xda, 0xca, 0x6c, 0x4f, 0x0c, 0xaf, 0x97, 0xa0, 0xd9, 0x7d, 0x35,
+  0xce, 0x5e, 0x29, 0xb3, 0x42, 0xb3, 0x56, 0x2f, 0xb9, 0x66, 0x25, 0xb3,
+  0x4e, 0x9e, 0x75, 0x7a, 0x8d, 0xcc, 0x54, 0x8b, 0x09, 0xb1, 0xb8, 0x5e,
+  0xa0, 0x66, 0x80, 0xbd, 0x24, 0xc5, 0x52, 0xc2, 0xf9, 0xab, 0x99, 0x48,
+  0x55, 0xf5, 0x24, 0xdf, 0x6b, 0xea, 0x3d, 0x17, 0x0a, 0x62, 0x42, 0xbe,
+  0x52, 0xc7, 0x5f, 0x05, 0x61, 0x67, 0xc5, 0x54, 0x66, 0x82, 0x66, 0xc3,
+  0xcc, 0xd4, 0x0b, 0xad, 0x18, 0x67, 0x2f, 0xbd, 0x5e, 0x84, 0xbd, 0xc2,
+  0x1a, 0xfa, 0x8d, 0xf8, 0xc7, 0x24, 0xa9, 0xb1, 0x41, 0x1a, 0xa6, 0x8d,
+  0x36, 0x2c, 0xfb, 0xe8, 0x94, 0x06, 0x64, 0x3d, 0xcb, 0xad, 0xa6, 0x00,
+  0xa9, 0x3d, 0xa1, 0xc0, 0xb0, 0xd5, 0x48, 0x9a, 0xcf, 0xe6, 0x99, 0x7a,
+  0x31, 0xaf, 0xd2, 0x0c, 0x54, 0x6d, 0xb8, 0x18, 0x26, 0x5f, 0x34, 0x33,
+  0x90, 0x58, 0x5d, 0xc3, 0x30, 0x96, 0x59, 0xc6, 0x6b, 0xd3, 0xac, 0xe5,
+  0xe5, 0xc7, 0x57, 0x65, 0xb1, 0x95, 0xd9, 0x5b, 0x3d, 0x41, 0x33, 0x93,
+  0x18, 0x9f, 0x59, 0xc8, 0x2c, 0x1b, 0x34, 0xeb, 0x14, 0xc3, 0x78, 0x61,
+  0x8a, 0x7d, 0xcc, 0x76, 0x62, 0xff, 0xc5, 0xec, 0x7a, 0x05, 0xaf, 0xf2,
+  0x1e, 0x9a, 0x04, 0xca, 0x87, 0xbc, 0x64, 0xa3, 0xd5, 0xef, 0x4b, 0xc8,
+  0x38, 0x07, 0xae, 0xc1, 0xcd, 0x50, 0x9b, 0x0d, 0x33, 0x98, 0xd9, 0x9e,
+  0x57, 0x4d, 0xcd, 0x51, 0xcb, 0x4f, 0x0d, 0x66, 0xa6, 0x11, 0xcb, 0x4a,
+  0x5e, 0x9a, 0x66, 0x33, 0x33, 0x42, 0x35, 0xb9, 0x86, 0x59, 0xea, 0xcd,
+  0x2e, 0xd5, 0xce, 0x9a, 0x15, 0x8a, 0x6d, 0x66, 0x2e, 0x24, 0x57, 0x30,
+  0x27, 0xb5, 0x1c, 0xba, 0x08, 0xfc, 0x99, 0x39, 0xce, 0xab, 0x64, 0x8c,
+  0xcd, 0xae, 0x3e, 0xfb, 0x4a, 0x51, 0x75, 0x0d, 0x03, 0xc8, 0x13, 0xa1,
+  0xb2, 0x43, 0x33, 0xcd, 0x6a, 0x1d, 0x9c, 0x19, 0xba, 0x7d, 0xbc, 0x30,
+  0x57, 0xc3, 0x32, 0x15, 0xd6, 0x0e, 0xf9, 0xba, 0x74, 0xdb, 0x14, 0xcb,
+  0x2d, 0x96, 0x32, 0xb3, 0x94, 0xbc, 0x6f, 0x3e, 0x2c, 0xfb, 0x88, 0x05,
+  0x8a, 0x55, 0x36, 0xcb, 0x78, 0xad, 0x9a, 0xa5, 0xcc, 0x86, 0x99, 0xa1,
+  0x17, 0x61, 0x2f, 0x9b, 0x9a, 0x6d, 0xc3, 0x30, 0x3d, 0xb3, 0x61, 0x36,
+  0x32, 0x93, 0x79, 0x09, 0xf7, 0xfa, 0x98, 0x7d, 0xda, 0x85, 0x17, 0xc3,
+  0x99, 0x4d, 0xf6, 0xa2, 0xc9, 0xf4, 0x4c, 0x88, 0x2d, 0xa4, 0xc8, 0x45,
+  0xb1, 0x78, 0xb8, 0x52, 0x53, 0x97, 0x03, 0x72, 0x99, 0x4a, 0x9c, 0x10,
+  0xae, 0x8e, 0x09, 0xa1, 0xd1, 0xf6, 0xe5, 0xaa, 0xf7, 0x12, 0xd3, 0x34,
+  0x83, 0x79, 0x05, 0x9a, 0x65, 0x1a, 0x31, 0x90, 0x99, 0xca, 0x8c, 0x63,
+  0x66, 0xdc, 0xb0, 0xed, 0xbb, 0x59, 0xab, 0x57, 0xc6, 0x4c, 0xb1, 0x57,
+  0x9f, 0x18, 0xcd, 0x0b, 0xcf, 0x4c, 0xad, 0xd9, 0x30, 0x9b, 0x6c, 0x76,
+  0xf3, 0xc2, 0x88, 0xcd, 0xbc, 0x36, 0x5e, 0xb2, 0xbd, 0x8a, 0x57, 0xcc,
+  0x6b, 0x27, 0x66, 0xdb, 0x0c, 0xb0, 0x58, 0xce, 0x2c, 0xe4, 0x55, 0xbc,
+  0xfc, 0xbc, 0xa4, 0x9b, 0x1d, 0x8a, 0x81, 0x37, 0x4c, 0x0b, 0x89, 0x45,
+  0x9a, 0x8d, 0xaa, 0x31, 0x37, 0xcb, 0x78, 0x59, 0x9a, 0x39, 0x97, 0x0d,
+  0xd0, 0x81, 0x6d, 0xcc, 0xfb, 0x28, 0x1b, 0x66, 0x20, 0xb1, 0x3e, 0xb3,
+  0x50, 0x33, 0x8f, 0x18, 0xa4, 0x57, 0xc6, 0x72, 0x3b, 0xe8, 0x0c, 0xd3,
+  0x4b, 0x24, 0x16, 0xc2, 0x19, 0x73, 0x31, 0x9c, 0x6d, 0x69, 0x77, 0x99,
+  0xe7, 0x12, 0xd3, 0x98, 0xb5, 0x17, 0xa3, 0x79, 0x65, 0x36, 0xab, 0xd4,
+  0xd3, 0x88, 0x85, 0x9a, 0xe5, 0x89, 0x15, 0x7a, 0xe5, 0xd6, 0xc1, 0x96,
+  0xdf, 0x8c, 0xae, 0x59, 0x6f, 0x4c, 0x0e, 0x55, 0xce, 0xb6, 0x6a, 0xb7,
+  0xd0, 0x05, 0xb3, 0x61, 0x29, 0xf7, 0x32, 0xac, 0xd6, 0x32, 0x43, 0x6b,
+  0x96, 0x33, 0x23, 0x2c, 0xb6, 0x51, 0x3b, 0x15, 0x63, 0x89, 0x89, 0x0c,
+  0x64, 0x02, 0x56, 0x23, 0x69, 0xd0, 0x9d, 0xc9, 0x26, 0x8b, 0xf5, 0x89,
+  0x39, 0x56, 0x4d, 0x24, 0xec, 0xa3, 0xd9, 0xbe, 0x26, 0x99, 0x79, 0x19,
+  0x39, 0x7d, 0x03, 0x68, 0xb4, 0xd7, 0x5a, 0x49, 0x00, 0xd2, 0xb0, 0xeb,
+  0x32, 0x34, 0x1b, 0x6a, 0x29, 0xc3, 0xb0, 0xc8, 0x66, 0x8d, 0x6a, 0x26,
+  0xb3, 0x8c, 0xd8, 0x5a, 0xdd, 0xee, 0xde, 0xe4, 0xc4, 0x34, 0x9d, 0x17,
+  0x64, 0xb3, 0xb8, 0x5e, 0xd4, 0xcd, 0x58, 0x62, 0x58, 0xa5, 0xe0, 0x9f,
+  0xd9, 0x5e, 0x33, 0x98, 0x9e, 0xc6, 0xac, 0x4f, 0x4c, 0x88, 0xa9, 0xd4,
+  0x10, 0x9d, 0x5b, 0x73, 0xab, 0x43, 0x1b, 0xbb, 0x6a, 0x62, 0xa7, 0x62,
+  0x7c, 0x66, 0x22, 0xc3, 0x32, 0x92, 0x59, 0xa5, 0x5c, 0x4b, 0x2d, 0xd5,
+  0x39, 0xb2, 0xb0, 0x32, 0x39, 0x2c, 0x64, 0x9e, 0x5e, 0x18, 0x1b, 0x26,
+  0x6a, 0xd8, 0xf1, 0x42, 0x99, 0xe5, 0x64, 0x4b, 0x43, 0xbb, 0x03, 0x11,
+  0xab, 0x93, 0x3b, 0x03, 0x99, 0x83, 0x6b, 0xab, 0x53, 0x03, 0x39, 0x7b,
+  0x23, 0x4b, 0xb2, 0xa6, 0x24, 0xba, 0x88, 0xcb, 0x58, 0xfe, 0x90, 0xfb,
+  0xf1, 0xc8, 0x76, 0xd9, 0x1b, 0xb1, 0x06, 0xc1, 0x7b, 0x33, 0x03, 0x29,
+  0x43, 0xa3, 0xd3, 0x86, 0x6b, 0x63, 0x69, 0x75, 0x71, 0x20, 0x61, 0x20,
+  0x72, 0x65, 0x76, 0x6f
+};
+
+/** Decompressed length of the LZMS test chunk */
+#define GRUB_WIM_LZMS_TEST_LEN 7362
+
+/** SHA-1 of the decompressed LZMS test chunk */
+static const uint8_t grub_wim_lzms_test_sha1[] =
+{
+  0x47, 0xd9, 0xb4, 0x43, 0x9e, 0xff, 0x96, 0xcc, 0xf6, 0xa9,
+  0xee, 0x4e, 0x07, 0x09, 0x92, 0x6d, 0xc6, 0xf9, 0x66, 0x46
+};
+
+/**
+ * Check the LZMS decompressor against the known chunk
+ *
+ * @ret rc    Return status code
+ */
+static int
+grub_wim_lzms_check (void)
+{
+  uint8_t ctx[SHA1_CTX_SIZE];
+  uint8_t digest[SHA1_DIGEST_SIZE];
+  uint8_t *buf;
+  ssize_t len;
+
+  buf = malloc (GRUB_WIM_LZMS_TEST_LEN);
+  if (! buf)
+    return -1;
+  len = lzms_decompress_max (grub_wim_lzms_test, sizeof (grub_wim_lzms_test),
+                             buf, GRUB_WIM_LZMS_TEST_LEN);
+  if (len == GRUB_WIM_LZMS_TEST_LEN)
+  {
+    sha1_init (ctx);
+    sha1_update (ctx, buf, len);
+    sha1_final (ctx, digest);
+  }
+  free (buf);
+
+  if ((len != GRUB_WIM_LZMS_TEST_LEN) ||
+      (memcmp (digest, grub_wim_lzms_test_sha1, sizeof (digest)) != 0))
+  {
+    grub_printf ("LZMS check: wrong output\n");
+    return -1;
+  }
+  grub_printf ("LZMS check: ok\n");
+  return 0;
+}
+
+int
+grub_wim_bench (grub_file_t file, unsigned int index)
+{
+  struct wim_header header;
+  struct wim_resource_header meta;
+  const char *format;
+  uint8_t *buf;
+  size_t offset;
+  size_t len;
+  grub_uint64_t start, elapsed;
+
+  if (grub_wim_header (file, &header))
+    return -1;
+
+  /* Get image metadata */
+  if (grub_wim_metadata (file, &header, index, &meta))
+    return -1;
+
+  /* Check LZMS output before timing anything */
+  if (grub_wim_lzms_check ())
+    return -1;
+
+  if (! (meta.zlen__flags & WIM_RESHDR_COMPRESSED))
+    format = "none";
+  else if (header.flags & WIM_HDR_LZX)
+    format = "LZX";
+  else if (header.flags & WIM_HDR_XPRESS)
+    format = "XPRESS";
+  else if (header.flags & WIM_HDR_LZMS)
+    format = "LZMS";
+  else
+    format = "unknown";
+
+  buf = malloc (GRUB_WIM_BENCH_LEN);
+  if (! buf)
+    return -1;
+
+  /* Read the whole metadata resource, decompressing each chunk once */
+  start = grub_get_time_ms ();
+  for (offset = 0 ; offset < meta.len ; offset += len)
+  {
+    len = GRUB_WIM_BENCH_LEN;
+    if (len > meta.len - offset)
+      len = meta.len - offset;
+    if (grub_wim_read (file, &header, &meta, buf, offset, len))
+    {
+      free (buf);
+      return -1;
+    }
+  }
+  elapsed = grub_get_time_ms () - start;
+  free (buf);
+
+  grub_printf ("%s: %llu bytes in %llu ms",
+               format, (unsigned long long) meta.len,
+               (unsigned long long) elapsed);
+  if (elapsed)
+    grub_printf (" (%llu KiB/s)",
+                 (unsigned long long) (grub_divmod64 (meta.len * 1000,
+                                                      elapsed, 0) >> 10));
+  grub_printf ("\n");
+  return 0;
+}
@@ -34,14 +34,16 @@
 #pragma GCC diagnostic ignored "-Wcast-align"
 
 /**
- * Decompress XCA-compressed data
+ * Decompress XCA-compressed data into a bounded buffer
  *
  * @v data		Compressed data
  * @v len		Length of compressed data
  * @v buf		Decompression buffer, or NULL
+ * @v max_len		Length of decompression buffer
  * @ret out_len		Length of decompressed data, or negative error
  */
-ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
+ssize_t xca_decompress_max ( const void *data, size_t len, void *buf,
+			     size_t max_len ) {
 	const void *src = data;
 	const void *end = ( uint8_t * ) src + len;
 	uint8_t *out = buf;
@@ -107,6 +109,8 @@ ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
 		if ( raw < XCA_END_MARKER ) {
 
 			/* Literal symbol - add to output stream */
+			if ( out_len >= max_len )
+				return -1;
 			if ( buf )
 				*(out++) = raw;
 			out_len++;
@@ -147,6 +151,9 @@ ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
 			}
 
 			/* Copy data */
+			if ( ( match_offset > out_len ) ||
+			     ( match_len > ( max_len - out_len ) ) )
+				return -1;
 			out_len += match_len;
 			if ( buf ) {
 				copy = ( out - match_offset );
@@ -158,3 +165,15 @@ ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
 
 	return out_len;
 }
+
+/**
+ * Decompress XCA-compressed data
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer, or NULL
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
+	return xca_decompress_max ( data, len, buf, ( ( size_t ) -1 ) );
+}
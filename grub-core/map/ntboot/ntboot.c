@@ -110,10 +110,10 @@ grub_cmd_ntboot (grub_extcmd_context_t ctxt,
   {
     char str[32];
     grub_snprintf (str, 32, "(%s)", argv[0]);
-    file = file_open (str, 0, 0, 0);
+    file = file_open (str, 0, 0, 0, NULL);
   }
   else
-    file = file_open (argv[0], 0, 0, 0);
+    file = file_open (argv[0], 0, 0, 0, NULL);
 
   if (!file)
   {
@@ -187,13 +187,13 @@ grub_cmd_ntboot (grub_extcmd_context_t ctxt,
   if (state[NTBOOT_PAUSE].set)
     wimboot_cmd.pause = 1;
 
-  bcd = file_open ("(proc)/bcd", 0, 0, 0);
+  bcd = file_open ("(proc)/bcd", 0, 0, 0, NULL);
   vfat_add_file ("bcd", bcd, bcd->size, vfat_read_wrapper);
 
   if (state[NTBOOT_EFI].set)
-    bootmgr = file_open (state[NTBOOT_EFI].arg, 0, 0, 0);
+    bootmgr = file_open (state[NTBOOT_EFI].arg, 0, 0, 0, NULL);
   else
-    bootmgr = file_open ("/efi/microsoft/boot/bootmgfw.efi", 0, 0, 0);
+    bootmgr = file_open ("/efi/microsoft/boot/bootmgfw.efi", 0, 0, 0, NULL);
   if (!bootmgr)
   {
     grub_error (GRUB_ERR_FILE_READ_ERROR, N_("failed to open bootmgfw.efi"));
@@ -205,9 +205,9 @@ grub_cmd_ntboot (grub_extcmd_context_t ctxt,
   if (type == BOOT_WIM)
   {
     if (state[NTBOOT_SDI].set)
-      bootsdi = file_open (state[NTBOOT_SDI].arg, 0, 0, 0);
+      bootsdi = file_open (state[NTBOOT_SDI].arg, 0, 0, 0, NULL);
     else
-      bootsdi = file_open ("(proc)/boot.sdi", 0, 0, 0);
+      bootsdi = file_open ("(proc)/boot.sdi", 0, 0, 0, NULL);
     if (!bootsdi)
     {
       grub_error (GRUB_ERR_FILE_READ_ERROR, N_("failed to open boot.sdi"));
@@ -228,7 +228,7 @@ grub_wimboot_init (int argc, char *argv[])
       mem = 1;
     if (argv[i][0] == 'b')
       bl = 1;
-    file = file_open (fname, mem, bl, 0);
+    file = file_open (fname, mem, bl, 0, NULL);
     if (!file)
       grub_pause_fatal ("fatal: bad file %s.\n", fname);
     if (!file_name)
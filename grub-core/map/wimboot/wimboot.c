@@ -146,12 +146,12 @@ grub_cmd_wimboot (grub_extcmd_context_t ctxt, int argc, char *argv[])
     if (state[WIMBOOT_NOVGA].set)
       data.novga = state[WIMBOOT_NOVGA].arg;
     grub_patch_bcd (&data);
-    grub_file_t bcd = file_open ("(proc)/bcd", 0, 0, 0);
+    grub_file_t bcd = file_open ("(proc)/bcd", 0, 0, 0, NULL);
     vfat_add_file ("bcd", bcd, bcd->size, vfat_read_wrapper);
   }
   if (! wimboot_cmd.bootsdi)
   {
-    grub_file_t bootsdi = file_open ("(proc)/boot.sdi", 0, 0, 0);
+    grub_file_t bootsdi = file_open ("(proc)/boot.sdi", 0, 0, 0, NULL);
     vfat_add_file ("boot.sdi", bootsdi, bootsdi->size, vfat_read_wrapper);
   }
   grub_wimboot_install ();
@@ -169,6 +169,7 @@ static const struct grub_arg_option options_wimtools[] = {
   {"is64", 'a', 0, N_("Check winload.exe is 64 bit or not."), 0, 0},
   {"boot_index", 'b', 0, N_("Get boot index."), N_("VAR"), ARG_TYPE_STRING},
   {"image_count", 'c', 0, N_("Get number of images."), N_("VAR"), ARG_TYPE_STRING},
+  {"bench", 'm', 0, N_("Time decompressing image metadata."), 0, 0},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -179,6 +180,7 @@ enum options_wimtools
   WIMTOOLS_IS64,
   WIMTOOLS_BOOT,
   WIMTOOLS_COUNT,
+  WIMTOOLS_BENCH,
 };
 
 static grub_err_t
@@ -226,6 +228,11 @@ grub_cmd_wimtools (grub_extcmd_context_t ctxt, int argc, char *argv[])
     grub_env_set (state[WIMTOOLS_COUNT].arg, str);
     err = GRUB_ERR_NONE;
   }
+  else if (state[WIMTOOLS_BENCH].set)
+  {
+    if (grub_wim_bench (file, index))
+      err = grub_error (GRUB_ERR_BAD_FILE_TYPE, N_("failed to read WIM metadata"));
+  }
   grub_file_close (file);
   return err;
 }
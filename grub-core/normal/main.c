@@ -34,6 +34,7 @@
 #include <grub/charset.h>
 #include <grub/script_sh.h>
 #include <grub/bufio.h>
+#include <grub/disk.h>
 #include <grub/net.h>
 #ifdef GRUB_MACHINE_IEEE1275
 #include <grub/ieee1275/ieee1275.h>
@@ -546,6 +547,53 @@ grub_env_write_pager (struct grub_env_var *var __attribute__ ((unused)),
   return grub_strdup (val);
 }
 
+/* Size of the disk cache in MiB.  */
+static char *
+grub_env_write_disk_cache_size (struct grub_env_var *var
+				__attribute__ ((unused)),
+				const char *val)
+{
+  unsigned long size;
+  const char *end;
+
+  size = grub_strtoul (val, &end, 0);
+  if (grub_errno || *end)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return grub_xasprintf ("%" PRIuGRUB_SIZE,
+			     grub_disk_cache_get_size () >> 20);
+    }
+
+  if (size > ((grub_size_t) -1 >> 20))
+    size = (grub_size_t) -1 >> 20;
+
+  if (grub_disk_cache_set_size ((grub_size_t) size << 20))
+    grub_errno = GRUB_ERR_NONE;
+
+  return grub_xasprintf ("%" PRIuGRUB_SIZE, grub_disk_cache_get_size () >> 20);
+}
+
+/* Upper bound of the disk readahead window in KiB.  */
+static char *
+grub_env_write_disk_readahead (struct grub_env_var *var
+			       __attribute__ ((unused)),
+			       const char *val)
+{
+  unsigned long size;
+  const char *end;
+
+  size = grub_strtoul (val, &end, 0);
+  if (grub_errno || *end)
+    grub_errno = GRUB_ERR_NONE;
+  else
+    grub_disk_readahead_max = size >> (GRUB_DISK_CACHE_BITS
+				       + GRUB_DISK_SECTOR_BITS - 10);
+
+  return grub_xasprintf ("%u", grub_disk_readahead_max
+			 << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
+			     - 10));
+}
+
 /* clear */
 static grub_err_t
 grub_mini_cmd_clear (struct grub_command *cmd __attribute__ ((unused)),
@@ -597,6 +645,14 @@ GRUB_MOD_INIT(normal)
   grub_register_variable_hook ("pager", 0, grub_env_write_pager);
   grub_env_export ("pager");
 
+  grub_register_variable_hook ("disk_cache_size", 0,
+			       grub_env_write_disk_cache_size);
+  grub_env_export ("disk_cache_size");
+
+  grub_register_variable_hook ("disk_readahead", 0,
+			       grub_env_write_disk_readahead);
+  grub_env_export ("disk_readahead");
+
   /* Register a command "normal" for the rescue mode.  */
   grub_register_command ("normal", grub_cmd_normal,
 			 0, N_("Enter normal mode."));
@@ -642,6 +698,8 @@ GRUB_MOD_FINI(normal)
 
   grub_set_history (0);
   grub_register_variable_hook ("pager", 0, 0);
+  grub_register_variable_hook ("disk_cache_size", 0, 0);
+  grub_register_variable_hook ("disk_readahead", 0, 0);
   grub_fs_autoload_hook = 0;
   grub_unregister_command (cmd_clear);
 }
@@ -112,6 +112,49 @@ extern grub_disk_dev_t EXPORT_VAR (grub_disk_dev_list);
 
 struct grub_partition;
 
+/* The number of buckets of the read latency histogram.  */
+#define GRUB_DISK_STAT_BUCKETS	24
+
+/* I/O statistics of a disk.  */
+struct grub_disk_stat
+{
+  struct grub_disk_stat *next;
+
+  /* The name of the disk the record was created for.  */
+  char *name;
+
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+
+  /* Calls to grub_disk_read.  */
+  grub_uint64_t reads;
+
+  /* Requests to the device driver and the 512B sectors they read.  */
+  grub_uint64_t device_reads;
+  grub_uint64_t sectors;
+
+  /* Cache units found and not found in the disk cache, and the bytes
+     served from it.  */
+  grub_uint64_t cache_hits;
+  grub_uint64_t cache_misses;
+  grub_uint64_t cache_bytes;
+
+  /* Readahead counters of the closed instances of the disk.  */
+  grub_uint64_t ra_hits;
+  grub_uint64_t ra_misses;
+
+  /* Total time spent in the device driver in microseconds.  */
+  grub_uint64_t read_time;
+
+  /* LATENCY[N] counts driver requests which took less than 2^N
+     microseconds, the last bucket the rest.  */
+  grub_uint64_t latency[GRUB_DISK_STAT_BUCKETS];
+};
+
+extern struct grub_disk_stat *EXPORT_VAR(grub_disk_stat_list);
+
+void EXPORT_FUNC(grub_disk_stat_reset) (void);
+
 typedef void (*grub_disk_read_hook_t) (grub_disk_addr_t sector,
 				       unsigned offset, unsigned length,
 				       void *data);
@@ -147,6 +190,25 @@ struct grub_disk
   /* Caller-specific data passed to the read hook.  */
   void *read_hook_data;
 
+  /* The cache unit following the last one read.  */
+  grub_disk_addr_t ra_next;
+
+  /* The current readahead window in cache units, 0 if the access
+     pattern is not sequential.  */
+  unsigned int ra_window;
+
+  /* The cache units prefetched last, from RA_START to RA_END - 1.  */
+  grub_disk_addr_t ra_start;
+  grub_disk_addr_t ra_end;
+
+  /* Cache units served from the readahead window, and cache units of a
+     sequential stream which had to be read on demand.  */
+  unsigned long ra_hits;
+  unsigned long ra_misses;
+
+  /* The I/O statistics of this disk, may be NULL.  */
+  struct grub_disk_stat *stat;
+
   /* Device-specific data.  */
   void *data;
 };
@@ -165,21 +227,35 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 #define GRUB_DISK_SECTOR_SIZE	0x200
 #define GRUB_DISK_SECTOR_BITS	9
 
-/* The maximum number of disk caches.  */
-#define GRUB_DISK_CACHE_NUM	1021
+/* The default number of disk cache units, 32MiB.  */
+#define GRUB_DISK_CACHE_NUM	1024
+
+/* The number of cache units in a set of the disk cache.  */
+#define GRUB_DISK_CACHE_WAYS	8
 
 /* The size of a disk cache in 512B units. Must be at least as big as the
    largest supported sector size, currently 16K.  */
 #define GRUB_DISK_CACHE_BITS	6
 #define GRUB_DISK_CACHE_SIZE	(1 << GRUB_DISK_CACHE_BITS)
 
+/* The default upper bound of the readahead window in cache units.  */
+#define GRUB_DISK_READAHEAD_MAX	(1048576 >> (GRUB_DISK_SECTOR_BITS \
+					     + GRUB_DISK_CACHE_BITS))
+
 #define GRUB_DISK_MAX_MAX_AGGLOMERATE ((1 << (30 - GRUB_DISK_CACHE_BITS - GRUB_DISK_SECTOR_BITS)) - 1)
 
 /* Return value of grub_disk_get_size() in case disk size is unknown. */
 #define GRUB_DISK_SIZE_UNKNOWN	 0xffffffffffffffffULL
 
+void EXPORT_FUNC(grub_disk_cache_invalidate_all) (void);
+void EXPORT_FUNC(grub_disk_cache_invalidate) (unsigned long dev_id,
+					      unsigned long disk_id,
+					      grub_disk_addr_t sector);
 /* This is called from the memory manager.  */
-void grub_disk_cache_invalidate_all (void);
+void grub_disk_cache_release (void);
+/* Resize the disk cache to SIZE bytes, dropping all cached data.  */
+grub_err_t EXPORT_FUNC(grub_disk_cache_set_size) (grub_size_t size);
+grub_size_t EXPORT_FUNC(grub_disk_cache_get_size) (void);
 
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
@@ -231,6 +307,9 @@ EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits, unsigned long
 extern void (* EXPORT_VAR(grub_disk_firmware_fini)) (void);
 extern int EXPORT_VAR(grub_disk_firmware_is_tainted);
 
+/* Upper bound of the readahead window in cache units, 0 disables it.  */
+extern unsigned int EXPORT_VAR(grub_disk_readahead_max);
+
 static inline void
 grub_stop_disk_firmware (void)
 {
@@ -251,10 +330,9 @@ struct grub_disk_cache
   grub_disk_addr_t sector;
   char *data;
   int lock;
+  grub_uint32_t age;
 };
 
-extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
-
 #if defined (GRUB_UTIL)
 void grub_lvm_init (void);
 void grub_ldm_init (void);
@@ -264,6 +264,9 @@ struct grub_ext3_journal_sblock
 };
 
 #define EXT4_EXT_MAGIC		0xf30a
+/* Extents longer than this are preallocated but not written yet, and are
+   this much shorter than their length field.  */
+#define EXT4_EXT_INIT_MAX_LEN	32768
 
 struct grub_ext4_extent_header
 {
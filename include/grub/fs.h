@@ -47,6 +47,22 @@ typedef int (*grub_fs_dir_hook_t) (const char *filename,
 				   const struct grub_dirhook_info *info,
 				   void *data);
 
+/* A magic string LEN bytes long at byte OFFSET from the start of the
+   device.  Signature arrays are terminated by an entry with LEN 0.  */
+struct grub_fs_signature
+{
+  grub_uint32_t offset;
+  grub_uint32_t len;
+  const char *magic;
+};
+
+/* LENGTH bytes stored from byte OFFSET of a device on.  */
+struct grub_fs_block
+{
+  grub_disk_addr_t offset;
+  grub_off_t length;
+};
+
 /* Filesystem descriptor.  */
 struct grub_fs
 {
@@ -83,6 +99,15 @@ struct grub_fs
   /* Get writing time of filesystem. */
   grub_err_t (*fs_mtime) (grub_device_t device, grub_int32_t *timebuf);
 
+  /* Set BLOCK to where the byte OFFSET of FILE is stored on its device,
+     with the length of the data following it contiguously there, up to
+     the end of the file.  Fails with GRUB_ERR_NOT_IMPLEMENTED_YET if
+     that part of the file is not stored as is, for example if it is
+     sparse, compressed or embedded in metadata.  Optional; blocklists
+     are otherwise made by reading the file with a read hook.  */
+  grub_err_t (*fs_map) (struct grub_file *file, grub_off_t offset,
+			struct grub_fs_block *block);
+
 #ifdef GRUB_UTIL
   /* Determine sectors available for embedding.  */
   grub_err_t (*fs_embed) (grub_device_t device, unsigned int *nsectors,
@@ -97,18 +122,16 @@ struct grub_fs
   int blocklist_install;
 #endif
   int fast_blocklist;
+
+  /* If not NULL, grub_fs_probe only tries this filesystem on devices
+     matching at least one of these signatures.  */
+  const struct grub_fs_signature *signatures;
 };
 typedef struct grub_fs *grub_fs_t;
 
 /* This is special, because block lists are not files in usual sense.  */
 extern struct grub_fs grub_fs_blocklist;
 
-struct grub_fs_block
-{
-  grub_disk_addr_t offset;
-  grub_off_t length;
-};
-
 /* This hook is used to automatically load filesystem modules.
    If this hook loads a module, return non-zero. Otherwise return zero.
    The newly loaded filesystem is assumed to be inserted into the head of
@@ -125,9 +148,17 @@ grub_fs_register (grub_fs_t fs)
 }
 #endif
 
+/* Incremented whenever cached filesystem state may have gone stale.
+   Caches outside the kernel compare it against the value they were
+   filled with.  */
+extern grub_uint32_t EXPORT_VAR (grub_fs_cache_generation);
+
+void EXPORT_FUNC(grub_fs_cache_flush) (void);
+
 static inline void
 grub_fs_unregister (grub_fs_t fs)
 {
+  grub_fs_cache_flush ();
   grub_list_remove (GRUB_AS_LIST (fs));
 }
 
@@ -24,6 +24,7 @@
 #include <grub/symbol.h>
 #include <grub/err.h>
 #include <grub/disk.h>
+#include <grub/fs.h>
 
 typedef struct grub_fshelp_node *grub_fshelp_node_t;
 
@@ -73,6 +74,63 @@ EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   char *(*read_symlink) (grub_fshelp_node_t node),
 					   enum grub_fshelp_filetype expect);
 
+/* Lets grub_fshelp_find_file_cached keep the result of directory
+   lookups across mounts of the same filesystem.  */
+struct grub_fshelp_cache_ops
+{
+  /* Return a number identifying the directory DIR within its
+     filesystem, such as its inode number.  */
+  grub_uint64_t (*dir_key) (grub_fshelp_node_t dir);
+
+  /* Return a malloc'ed copy of NODE bound to the mount DIR belongs to.
+     NODE may be a cached copy made under an earlier mount, so only its
+     own contents may be used.  */
+  grub_fshelp_node_t (*dup_node) (grub_fshelp_node_t node,
+				  grub_fshelp_node_t dir);
+
+  /* If set, the first lookup in a directory reads all of it into a
+     hash table of its names, so later lookups there need no scan.
+     Meant for unsorted directories whose entries are costly to decode.
+     Nodes are kept through DUP_NODE, which should make them small.  */
+  int index_dirs;
+};
+
+/* Like grub_fshelp_find_file, but remember which node each path
+   component of a directory on DISK resolved to, or that it does not
+   exist, until grub_fs_cache_flush is called.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_cached) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   int (*iterate_dir) (grub_fshelp_node_t dir,
+							       grub_fshelp_iterate_dir_hook_t hook,
+							       void *hook_data),
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect,
+					   grub_disk_t disk,
+					   const struct grub_fshelp_cache_ops *cache);
+
+/* Like grub_fshelp_find_file_cached, but look names up with LOOKUP_FILE,
+   which only has to find their exact spelling, for example through an
+   on-disk hash index.  ITERATE_DIR is used if LOOKUP_FILE finds nothing,
+   names are matched case-insensitively and the name has letters, or if
+   LOOKUP_FILE fails with GRUB_ERR_NOT_IMPLEMENTED_YET.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_lookup_cached) (const char *path,
+						  grub_fshelp_node_t rootnode,
+						  grub_fshelp_node_t *foundnode,
+						  int (*iterate_dir) (grub_fshelp_node_t dir,
+								      grub_fshelp_iterate_dir_hook_t hook,
+								      void *hook_data),
+						  grub_err_t (*lookup_file) (grub_fshelp_node_t dir,
+									     const char *name,
+									     grub_fshelp_node_t *foundnode,
+									     enum grub_fshelp_filetype *foundtype),
+						  char *(*read_symlink) (grub_fshelp_node_t node),
+						  enum grub_fshelp_filetype expect,
+						  grub_disk_t disk,
+						  const struct grub_fshelp_cache_ops *cache);
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
@@ -88,4 +146,40 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_off_t filesize, int log2blocksize,
 				    grub_disk_addr_t blocks_start);
 
+typedef grub_disk_addr_t (*grub_fshelp_get_block_t) (grub_fshelp_node_t node,
+						     grub_disk_addr_t block);
+
+/* Translate the file block BLOCK of NODE to a disk block and store in
+   COUNT how many file blocks from BLOCK on follow it contiguously on
+   disk.  A return value of 0 means COUNT sparse blocks.  */
+typedef grub_disk_addr_t (*grub_fshelp_get_extent_t) (grub_fshelp_node_t node,
+						      grub_disk_addr_t block,
+						      grub_disk_addr_t *count);
+
+/* Like grub_fshelp_read_file, but GET_EXTENT, if not NULL, is used to
+   translate whole runs of blocks instead of GET_BLOCK.  */
+grub_ssize_t
+EXPORT_FUNC(grub_fshelp_read_file_ex) (grub_disk_t disk,
+				       grub_fshelp_node_t node,
+				       grub_disk_read_hook_t read_hook,
+				       void *read_hook_data, int blocklist,
+				       grub_off_t pos, grub_size_t len,
+				       char *buf,
+				       grub_fshelp_get_block_t get_block,
+				       grub_fshelp_get_extent_t get_extent,
+				       grub_off_t filesize, int log2blocksize,
+				       grub_disk_addr_t blocks_start);
+
+/* Implement fs_map for a file NODE read with grub_fshelp_read_file_ex
+   and the same GET_BLOCK, GET_EXTENT, FILESIZE, LOG2BLOCKSIZE and
+   BLOCKS_START: set BLOCK to where byte POS of the file is stored on
+   DISK and how much follows contiguously.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_map_file) (grub_disk_t disk, grub_fshelp_node_t node,
+				   grub_off_t pos, struct grub_fs_block *block,
+				   grub_fshelp_get_block_t get_block,
+				   grub_fshelp_get_extent_t get_extent,
+				   grub_off_t filesize, int log2blocksize,
+				   grub_disk_addr_t blocks_start);
+
 #endif /* ! GRUB_FSHELP_HEADER */
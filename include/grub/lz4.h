@@ -0,0 +1,35 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_LZ4_HEADER
+#define GRUB_LZ4_HEADER 1
+
+#include <grub/types.h>
+
+/* Largest match offset, and so the most earlier output a block uses.  */
+#define GRUB_LZ4_MAX_DISTANCE	65535
+
+/* Decompress the raw LZ4 block SRC of S_LEN bytes into DEST, which has
+   room for D_LEN bytes.  Matches may reach into the PREFIX_LEN bytes of
+   earlier output just before DEST.  Return the decompressed size, or -1
+   if the block is corrupted.  */
+grub_ssize_t
+grub_lz4_decompress_block (const void *src, grub_size_t s_len, void *dest,
+			   grub_size_t d_len, grub_size_t prefix_len);
+
+#endif
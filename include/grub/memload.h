@@ -0,0 +1,39 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_MEMLOAD_HEADER
+#define GRUB_MEMLOAD_HEADER	1
+
+#include <grub/types.h>
+#include <grub/file.h>
+
+/* Keep the copy in EFI runtime services memory, so that it survives
+   ExitBootServices.  */
+#define GRUB_MEMLOAD_RUNTIME	(1 << 0)
+
+/* Copy FILE to memory followed by PAD zero bytes and return the copy,
+   or NULL with grub_errno set.  If SHA256 is not NULL, it is the
+   expected digest of FILE in hex and the copy fails on a mismatch.  */
+void *grub_memload_file (grub_file_t file, grub_size_t pad, int flags,
+			 const char *sha256);
+
+/* Allocate and free SIZE bytes the way grub_memload_file does.  */
+void *grub_memload_alloc (grub_size_t size, int flags);
+void grub_memload_free (void *addr, grub_size_t size);
+
+#endif
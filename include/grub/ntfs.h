@@ -127,13 +127,38 @@ struct grub_ntfs_bpb
   grub_uint32_t checksum;
 } GRUB_PACKED;
 
+/* Decompressed compression units kept per attribute.  */
+#define GRUB_NTFS_COMP_CACHE_UNITS	4
+
+struct grub_ntfs_comp_unit
+{
+  /* Offset of the unit in the attribute, valid when BUF is set.  */
+  grub_disk_addr_t ofs;
+  grub_uint64_t last_use;
+  grub_uint8_t *buf;
+};
+
+/* A run of clusters of a non-resident attribute.  LCN is 0 for a sparse
+   run.  */
+struct grub_ntfs_run
+{
+  grub_disk_addr_t vcn;
+  grub_disk_addr_t count;
+  grub_disk_addr_t lcn;
+};
+
 struct grub_ntfs_attr
 {
   int flags;
   grub_uint8_t *emft_buf, *edat_buf;
   grub_uint8_t *attr_cur, *attr_nxt, *attr_end;
-  grub_uint32_t save_pos;
-  grub_uint8_t *sbuf;
+  struct grub_ntfs_comp_unit *units;
+  grub_uint64_t unit_clock;
+  /* Run list of $DATA decoded once: 1 if RUNS is complete, -1 if it
+     couldn't be decoded.  */
+  int runs_valid;
+  struct grub_ntfs_run *runs;
+  grub_size_t num_runs, alloc_runs, run_hint;
   struct grub_ntfs_file *mft;
 };
 
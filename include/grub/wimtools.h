@@ -35,4 +35,9 @@ grub_wim_image_count (grub_file_t file);
 grub_uint32_t
 grub_wim_boot_index (grub_file_t file);
 
+/* Time reading the whole metadata resource of image INDEX and print
+   the decompression speed.  */
+int
+grub_wim_bench (grub_file_t file, unsigned int index);
+
 #endif /* _WIMTOOLS_H */